@@ -134,6 +134,7 @@ int arch_load_dynsymtab_bindnow(Elf *elf, struct symtab *dsymtab,
 			sym->addr = plt_addr + (i * PLTGOT_SIZE);
 			sym->size = PLTGOT_SIZE;
 			sym->type = ST_PLT;
+			sym->name_id = 0;
 
 			if (flags & SYMTAB_FL_DEMANGLE)
 				sym->name = demangle(name);
@@ -0,0 +1,8 @@
+#include <zlib.h>
+
+int main(void)
+{
+	uLong len = compressBound(0);
+
+	return len ? 0 : 1;
+}
@@ -4,6 +4,10 @@
 #include <inttypes.h>
 #include <time.h>
 #include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
 #include "uftrace.h"
@@ -14,6 +18,9 @@
 #include "utils/filter.h"
 #include "utils/kernel.h"
 #include "utils/graph.h"
+#include "utils/intern.h"
+#include "utils/perfetto.h"
+#include "utils/json.h"
 #include "libtraceevent/kbuffer.h"
 #include "libtraceevent/event-parse.h"
 
@@ -69,10 +76,50 @@ struct uftrace_raw_dump {
 	uint64_t kbuf_offset;
 };
 
+struct chrome_task {
+	int pid;
+	int tid;
+	char **stack;  /* (interned) names of running functions */
+	int depth;
+	int alloc;
+};
+
 struct uftrace_chrome_dump {
 	struct uftrace_dump_ops ops;
+	struct json_writer jw;
+	struct ftrace_file_handle *handle;
 	unsigned lost_event_cnt;
 	bool last_comma;
+	char recorded_time[32];
+	/* metadata events which should be in every (split) file */
+	char **meta;
+	int nr_meta;
+	/* below are for --split */
+	bool split;
+	uint64_t split_time;
+	uint64_t split_size;
+	uint64_t file_start;
+	char *prefix;
+	char *filename;
+	int nr_files;
+	struct chrome_task *tasks;
+	int nr_tasks;
+};
+
+struct perfetto_task {
+	int pid;
+	bool started;
+	uint64_t last_time;
+	unsigned long *names;  /* bitmap of names interned in the sequence */
+	unsigned nr_names;
+};
+
+struct uftrace_perfetto_dump {
+	struct uftrace_dump_ops ops;
+	struct perfetto_buf buf;
+	struct perfetto_task *tasks;
+	int nr_tasks;
+	unsigned lost_event_cnt;
 };
 
 struct uftrace_flame_dump {
@@ -80,6 +127,9 @@ struct uftrace_flame_dump {
 	struct rb_root tasks;
 	struct fg_node *node;
 	uint64_t sample_time;
+	struct uftrace_graph *graph;
+	/* task graph of a worker thread which reads a single task */
+	struct uftrace_task_graph *tg;
 };
 
 static const char * rstack_type(struct uftrace_record *frs)
@@ -354,7 +404,8 @@ static void pr_args(struct fstack_arguments *args)
 						 (uint64_t)val);
 
 			if (sym)
-				pr_out("  args[%d] p: &%s\n", i, sym->name);
+				pr_out("  args[%d] p: &%s\n", i,
+				       symbol_getname(sym, sym->addr));
 			else
 				pr_out("  args[%d] p: %p\n", i, (void *)val);
 		}
@@ -426,7 +477,8 @@ static void pr_retval(struct fstack_arguments *args)
 						 (uint64_t)val);
 
 			if (sym)
-				pr_out("  retval p: &%s\n", sym->name);
+				pr_out("  retval p: &%s\n",
+				       symbol_getname(sym, sym->addr));
 			else
 				pr_out("  retval p: %p\n", (void *)val);
 		}
@@ -449,6 +501,8 @@ static void pr_event(int eid, void *ptr, int len)
 	union {
 		struct uftrace_proc_statm *statm;
 		struct uftrace_page_fault *pgfault;
+		struct uftrace_buffer_stall *stall;
+		struct uftrace_script_queue *sq;
 	} d;
 
 	/* built-in events */
@@ -473,6 +527,15 @@ static void pr_event(int eid, void *ptr, int len)
 		pr_out("  page-fault: major=%+"PRId64" minor=%+"PRId64"\n",
 		       d.pgfault->major, d.pgfault->minor);
 		break;
+	case EVENT_ID_BUFFER_STALL:
+		d.stall = ptr;
+		pr_out("  buffer-stall: time=%"PRIu64"ns\n", d.stall->time);
+		break;
+	case EVENT_ID_SCRIPT_QUEUE:
+		d.sq = ptr;
+		pr_out("  script-queue: dropped=%"PRIu64" time=%"PRIu64"ns\n",
+		       d.sq->dropped, d.sq->time);
+		break;
 	default:
 		break;
 	}
@@ -799,24 +862,221 @@ static void print_raw_footer(struct uftrace_dump_ops *ops,
 {
 }
 
+static void add_chrome_meta(struct uftrace_chrome_dump *chrome,
+			    int pid, int tid, const char *type, const char *name)
+{
+	char *meta;
+
+	if (tid == pid) {
+		/* no need to add "tid" field */
+		xasprintf(&meta, "{\"ts\":0,\"ph\":\"M\",\"pid\":%d,"
+			  "\"name\":\"%s\",\"args\":{\"name\":\"%s\"}}",
+			  pid, type, name);
+	}
+	else {
+		xasprintf(&meta, "{\"ts\":0,\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+			  "\"name\":\"%s\",\"args\":{\"name\":\"%s\"}}",
+			  pid, tid, type, name);
+	}
+
+	chrome->meta = xrealloc(chrome->meta,
+				(chrome->nr_meta + 1) * sizeof(*chrome->meta));
+	chrome->meta[chrome->nr_meta++] = meta;
+}
+
+/* writes common part of an event, caller should add args and close it */
+static void add_chrome_event(struct uftrace_chrome_dump *chrome, uint64_t time,
+			     char ph, int pid, int tid, const char *name)
+{
+	struct json_writer *jw = &chrome->jw;
+
+	if (chrome->last_comma)
+		json_add_raw(jw, ",\n", 2);
+	chrome->last_comma = true;
+
+	json_add_str(jw, "{\"ts\":");
+	json_add_time(jw, time);
+	json_add_str(jw, ",\"ph\":\"");
+	json_add_char(jw, ph);
+	json_add_str(jw, "\",\"pid\":");
+	json_add_int(jw, pid);
+	if (tid != pid) {
+		json_add_str(jw, ",\"tid\":");
+		json_add_int(jw, tid);
+	}
+	json_add_str(jw, ",\"name\":\"");
+	json_add_escape(jw, name);
+	json_add_char(jw, '"');
+}
+
+static void start_chrome_file(struct uftrace_chrome_dump *chrome)
+{
+	FILE *fp = outfp;
+	int i;
+
+	if (chrome->split) {
+		char *filename;
+
+		xasprintf(&filename, "%s.%03d.json", chrome->prefix,
+			  chrome->nr_files);
+
+		fp = fopen(filename, "w");
+		if (fp == NULL)
+			pr_err("cannot open %s", filename);
+
+		free(chrome->filename);
+		chrome->filename = filename;
+	}
+	chrome->nr_files++;
+
+	json_writer_init(&chrome->jw, fp);
+	json_add_str(&chrome->jw, "{\"traceEvents\":[\n");
+
+	for (i = 0; i < chrome->nr_meta; i++) {
+		json_add_str(&chrome->jw, chrome->meta[i]);
+		json_add_raw(&chrome->jw, ",\n", 2);
+	}
+
+	chrome->last_comma = false;
+	chrome->file_start = 0;
+}
+
+static void finish_chrome_file(struct uftrace_chrome_dump *chrome)
+{
+	struct json_writer *jw = &chrome->jw;
+	struct ftrace_file_handle *handle = chrome->handle;
+
+	/* the footer is written only if it has the recorded time */
+	if (chrome->recorded_time[0]) {
+		json_add_str(jw, "\n], \"displayTimeUnit\": \"ns\", \"metadata\": {\n");
+		json_add_str(jw, "\"version\":\"uftrace " UFTRACE_VERSION "\",\n");
+		json_add_str(jw, "\"recorded_time\":\"");
+		json_add_str(jw, chrome->recorded_time);
+		json_add_str(jw, "\",\n");
+		if (handle->hdr.info_mask & (1UL << CMDLINE)) {
+			json_add_str(jw, "\"command_line\":\"");
+			json_add_str(jw, handle->info.cmdline);
+			json_add_str(jw, "\"\n");
+		}
+		json_add_str(jw, "} }\n");
+	}
+
+	if (chrome->split) {
+		uint64_t size = jw->written;
+
+		json_writer_finish(jw);
+		fclose(jw->fp);
+		pr_out("%s: %"PRIu64" bytes\n", chrome->filename, size);
+	}
+	else {
+		json_writer_finish(jw);
+	}
+}
+
+/*
+ * Each split file should have matching entry and exit events, so it
+ * closes the functions still running at the end of the file and opens
+ * them again at the beginning of the next file.
+ */
+static void split_chrome_file(struct uftrace_chrome_dump *chrome, uint64_t time)
+{
+	struct chrome_task *ctask;
+	int i, k;
+
+	for (i = 0; i < chrome->nr_tasks; i++) {
+		ctask = &chrome->tasks[i];
+
+		for (k = ctask->depth - 1; k >= 0; k--) {
+			add_chrome_event(chrome, time, 'E', ctask->pid,
+					 ctask->tid, ctask->stack[k]);
+			json_add_char(&chrome->jw, '}');
+		}
+	}
+
+	finish_chrome_file(chrome);
+	start_chrome_file(chrome);
+	chrome->file_start = time;
+
+	for (i = 0; i < chrome->nr_tasks; i++) {
+		ctask = &chrome->tasks[i];
+
+		for (k = 0; k < ctask->depth; k++) {
+			add_chrome_event(chrome, time, 'B', ctask->pid,
+					 ctask->tid, ctask->stack[k]);
+			json_add_char(&chrome->jw, '}');
+		}
+	}
+}
+
+static bool need_chrome_split(struct uftrace_chrome_dump *chrome, uint64_t time)
+{
+	if (chrome->file_start == 0) {
+		chrome->file_start = time;
+		return false;
+	}
+
+	if (chrome->split_time && time >= chrome->file_start + chrome->split_time)
+		return true;
+	if (chrome->split_size && chrome->jw.written >= chrome->split_size)
+		return true;
+	return false;
+}
+
+/* keep track of running functions in each task for --split */
+static void update_chrome_task(struct uftrace_chrome_dump *chrome,
+			       struct ftrace_task_handle *task,
+			       char ph, char *name)
+{
+	struct chrome_task *ctask;
+
+	if (chrome->tasks == NULL) {
+		chrome->nr_tasks = task->h->nr_tasks;
+		chrome->tasks = xcalloc(chrome->nr_tasks, sizeof(*ctask));
+	}
+	ctask = &chrome->tasks[task - task->h->tasks];
+
+	if (ph == 'E') {
+		if (ctask->depth > 0)
+			ctask->depth--;
+		return;
+	}
+
+	if (ctask->depth == ctask->alloc) {
+		ctask->alloc = ctask->alloc ? ctask->alloc * 2 : 16;
+		ctask->stack = xrealloc(ctask->stack,
+					ctask->alloc * sizeof(*ctask->stack));
+	}
+
+	ctask->pid = task->t->pid;
+	ctask->tid = task->tid;
+	/* the name will be freed after this call, use the interned one */
+	ctask->stack[ctask->depth++] = intern_name(intern_id(name));
+}
+
 static void print_chrome_header(struct uftrace_dump_ops *ops,
 				struct ftrace_file_handle *handle,
 				struct opts *opts)
 {
 	struct uftrace_chrome_dump *chrome = container_of(ops, typeof(*chrome), ops);
 	struct uftrace_info *info = &handle->info;
+	char buf[PATH_MAX];
+	struct stat statbuf;
 
-	pr_out("{\"traceEvents\":[\n");
-	pr_out("{\"ts\":0,\"ph\":\"M\",\"pid\":%d,"
-	       "\"name\":\"process_name\","
-	       "\"args\":{\"name\":\"%s\"}},\n",
-	       info->tids[0], basename(info->exename));
-	pr_out("{\"ts\":0,\"ph\":\"M\",\"pid\":%d,"
-	       "\"name\":\"thread_name\","
-	       "\"args\":{\"name\":\"%s\"}},\n",
-	       info->tids[0], basename(info->exename));
+	chrome->handle = handle;
 
-	chrome->last_comma = false;
+	/* read recorded date and time */
+	snprintf(buf, sizeof(buf), "%s/info", opts->dirname);
+	if (stat(buf, &statbuf) == 0) {
+		ctime_r(&statbuf.st_mtime, chrome->recorded_time);
+		chrome->recorded_time[strlen(chrome->recorded_time) - 1] = '\0';
+	}
+
+	add_chrome_meta(chrome, info->tids[0], info->tids[0], "process_name",
+			basename(info->exename));
+	add_chrome_meta(chrome, info->tids[0], info->tids[0], "thread_name",
+			basename(info->exename));
+
+	start_chrome_file(chrome);
 }
 
 static void print_chrome_task_start(struct uftrace_dump_ops *ops,
@@ -837,7 +1097,12 @@ static void print_chrome_task_rstack(struct uftrace_dump_ops *ops,
 	struct uftrace_record *frs = task->rstack;
 	enum argspec_string_bits str_mode = NEEDS_ESCAPE | NEEDS_PAREN;
 	struct uftrace_chrome_dump *chrome = container_of(ops, typeof(*chrome), ops);
-	bool is_process = task->t->pid == task->tid;
+	struct json_writer *jw = &chrome->jw;
+
+	if (frs->type == UFTRACE_LOST) {
+		chrome->lost_event_cnt++;
+		return;
+	}
 
 	if (frs->type == UFTRACE_EVENT) {
 		if (frs->addr != EVENT_ID_PERF_SCHED_IN &&
@@ -849,52 +1114,33 @@ static void print_chrome_task_rstack(struct uftrace_dump_ops *ops,
 			return;
 	}
 
-	if (chrome->last_comma)
-		pr_out(",\n");
-	chrome->last_comma = true;
-
 	if ((frs->type == UFTRACE_ENTRY) ||
-	    (frs->type == UFTRACE_EVENT && frs->addr == EVENT_ID_PERF_SCHED_OUT)) {
+	    (frs->type == UFTRACE_EVENT && frs->addr == EVENT_ID_PERF_SCHED_OUT))
 		ph = 'B';
-		if (is_process) {
-			/* no need to add "tid" field */
-			pr_out("{\"ts\":%"PRIu64".%03d,\"ph\":\"%c\",\"pid\":%d,\"name\":\"%s\"",
-			       frs->time / 1000, (int)(frs->time % 1000), ph, task->tid, name);
-		} else {
-			pr_out("{\"ts\":%"PRIu64".%03d,\"ph\":\"%c\",\"pid\":%d,\"tid\":%d,\"name\":\"%s\"",
-			       frs->time / 1000, (int)(frs->time % 1000), ph, task->t->pid, task->tid, name);
-		}
-		if (frs->more) {
-			str_mode |= HAS_MORE;
-			get_argspec_string(task, spec_buf, sizeof(spec_buf), str_mode);
-			pr_out(",\"args\":{\"arguments\":\"%s\"}}",
-				spec_buf);
-		}
-		else
-			pr_out("}");
-	}
-	else if ((frs->type == UFTRACE_EXIT) ||
-		 (frs->type == UFTRACE_EVENT && frs->addr == EVENT_ID_PERF_SCHED_IN)) {
+	else
 		ph = 'E';
-		if (is_process) {
-			/* no need to add "tid" field */
-			pr_out("{\"ts\":%"PRIu64".%03d,\"ph\":\"%c\",\"pid\":%d,\"name\":\"%s\"",
-			       frs->time / 1000, (int)(frs->time % 1000), ph, task->tid, name);
-		} else {
-			pr_out("{\"ts\":%"PRIu64".%03d,\"ph\":\"%c\",\"pid\":%d,\"tid\":%d,\"name\":\"%s\"",
-			       frs->time / 1000, (int)(frs->time % 1000), ph, task->t->pid, task->tid, name);
-		}
-		if (frs->more) {
-			str_mode |= IS_RETVAL | HAS_MORE;
-			get_argspec_string(task, spec_buf, sizeof(spec_buf), str_mode);
-			pr_out(",\"args\":{\"retval\":\"%s\"}}",
-				spec_buf);
-		}
-		else
-			pr_out("}");
+
+	if (chrome->split) {
+		if (need_chrome_split(chrome, frs->time))
+			split_chrome_file(chrome, frs->time);
+		update_chrome_task(chrome, task, ph, name);
 	}
-	else if (frs->type == UFTRACE_LOST)
-		chrome->lost_event_cnt++;
+
+	add_chrome_event(chrome, frs->time, ph, task->t->pid, task->tid, name);
+
+	if (frs->more) {
+		str_mode |= HAS_MORE;
+		if (ph == 'E')
+			str_mode |= IS_RETVAL;
+		get_argspec_string(task, spec_buf, sizeof(spec_buf), str_mode);
+
+		json_add_str(jw, ph == 'B' ? ",\"args\":{\"arguments\":\"" :
+				",\"args\":{\"retval\":\"");
+		json_add_str(jw, spec_buf);
+		json_add_str(jw, "\"}}");
+	}
+	else
+		json_add_char(jw, '}');
 }
 
 static void print_chrome_task_event(struct uftrace_dump_ops *ops,
@@ -938,56 +1184,56 @@ static void print_chrome_perf_event(struct uftrace_dump_ops *ops,
 				    struct uftrace_perf_reader *perf,
 				    struct uftrace_record *frs)
 {
+	struct uftrace_chrome_dump *chrome = container_of(ops, typeof(*chrome), ops);
 	uint64_t evt_id = frs->addr;
 	bool is_process = perf->u.comm.pid == perf->tid;
+	int nr_meta = chrome->nr_meta;
 
 	switch (evt_id) {
 	case EVENT_ID_PERF_COMM:
 		if (is_process) {
-			pr_out(",\n{\"ts\":0,\"ph\":\"M\",\"pid\":%d,"
-			       "\"name\":\"process_name\","
-			       "\"args\":{\"name\":\"%s\"}}",
-			       perf->tid, perf->u.comm.comm);
-			pr_out(",\n{\"ts\":0,\"ph\":\"M\",\"pid\":%d,"
-			       "\"name\":\"thread_name\","
-			       "\"args\":{\"name\":\"%s\"}}",
-			       perf->tid, perf->u.comm.comm);
+			add_chrome_meta(chrome, perf->tid, perf->tid,
+					"process_name", perf->u.comm.comm);
+			add_chrome_meta(chrome, perf->tid, perf->tid,
+					"thread_name", perf->u.comm.comm);
 		} else {
 			char buf[32];
-			sprintf(buf, "%s (%d)", perf->u.comm.comm, perf->tid);
-			pr_out(",\n{\"ts\":0,\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
-			       "\"name\":\"thread_name\","
-			       "\"args\":{\"name\":\"%s\"}}",
-			       perf->u.comm.pid, perf->tid, buf);
+			snprintf(buf, sizeof(buf), "%s (%d)",
+				 perf->u.comm.comm, perf->tid);
+			add_chrome_meta(chrome, perf->u.comm.pid, perf->tid,
+					"thread_name", buf);
 		}
 		break;
 	default:
 		break;
 	};
+
+	/* the metadata will be added to next files too */
+	for (; nr_meta < chrome->nr_meta; nr_meta++) {
+		if (chrome->last_comma)
+			json_add_raw(&chrome->jw, ",\n", 2);
+		chrome->last_comma = true;
+		json_add_str(&chrome->jw, chrome->meta[nr_meta]);
+	}
 }
 
 static void print_chrome_footer(struct uftrace_dump_ops *ops,
 				struct ftrace_file_handle *handle,
 				struct opts *opts)
 {
-	char buf[PATH_MAX];
-	struct stat statbuf;
 	struct uftrace_chrome_dump *chrome = container_of(ops, typeof(*chrome), ops);
+	int i;
 
-	/* read recorded date and time */
-	snprintf(buf, sizeof(buf), "%s/info", opts->dirname);
-	if (stat(buf, &statbuf) < 0)
-		return;
+	finish_chrome_file(chrome);
 
-	ctime_r(&statbuf.st_mtime, buf);
-	buf[strlen(buf) - 1] = '\0';
+	for (i = 0; i < chrome->nr_meta; i++)
+		free(chrome->meta[i]);
+	free(chrome->meta);
 
-	pr_out("\n], \"displayTimeUnit\": \"ns\", \"metadata\": {\n");
-	pr_out("\"version\":\"uftrace %s\",\n", UFTRACE_VERSION);
-	pr_out("\"recorded_time\":\"%s\",\n", buf);
-	if (handle->hdr.info_mask & (1UL << CMDLINE))
-		pr_out("\"command_line\":\"%s\"\n", handle->info.cmdline);
-	pr_out("} }\n");
+	for (i = 0; i < chrome->nr_tasks; i++)
+		free(chrome->tasks[i].stack);
+	free(chrome->tasks);
+	free(chrome->filename);
 
 	/*
 	 * Chrome trace format requires to have both entry and exit records so
@@ -1008,12 +1254,379 @@ static void print_chrome_footer(struct uftrace_dump_ops *ops,
 	}
 }
 
+/* use name of the data directory as the prefix of split files */
+static char * get_split_prefix(const char *dirname)
+{
+	char *dir = xstrdup(dirname);
+	char *end = dir + strlen(dir);
+	char *name, *prefix;
+
+	while (end > dir + 1 && end[-1] == '/')
+		*--end = '\0';
+
+	name = basename(dir);
+	if (*name == '\0' || !strcmp(name, ".") || !strcmp(name, "/"))
+		name = "uftrace";
+
+	prefix = xstrdup(name);
+	free(dir);
+	return prefix;
+}
+
+/* perfetto support */
+#define PERFETTO_FLUSH_SIZE  (1024 * 1024)
+
+/* uuid of process tracks is the pid, so use upper bits for threads */
+#define PERFETTO_THREAD_UUID(tid)  ((1ULL << 32) | (tid))
+
+#define NAME_BITS  (sizeof(long) * 8)
+
+static void flush_perfetto_buf(struct uftrace_perfetto_dump *perfetto,
+			       bool force)
+{
+	struct perfetto_buf *buf = &perfetto->buf;
+
+	if (!force && buf->len < PERFETTO_FLUSH_SIZE)
+		return;
+
+	if (buf->len && fwrite(buf->data, buf->len, 1, outfp) != 1)
+		pr_err("write perfetto trace failed");
+	perfetto_buf_reset(buf);
+}
+
+static void add_perfetto_track(struct uftrace_perfetto_dump *perfetto,
+			       int pid, int tid, const char *name)
+{
+	struct perfetto_buf *buf = &perfetto->buf;
+	size_t packet, track, desc;
+
+	packet = pb_begin(buf, PF_TRACE_PACKET);
+	track = pb_begin(buf, PF_PACKET_TRACK_DESCRIPTOR);
+
+	if (tid == 0) {
+		pb_add_uint(buf, PF_TRACK_UUID, pid);
+		desc = pb_begin(buf, PF_TRACK_PROCESS);
+		pb_add_uint(buf, PF_PROCESS_PID, pid);
+		pb_add_string(buf, PF_PROCESS_NAME, name);
+	}
+	else {
+		pb_add_uint(buf, PF_TRACK_UUID, PERFETTO_THREAD_UUID(tid));
+		pb_add_uint(buf, PF_TRACK_PARENT_UUID, pid);
+		desc = pb_begin(buf, PF_TRACK_THREAD);
+		pb_add_uint(buf, PF_THREAD_PID, pid);
+		pb_add_uint(buf, PF_THREAD_TID, tid);
+		pb_add_string(buf, PF_THREAD_NAME, name);
+	}
+
+	pb_end(buf, desc);
+	pb_end(buf, track);
+	pb_end(buf, packet);
+}
+
+static void add_perfetto_clock(struct perfetto_buf *buf, int clock_id,
+			       uint64_t timestamp, bool incremental)
+{
+	size_t clock;
+
+	clock = pb_begin(buf, PF_CLOCK_SNAPSHOT_CLOCKS);
+	pb_add_uint(buf, PF_CLOCK_ID, clock_id);
+	pb_add_uint(buf, PF_CLOCK_TIMESTAMP, timestamp);
+	if (incremental)
+		pb_add_uint(buf, PF_CLOCK_IS_INCREMENTAL, 1);
+	pb_end(buf, clock);
+}
+
+/*
+ * Each task has its own packet sequence.  The first packet defines a
+ * sequence-scoped clock which is incremental so that later packets only
+ * have (small) deltas of the timestamp.  It also sets the default track
+ * of the events to the thread.
+ */
+static void start_perfetto_task(struct uftrace_perfetto_dump *perfetto,
+				struct ftrace_task_handle *task,
+				struct perfetto_task *ptask)
+{
+	struct perfetto_buf *buf = &perfetto->buf;
+	struct uftrace_task *proc;
+	uint64_t timestamp = task->rstack->time;
+	int seq = ptask - perfetto->tasks + 1;
+	int pid = task->t->pid;
+	size_t packet, snapshot, defaults, event_defaults;
+	int i;
+
+	/* add the process track for the first task of the process */
+	for (i = 0; i < perfetto->nr_tasks; i++) {
+		if (perfetto->tasks[i].started && perfetto->tasks[i].pid == pid)
+			break;
+	}
+	if (i == perfetto->nr_tasks) {
+		proc = find_task(&task->h->sessions, pid);
+		add_perfetto_track(perfetto, pid, 0,
+				   proc ? proc->comm : basename(task->h->info.exename));
+	}
+	add_perfetto_track(perfetto, pid, task->tid, task->t->comm);
+
+	packet = pb_begin(buf, PF_TRACE_PACKET);
+	pb_add_uint(buf, PF_PACKET_TIMESTAMP, timestamp);
+	pb_add_uint(buf, PF_PACKET_TIMESTAMP_CLOCK_ID, PERFETTO_CLOCK_MONOTONIC);
+	pb_add_uint(buf, PF_PACKET_SEQUENCE_ID, seq);
+	pb_add_uint(buf, PF_PACKET_SEQUENCE_FLAGS,
+		    PERFETTO_SEQ_INCREMENTAL_STATE_CLEARED);
+
+	snapshot = pb_begin(buf, PF_PACKET_CLOCK_SNAPSHOT);
+	add_perfetto_clock(buf, PERFETTO_CLOCK_MONOTONIC, timestamp, false);
+	add_perfetto_clock(buf, PERFETTO_CLOCK_SEQUENCE, 0, true);
+	pb_add_uint(buf, PF_CLOCK_SNAPSHOT_PRIMARY, PERFETTO_CLOCK_MONOTONIC);
+	pb_end(buf, snapshot);
+
+	defaults = pb_begin(buf, PF_PACKET_DEFAULTS);
+	pb_add_uint(buf, PF_DEFAULTS_TIMESTAMP_CLOCK_ID, PERFETTO_CLOCK_SEQUENCE);
+	event_defaults = pb_begin(buf, PF_DEFAULTS_TRACK_EVENT);
+	pb_add_uint(buf, PF_TRACK_EVENT_DEFAULTS_UUID,
+		    PERFETTO_THREAD_UUID(task->tid));
+	pb_end(buf, event_defaults);
+	pb_end(buf, defaults);
+
+	pb_end(buf, packet);
+
+	ptask->pid = pid;
+	ptask->started = true;
+	ptask->last_time = timestamp;
+}
+
+/* returns true if the name is not interned in the sequence yet */
+static bool intern_perfetto_name(struct perfetto_task *ptask, unsigned id)
+{
+	unsigned idx = id / NAME_BITS;
+	unsigned long bit = 1UL << (id % NAME_BITS);
+
+	if (idx >= ptask->nr_names) {
+		unsigned nr = ALIGN(idx + 1, 64);
+
+		ptask->names = xrealloc(ptask->names, nr * sizeof(long));
+		memset(ptask->names + ptask->nr_names, 0,
+		       (nr - ptask->nr_names) * sizeof(long));
+		ptask->nr_names = nr;
+	}
+
+	if (ptask->names[idx] & bit)
+		return false;
+
+	ptask->names[idx] |= bit;
+	return true;
+}
+
+static void print_perfetto_header(struct uftrace_dump_ops *ops,
+				  struct ftrace_file_handle *handle,
+				  struct opts *opts)
+{
+}
+
+static void print_perfetto_task_start(struct uftrace_dump_ops *ops,
+				      struct ftrace_task_handle *task)
+{
+}
+
+static void print_perfetto_inverted_time(struct uftrace_dump_ops *ops,
+					 struct ftrace_task_handle *task)
+{
+}
+
+static void print_perfetto_task_rstack(struct uftrace_dump_ops *ops,
+				       struct ftrace_task_handle *task, char *name)
+{
+	struct uftrace_perfetto_dump *perfetto = container_of(ops, typeof(*perfetto), ops);
+	struct perfetto_buf *buf = &perfetto->buf;
+	struct uftrace_record *frs = task->rstack;
+	struct perfetto_task *ptask;
+	enum perfetto_event_type type;
+	enum argspec_string_bits str_mode = HAS_MORE;
+	char spec_buf[1024];
+	size_t packet, event, anno;
+	uint64_t delta = 0;
+	unsigned id;
+
+	if (frs->type == UFTRACE_LOST) {
+		perfetto->lost_event_cnt++;
+		return;
+	}
+
+	if (frs->type == UFTRACE_EVENT) {
+		if (frs->addr != EVENT_ID_PERF_SCHED_IN &&
+		    frs->addr != EVENT_ID_PERF_SCHED_OUT)
+			return;
+
+		/* new thread starts with sched-in event which should be ignored */
+		if (frs->addr == EVENT_ID_PERF_SCHED_IN && task->timestamp_last == 0)
+			return;
+	}
+
+	if ((frs->type == UFTRACE_ENTRY) ||
+	    (frs->type == UFTRACE_EVENT && frs->addr == EVENT_ID_PERF_SCHED_OUT))
+		type = PERFETTO_SLICE_BEGIN;
+	else
+		type = PERFETTO_SLICE_END;
+
+	if (perfetto->tasks == NULL) {
+		perfetto->nr_tasks = task->h->nr_tasks;
+		perfetto->tasks = xcalloc(perfetto->nr_tasks, sizeof(*ptask));
+	}
+	ptask = &perfetto->tasks[task - task->h->tasks];
+
+	if (!ptask->started)
+		start_perfetto_task(perfetto, task, ptask);
+
+	/* the incremental clock cannot go backward */
+	if (frs->time > ptask->last_time) {
+		delta = frs->time - ptask->last_time;
+		ptask->last_time = frs->time;
+	}
+
+	id = intern_id(name);
+
+	packet = pb_begin(buf, PF_TRACE_PACKET);
+	pb_add_uint(buf, PF_PACKET_TIMESTAMP, delta);
+	pb_add_uint(buf, PF_PACKET_SEQUENCE_ID, ptask - perfetto->tasks + 1);
+	pb_add_uint(buf, PF_PACKET_SEQUENCE_FLAGS,
+		    PERFETTO_SEQ_NEEDS_INCREMENTAL_STATE);
+
+	if (intern_perfetto_name(ptask, id)) {
+		size_t interned, event_name;
+
+		interned = pb_begin(buf, PF_PACKET_INTERNED_DATA);
+		event_name = pb_begin(buf, PF_INTERNED_EVENT_NAMES);
+		pb_add_uint(buf, PF_EVENT_NAME_IID, id);
+		pb_add_string(buf, PF_EVENT_NAME_NAME, name);
+		pb_end(buf, event_name);
+		pb_end(buf, interned);
+	}
+
+	event = pb_begin(buf, PF_PACKET_TRACK_EVENT);
+	pb_add_uint(buf, PF_TRACK_EVENT_TYPE, type);
+	pb_add_uint(buf, PF_TRACK_EVENT_NAME_IID, id);
+
+	if (frs->more && frs->type != UFTRACE_EVENT) {
+		if (type == PERFETTO_SLICE_END)
+			str_mode |= IS_RETVAL;
+		get_argspec_string(task, spec_buf, sizeof(spec_buf), str_mode);
+
+		anno = pb_begin(buf, PF_TRACK_EVENT_DEBUG_ANNOTATION);
+		pb_add_string(buf, PF_ANNOTATION_NAME,
+			      type == PERFETTO_SLICE_END ? "retval" : "arguments");
+		pb_add_string(buf, PF_ANNOTATION_STRING_VALUE, spec_buf);
+		pb_end(buf, anno);
+	}
+
+	pb_end(buf, event);
+	pb_end(buf, packet);
+
+	flush_perfetto_buf(perfetto, false);
+}
+
+static void print_perfetto_task_event(struct uftrace_dump_ops *ops,
+				      struct ftrace_task_handle *task)
+{
+}
+
+static void print_perfetto_kernel_start(struct uftrace_dump_ops *ops,
+					struct uftrace_kernel_reader *kernel)
+{
+}
+
+static void print_perfetto_cpu_start(struct uftrace_dump_ops *ops,
+				     struct uftrace_kernel_reader *kernel, int cpu)
+{
+}
+
+static void print_perfetto_kernel_rstack(struct uftrace_dump_ops *ops,
+					 struct uftrace_kernel_reader *kernel, int cpu,
+					 struct uftrace_record *frs, char *name)
+{
+}
+
+static void print_perfetto_kernel_event(struct uftrace_dump_ops *ops,
+					struct uftrace_kernel_reader *kernel, int cpu,
+					struct uftrace_record *frs)
+{
+}
+
+static void print_perfetto_kernel_lost(struct uftrace_dump_ops *ops,
+				       uint64_t time, int tid, int losts)
+{
+}
+
+static void print_perfetto_perf_start(struct uftrace_dump_ops *ops,
+				      struct uftrace_perf_reader *perf, int cpu)
+{
+}
+
+static void print_perfetto_perf_event(struct uftrace_dump_ops *ops,
+				      struct uftrace_perf_reader *perf,
+				      struct uftrace_record *frs)
+{
+	struct uftrace_perfetto_dump *perfetto = container_of(ops, typeof(*perfetto), ops);
+	int pid = perf->u.comm.pid;
+
+	/* the track descriptors with same uuid update the names */
+	if (frs->addr == EVENT_ID_PERF_COMM) {
+		if (pid == perf->tid)
+			add_perfetto_track(perfetto, pid, 0, perf->u.comm.comm);
+		add_perfetto_track(perfetto, pid, perf->tid, perf->u.comm.comm);
+	}
+}
+
+static void print_perfetto_footer(struct uftrace_dump_ops *ops,
+				  struct ftrace_file_handle *handle,
+				  struct opts *opts)
+{
+	struct uftrace_perfetto_dump *perfetto = container_of(ops, typeof(*perfetto), ops);
+	int i;
+
+	flush_perfetto_buf(perfetto, true);
+	perfetto_buf_free(&perfetto->buf);
+
+	for (i = 0; i < perfetto->nr_tasks; i++)
+		free(perfetto->tasks[i].names);
+	free(perfetto->tasks);
+
+	/* see the comment in print_chrome_footer() */
+	if (perfetto->lost_event_cnt) {
+		pr_warn("Some of function trace records are lost. "
+			"(%d times shown)\n", perfetto->lost_event_cnt);
+		pr_warn("The output trace may not show the correct view "
+			"in perfetto UI.\n");
+	}
+}
+
 /* flamegraph support */
 static struct uftrace_graph flame_graph = {
 	.root.head     = LIST_HEAD_INIT(flame_graph.root.head),
 	.special_nodes = LIST_HEAD_INIT(flame_graph.special_nodes),
 };
 
+/*
+ * Graph nodes of the flame graph keep the time of the first call so that
+ * graphs of different tasks can be merged in the same (time) order.
+ */
+struct flame_node {
+	struct uftrace_graph_node	node;
+	uint64_t			first_time;
+	uint64_t			samples;  /* including children (for SVG) */
+};
+
+static inline struct flame_node *to_flame_node(struct uftrace_graph_node *node)
+{
+	return container_of(node, struct flame_node, node);
+}
+
+static void update_fg_first_time(struct uftrace_task_graph *tg, void *arg)
+{
+	struct flame_node *fn = to_flame_node(tg->node);
+
+	if (fn->node.nr_calls == 1)
+		fn->first_time = tg->task->rstack->time;
+}
+
 static void adjust_fg_time(struct uftrace_task_graph *tg, void *arg)
 {
 	struct uftrace_dump_ops *ops = arg;
@@ -1059,46 +1672,340 @@ static void adjust_fg_time(struct uftrace_task_graph *tg, void *arg)
 	node->parent->child_time += accounted_time;
 }
 
-static void print_flame_graph(struct uftrace_graph_node *node, struct opts *opts)
+static unsigned long flame_samples(struct uftrace_graph_node *node,
+				   struct opts *opts)
 {
-	struct uftrace_graph_node *child;
 	unsigned long sample = node->nr_calls;
 
 	if (sample && opts->sample_time)
 		sample = (node->time - node->child_time) / opts->sample_time;
 
-	if (sample) {
-		struct uftrace_graph_node *parent = node;
-		char *names[opts->max_stack];
-		char *buf, *ptr;
-		int i = 0;
-		size_t len = 0;
+	return sample;
+}
+
+/* returns the next node in pre-order and updates the @depth */
+static struct uftrace_graph_node * next_flame_node(struct uftrace_graph_node *node,
+						   int *depth)
+{
+	if (!list_empty(&node->head)) {
+		(*depth)++;
+		return list_first_entry(&node->head, struct uftrace_graph_node, list);
+	}
+
+	while (node->parent) {
+		if (!list_is_last(&node->list, &node->parent->head))
+			return list_next_entry(node, list);
 
-		while (parent != NULL && parent->name != NULL) {
-			names[i++] = parent->name;
-			len += strlen(parent->name) + 1;
+		node = node->parent;
+		(*depth)--;
+	}
+	return NULL;
+}
+
+/* put the @node in the list of siblings in the order of the first call */
+static void sort_flame_node(struct uftrace_graph_node *node)
+{
+	struct uftrace_graph_node *parent = node->parent;
+	struct uftrace_graph_node *pos;
+	uint64_t first_time = to_flame_node(node)->first_time;
+
+	list_del(&node->list);
+
+	list_for_each_entry_reverse(pos, &parent->head, list) {
+		if (to_flame_node(pos)->first_time <= first_time) {
+			list_add(&node->list, &pos->list);
+			return;
+		}
+	}
+	list_add(&node->list, &parent->head);
+}
+
+static struct uftrace_graph_node * merge_flame_node(struct uftrace_graph *graph,
+						    struct uftrace_graph_node *parent,
+						    struct uftrace_graph_node *src)
+{
+	struct uftrace_graph_node *node;
+	struct flame_node *fn;
+	uint64_t first_time = to_flame_node(src)->first_time;
+
+	node = graph_find_child(parent, src->name_id);
+	if (node == NULL) {
+		node = graph_add_child(graph, parent, src->name_id,
+				       sizeof(struct flame_node));
+		node->addr = src->addr;
+
+		fn = to_flame_node(node);
+		fn->first_time = first_time;
+		sort_flame_node(node);
+	}
+	else {
+		fn = to_flame_node(node);
+		if (fn->first_time > first_time) {
+			fn->first_time = first_time;
+			sort_flame_node(node);
+		}
+	}
+
+	node->nr_calls   += src->nr_calls;
+	node->time       += src->time;
+	node->child_time += src->child_time;
+
+	return node;
+}
+
+/**
+ * merge_flame_graph - merge a flame graph into another
+ * @dst: graph to be merged into
+ * @src: graph to merge
+ *
+ * This function adds nodes in @src to @dst which has the same path (i.e.
+ * parent nodes) using the hash table of the children.  Nodes are kept in
+ * the order of the first call so the result is same as it's built from
+ * records of all tasks in time order.
+ */
+static void merge_flame_graph(struct uftrace_graph *dst,
+			      struct uftrace_graph *src)
+{
+	struct uftrace_graph_node *node = &src->root;
+	struct uftrace_graph_node *parent = &dst->root;
+	int depth = 0;
+	int prev_depth = 0;
+
+	dst->root.time       += src->root.time;
+	dst->root.child_time += src->root.child_time;
+
+	while ((node = next_flame_node(node, &depth)) != NULL) {
+		/* find the parent of the node at the (new) depth */
+		while (prev_depth-- >= depth)
 			parent = parent->parent;
+
+		parent = merge_flame_node(dst, parent, node);
+		prev_depth = depth;
+	}
+}
+
+/*
+ * It prints a line for each node in the collapsed stack format like:
+ *
+ *   main;foo;bar 3
+ *
+ * The path is built incrementally in a buffer during the traversal.
+ */
+static void print_flame_graph(struct uftrace_graph *graph, struct opts *opts)
+{
+	struct uftrace_graph_node *node = &graph->root;
+	size_t *offset = NULL;
+	char *path = NULL;
+	size_t path_size = 0;
+	int max_depth = 0;
+	int depth = 0;
+
+	while ((node = next_flame_node(node, &depth)) != NULL && !uftrace_done) {
+		unsigned long sample;
+		size_t len = strlen(node->name);
+		size_t start;
+
+		if (depth > max_depth) {
+			max_depth = depth;
+			offset = xrealloc(offset, (max_depth + 1) * sizeof(*offset));
+			offset[0] = 0;
+		}
+
+		start = offset[depth - 1];
+		if (start + len + 1 > path_size) {
+			path_size = ALIGN(start + len + 1, 4096);
+			path = xrealloc(path, path_size);
 		}
 
-		buf = ptr = xmalloc(len + 32);
-		while (--i >= 0)
-			ptr += snprintf(ptr, len, "%s;", names[i]);
-		ptr[-1] = ' ';
-		snprintf(ptr, len, "%lu", sample);
+		memcpy(path + start, node->name, len);
+		path[start + len] = ';';
+		offset[depth] = start + len + 1;
 
-		pr_out("%s\n", buf);
-		free(buf);
+		sample = flame_samples(node, opts);
+		if (sample)
+			pr_out("%.*s %lu\n", (int)(start + len), path, sample);
 	}
 
-	list_for_each_entry(child, &node->head, list)
-		print_flame_graph(child, opts);
+	free(path);
+	free(offset);
+}
+
+/* frame layout of the SVG output (similar to flamegraph.pl) */
+#define FLAME_SVG_WIDTH        1200
+#define FLAME_SVG_FRAME        16
+#define FLAME_SVG_FONT_SIZE    12
+#define FLAME_SVG_FONT_WIDTH   0.59
+#define FLAME_SVG_XPAD         10
+#define FLAME_SVG_YPAD_TOP     (FLAME_SVG_FONT_SIZE * 3)
+#define FLAME_SVG_YPAD_BOTTOM  (FLAME_SVG_FONT_SIZE * 2 + 10)
+#define FLAME_SVG_MIN_WIDTH    0.1
+
+static void print_svg_escape(const char *str, int len)
+{
+	int i;
+
+	for (i = 0; i < len && str[i]; i++) {
+		switch (str[i]) {
+		case '<':
+			pr_out("&lt;");
+			break;
+		case '>':
+			pr_out("&gt;");
+			break;
+		case '&':
+			pr_out("&amp;");
+			break;
+		case '"':
+			pr_out("&quot;");
+			break;
+		default:
+			pr_out("%c", str[i]);
+			break;
+		}
+	}
+}
+
+static void print_svg_frame(const char *name, uint64_t samples,
+			    uint64_t total, double x, double width, int y)
+{
+	/* use warm colors based on the name so that it's not changed */
+	unsigned hash = 2166136261U;
+	const char *p;
+	int max_chars;
+	int len = strlen(name);
+
+	for (p = name; *p; p++)
+		hash = (hash ^ (unsigned char)*p) * 16777619U;
+
+	pr_out("<g><title>");
+	print_svg_escape(name, len);
+	pr_out(" (%"PRIu64" samples, %.2f%%)</title>", samples,
+	       100.0 * samples / total);
+	pr_out("<rect x=\"%.1f\" y=\"%d\" width=\"%.1f\" height=\"%d\" "
+	       "fill=\"rgb(%u,%u,%u)\" rx=\"2\" ry=\"2\"/>",
+	       x, y, width, FLAME_SVG_FRAME - 1,
+	       205 + hash % 51, (hash >> 8) % 231, (hash >> 16) % 56);
+
+	max_chars = width / (FLAME_SVG_FONT_SIZE * FLAME_SVG_FONT_WIDTH);
+	if (max_chars >= 3) {
+		pr_out("<text x=\"%.1f\" y=\"%.1f\">", x + 3,
+		       y + FLAME_SVG_FRAME - 4.5);
+
+		if (len <= max_chars)
+			print_svg_escape(name, len);
+		else {
+			print_svg_escape(name, max_chars - 2);
+			pr_out("..");
+		}
+		pr_out("</text>");
+	}
+	pr_out("</g>\n");
+}
+
+/**
+ * print_flame_svg - print the flame graph as a SVG image
+ * @graph: flame graph
+ * @opts: uftrace command line options
+ *
+ * This function draws the flame graph directly like flamegraph.pl does
+ * with the collapsed stack output.  Width of each frame is proportional
+ * to the samples of itself and its children, and the children are placed
+ * in the order of the first call (not sorted by name).
+ */
+static void print_flame_svg(struct uftrace_graph *graph, struct opts *opts)
+{
+	struct uftrace_graph_node *node = &graph->root;
+	struct uftrace_graph_node **nodes = NULL;
+	uint64_t *offset = NULL;
+	uint64_t total;
+	double scale;
+	int nr_nodes = 0;
+	int max_depth = 0;
+	int depth = 0;
+	int height;
+	int i;
+
+	/* collect the nodes in pre-order to sum samples from the leaves */
+	while ((node = next_flame_node(node, &depth)) != NULL) {
+		struct flame_node *fn = to_flame_node(node);
+
+		if ((nr_nodes % 4096) == 0)
+			nodes = xrealloc(nodes, (nr_nodes + 4096) * sizeof(*nodes));
+		nodes[nr_nodes++] = node;
+
+		fn->samples = 0;
+		if (node->time >= node->child_time)
+			fn->samples = flame_samples(node, opts);
+
+		if (depth > max_depth)
+			max_depth = depth;
+	}
+
+	/* the root node is not a flame node */
+	total = 0;
+	for (i = nr_nodes - 1; i >= 0; i--) {
+		node = nodes[i];
+
+		if (node->parent == &graph->root)
+			total += to_flame_node(node)->samples;
+		else
+			to_flame_node(node->parent)->samples += to_flame_node(node)->samples;
+	}
+	free(nodes);
+
+	scale = total ? (double)(FLAME_SVG_WIDTH - 2 * FLAME_SVG_XPAD) / total : 0;
+	height = (max_depth + 1) * FLAME_SVG_FRAME +
+		FLAME_SVG_YPAD_TOP + FLAME_SVG_YPAD_BOTTOM;
+
+	pr_out("<?xml version=\"1.0\" standalone=\"no\"?>\n");
+	pr_out("<svg version=\"1.1\" width=\"%d\" height=\"%d\" "
+	       "viewBox=\"0 0 %d %d\" xmlns=\"http://www.w3.org/2000/svg\">\n",
+	       FLAME_SVG_WIDTH, height, FLAME_SVG_WIDTH, height);
+	pr_out("<rect x=\"0\" y=\"0\" width=\"100%%\" height=\"100%%\" fill=\"#eeeeee\"/>\n");
+	pr_out("<text x=\"%d\" y=\"%d\" text-anchor=\"middle\" "
+	       "font-family=\"Verdana\" font-size=\"%d\">Flame Graph</text>\n",
+	       FLAME_SVG_WIDTH / 2, FLAME_SVG_FONT_SIZE * 2,
+	       FLAME_SVG_FONT_SIZE + 5);
+	pr_out("<g font-family=\"Verdana\" font-size=\"%d\">\n",
+	       FLAME_SVG_FONT_SIZE);
+
+	if (total == 0)
+		goto out;
+
+	print_svg_frame("all", total, total, FLAME_SVG_XPAD,
+			total * scale, height - FLAME_SVG_YPAD_BOTTOM - FLAME_SVG_FRAME);
+
+	/* offset[d] is the position of next frame at depth d (in samples) */
+	offset = xcalloc(max_depth + 1, sizeof(*offset));
+
+	node = &graph->root;
+	depth = 0;
+	while ((node = next_flame_node(node, &depth)) != NULL && !uftrace_done) {
+		struct flame_node *fn = to_flame_node(node);
+		uint64_t x = offset[depth - 1];
+		int y = height - FLAME_SVG_YPAD_BOTTOM - (depth + 1) * FLAME_SVG_FRAME;
+
+		offset[depth - 1] += fn->samples;
+		offset[depth] = x;
+
+		if (fn->samples * scale < FLAME_SVG_MIN_WIDTH)
+			continue;
+
+		print_svg_frame(node->name, fn->samples, total,
+				FLAME_SVG_XPAD + x * scale,
+				fn->samples * scale, y);
+	}
+
+	free(offset);
+out:
+	pr_out("</g>\n</svg>\n");
 }
 
 static void print_flame_header(struct uftrace_dump_ops *ops,
 			       struct ftrace_file_handle *handle,
 			       struct opts *opts)
 {
-	graph_init_callbacks(NULL, adjust_fg_time, NULL, ops);
+	graph_init_callbacks(update_fg_first_time, adjust_fg_time, NULL, ops);
 }
 
 static void print_flame_task_start(struct uftrace_dump_ops *ops,
@@ -1116,18 +2023,29 @@ static void print_flame_task_rstack(struct uftrace_dump_ops *ops,
 {
 	struct uftrace_record *frs = task->rstack;
 	struct uftrace_flame_dump *flame = container_of(ops, typeof(*flame), ops);
+	struct uftrace_graph *fg = flame->graph;
 	struct uftrace_task_graph *graph;
+	unsigned name_id = 0;
 
-	graph = graph_get_task(task, sizeof(*graph));
+	if (flame->tg) {
+		/* a worker reads a single task only */
+		graph = flame->tg;
+		graph->task = task;
+	}
+	else
+		graph = graph_get_task(task, sizeof(*graph));
 
-	graph->graph = &flame_graph;
-	flame_graph.sess = find_task_session(&task->h->sessions,
-					     task->tid, frs->time);
+	graph->graph = fg;
+	fg->sess = find_task_session(&task->h->sessions, task->tid, frs->time);
 
 	if (graph->node == NULL)
-		graph->node = &flame_graph.root;
+		graph->node = &fg->root;
+
+	/* the name is used only for a new (entry) node */
+	if (frs->type == UFTRACE_ENTRY)
+		name_id = intern_id(name);
 
-	graph_add_node(graph, frs->type, name, sizeof(struct uftrace_graph_node));
+	graph_add_node(graph, frs->type, name_id, sizeof(struct flame_node));
 }
 
 static void print_flame_task_event(struct uftrace_dump_ops *ops,
@@ -1177,9 +2095,14 @@ static void print_flame_footer(struct uftrace_dump_ops *ops,
 			       struct ftrace_file_handle *handle,
 			       struct opts *opts)
 {
-	print_flame_graph(&flame_graph.root, opts);
+	struct uftrace_flame_dump *flame = container_of(ops, typeof(*flame), ops);
 
-	graph_destroy(&flame_graph);
+	if (opts->flame_svg)
+		print_flame_svg(flame->graph, opts);
+	else
+		print_flame_graph(flame->graph, opts);
+
+	graph_destroy(flame->graph);
 	graph_remove_task();
 }
 
@@ -1369,15 +2292,13 @@ static void dump_replay_event(struct uftrace_dump_ops *ops,
 	}
 }
 
-static void do_dump_replay(struct uftrace_dump_ops *ops, struct opts *opts,
-			   struct ftrace_file_handle *handle)
+static void dump_replay_records(struct uftrace_dump_ops *ops, struct opts *opts,
+				struct ftrace_file_handle *handle)
 {
 	uint64_t prev_time = 0;
 	struct ftrace_task_handle *task;
 	int i;
 
-	ops->header(ops, handle, opts);
-
 	while (!read_rstack(handle, &task) && !uftrace_done) {
 		struct uftrace_record *frs = task->rstack;
 
@@ -1448,10 +2369,132 @@ static void do_dump_replay(struct uftrace_dump_ops *ops, struct opts *opts,
 				dump_replay_func(ops, task);
 		}
 	}
+}
 
+static void do_dump_replay(struct uftrace_dump_ops *ops, struct opts *opts,
+			   struct ftrace_file_handle *handle)
+{
+	ops->header(ops, handle, opts);
+	dump_replay_records(ops, opts, handle);
 	ops->footer(ops, handle, opts);
 }
 
+/*
+ * The flame graph only needs the call path of each function so records
+ * of a task can be processed independently.  Each worker thread builds a
+ * graph for a task and merges it to its own graph.  They are merged to
+ * the final graph at last.
+ */
+struct flame_parallel {
+	struct ftrace_file_handle	*handle;
+	struct opts			*opts;
+	struct uftrace_flame_dump	*flame;
+	int				next;  /* next task to process */
+};
+
+struct flame_worker {
+	pthread_t			thread;
+	struct flame_parallel		*fp;
+	struct uftrace_graph		graph;
+};
+
+static void *flame_worker_thread(void *arg)
+{
+	struct flame_worker *w = arg;
+	struct flame_parallel *fp = w->fp;
+	struct ftrace_file_handle *handle = fp->handle;
+	struct ftrace_file_handle sub;
+	struct uftrace_flame_dump flame;
+	struct uftrace_task_graph tg;
+	struct uftrace_graph graph;
+	sigset_t sigset;
+	int idx;
+
+	/* signals should be handled by the main thread */
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+
+	while (!uftrace_done) {
+		idx = __sync_fetch_and_add(&fp->next, 1);
+		if (idx >= handle->nr_tasks)
+			break;
+
+		setup_single_task_handle(handle, idx, &sub);
+		graph_init(&graph, NULL);
+
+		memset(&tg, 0, sizeof(tg));
+		flame = *fp->flame;
+		flame.graph = &graph;
+		flame.tg = &tg;
+
+		dump_replay_records(&flame.ops, fp->opts, &sub);
+
+		merge_flame_graph(&w->graph, &graph);
+		graph_destroy(&graph);
+
+		finish_single_task_handle(handle, &sub);
+	}
+
+	return NULL;
+}
+
+static bool can_dump_flame_parallel(struct ftrace_file_handle *handle,
+				    struct opts *opts)
+{
+	int i;
+
+	if (!can_read_tasks_parallel(handle, opts))
+		return false;
+
+	/* forked tasks continue the graph of the parent */
+	for (i = 0; i < handle->nr_tasks; i++) {
+		struct uftrace_task *t = handle->tasks[i].t;
+
+		if (t == NULL || t->ppid)
+			return false;
+	}
+
+	return true;
+}
+
+static void do_dump_flame_parallel(struct uftrace_flame_dump *flame,
+				   struct opts *opts,
+				   struct ftrace_file_handle *handle)
+{
+	struct flame_parallel fp = {
+		.handle = handle,
+		.opts   = opts,
+		.flame  = flame,
+	};
+	struct flame_worker *workers;
+	int i, nr = handle->nr_jobs;
+
+	if (nr > handle->nr_tasks)
+		nr = handle->nr_tasks;
+
+	pr_dbg("start %d worker thread(s) for %d task(s)\n",
+	       nr, handle->nr_tasks);
+
+	flame->ops.header(&flame->ops, handle, opts);
+
+	workers = xcalloc(nr, sizeof(*workers));
+	for (i = 0; i < nr; i++) {
+		workers[i].fp = &fp;
+		graph_init(&workers[i].graph, NULL);
+		pthread_create(&workers[i].thread, NULL,
+			       flame_worker_thread, &workers[i]);
+	}
+
+	for (i = 0; i < nr; i++) {
+		pthread_join(workers[i].thread, NULL);
+		merge_flame_graph(flame->graph, &workers[i].graph);
+		graph_destroy(&workers[i].graph);
+	}
+	free(workers);
+
+	flame->ops.footer(&flame->ops, handle, opts);
+}
+
 int command_dump(int argc, char *argv[], struct opts *opts)
 {
 	int ret;
@@ -1465,6 +2508,9 @@ int command_dump(int argc, char *argv[], struct opts *opts)
 
 	fstack_setup_filters(opts, &handle);
 
+	if ((opts->split_time || opts->split_size) && !opts->chrome_trace)
+		pr_warn("--split is only supported for chrome trace (ignored)\n");
+
 	if (opts->chrome_trace) {
 		struct uftrace_chrome_dump dump = {
 			.ops = {
@@ -1482,8 +2528,43 @@ int command_dump(int argc, char *argv[], struct opts *opts)
 				.perf_event     = print_chrome_perf_event,
 				.footer         = print_chrome_footer,
 			},
+			.split_time = opts->split_time,
+			.split_size = opts->split_size,
+		};
+
+		if (dump.split_time || dump.split_size) {
+			dump.split = true;
+			dump.prefix = get_split_prefix(opts->dirname);
+		}
+
+		do_dump_replay(&dump.ops, opts, &handle);
+		free(dump.prefix);
+	}
+	else if (opts->perfetto) {
+		struct uftrace_perfetto_dump dump = {
+			.ops = {
+				.header         = print_perfetto_header,
+				.task_start     = print_perfetto_task_start,
+				.inverted_time  = print_perfetto_inverted_time,
+				.task_rstack    = print_perfetto_task_rstack,
+				.task_event     = print_perfetto_task_event,
+				.kernel_start   = print_perfetto_kernel_start,
+				.cpu_start      = print_perfetto_cpu_start,
+				.kernel_func    = print_perfetto_kernel_rstack,
+				.kernel_event   = print_perfetto_kernel_event,
+				.lost           = print_perfetto_kernel_lost,
+				.perf_start     = print_perfetto_perf_start,
+				.perf_event     = print_perfetto_perf_event,
+				.footer         = print_perfetto_footer,
+			},
 		};
 
+		if (isatty(fileno(outfp))) {
+			pr_warn("perfetto trace is binary, please redirect the output\n");
+			ret = -1;
+			goto out;
+		}
+
 		do_dump_replay(&dump.ops, opts, &handle);
 	}
 	else if (opts->flame_graph) {
@@ -1505,9 +2586,13 @@ int command_dump(int argc, char *argv[], struct opts *opts)
 			},
 			.tasks = RB_ROOT,
 			.sample_time = opts->sample_time,
+			.graph = &flame_graph,
 		};
 
-		do_dump_replay(&dump.ops, opts, &handle);
+		if (can_dump_flame_parallel(&handle, opts))
+			do_dump_flame_parallel(&dump, opts, &handle);
+		else
+			do_dump_replay(&dump.ops, opts, &handle);
 	}
 	else {
 		struct uftrace_raw_dump dump = {
@@ -1531,6 +2616,7 @@ int command_dump(int argc, char *argv[], struct opts *opts)
 		do_dump_file(&dump.ops, opts, &handle);
 	}
 
+out:
 	close_data_file(opts, &handle);
 
 	return ret;
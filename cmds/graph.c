@@ -12,6 +12,7 @@
 #include "utils/fstack.h"
 #include "utils/field.h"
 #include "utils/graph.h"
+#include "utils/intern.h"
 
 static LIST_HEAD(output_fields);
 
@@ -435,11 +436,11 @@ static int print_graph(struct session_graph *graph, struct opts *opts)
 }
 
 static void build_graph_node(struct ftrace_task_handle *task, uint64_t time,
-			     uint64_t addr, int type, char *func)
+			     uint64_t addr, int type, unsigned func_id)
 {
 	struct task_graph *tg;
 	struct sym *sym = NULL;
-	char *name;
+	unsigned name_id;
 
 	tg = get_task_graph(task, time, addr);
 
@@ -447,30 +448,27 @@ static void build_graph_node(struct ftrace_task_handle *task, uint64_t time,
 	if (sym == NULL)
 		sym = session_find_dlsym(tg->utg.graph->sess, time, addr);
 
-	name = symbol_getname(sym, addr);
+	name_id = symbol_getname_id(sym, addr);
 
 	if (tg->enabled) {
-		graph_add_node(&tg->utg, type, name,
+		graph_add_node(&tg->utg, type, name_id,
 			       sizeof(struct uftrace_graph_node));
 	}
 
 	/* cannot find a session for this record */
 	if (tg->utg.graph == NULL)
-		goto out;
+		return;
 	if (type == UFTRACE_EVENT)
-		goto out;
+		return;
 	if (full_graph)
-		goto out;
+		return;
 
-	if (!strcmp(name, func)) {
+	if (name_id == func_id) {
 		if (type == UFTRACE_ENTRY)
 			start_graph(tg);
 		else if (type == UFTRACE_EXIT)
 			end_graph(tg);
 	}
-
-out:
-	symbol_putname(sym, name);
 }
 
 static void build_graph(struct opts *opts, struct ftrace_file_handle *handle,
@@ -479,6 +477,7 @@ static void build_graph(struct opts *opts, struct ftrace_file_handle *handle,
 	struct ftrace_task_handle *task;
 	struct session_graph *graph;
 	uint64_t prev_time = 0;
+	unsigned func_id = intern_id(func);
 	int i;
 
 	setup_graph_list(handle, opts, func);
@@ -517,7 +516,7 @@ static void build_graph(struct opts *opts, struct ftrace_file_handle *handle,
 				    !(fstack->flags & FSTACK_FL_NORECORD)) {
 					build_graph_node(task, prev_time,
 							 fstack->addr,
-							 UFTRACE_EXIT, func);
+							 UFTRACE_EXIT, func_id);
 				}
 
 				fstack_exit(task);
@@ -546,7 +545,7 @@ static void build_graph(struct opts *opts, struct ftrace_file_handle *handle,
 		if (task->stack_count >= opts->max_stack)
 			continue;
 
-		build_graph_node(task, frs->time, frs->addr, frs->type, func);
+		build_graph_node(task, frs->time, frs->addr, frs->type, func_id);
 	}
 
 	/* add duration of remaining functions */
@@ -581,7 +580,7 @@ static void build_graph(struct opts *opts, struct ftrace_file_handle *handle,
 				fstack[-1].child_time += fstack->total_time;
 
 			build_graph_node(task, last_time, fstack->addr,
-					 UFTRACE_EXIT, func);
+					 UFTRACE_EXIT, func_id);
 		}
 	}
 
@@ -21,6 +21,7 @@
 #include "libmcount/mcount.h"
 #include "utils/utils.h"
 #include "utils/filter.h"
+#include "utils/record-stat.h"
 #include "version.h"
 
 #define BUILD_ID_SIZE 20
@@ -971,6 +972,65 @@ void clear_uftrace_info(struct uftrace_info *info)
 	free(info->uftrace_version);
 }
 
+static void print_hist_percentile(const char *name, uint64_t *hist)
+{
+	int p50 = record_stat_percentile(hist, 50);
+	int p99 = record_stat_percentile(hist, 99);
+	int max = record_stat_percentile(hist, 100);
+
+	/* bucket N has values less than 2^N */
+	pr_out("# %-20s: < %llu / < %llu / < %llu usec (p50 / p99 / max)\n",
+	       name, 1ULL << p50, 1ULL << p99, 1ULL << max);
+}
+
+static void print_record_stat(const char *dirname)
+{
+	struct record_stat rs;
+	struct record_stat_task *t;
+	struct rb_node *node;
+	double sec;
+	bool first = true;
+
+	if (read_record_stat(&rs, dirname) < 0)
+		return;
+
+	sec = (double)rs.elapsed / NSEC_PER_SEC;
+	if (sec == 0)
+		sec = 1;
+
+	pr_out("#\n");
+	pr_out("# recorder statistics\n");
+	pr_out("# ===================\n");
+
+	pr_out("# %-20s: %"PRIu64" / %"PRIu64" / %"PRIu64" (received / written / reused)\n",
+	       "buffers", rs.total.recv, rs.total.written, rs.total.reused);
+	pr_out("# %-20s: %.0f / %.0f (received / written per sec)\n",
+	       "buffer rate", rs.total.recv / sec, rs.total.written / sec);
+	pr_out("# %-20s: %.2f / %.2f MB/s (average / max)\n", "write bandwidth",
+	       rs.total.bytes / sec / (1024 * 1024),
+	       (double)rs.max_bytes / (1024 * 1024));
+	pr_out("# %-20s: %d\n", "shmem buffers", rs.max_shm);
+	pr_out("# %-20s: %"PRIu64"\n", "lost records", rs.total.lost);
+
+	if (rs.total.lost) {
+		pr_out("# %-20s: ", "lost per task");
+		for (node = rb_first(&rs.tasks); node; node = rb_next(node)) {
+			t = rb_entry(node, struct record_stat_task, node);
+			if (t->lost == 0)
+				continue;
+
+			pr_out("%s%d(%"PRIu64")", first ? "" : ", ", t->tid, t->lost);
+			first = false;
+		}
+		pr_out("\n");
+	}
+
+	pr_out("# %-20s: %d\n", "max queue depth", rs.max_queued);
+	print_hist_percentile("write latency", rs.latency_hist);
+
+	free_record_stat(&rs);
+}
+
 int command_info(int argc, char *argv[], struct opts *opts)
 {
 	int ret;
@@ -1122,6 +1182,8 @@ int command_info(int argc, char *argv[], struct opts *opts)
 		pr_out("# %-20s: %ld / %ld (read / write)\n", "disk iops",
 		       handle.info.rblock, handle.info.wblock);
 	}
+
+	print_record_stat(opts->dirname);
 	pr_out("\n");
 
 out:
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <dirent.h>
 #include <signal.h>
@@ -7,6 +8,7 @@
 #include "uftrace.h"
 #include "utils/utils.h"
 #include "utils/fstack.h"
+#include "utils/filter.h"
 #include "utils/kernel.h"
 #include "libmcount/mcount.h"
 
@@ -48,9 +50,40 @@ static bool can_skip_replay(struct opts *opts, int record_result)
 	if (opts->nop)
 		return true;
 
+	/* records were printed already */
+	if (opts->stream)
+		return true;
+
 	return false;
 }
 
+/*
+ * The stream mode parses the records without argspec and symbols are
+ * read from user sessions only.  Also it only supports default output
+ * and the options handled by record.
+ */
+static bool can_use_stream(struct opts *opts)
+{
+	unsigned long trigger_flags = uftrace_trigger_flags(opts->trigger);
+
+	if (opts->args || opts->retval || opts->auto_args)
+		return false;
+	/* read= trigger saves data in events which is not printed */
+	if (trigger_flags & (TRIGGER_FL_ARGUMENT | TRIGGER_FL_RETVAL |
+			     TRIGGER_FL_READ))
+		return false;
+	if (opts->kernel || opts->event)
+		return false;
+	if (opts->report || opts->fields || opts->host)
+		return false;
+	if (opts->flat || opts->column_view || opts->task_newline)
+		return false;
+	if (opts->tid || opts->range.start || opts->range.stop)
+		return false;
+
+	return true;
+}
+
 static void setup_child_environ(struct opts *opts)
 {
 	char *old_preload, *libpath;
@@ -112,6 +145,12 @@ int command_live(int argc, char *argv[], struct opts *opts)
 
 	opts->dirname = template;
 
+	if (opts->stream && !can_use_stream(opts)) {
+		pr_warn("stream is not supported with the given options, "
+			"record and replay it instead\n");
+		opts->stream = false;
+	}
+
 	if (opts->list_event) {
 		if (geteuid() == 0)
 			list_kernel_events();
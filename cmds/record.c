@@ -10,6 +10,7 @@
 #include <dirent.h>
 #include <pthread.h>
 #include <signal.h>
+#include <sched.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
@@ -18,21 +19,30 @@
 #include <sys/resource.h>
 #include <sys/epoll.h>
 #include <sys/personality.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include "uftrace.h"
 #include "libmcount/mcount.h"
 #include "utils/utils.h"
 #include "utils/symbol.h"
 #include "utils/list.h"
+#include "utils/rbtree.h"
 #include "utils/filter.h"
 #include "utils/kernel.h"
 #include "utils/perf.h"
+#include "utils/record-stat.h"
+#include "utils/time-index.h"
+#include "utils/live-stream.h"
 
 #define SHMEM_NAME_SIZE (64 - (int)sizeof(struct list_head))
 
 struct shmem_list {
 	struct list_head list;
 	char id[SHMEM_NAME_SIZE];
+	/* for live --stream, see flush_stale_shmem() */
+	unsigned flushed;  /* size of data sent already */
+	uint64_t time;     /* when it's sent */
 };
 
 static LIST_HEAD(shmem_list_head);
@@ -42,10 +52,50 @@ struct buf_list {
 	struct list_head list;
 	int tid;
 	void *shmem_buf;
+	uint64_t time;  /* when it's queued */
+	/* data in [offset, size) will be written */
+	unsigned offset;
+	unsigned size;
+	bool partial;   /* the task is still recording in the buffer */
 };
 
 static LIST_HEAD(buf_free_list);
-static LIST_HEAD(buf_write_list);
+
+/*
+ * Buffers to be written are queued to a writer queue.  Normally there's
+ * only one queue shared by all writers, but with --writer-affinity=auto
+ * each NUMA node has its own queue and writers pinned to the node.
+ */
+struct writer_queue {
+	struct list_head	bufs;
+	int			ctl[2];
+	int			node;
+	int			nr_cpu;
+	int			*cpus;
+	cpu_set_t		cpuset;
+};
+
+static struct writer_queue *writer_queues;
+static int nr_writer_queue;
+
+/* map cpu to the index of writer_queues (only for affinity) */
+static int *cpu_queue_map;
+static int nr_cpu_queue_map;
+
+/*
+ * Pending buffers of a task should be in a same queue, otherwise writers
+ * in different nodes might write them out of order.  This keeps the
+ * queue and the number of buffers of each task (in the writer queues).
+ * It's only used for multiple queues and protected by write_list_lock.
+ */
+struct queued_task {
+	struct rb_node		node;
+	int			tid;
+	int			nr_buf;
+	struct writer_queue	*queue;
+};
+
+static struct rb_root queued_tasks = RB_ROOT;
 
 /* currently active writers */
 static LIST_HEAD(writer_list);
@@ -53,10 +103,15 @@ static LIST_HEAD(writer_list);
 static pthread_mutex_t free_list_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t write_list_lock = PTHREAD_MUTEX_INITIALIZER;
 static bool buf_done;
-static int thread_ctl[2];
 
 static bool has_perf_event;
 
+static struct record_stat rstat;
+
+/* live --stream: buffers are printed instead of written */
+static struct live_stream lstream;
+static bool use_live_stream;
+
 
 static bool can_use_fast_libmcount(struct opts *opts)
 {
@@ -254,6 +309,14 @@ static void setup_child_environ(struct opts *opts, int pfd,
 		setenv("UFTRACE_BUFFER", buf, 1);
 	}
 
+	if (opts->max_buffer) {
+		snprintf(buf, sizeof(buf), "%d", opts->max_buffer);
+		setenv("UFTRACE_MAX_BUFFER", buf, 1);
+	}
+
+	if (opts->no_loss)
+		setenv("UFTRACE_NO_LOSS", "1", 1);
+
 	if (opts->logfile) {
 		snprintf(buf, sizeof(buf), "%d", fileno(logfp));
 		setenv("UFTRACE_LOGFD", buf, 1);
@@ -284,9 +347,13 @@ static void setup_child_environ(struct opts *opts, int pfd,
 	    check_kernel_pid_filter())
 		setenv("UFTRACE_KERNEL_PID_UPDATE", "1", 1);
 
-	if (opts->script_file)
+	if (opts->script_file) {
 		setenv("UFTRACE_SCRIPT", opts->script_file, 1);
 
+		if (opts->script_async)
+			setenv("UFTRACE_SCRIPT_ASYNC", opts->script_async, 1);
+	}
+
 	if (opts->patt_type != PATT_REGEX)
 		setenv("UFTRACE_PATTERN", get_filter_pattern(opts->patt_type), 1);
 
@@ -455,9 +522,37 @@ static char *make_disk_name(const char *dirname, int tid)
 	return filename;
 }
 
+/* add time index of the buffer to seek the data file for time range */
+static void write_buffer_index(const char *dirname, struct buf_list *buf,
+			       off_t offset)
+{
+	char *filename;
+	struct mcount_shmem_buffer *shmbuf = buf->shmem_buf;
+	struct uftrace_record *rec = (void *)shmbuf->data;
+	struct uftrace_time_index idx = {
+		.offset = offset,
+	};
+
+	/* LOST record (if any) has no timestamp */
+	if (shmbuf->size >= sizeof(*rec) && rec->type == UFTRACE_LOST)
+		rec++;
+
+	if ((void *)(rec + 1) > (void *)(shmbuf->data + shmbuf->size))
+		return;
+
+	idx.time  = rec->time;
+	idx.depth = rec->depth;
+
+	xasprintf(&filename, "%s/%d.idx", dirname, buf->tid);
+	if (append_time_index(filename, &idx) < 0)
+		pr_dbg("cannot write time index: %s: %m\n", filename);
+	free(filename);
+}
+
 static void write_buffer_file(const char *dirname, struct buf_list *buf)
 {
 	int fd;
+	off_t offset;
 	char *filename;
 	struct mcount_shmem_buffer *shmbuf = buf->shmem_buf;
 
@@ -466,38 +561,144 @@ static void write_buffer_file(const char *dirname, struct buf_list *buf)
 	if (fd < 0)
 		pr_err("open disk file");
 
+	/* a task is handled by a single writer, so it's safe */
+	offset = lseek(fd, 0, SEEK_END);
+
 	if (write_all(fd, shmbuf->data, shmbuf->size) < 0)
 		pr_err("write shmem buffer");
 
 	close(fd);
 	free(filename);
+
+	if (offset >= 0)
+		write_buffer_index(dirname, buf, offset);
+}
+
+/* connections to the host, data of a task (or cpu) goes to a same one */
+static int *send_socks;
+static int nr_send_sock;
+
+static int get_send_sock(int id)
+{
+	if (nr_send_sock == 0)
+		return -1;
+
+	return send_socks[id % nr_send_sock];
 }
 
-static void write_buffer(struct buf_list *buf, struct opts *opts, int sock)
+static void write_buffer(struct buf_list *buf, struct opts *opts,
+			 struct uftrace_send_batch *batch)
 {
 	struct mcount_shmem_buffer *shmbuf = buf->shmem_buf;
 
-	if (!opts->host)
+	/* only live --stream sends a part of the buffer */
+	if (use_live_stream)
+		live_stream_add(&lstream, buf->tid, shmbuf->data + buf->offset,
+				buf->size - buf->offset);
+	else if (!opts->host)
 		write_buffer_file(opts->dirname, buf);
 	else
-		send_trace_data(sock, buf->tid, shmbuf->data, shmbuf->size);
+		add_send_batch(batch, get_send_sock(buf->tid), buf->tid,
+			       shmbuf->data, shmbuf->size);
+
+	record_stat_write(&rstat, buf->size - buf->offset, buf->time);
 
-	shmbuf->size = 0;
+	/* the task might write to the buffer */
+	if (!buf->partial)
+		shmbuf->size = 0;
 }
 
+/* max number of tasks a writer can take at once (to send in a batch) */
+#define WRITER_MAX_TASK  32
+
 struct writer_arg {
 	struct list_head		list;
 	struct list_head		bufs;
 	struct opts			*opts;
+	struct writer_queue		*queue;
 	struct uftrace_kernel_writer	*kern;
 	struct uftrace_perf_writer	*perf;
-	int				sock;
+	struct uftrace_send_batch	batch;
 	int				idx;
-	int				tid;
+	int				nr_tid;
+	int				tids[WRITER_MAX_TASK];
 	int				nr_cpu;
 	int				cpus[];
 };
 
+static bool writer_has_task(struct writer_arg *warg, int tid)
+{
+	int i;
+
+	for (i = 0; i < warg->nr_tid; i++) {
+		if (warg->tids[i] == tid)
+			return true;
+	}
+	return false;
+}
+
+/* move bufs of the task in the queue to the writer (with write_list_lock) */
+static struct queued_task *get_queued_task(int tid)
+{
+	struct rb_node *parent = NULL;
+	struct rb_node **p = &queued_tasks.rb_node;
+	struct queued_task *qt;
+
+	while (*p) {
+		parent = *p;
+		qt = rb_entry(parent, struct queued_task, node);
+
+		if (qt->tid == tid)
+			return qt;
+
+		if (qt->tid > tid)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+
+	qt = xzalloc(sizeof(*qt));
+	qt->tid = tid;
+
+	rb_link_node(&qt->node, parent, p);
+	rb_insert_color(&qt->node, &queued_tasks);
+	return qt;
+}
+
+static void free_queued_tasks(void)
+{
+	struct rb_node *node;
+
+	while (!RB_EMPTY_ROOT(&queued_tasks)) {
+		node = rb_first(&queued_tasks);
+		rb_erase(node, &queued_tasks);
+		free(rb_entry(node, struct queued_task, node));
+	}
+}
+
+static size_t take_task_bufs(struct writer_arg *warg, struct list_head *head,
+			     int tid)
+{
+	struct buf_list *buf, *pos;
+	size_t size = 0;
+	int nr_buf = 0;
+
+	list_for_each_entry_safe(buf, pos, &warg->queue->bufs, list) {
+		/* list may have multiple buf for this task */
+		if (buf->tid == tid) {
+			list_move_tail(&buf->list, head);
+			size += buf->size - buf->offset;
+			nr_buf++;
+		}
+	}
+
+	if (nr_writer_queue > 1)
+		get_queued_task(tid)->nr_buf -= nr_buf;
+
+	warg->tids[warg->nr_tid++] = tid;
+	return size;
+}
+
 static void write_buf_list(struct list_head *buf_head, struct opts *opts,
 			   struct writer_arg *warg)
 {
@@ -505,8 +706,15 @@ static void write_buf_list(struct list_head *buf_head, struct opts *opts,
 
 	list_for_each_entry(buf, buf_head, list) {
 		struct mcount_shmem_buffer *shmbuf = buf->shmem_buf;
+		unsigned flag;
+
+		write_buffer(buf, opts, &warg->batch);
 
-		write_buffer(buf, opts, warg->sock);
+		if (buf->partial) {
+			munmap(shmbuf, opts->bufsize);
+			buf->shmem_buf = NULL;
+			continue;
+		}
 
 		/*
 		 * Now it has consumed all contents in the shmem buffer,
@@ -514,7 +722,11 @@ static void write_buf_list(struct list_head *buf_head, struct opts *opts,
 		 * This is paired with get_new_shmem_buffer().
 		 */
 		__sync_synchronize();
-		shmbuf->flag = SHMEM_FL_WRITTEN;
+		flag = __sync_lock_test_and_set(&shmbuf->flag, SHMEM_FL_WRITTEN);
+
+		/* wake up the producer waiting for the buffer (--no-loss) */
+		if (flag & SHMEM_FL_WAITING)
+			syscall(SYS_futex, &shmbuf->flag, FUTEX_WAKE, 1, NULL, NULL, 0);
 
 		munmap(shmbuf, opts->bufsize);
 		buf->shmem_buf = NULL;
@@ -542,7 +754,7 @@ static int setup_pollfd(struct pollfd **pollfd, struct writer_arg *warg,
 
 	p = xcalloc(nr_poll, sizeof(*p));
 
-	p[0].fd = thread_ctl[0];
+	p[0].fd = warg->queue->ctl[0];
 	p[0].events = POLLIN;
 	nr_poll = 1;
 
@@ -590,15 +802,16 @@ static bool handle_pollfd(struct pollfd *pollfd, struct writer_arg *warg,
 		if (i == 0)
 			check_task = true;
 		else if (trace_perf && i < (warg->nr_cpu + 1)) {
-			record_perf_data(warg->perf, warg->cpus[i - 1],
-					 warg->sock);
+			int cpu = warg->cpus[i - 1];
+
+			record_perf_data(warg->perf, cpu, get_send_sock(cpu));
 		}
 		else if (trace_kernel) {
 			int idx = i - (nr_poll - warg->nr_cpu);
+			int cpu = warg->cpus[idx];
 
-			record_kernel_trace_pipe(warg->kern,
-						 warg->cpus[idx],
-						 warg->sock);
+			record_kernel_trace_pipe(warg->kern, cpu,
+						 get_send_sock(cpu));
 		}
 	}
 
@@ -612,7 +825,7 @@ static void finish_pollfd(struct pollfd *pollfd)
 
 void *writer_thread(void *arg)
 {
-	struct buf_list *buf, *pos;
+	struct buf_list *buf;
 	struct writer_arg *warg = arg;
 	struct opts *opts = warg->opts;
 	struct pollfd *pollfd;
@@ -628,10 +841,17 @@ void *writer_thread(void *arg)
 			pr_warn("set scheduling param failed\n");
 	}
 
+	if (opts->writer_affinity) {
+		if (sched_setaffinity(0, sizeof(warg->queue->cpuset),
+				      &warg->queue->cpuset) < 0)
+			pr_warn("set writer affinity failed\n");
+	}
+
 	sigfillset(&sigset);
 	pthread_sigmask(SIG_BLOCK, &sigset, NULL);
 
 	setup_pollfd(&pollfd, warg, has_perf_event, opts->kernel);
+	init_send_batch(&warg->batch, opts->compress);
 
 	pr_dbg2("start writer thread %d\n", warg->idx);
 	while (!buf_done) {
@@ -643,7 +863,7 @@ void *writer_thread(void *arg)
 		if (!check_list)
 			continue;
 
-		if (read(thread_ctl[0], &dummy, sizeof(dummy)) < 0) {
+		if (read(warg->queue->ctl[0], &dummy, sizeof(dummy)) < 0) {
 			if (errno == EAGAIN && errno == EINTR)
 				continue;
 			/* other errors are problematic */
@@ -652,22 +872,26 @@ void *writer_thread(void *arg)
 
 		pthread_mutex_lock(&write_list_lock);
 
-		if (!list_empty(&buf_write_list)) {
+		if (!list_empty(&warg->queue->bufs)) {
+			size_t size;
+
 			/* pick first unhandled buf  */
-			buf = list_first_entry(&buf_write_list,
+			buf = list_first_entry(&warg->queue->bufs,
 					       struct buf_list, list);
-			list_move(&buf->list, &head);
+			size = take_task_bufs(warg, &head, buf->tid);
+
+			/* take more tasks to fill a batch for the host */
+			while (opts->host && size < UFTRACE_SEND_BATCH_SIZE &&
+			       warg->nr_tid < WRITER_MAX_TASK &&
+			       !list_empty(&warg->queue->bufs)) {
+				buf = list_first_entry(&warg->queue->bufs,
+						       struct buf_list, list);
+				size += take_task_bufs(warg, &head, buf->tid);
+			}
 
-			warg->tid = buf->tid;
 			list_add(&warg->list, &writer_list);
 		}
 
-		list_for_each_entry_safe(buf, pos, &buf_write_list, list) {
-			/* list may have multiple buf for this task */
-			if (buf->tid == warg->tid)
-				list_move_tail(&buf->list, &head);
-		}
-
 		pthread_mutex_unlock(&write_list_lock);
 
 		while (!list_empty(&head)) {
@@ -677,9 +901,19 @@ void *writer_thread(void *arg)
 			/* check someone sends bufs for me directly */
 			list_splice_tail_init(&warg->bufs, &head);
 
+			if (list_empty(&head) && warg->batch.nr) {
+				pthread_mutex_unlock(&write_list_lock);
+
+				/* send them before other writers can take the tasks */
+				flush_send_batch(&warg->batch);
+
+				pthread_mutex_lock(&write_list_lock);
+				list_splice_tail_init(&warg->bufs, &head);
+			}
+
 			if (list_empty(&head)) {
-				/* I'm done with this tid */
-				warg->tid = -1;
+				/* I'm done with these tasks */
+				warg->nr_tid = 0;
 				list_del_init(&warg->list);
 			}
 			pthread_mutex_unlock(&write_list_lock);
@@ -694,10 +928,14 @@ void *writer_thread(void *arg)
 	pr_dbg2("stop writer thread %d\n", warg->idx);
 
 	if (has_perf_event) {
-		for (i = 0; i < warg->nr_cpu; i++)
-			record_perf_data(warg->perf, warg->cpus[i], warg->sock);
+		for (i = 0; i < warg->nr_cpu; i++) {
+			int cpu = warg->cpus[i];
+
+			record_perf_data(warg->perf, cpu, get_send_sock(cpu));
+		}
 	}
 
+	finish_send_batch(&warg->batch);
 	finish_pollfd(pollfd);
 	free(warg);
 	return NULL;
@@ -716,10 +954,35 @@ static struct buf_list *make_write_buffer(void)
 	return buf;
 }
 
-static void copy_to_buffer(struct mcount_shmem_buffer *shm, char *sess_id)
+/* select a queue for the buf and count it (under write_list_lock) */
+static struct writer_queue *get_writer_queue(struct buf_list *buf)
+{
+	struct mcount_shmem_buffer *shm = buf->shmem_buf;
+	struct queued_task *qt;
+
+	if (nr_writer_queue == 1)
+		return &writer_queues[0];
+
+	qt = get_queued_task(buf->tid);
+
+	/* the task has pending buffers, use the same queue */
+	if (qt->nr_buf++)
+		return qt->queue;
+
+	if (shm->cpu >= 0 && shm->cpu < nr_cpu_queue_map)
+		qt->queue = &writer_queues[cpu_queue_map[shm->cpu]];
+	else
+		qt->queue = &writer_queues[buf->tid % nr_writer_queue];
+
+	return qt->queue;
+}
+
+static void copy_to_buffer(struct mcount_shmem_buffer *shm, char *sess_id,
+			   unsigned offset, unsigned size, bool partial)
 {
 	struct buf_list *buf = NULL;
 	struct writer_arg *writer;
+	int seq;
 
 	pthread_mutex_lock(&free_list_lock);
 	if (!list_empty(&buf_free_list)) {
@@ -737,29 +1000,40 @@ static void copy_to_buffer(struct mcount_shmem_buffer *shm, char *sess_id)
 	}
 
 	buf->shmem_buf = shm;
-	parse_msg_id(sess_id, NULL, &buf->tid, NULL);
+	buf->time = record_stat_now();
+	buf->offset = offset;
+	buf->size = size;
+	buf->partial = partial;
+	parse_msg_id(sess_id, NULL, &buf->tid, &seq);
+
+	if (!partial)
+		record_stat_recv(&rstat, buf->tid, seq);
+	record_stat_enqueue(&rstat);
 
 	pthread_mutex_lock(&write_list_lock);
 	/* check some writers work for this tid */
 	list_for_each_entry(writer, &writer_list, list) {
-		if (buf->tid == writer->tid) {
+		if (writer_has_task(writer, buf->tid)) {
 			/* if so, pass the buf directly */
 			list_add_tail(&buf->list, &writer->bufs);
 			break;
 		}
 	}
 	if (list_no_entry(writer, &writer_list, list)) {
+		struct writer_queue *queue = get_writer_queue(buf);
 		int kick = 1;
 
 		/* no writer is dealing with the tid */
-		list_add_tail(&buf->list, &buf_write_list);
-		if (write(thread_ctl[1], &kick, sizeof(kick)) < 0 && !buf_done)
+		list_add_tail(&buf->list, &queue->bufs);
+		if (write(queue->ctl[1], &kick, sizeof(kick)) < 0 && !buf_done)
 			pr_err("copying to buffer failed");
 	}
 	pthread_mutex_unlock(&write_list_lock);
 }
 
-static void record_mmap_file(const char *dirname, char *sess_id, int bufsize)
+/* @offset is the size of data flushed while it's recorded (live --stream) */
+static void record_mmap_file(const char *dirname, char *sess_id, int bufsize,
+			     unsigned offset)
 {
 	int fd;
 	struct shmem_list *sl;
@@ -801,9 +1075,10 @@ static void record_mmap_file(const char *dirname, char *sess_id, int bufsize)
 			}
 		}
 
-		if (shmem_buf->size) {
+		if (shmem_buf->size > offset) {
 			/* shmem_buf will be unmapped */
-			copy_to_buffer(shmem_buf, sess_id);
+			copy_to_buffer(shmem_buf, sess_id, offset,
+				       shmem_buf->size, false);
 			return;
 		}
 	}
@@ -813,24 +1088,38 @@ static void record_mmap_file(const char *dirname, char *sess_id, int bufsize)
 
 static void stop_all_writers(void)
 {
+	int i;
+
 	buf_done = true;
-	close(thread_ctl[1]);
-	thread_ctl[1] = -1;
+	for (i = 0; i < nr_writer_queue; i++) {
+		close(writer_queues[i].ctl[1]);
+		writer_queues[i].ctl[1] = -1;
+	}
 }
 
-static void record_remaining_buffer(struct opts *opts, int sock)
+static void record_remaining_buffer(struct opts *opts)
 {
 	struct buf_list *buf;
+	struct list_head *head;
+	struct uftrace_send_batch batch;
+	int i;
+
+	init_send_batch(&batch, opts->compress);
 
 	/* called after all writers gone, no lock is needed */
-	while (!list_empty(&buf_write_list)) {
-		buf = list_first_entry(&buf_write_list, struct buf_list, list);
-		write_buffer(buf, opts, sock);
-		munmap(buf->shmem_buf, opts->bufsize);
+	for (i = 0; i < nr_writer_queue; i++) {
+		head = &writer_queues[i].bufs;
 
-		list_del(&buf->list);
-		free(buf);
+		while (!list_empty(head)) {
+			buf = list_first_entry(head, struct buf_list, list);
+			write_buffer(buf, opts, &batch);
+			munmap(buf->shmem_buf, opts->bufsize);
+
+			list_del(&buf->list);
+			free(buf);
+		}
 	}
+	finish_send_batch(&batch);
 
 	while (!list_empty(&buf_free_list)) {
 		buf = list_first_entry(&buf_free_list, struct buf_list, list);
@@ -849,7 +1138,7 @@ static void flush_shmem_list(const char *dirname, int bufsize)
 		pr_dbg("flushing %s\n", sl->id);
 
 		list_del(&sl->list);
-		record_mmap_file(dirname, sl->id, bufsize);
+		record_mmap_file(dirname, sl->id, bufsize, sl->flushed);
 		free(sl);
 	}
 }
@@ -905,13 +1194,59 @@ static void flush_old_shmem(const char *dirname, int tid, int bufsize)
 			pr_dbg3("flushing %s\n", sl->id);
 
 			list_del(&sl->list);
-			record_mmap_file(dirname, sl->id, bufsize);
+			record_mmap_file(dirname, sl->id, bufsize, sl->flushed);
 			free(sl);
 			return;
 		}
 	}
 }
 
+/*
+ * A task sends a buffer only when it's full, so live --stream would
+ * see records of a task calling functions rarely too late.  Send the
+ * new data in the buffers being recorded if they're not sent in the
+ * @flush_time.  The rest of the buffer will be sent when it's done.
+ */
+static void flush_stale_shmem(int bufsize, uint64_t flush_time)
+{
+	struct shmem_list *sl;
+	struct mcount_shmem_buffer *shmem_buf;
+	uint64_t now = record_stat_now();
+	unsigned size;
+	int fd;
+
+	list_for_each_entry(sl, &shmem_list_head, list) {
+		if (now - sl->time < flush_time)
+			continue;
+
+		sl->time = now;
+
+		fd = shm_open(sl->id, O_RDONLY, 0600);
+		if (fd < 0)
+			continue;
+
+		shmem_buf = mmap(NULL, bufsize, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+
+		if (shmem_buf == MAP_FAILED)
+			continue;
+
+		/* paired with commit_shmem_buffer() in libmcount */
+		size = __atomic_load_n(&shmem_buf->size, __ATOMIC_ACQUIRE);
+		if (size <= sl->flushed) {
+			munmap(shmem_buf, bufsize);
+			continue;
+		}
+
+		pr_dbg3("flushing %s partially (%u bytes)\n", sl->id,
+			size - sl->flushed);
+
+		/* shmem_buf will be unmapped */
+		copy_to_buffer(shmem_buf, sl->id, sl->flushed, size, true);
+		sl->flushed = size;
+	}
+}
+
 static int shmem_lost_count;
 
 struct tid_list {
@@ -1027,9 +1362,13 @@ static void read_record_mmap(int pfd, const char *dirname, int bufsize)
 	struct uftrace_msg_task tmsg;
 	struct uftrace_msg_sess sess;
 	struct uftrace_msg_dlopen dmsg;
+	struct uftrace_msg_lost lmsg = {
+		.tid = -1,
+	};
 	struct dlopen_list *dlib;
 	char *exename;
-	int lost;
+	unsigned flushed;
+	int tid, seq;
 
 	if (read_all(pfd, &msg, sizeof(msg)) < 0)
 		pr_err("reading pipe failed:");
@@ -1048,8 +1387,13 @@ static void read_record_mmap(int pfd, const char *dirname, int bufsize)
 			pr_err("reading pipe failed");
 
 		sl->id[msg.len] = '\0';
+		sl->flushed = 0;
+		sl->time = record_stat_now();
 		pr_dbg2("MSG START: %s\n", sl->id);
 
+		parse_msg_id(sl->id, NULL, &tid, &seq);
+		record_stat_start(&rstat, tid, seq);
+
 		/* link to shmem_list */
 		list_add_tail(&sl->list, &shmem_list_head);
 		break;
@@ -1065,15 +1409,17 @@ static void read_record_mmap(int pfd, const char *dirname, int bufsize)
 		pr_dbg2("MSG  END : %s\n", buf);
 
 		/* remove from shmem_list */
+		flushed = 0;
 		list_for_each_entry_safe(sl, tmp, &shmem_list_head, list) {
-			if (!memcmp(sl->id, buf, SHMEM_NAME_SIZE)) {
+			if (!strcmp(sl->id, buf)) {
+				flushed = sl->flushed;
 				list_del(&sl->list);
 				free(sl);
 				break;
 			}
 		}
 
-		record_mmap_file(dirname, buf, bufsize);
+		record_mmap_file(dirname, buf, bufsize, flushed);
 		break;
 
 	case UFTRACE_MSG_TASK_START:
@@ -1097,6 +1443,8 @@ static void read_record_mmap(int pfd, const char *dirname, int bufsize)
 			add_tid_list(tmsg.pid, tmsg.tid);
 
 		write_task_info(dirname, &tmsg);
+		if (use_live_stream)
+			live_stream_task(&lstream, &tmsg, false);
 		break;
 
 	case UFTRACE_MSG_TASK_END:
@@ -1107,6 +1455,7 @@ static void read_record_mmap(int pfd, const char *dirname, int bufsize)
 			pr_err("reading pipe failed");
 
 		pr_dbg2("MSG TASK_END : %d/%d\n", tmsg.pid, tmsg.tid);
+		record_stat_task_end(&rstat, tmsg.tid);
 
 		/* mark test exited */
 		list_for_each_entry(pos, &tid_list_head, list) {
@@ -1165,6 +1514,8 @@ static void read_record_mmap(int pfd, const char *dirname, int bufsize)
 		pr_dbg2("MSG FORK2: %d/%d\n", tl->pid, tl->tid);
 
 		write_fork_info(dirname, &tmsg);
+		if (use_live_stream)
+			live_stream_task(&lstream, &tmsg, true);
 		break;
 
 	case UFTRACE_MSG_SESSION:
@@ -1185,17 +1536,23 @@ static void read_record_mmap(int pfd, const char *dirname, int bufsize)
 		pr_dbg2("MSG SESSION: %d: %s (%s)\n", sess.task.tid, exename, buf);
 
 		write_session_info(dirname, &sess, exename);
+		if (use_live_stream)
+			live_stream_session(&lstream, &sess, exename);
 		free(exename);
 		break;
 
 	case UFTRACE_MSG_LOST:
-		if (msg.len < sizeof(lost))
+		/* old libmcount sends the count only */
+		if (msg.len < sizeof(lmsg.lost) || msg.len > sizeof(lmsg))
 			pr_err_ns("invalid message length\n");
 
-		if (read_all(pfd, &lost, sizeof(lost)) < 0)
+		if (read_all(pfd, &lmsg, msg.len) < 0)
 			pr_err("reading pipe failed");
 
-		shmem_lost_count += lost;
+		pr_dbg2("MSG LOST : %d: %d\n", lmsg.tid, lmsg.lost);
+
+		shmem_lost_count += lmsg.lost;
+		record_stat_lost(&rstat, lmsg.tid, lmsg.lost);
 		break;
 
 	case UFTRACE_MSG_DLOPEN:
@@ -1217,6 +1574,8 @@ static void read_record_mmap(int pfd, const char *dirname, int bufsize)
 		list_add_tail(&dlib->list, &dlopen_libs);
 
 		write_dlopen_info(dirname, &dmsg, exename);
+		if (use_live_stream)
+			live_stream_dlopen(&lstream, &dmsg, exename);
 		/* exename will be freed with the dlib */
 		break;
 
@@ -1260,12 +1619,14 @@ static void send_map_files(int sock, const char *dirname)
 	free(map_list);
 }
 
-/* find "XXX.sym" file */
+/* find "XXX.sym" and "XXX.symbin" files */
 static int filter_sym(const struct dirent *de)
 {
 	size_t len = strlen(de->d_name);
 
-	return !strncmp(".sym", de->d_name + len - 4, 4);
+	if (len > 7 && !strncmp(".symbin", de->d_name + len - 7, 7))
+		return 1;
+	return len > 4 && !strncmp(".sym", de->d_name + len - 4, 4);
 }
 
 static void send_sym_files(int sock, const char *dirname)
@@ -1323,6 +1684,17 @@ static void send_kernel_metadata(int sock, const char *dirname)
 	send_trace_metadata(sock, dirname, "kallsyms");
 }
 
+static void send_stat_file(int sock, const char *dirname)
+{
+	char buf[PATH_MAX];
+
+	snprintf(buf, sizeof(buf), "%s/%s", dirname, RECORD_STAT_FILE);
+	if (access(buf, F_OK) != 0)
+		return;
+
+	send_trace_metadata(sock, dirname, RECORD_STAT_FILE);
+}
+
 static void send_event_file(int sock, const char *dirname)
 {
 	char buf[PATH_MAX];
@@ -1555,6 +1927,218 @@ struct writer_data {
 	struct uftrace_perf_writer	perf;
 };
 
+#define NUMA_NODE_DIR  "/sys/devices/system/node"
+
+/* find "nodeN" directory */
+static int filter_numa_node(const struct dirent *de)
+{
+	int node;
+
+	return sscanf(de->d_name, "node%d", &node) == 1;
+}
+
+static int read_numa_node_cpus(const char *name, int *cpus, int max)
+{
+	FILE *fp;
+	char *filename = NULL;
+	char *line = NULL;
+	size_t len = 0;
+	int nr = -1;
+
+	xasprintf(&filename, "%s/%s/cpulist", NUMA_NODE_DIR, name);
+
+	fp = fopen(filename, "r");
+	if (fp == NULL)
+		goto out;
+
+	if (getline(&line, &len, fp) > 0)
+		nr = parse_cpulist(line, cpus, max);
+
+	free(line);
+	fclose(fp);
+out:
+	free(filename);
+	return nr;
+}
+
+static void setup_numa_writer_queues(int nr_cpu)
+{
+	struct dirent **node_list;
+	int *cpus = xcalloc(nr_cpu, sizeof(*cpus));
+	int i, k, nodes;
+
+	nodes = scandir(NUMA_NODE_DIR, &node_list, filter_numa_node, versionsort);
+	if (nodes < 0) {
+		pr_dbg("cannot read NUMA topology: %m\n");
+		nodes = 0;
+	}
+
+	cpu_queue_map = xcalloc(nr_cpu, sizeof(*cpu_queue_map));
+	nr_cpu_queue_map = nr_cpu;
+
+	for (i = 0; i < nodes; i++) {
+		struct writer_queue *queue;
+		int nr;
+
+		nr = read_numa_node_cpus(node_list[i]->d_name, cpus, nr_cpu);
+		if (nr > 0) {
+			writer_queues = xrealloc(writer_queues,
+						 (nr_writer_queue + 1) * sizeof(*queue));
+			queue = &writer_queues[nr_writer_queue];
+
+			sscanf(node_list[i]->d_name, "node%d", &queue->node);
+			queue->nr_cpu = 0;
+			queue->cpus = xcalloc(nr, sizeof(*queue->cpus));
+			CPU_ZERO(&queue->cpuset);
+
+			for (k = 0; k < nr; k++) {
+				if (cpus[k] >= nr_cpu)
+					continue;
+
+				queue->cpus[queue->nr_cpu++] = cpus[k];
+				cpu_queue_map[cpus[k]] = nr_writer_queue;
+				CPU_SET(cpus[k], &queue->cpuset);
+			}
+
+			pr_dbg2("NUMA node %d has %d cpus\n",
+				queue->node, queue->nr_cpu);
+			nr_writer_queue++;
+		}
+		free(node_list[i]);
+	}
+
+	if (nodes > 0)
+		free(node_list);
+	free(cpus);
+}
+
+static void setup_writer_queues(struct opts *opts)
+{
+	int i;
+
+	nr_writer_queue = 0;
+
+	if (opts->writer_affinity)
+		setup_numa_writer_queues(sysconf(_SC_NPROCESSORS_CONF));
+
+	if (nr_writer_queue <= 1) {
+		if (opts->writer_affinity)
+			pr_dbg("single NUMA node: writer affinity is not used\n");
+
+		opts->writer_affinity = false;
+		for (i = 0; i < nr_writer_queue; i++)
+			free(writer_queues[i].cpus);
+
+		free(cpu_queue_map);
+		cpu_queue_map = NULL;
+		nr_cpu_queue_map = 0;
+
+		writer_queues = xrealloc(writer_queues, sizeof(*writer_queues));
+		writer_queues[0].node = -1;
+		writer_queues[0].nr_cpu = 0;
+		writer_queues[0].cpus = NULL;
+		nr_writer_queue = 1;
+	}
+	else if (opts->nr_thread < nr_writer_queue) {
+		/* needs at least one writer per node */
+		opts->nr_thread = nr_writer_queue;
+	}
+
+	for (i = 0; i < nr_writer_queue; i++) {
+		INIT_LIST_HEAD(&writer_queues[i].bufs);
+
+		if (pipe(writer_queues[i].ctl) < 0)
+			pr_err("cannot create a pipe for writer thread");
+	}
+}
+
+static void finish_writer_queues(void)
+{
+	int i;
+
+	for (i = 0; i < nr_writer_queue; i++) {
+		close(writer_queues[i].ctl[0]);
+		free(writer_queues[i].cpus);
+	}
+
+	free(writer_queues);
+	writer_queues = NULL;
+	nr_writer_queue = 0;
+
+	free(cpu_queue_map);
+	cpu_queue_map = NULL;
+	nr_cpu_queue_map = 0;
+
+	free_queued_tasks();
+}
+
+/* returns the main connection which is used to send metadata */
+static int setup_send_socks(struct opts *opts)
+{
+	int i;
+
+#ifndef HAVE_LIBZ
+	if (opts->compress) {
+		pr_warn("compression is not supported, ignoring...\n");
+		opts->compress = false;
+	}
+#endif
+
+	nr_send_sock = opts->nr_conn;
+	send_socks = xcalloc(nr_send_sock, sizeof(*send_socks));
+
+	send_socks[0] = setup_client_socket(opts);
+	send_trace_dir_name(send_socks[0], opts->dirname);
+
+	if (nr_send_sock == 1)
+		return send_socks[0];
+
+	pr_dbg("sending data using %d connections\n", nr_send_sock);
+	send_trace_nr_conn(send_socks[0], nr_send_sock);
+
+	for (i = 1; i < nr_send_sock; i++) {
+		send_socks[i] = setup_client_socket(opts);
+		send_trace_data_conn(send_socks[i], opts->dirname);
+	}
+
+	return send_socks[0];
+}
+
+static void finish_send_socks(void)
+{
+	int i;
+
+	for (i = 0; i < nr_send_sock; i++) {
+		send_trace_end(send_socks[i]);
+		close(send_socks[i]);
+	}
+
+	free(send_socks);
+	send_socks = NULL;
+	nr_send_sock = 0;
+}
+
+/* distribute per-cpu readers to writers in the same NUMA node */
+static int get_node_writer_cpus(struct writer_queue *queue, int idx,
+				int nr_thread, int nr_cpu, int *cpus)
+{
+	int q = queue - writer_queues;
+	int nr_node_writer = (nr_thread - q + nr_writer_queue - 1) / nr_writer_queue;
+	int rank = idx / nr_writer_queue;
+	int i, nr = 0;
+
+	for (i = rank; i < queue->nr_cpu; i += nr_node_writer) {
+		if (queue->cpus[i] >= nr_cpu)
+			continue;
+
+		if (cpus)
+			cpus[nr] = queue->cpus[i];
+		nr++;
+	}
+
+	return nr;
+}
+
 static void setup_writers(struct writer_data *wd, struct opts *opts)
 {
 	struct uftrace_kernel_writer *kernel = &wd->kernel;
@@ -1569,10 +2153,8 @@ static void setup_writers(struct writer_data *wd, struct opts *opts)
 	sa.sa_flags = SA_NOCLDSTOP | SA_SIGINFO;
 	sigaction(SIGCHLD, &sa, NULL);
 
-	if (opts->host) {
-		wd->sock = setup_client_socket(opts);
-		send_trace_dir_name(wd->sock, opts->dirname);
-	}
+	if (opts->host)
+		wd->sock = setup_send_socks(opts);
 	else
 		wd->sock = -1;
 
@@ -1626,11 +2208,10 @@ static void setup_writers(struct writer_data *wd, struct opts *opts)
 	else
 		has_perf_event = true;  /* for task/comm events */
 
+	setup_writer_queues(opts);
+
 	pr_dbg("creating %d thread(s) for recording\n", opts->nr_thread);
 	wd->writers = xmalloc(opts->nr_thread * sizeof(*wd->writers));
-
-	if (pipe(thread_ctl) < 0)
-		pr_err("cannot create an eventfd for writer thread");
 }
 
 static void start_tracing(struct writer_data *wd, struct opts *opts, int ready_fd)
@@ -1647,20 +2228,34 @@ static void start_tracing(struct writer_data *wd, struct opts *opts, int ready_f
 
 	for (i = 0; i < opts->nr_thread; i++) {
 		struct writer_arg *warg;
+		struct writer_queue *queue = &writer_queues[i % nr_writer_queue];
 		int cpu_per_thread = DIV_ROUND_UP(wd->nr_cpu, opts->nr_thread);
-		size_t sizeof_warg = sizeof(*warg) + sizeof(int) * cpu_per_thread;
+		size_t sizeof_warg;
+
+		if (opts->writer_affinity) {
+			cpu_per_thread = get_node_writer_cpus(queue, i,
+							      opts->nr_thread,
+							      wd->nr_cpu, NULL);
+		}
+		sizeof_warg = sizeof(*warg) + sizeof(int) * cpu_per_thread;
 
 		warg = xzalloc(sizeof_warg);
 		warg->opts = opts;
+		warg->queue = queue;
 		warg->idx  = i;
-		warg->sock = wd->sock;
 		warg->kern = &wd->kernel;
 		warg->perf = &wd->perf;
 		warg->nr_cpu = 0;
 		INIT_LIST_HEAD(&warg->list);
 		INIT_LIST_HEAD(&warg->bufs);
 
-		if (opts->kernel || has_perf_event) {
+		if ((opts->kernel || has_perf_event) && opts->writer_affinity) {
+			warg->nr_cpu = get_node_writer_cpus(queue, i,
+							    opts->nr_thread,
+							    wd->nr_cpu,
+							    warg->cpus);
+		}
+		else if (opts->kernel || has_perf_event) {
 			warg->nr_cpu = cpu_per_thread;
 
 			for (k = 0; k < cpu_per_thread; k++) {
@@ -1770,10 +2365,13 @@ static void finish_writers(struct writer_data *wd, struct opts *opts)
 	for (i = 0; i < opts->nr_thread; i++)
 		pthread_join(wd->writers[i], NULL);
 	free(wd->writers);
-	close(thread_ctl[0]);
 
 	flush_shmem_list(opts->dirname, opts->bufsize);
-	record_remaining_buffer(opts, wd->sock);
+	record_remaining_buffer(opts);
+	record_stat_finish(&rstat);
+	if (use_live_stream)
+		live_stream_finish(&lstream);
+	finish_writer_queues();
 	unlink_shmem_list();
 	free_tid_list();
 
@@ -1787,8 +2385,9 @@ static void write_symbol_files(struct writer_data *wd, struct opts *opts)
 {
 	struct dlopen_list *dlib, *tmp;
 
-	/* main executable and shared libraries */
-	save_session_symbols(opts);
+	/* symbols were already used by the live stream */
+	if (!use_live_stream)
+		save_session_symbols(opts);
 
 	/* dynamically loaded libraries using dlopen() */
 	list_for_each_entry_safe(dlib, tmp, &dlopen_libs, list) {
@@ -1796,8 +2395,10 @@ static void write_symbol_files(struct writer_data *wd, struct opts *opts)
 			.loaded = false,
 		};
 
-		load_symtabs(&dlib_symtabs, opts->dirname, dlib->libname);
-		save_symbol_file(&dlib_symtabs, opts->dirname, dlib->libname);
+		if (!use_live_stream) {
+			load_symtabs(&dlib_symtabs, opts->dirname, dlib->libname);
+			save_symbol_file(&dlib_symtabs, opts->dirname, dlib->libname);
+		}
 
 		list_del(&dlib->list);
 
@@ -1812,14 +2413,14 @@ static void write_symbol_files(struct writer_data *wd, struct opts *opts)
 		send_map_files(sock, opts->dirname);
 		send_sym_files(sock, opts->dirname);
 		send_info_file(sock, opts->dirname);
+		send_stat_file(sock, opts->dirname);
 
 		if (opts->kernel)
 			send_kernel_metadata(sock, opts->dirname);
 		if (opts->event)
 			send_event_file(sock, opts->dirname);
 
-		send_trace_end(sock);
-		close(sock);
+		finish_send_socks();
 
 		remove_directory(opts->dirname);
 	}
@@ -1836,6 +2437,10 @@ int do_main_loop(int pfd[2], int ready, struct opts *opts, int pid)
 	wd.pipefd = pfd[0];
 	close(pfd[1]);
 
+	record_stat_init(&rstat, opts->dirname, opts->stat);
+	if (use_live_stream)
+		live_stream_init(&lstream, opts);
+
 	setup_writers(&wd, opts);
 	start_tracing(&wd, opts, ready);
 	close(ready);
@@ -1845,8 +2450,22 @@ int do_main_loop(int pfd[2], int ready, struct opts *opts, int pid)
 			.fd = pfd[0],
 			.events = POLLIN,
 		};
+		int timeout = record_stat_update(&rstat);
+
+		if (use_live_stream) {
+			int stream_timeout;
 
-		ret = poll(&pollfd, 1, 1000);
+			/* so that it can be printed in the window */
+			flush_stale_shmem(opts->bufsize,
+					  opts->stream_window / 2);
+
+			stream_timeout = live_stream_update(&lstream);
+
+			if (timeout > stream_timeout)
+				timeout = stream_timeout;
+		}
+
+		ret = poll(&pollfd, 1, timeout);
 		if (ret < 0 && errno == EINTR)
 			continue;
 		if (ret < 0)
@@ -1910,11 +2529,20 @@ int command_record(int argc, char *argv[], struct opts *opts)
 	if (opts->script_file)
 		parse_script_opt(opts);
 
+	if (opts->host == NULL && (opts->nr_conn > 1 || opts->compress)) {
+		pr_warn("--num-conn and --compress need -H option, ignoring...\n");
+		opts->nr_conn = 1;
+		opts->compress = false;
+	}
+
 	check_binary(opts);
 
 	has_perf_event = check_linux_schedule_event(opts->event,
 						    opts->patt_type);
 
+	/* only the live command can print the records */
+	use_live_stream = opts->stream && opts->mode == UFTRACE_MODE_LIVE;
+
 	fflush(stdout);
 
 	efd = eventfd(0, EFD_CLOEXEC | EFD_SEMAPHORE);
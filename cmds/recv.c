@@ -13,18 +13,116 @@
 #include <sys/stat.h>
 #include <errno.h>
 #include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <pthread.h>
+
+#ifdef HAVE_LIBZ
+# include <zlib.h>
+#endif
 
 #include "uftrace.h"
 #include "utils/utils.h"
 #include "utils/list.h"
 
+/* a recording which can be sent over multiple connections */
+struct recv_session {
+	struct list_head	list;
+	char			*dirname;
+	int			refcnt;
+	int			nr_conn;
+	int			nr_end;
+	bool			main_end;
+	bool			done;
+};
+
+enum recv_state {
+	RECV_MSG_HEADER,
+	RECV_MSG_BODY,
+	RECV_MSG_PREFIX,	/* id of data, or batch (buffer) header */
+	RECV_MSG_SPLICE,	/* data to be moved to the pipe */
+	RECV_MSG_INVALID,	/* client sent a bad message, to be dropped */
+};
+
+/* an open file of the client, recently used one comes first */
+struct client_file {
+	struct list_head	list;
+	char			*name;
+	int			fd;
+};
+
+#define CLIENT_FILE_MAX  64
+
 struct client_data {
 	struct list_head	list;
 	int			sock;
 	char			*dirname;
+	struct recv_session	*sess;
+	bool			main_conn;
+	bool			paused;
+	bool			dropped;	/* ignore remaining works */
+	/* message being read (by the main thread) */
+	enum recv_state		state;
+	struct uftrace_msg	msg;
+	size_t			pos;
+	void			*body;
+	/* data message being spliced (by the main thread) */
+	char			prefix[sizeof(struct uftrace_msg_batch)];
+	size_t			prefix_len;
+	size_t			msg_left;
+	size_t			remain;
+	int			data_type;
+	int			data_id;
+	unsigned		batch_nr;
+	bool			in_batch;
+	int			pipe[2];
+	size_t			pipe_size;
+	/* messages queued to the worker */
+	struct recv_worker	*worker;
+	size_t			pending;
+	size_t			piped;
+	/* files written by the worker */
+	struct list_head	files;
+	int			nr_files;
+};
+
+/* a complete message (or spliced data) to be handled by a worker */
+struct recv_work {
+	struct list_head	list;
+	struct client_data	*client;
+	int			type;
+	int			len;
+	void			*body;
+	int			id;
+	bool			spliced;
+};
+
+/* pseudo message type to release a closed client */
+#define RECV_WORK_CLOSE  0
+
+struct recv_worker {
+	pthread_t		th;
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	struct list_head	works;
+	bool			done;
+	int			efd;
+	struct opts		*opts;
 };
 
+/* stop reading a client if it has this many bytes pending in the worker */
+#define RECV_PENDING_MAX  (64 * 1024 * 1024)
+/* max bytes to read from a client at once, so that others are not starved */
+#define RECV_READ_BUDGET  (4 * 1024 * 1024)
+/* size of pipe to splice data from a client */
+#define RECV_PIPE_SIZE  (1024 * 1024)
+
 static LIST_HEAD(client_list);
+static LIST_HEAD(session_list);
+static pthread_mutex_t session_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct recv_worker *workers;
+static int nr_workers;
+static int next_worker;
 
 static int server_socket(struct opts *opts)
 {
@@ -74,6 +172,25 @@ static int signal_fd(struct opts *opts)
 }
 
 /* client (record) side API */
+
+/* writers can send messages to a same socket concurrently */
+#define SEND_LOCK_NR  16
+static pthread_mutex_t send_lock[SEND_LOCK_NR] = {
+	[0 ... SEND_LOCK_NR - 1] = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static int send_msg(int sock, struct iovec *iov, int cnt)
+{
+	pthread_mutex_t *lock = &send_lock[sock % SEND_LOCK_NR];
+	int ret;
+
+	pthread_mutex_lock(lock);
+	ret = writev_all(sock, iov, cnt);
+	pthread_mutex_unlock(lock);
+
+	return ret;
+}
+
 int setup_client_socket(struct opts *opts)
 {
 	struct sockaddr_in addr = {
@@ -102,12 +219,12 @@ int setup_client_socket(struct opts *opts)
 	return sock;
 }
 
-void send_trace_dir_name(int sock, char *name)
+static void send_trace_name(int sock, int type, char *name)
 {
 	ssize_t len = strlen(name);
 	struct uftrace_msg msg = {
 		.magic = htons(UFTRACE_MSG_MAGIC),
-		.type  = htons(UFTRACE_MSG_SEND_DIR_NAME),
+		.type  = htons(type),
 		.len   = htonl(len),
 	};
 	struct iovec iov[] = {
@@ -115,11 +232,42 @@ void send_trace_dir_name(int sock, char *name)
 		{ .iov_base = name, .iov_len = len, },
 	};
 
-	pr_dbg2("send UFTRACE_MSG_SEND_HDR\n");
-	if (writev_all(sock, iov, ARRAY_SIZE(iov)) < 0)
+	if (send_msg(sock, iov, ARRAY_SIZE(iov)) < 0)
 		pr_err("send header failed");
 }
 
+void send_trace_dir_name(int sock, char *name)
+{
+	pr_dbg2("send UFTRACE_MSG_SEND_HDR\n");
+	send_trace_name(sock, UFTRACE_MSG_SEND_DIR_NAME, name);
+}
+
+/* tell the number of connections, should be sent to the main connection */
+void send_trace_nr_conn(int sock, int nr)
+{
+	int32_t msg_nr = htonl(nr);
+	struct uftrace_msg msg = {
+		.magic = htons(UFTRACE_MSG_MAGIC),
+		.type  = htons(UFTRACE_MSG_SEND_NR_CONN),
+		.len   = htonl(sizeof(msg_nr)),
+	};
+	struct iovec iov[] = {
+		{ .iov_base = &msg,    .iov_len = sizeof(msg), },
+		{ .iov_base = &msg_nr, .iov_len = sizeof(msg_nr), },
+	};
+
+	pr_dbg2("send UFTRACE_MSG_SEND_NR_CONN\n");
+	if (send_msg(sock, iov, ARRAY_SIZE(iov)) < 0)
+		pr_err("send connection count failed");
+}
+
+/* identify an additional connection for the (main) data directory */
+void send_trace_data_conn(int sock, char *name)
+{
+	pr_dbg2("send UFTRACE_MSG_SEND_DATA_CONN\n");
+	send_trace_name(sock, UFTRACE_MSG_SEND_DATA_CONN, name);
+}
+
 void send_trace_data(int sock, int tid, void *data, size_t len)
 {
 	int32_t msg_tid = htonl(tid);
@@ -135,7 +283,7 @@ void send_trace_data(int sock, int tid, void *data, size_t len)
 	};
 
 	pr_dbg2("send UFTRACE_MSG_SEND_DATA\n");
-	if (writev_all(sock, iov, ARRAY_SIZE(iov)) < 0)
+	if (send_msg(sock, iov, ARRAY_SIZE(iov)) < 0)
 		pr_err("send data failed");
 }
 
@@ -154,7 +302,7 @@ void send_trace_kernel_data(int sock, int cpu, void *data, size_t len)
 	};
 
 	pr_dbg2("send UFTRACE_MSG_SEND_KERNEL_DATA\n");
-	if (writev_all(sock, iov, ARRAY_SIZE(iov)) < 0)
+	if (send_msg(sock, iov, ARRAY_SIZE(iov)) < 0)
 		pr_err("send kernel data failed");
 }
 
@@ -173,7 +321,7 @@ void send_trace_perf_data(int sock, int cpu, void *data, size_t len)
 	};
 
 	pr_dbg2("send UFTRACE_MSG_SEND_PERF_DATA\n");
-	if (writev_all(sock, iov, ARRAY_SIZE(iov)) < 0)
+	if (send_msg(sock, iov, ARRAY_SIZE(iov)) < 0)
 		pr_err("send kernel data failed");
 }
 
@@ -219,7 +367,7 @@ void send_trace_metadata(int sock, const char *dirname, char *filename)
 	namelen = htonl(namelen);
 
 	pr_dbg2("send UFTRACE_MSG_SEND_META_DATA: %s\n", filename);
-	if (writev_all(sock, iov, ARRAY_SIZE(iov)) < 0)
+	if (send_msg(sock, iov, ARRAY_SIZE(iov)) < 0)
 		pr_err("send metadata failed");
 
 	free(pathname);
@@ -248,7 +396,7 @@ void send_trace_info(int sock, struct uftrace_file_header *hdr,
 	hdr->max_stack   = htons(hdr->max_stack);
 
 	pr_dbg2("send UFTRACE_MSG_SEND_INFO\n");
-	if (writev_all(sock, iov, ARRAY_SIZE(iov)) < 0)
+	if (send_msg(sock, iov, ARRAY_SIZE(iov)) < 0)
 		pr_err("send metadata failed");
 }
 
@@ -259,11 +407,123 @@ void send_trace_end(int sock)
 		.type  = htons(UFTRACE_MSG_SEND_END),
 	};
 
+	struct iovec iov = {
+		.iov_base = &msg, .iov_len = sizeof(msg),
+	};
+
 	pr_dbg2("send UFTRACE_MSG_SEND_END\n");
-	if (write_all(sock, &msg, sizeof(msg)) < 0)
+	if (send_msg(sock, &iov, 1) < 0)
 		pr_err("send end failed");
 }
 
+void init_send_batch(struct uftrace_send_batch *batch, bool compress)
+{
+	memset(batch, 0, sizeof(*batch));
+	batch->sock = -1;
+	batch->compress = compress;
+}
+
+void add_send_batch(struct uftrace_send_batch *batch, int sock, int tid,
+		    void *data, size_t len)
+{
+	struct uftrace_msg_batch_buf *bb;
+	size_t size = sizeof(*bb) + len;
+
+	/* a batch goes to a single socket */
+	if (batch->nr && (batch->sock != sock ||
+			  batch->size + size > UFTRACE_SEND_BATCH_SIZE))
+		flush_send_batch(batch);
+
+	if (batch->size + size > batch->alloc) {
+		batch->alloc = ALIGN(batch->size + size, UFTRACE_SEND_BATCH_SIZE);
+		batch->buf = xrealloc(batch->buf, batch->alloc);
+	}
+
+	bb = batch->buf + batch->size;
+	bb->tid = htonl(tid);
+	bb->len = htonl(len);
+	memcpy(bb->data, data, len);
+
+	batch->sock  = sock;
+	batch->size += size;
+	batch->nr++;
+}
+
+#ifdef HAVE_LIBZ
+static void *compress_batch(struct uftrace_send_batch *batch, size_t *len)
+{
+	uLongf zlen = compressBound(batch->size);
+
+	if (zlen > batch->zalloc) {
+		batch->zalloc = zlen;
+		batch->zbuf = xrealloc(batch->zbuf, zlen);
+	}
+
+	if (compress2(batch->zbuf, &zlen, batch->buf, batch->size,
+		      Z_BEST_SPEED) != Z_OK || zlen >= batch->size)
+		return NULL;
+
+	*len = zlen;
+	return batch->zbuf;
+}
+#else
+static void *compress_batch(struct uftrace_send_batch *batch, size_t *len)
+{
+	return NULL;
+}
+#endif
+
+void flush_send_batch(struct uftrace_send_batch *batch)
+{
+	struct uftrace_msg_batch hdr = {
+		.nr   = htonl(batch->nr),
+		.size = htonl(batch->size),
+	};
+	struct uftrace_msg msg = {
+		.magic = htons(UFTRACE_MSG_MAGIC),
+		.type  = htons(UFTRACE_MSG_SEND_DATA_BATCH),
+	};
+	struct iovec iov[] = {
+		{ .iov_base = &msg, .iov_len = sizeof(msg), },
+		{ .iov_base = &hdr, .iov_len = sizeof(hdr), },
+		{ .iov_base = batch->buf, .iov_len = batch->size, },
+	};
+
+	if (batch->nr == 0)
+		return;
+
+	/* the receiver would reject a too large batch to uncompress */
+	if (batch->compress && batch->size <= UFTRACE_BATCH_MAX_SIZE) {
+		size_t zlen;
+		void *zbuf = compress_batch(batch, &zlen);
+
+		if (zbuf) {
+			hdr.flags = htonl(UFTRACE_BATCH_COMPRESSED);
+			iov[2].iov_base = zbuf;
+			iov[2].iov_len  = zlen;
+		}
+	}
+
+	msg.len = htonl(sizeof(hdr) + iov[2].iov_len);
+
+	pr_dbg2("send UFTRACE_MSG_SEND_DATA_BATCH: %d buffers\n", batch->nr);
+	if (send_msg(batch->sock, iov, ARRAY_SIZE(iov)) < 0)
+		pr_err("send data failed");
+
+	batch->nr = 0;
+	batch->size = 0;
+}
+
+void finish_send_batch(struct uftrace_send_batch *batch)
+{
+	flush_send_batch(batch);
+
+	free(batch->buf);
+	free(batch->zbuf);
+	batch->buf = NULL;
+	batch->zbuf = NULL;
+}
+
 
 /* server (recv) side API */
 static struct client_data *find_client(int sock)
@@ -279,18 +539,64 @@ static struct client_data *find_client(int sock)
 
 #define O_CLIENT_FLAGS  (O_WRONLY | O_APPEND | O_CREAT)
 
-static void write_client_file(struct client_data *c, char *filename, int nr, ...)
+/* keep files open during the connection, rather than reopen for each message */
+static int get_client_file(struct client_data *c, char *filename)
 {
-	int i, fd;
-	va_list ap;
-	struct iovec iov[nr];
+	struct client_file *cf;
 	char buf[PATH_MAX];
+	int fd;
+
+	list_for_each_entry(cf, &c->files, list) {
+		if (!strcmp(cf->name, filename)) {
+			list_move(&cf->list, &c->files);
+			return cf->fd;
+		}
+	}
+
+	if (c->nr_files == CLIENT_FILE_MAX) {
+		cf = list_last_entry(&c->files, struct client_file, list);
+		list_del(&cf->list);
+		close(cf->fd);
+		free(cf->name);
+		free(cf);
+		c->nr_files--;
+	}
 
 	snprintf(buf, sizeof(buf), "%s/%s", c->dirname, filename);
 	fd = open(buf, O_CLIENT_FLAGS, 0644);
 	if (fd < 0)
 		pr_err("file open failed: %s", buf);
 
+	cf = xmalloc(sizeof(*cf));
+	cf->name = xstrdup(filename);
+	cf->fd = fd;
+	list_add(&cf->list, &c->files);
+	c->nr_files++;
+
+	return fd;
+}
+
+static void close_client_files(struct client_data *c)
+{
+	struct client_file *cf, *tmp;
+
+	list_for_each_entry_safe(cf, tmp, &c->files, list) {
+		list_del(&cf->list);
+		close(cf->fd);
+		free(cf->name);
+		free(cf);
+	}
+	c->nr_files = 0;
+}
+
+static void write_client_file(struct client_data *c, char *filename, int nr, ...)
+{
+	int i, fd;
+	va_list ap;
+	struct iovec iov[nr];
+
+	fd = get_client_file(c, filename);
+
 	va_start(ap, nr);
 	for (i = 0; i < nr; i++) {
 		iov[i].iov_base = va_arg(ap, void *);
@@ -299,165 +605,328 @@ static void write_client_file(struct client_data *c, char *filename, int nr, ...
 	va_end(ap);
 
 	if (writev_all(fd, iov, nr) < 0)
-		pr_err("write client data failed on %s", buf);
+		pr_err("write client data failed on %s/%s", c->dirname, filename);
+}
 
-	close(fd);
+/* move data in the pipe to the file */
+static void splice_client_file(struct client_data *c, int fd, size_t len)
+{
+	char buf[4096];
+	ssize_t n;
+
+	while (len > 0) {
+		n = splice(c->pipe[0], NULL, fd, NULL, len, SPLICE_F_MOVE);
+		if (n < 0 && errno == EINTR)
+			continue;
+
+		/* the file system might not support splice */
+		if (n < 0 && errno == EINVAL) {
+			n = read(c->pipe[0], buf, len < sizeof(buf) ? len : sizeof(buf));
+			if (n > 0 && write_all(fd, buf, n) < 0)
+				n = -1;
+		}
+
+		if (n <= 0)
+			pr_err("write client data failed on %s", c->dirname);
+
+		len -= n;
+	}
 }
 
-static void recv_trace_dir_name(int sock, int len)
+/* throw away data in the pipe, so that the main thread is not blocked */
+static void discard_client_pipe(struct client_data *c, size_t len)
 {
-	char dirname[len + 1];
-	struct client_data *client;
+	char buf[4096];
+	ssize_t n;
 
-	if (read_all(sock, dirname, len) < 0)
-		pr_err("recv header failed");
-	dirname[len] = '\0';
+	while (len > 0) {
+		n = read(c->pipe[0], buf, len < sizeof(buf) ? len : sizeof(buf));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
 
-	client = xmalloc(sizeof(*client));
+		len -= n;
+	}
+}
 
-	client->sock = sock;
-	client->dirname = xstrdup(dirname);
-	INIT_LIST_HEAD(&client->list);
+static char *client_data_name(int type, int id)
+{
+	char *filename = NULL;
+
+	switch (type) {
+	case UFTRACE_MSG_SEND_KERNEL_DATA:
+		xasprintf(&filename, "kernel-cpu%d.dat", id);
+		break;
+	case UFTRACE_MSG_SEND_PERF_DATA:
+		xasprintf(&filename, "perf-cpu%d.dat", id);
+		break;
+	default:
+		xasprintf(&filename, "%d.dat", id);
+		break;
+	}
+	return filename;
+}
+
+static struct recv_session *get_session(char *dirname)
+{
+	struct recv_session *sess;
+
+	pthread_mutex_lock(&session_lock);
+
+	list_for_each_entry(sess, &session_list, list) {
+		if (!sess->done && !strcmp(sess->dirname, dirname))
+			goto out;
+	}
+
+	sess = xzalloc(sizeof(*sess));
+	sess->dirname = xstrdup(dirname);
+	sess->nr_conn = 1;
+	list_add(&sess->list, &session_list);
 
 	create_directory(dirname);
 	pr_dbg3("create directory: %s\n", dirname);
 
-	list_add(&client->list, &client_list);
+out:
+	sess->refcnt++;
+	pthread_mutex_unlock(&session_lock);
+	return sess;
 }
 
-static void recv_trace_data(int sock, int len)
+static void put_session(struct recv_session *sess)
+{
+	pthread_mutex_lock(&session_lock);
+
+	if (--sess->refcnt == 0) {
+		list_del(&sess->list);
+		free(sess->dirname);
+		free(sess);
+	}
+
+	pthread_mutex_unlock(&session_lock);
+}
+
+static int check_client(struct client_data *client)
+{
+	if (client->dirname == NULL) {
+		pr_warn("no client on this socket\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int recv_trace_dir_name(struct client_data *client, void *buf, int len,
+			       bool main_conn)
+{
+	char dirname[len + 1];
+
+	if (client->sess) {
+		pr_dbg("ignore duplicate directory name\n");
+		return 0;
+	}
+
+	memcpy(dirname, buf, len);
+	dirname[len] = '\0';
+
+	client->sess = get_session(dirname);
+	client->dirname = xstrdup(dirname);
+	client->main_conn = main_conn;
+	return 0;
+}
+
+static int recv_trace_nr_conn(struct client_data *client, void *buf, int len)
+{
+	int32_t nr;
+
+	if (check_client(client) < 0)
+		return -1;
+
+	memcpy(&nr, buf, sizeof(nr));
+	nr = ntohl(nr);
+
+	pthread_mutex_lock(&session_lock);
+	client->sess->nr_conn = nr;
+	pthread_mutex_unlock(&session_lock);
+
+	pr_dbg("%s: receiving data from %d connections\n", client->dirname, nr);
+	return 0;
+}
+
+static int recv_trace_data(struct client_data *client, void *buf, int len)
 {
-	struct client_data *client;
 	int32_t tid;
 	char *filename = NULL;
-	void *buffer;
 
-	client = find_client(sock);
-	if (client == NULL)
-		pr_err_ns("no client on this socket\n");
+	if (check_client(client) < 0)
+		return -1;
 
-	if (read_all(sock, &tid, sizeof(tid)) < 0)
-		pr_err("recv tid failed");
+	memcpy(&tid, buf, sizeof(tid));
 	tid = ntohl(tid);
 
-	xasprintf(&filename, "%d.dat", tid);
+	filename = client_data_name(UFTRACE_MSG_SEND_DATA, tid);
 
 	len -= sizeof(tid);
-	buffer = xmalloc(len);
-
-	if (read_all(sock, buffer, len) < 0)
-		pr_err("recv buffer failed");
+	write_client_file(client, filename, 1, buf + sizeof(tid), len);
 
-	write_client_file(client, filename, 1, buffer, len);
-
-	free(buffer);
 	free(filename);
+	return 0;
 }
 
-static void recv_trace_kernel_data(int sock, int len)
+static int recv_trace_data_batch(struct client_data *client, void *buf, int len)
 {
-	struct client_data *client;
-	int32_t cpu;
+	struct uftrace_msg_batch hdr;
+	struct uftrace_msg_batch_buf *bb;
+	void *data = buf + sizeof(hdr);
+	void *raw = NULL;
 	char *filename = NULL;
-	void *buffer;
+	size_t pos = 0;
+	unsigned i;
+	int ret = -1;
 
-	client = find_client(sock);
-	if (client == NULL)
-		pr_err_ns("no client on this socket\n");
+	if (check_client(client) < 0)
+		return -1;
 
-	if (read_all(sock, &cpu, sizeof(cpu)) < 0)
-		pr_err("recv cpu failed");
-	cpu = ntohl(cpu);
+	memcpy(&hdr, buf, sizeof(hdr));
+	hdr.nr    = ntohl(hdr.nr);
+	hdr.flags = ntohl(hdr.flags);
+	hdr.size  = ntohl(hdr.size);
+	len -= sizeof(hdr);
 
-	xasprintf(&filename, "kernel-cpu%d.dat", cpu);
+	if (hdr.flags & UFTRACE_BATCH_COMPRESSED) {
+#ifdef HAVE_LIBZ
+		uLongf size = hdr.size;
 
-	len -= sizeof(cpu);
-	buffer = xmalloc(len);
+		/* don't trust the size before allocating it */
+		if (hdr.size > UFTRACE_BATCH_MAX_SIZE) {
+			pr_warn("too large batch (%u bytes) from %s\n",
+				hdr.size, client->dirname);
+			return -1;
+		}
+
+		raw = xmalloc(hdr.size);
+		if (uncompress(raw, &size, data, len) != Z_OK ||
+		    size != hdr.size) {
+			pr_warn("invalid compressed data from %s\n",
+				client->dirname);
+			goto out;
+		}
+		data = raw;
+#else
+		pr_warn("compressed data is not supported\n");
+		return -1;
+#endif
+	}
+	else if (hdr.size != (unsigned)len) {
+		pr_warn("invalid batch size from %s\n", client->dirname);
+		return -1;
+	}
 
-	if (read_all(sock, buffer, len) < 0)
-		pr_err("recv buffer failed");
+	pr_dbg3("%s: %u buffers in a batch\n", client->dirname, hdr.nr);
 
-	write_client_file(client, filename, 1, buffer, len);
+	for (i = 0; i < hdr.nr; i++) {
+		uint32_t size;
 
-	free(buffer);
-	free(filename);
+		if (pos + sizeof(*bb) > hdr.size)
+			goto bad;
+
+		bb = data + pos;
+		size = ntohl(bb->len);
+		pos += sizeof(*bb);
+
+		if (size > hdr.size - pos)
+			goto bad;
+
+		filename = client_data_name(UFTRACE_MSG_SEND_DATA, ntohl(bb->tid));
+		write_client_file(client, filename, 1, bb->data, size);
+		free(filename);
+
+		pos += size;
+	}
+	ret = 0;
+	goto out;
+
+bad:
+	pr_warn("invalid batch data from %s\n", client->dirname);
+out:
+	free(raw);
+	return ret;
 }
 
-static void recv_trace_perf_data(int sock, int len)
+static int recv_trace_cpu_data(struct client_data *client, void *buf, int len,
+			       int type)
 {
-	struct client_data *client;
 	int32_t cpu;
-	char *filename = NULL;
-	void *buffer;
+	char *filename;
 
-	client = find_client(sock);
-	if (client == NULL)
-		pr_err_ns("no client on this socket\n");
+	if (check_client(client) < 0)
+		return -1;
 
-	if (read_all(sock, &cpu, sizeof(cpu)) < 0)
-		pr_err("recv cpu failed");
+	memcpy(&cpu, buf, sizeof(cpu));
 	cpu = ntohl(cpu);
 
-	xasprintf(&filename, "perf-cpu%d.dat", cpu);
+	filename = client_data_name(type, cpu);
 
 	len -= sizeof(cpu);
-	buffer = xmalloc(len);
+	write_client_file(client, filename, 1, buf + sizeof(cpu), len);
+
+	free(filename);
+	return 0;
+}
 
-	if (read_all(sock, buffer, len) < 0)
-		pr_err("recv buffer failed");
+/* data was moved to the pipe by the main thread */
+static int recv_trace_spliced_data(struct client_data *client,
+				   struct recv_work *work)
+{
+	char *filename;
+
+	if (check_client(client) < 0)
+		return -1;
 
-	write_client_file(client, filename, 1, buffer, len);
+	filename = client_data_name(work->type, work->id);
+	splice_client_file(client, get_client_file(client, filename), work->len);
 
-	free(buffer);
 	free(filename);
+	return 0;
 }
 
-static void recv_trace_metadata(int sock, int len)
+static int recv_trace_metadata(struct client_data *client, void *buf, int len)
 {
-	struct client_data *client;
 	int32_t namelen;
 	char *filename = NULL;
-	void *filedata;
 
-	client = find_client(sock);
-	if (client == NULL)
-		pr_err_ns("no client on this socket\n");
-
-	if (read_all(sock, &namelen, sizeof(namelen)) < 0)
-		pr_err("recv symfile name length failed");
+	if (check_client(client) < 0)
+		return -1;
 
+	memcpy(&namelen, buf, sizeof(namelen));
 	namelen = ntohl(namelen);
-	filename = xmalloc(namelen + 1);
 
-	if (read_all(sock, filename, namelen) < 0)
-		pr_err("recv file name failed");
-	filename[namelen] = '\0';
+	buf += sizeof(namelen);
+	len -= sizeof(namelen);
+	if (namelen <= 0 || namelen > len) {
+		pr_warn("invalid file name length: %d\n", namelen);
+		return -1;
+	}
 
-	len -= sizeof(namelen) + namelen;
-	filedata = xmalloc(len);
+	filename = xstrndup(buf, namelen);
 
-	pr_dbg2("reading %s (%d bytes)\n", filename, len);
-	if (read_all(sock, filedata, len) < 0)
-		pr_err("recv symfile failed");
+	buf += namelen;
+	len -= namelen;
 
-	write_client_file(client, filename, 1, filedata, len);
+	pr_dbg2("writing %s (%d bytes)\n", filename, len);
+	write_client_file(client, filename, 1, buf, len);
 
-	free(filedata);
 	free(filename);
+	return 0;
 }
 
-static void recv_trace_info(int sock, int len)
+static int recv_trace_info(struct client_data *client, void *buf, int len)
 {
-	struct client_data *client;
 	struct uftrace_file_header hdr;
-	void *info;
 
-	client = find_client(sock);
-	if (client == NULL)
-		pr_err_ns("no client on this socket\n");
+	if (check_client(client) < 0)
+		return -1;
 
-	if (read_all(sock, &hdr, sizeof(hdr)) < 0)
-		pr_err("recv file header failed");
+	memcpy(&hdr, buf, sizeof(hdr));
 
 	hdr.version     = ntohl(hdr.version);
 	hdr.header_size = ntohs(hdr.header_size);
@@ -466,48 +935,157 @@ static void recv_trace_info(int sock, int len)
 	hdr.max_stack   = ntohs(hdr.max_stack);
 
 	len -= sizeof(hdr);
-	info = xmalloc(len);
+	write_client_file(client, "info", 2, &hdr, sizeof(hdr),
+			  buf + sizeof(hdr), len);
+	return 0;
+}
 
-	if (read_all(sock, info, len) < 0)
-		pr_err("recv info failed");
+static void execute_run_cmd(char **argv) {
+	if (!argv)
+		return;
 
-	write_client_file(client, "info", 2, &hdr, sizeof(hdr), info, len);
+	int pid = fork();
+	if (pid < 0)
+		pr_err("cannot start child process");
 
-	free(info);
+	if (pid == 0) {
+		execvp(argv[0], argv);
+		pr_err("Failed to execute '%s'", argv[0]);
+	}
 }
 
-static void recv_trace_end(int sock, int efd)
+static int recv_trace_end(struct client_data *client, struct opts *opts)
 {
-	struct client_data *client;
+	struct recv_session *sess = client->sess;
+	bool done = true;
 
-	client = find_client(sock);
-	if (client) {
-		list_del(&client->list);
+	if (sess) {
+		pthread_mutex_lock(&session_lock);
+
+		sess->nr_end++;
+		if (client->main_conn)
+			sess->main_end = true;
+
+		/* run the command after all connections are finished */
+		done = sess->main_end && sess->nr_end >= sess->nr_conn;
+		if (done)
+			sess->done = true;
+
+		pthread_mutex_unlock(&session_lock);
+	}
 
+	if (!done)
+		return 0;
+
+	if (client->dirname)
 		pr_dbg("wrote client data to %s\n", client->dirname);
 
-		free(client->dirname);
-		free(client);
+	execute_run_cmd(opts->run_cmd);
+	return 0;
+}
+
+static void release_client(struct client_data *client)
+{
+	close(client->sock);
+
+	if (client->pipe[0] >= 0) {
+		close(client->pipe[0]);
+		close(client->pipe[1]);
 	}
+	close_client_files(client);
 
-	if (epoll_ctl(efd, EPOLL_CTL_DEL, sock, NULL) < 0)
-		pr_err("epoll del failed");
+	if (client->sess)
+		put_session(client->sess);
 
-	close(sock);
+	free(client->body);
+	free(client->dirname);
+	free(client);
 }
 
-static void execute_run_cmd(char **argv) {
-	if (!argv)
-		return;
+/* minimum length of each message type, or -1 if it has no payload */
+static int recv_msg_min_len(int type)
+{
+	switch (type) {
+	case UFTRACE_MSG_SEND_DIR_NAME:
+	case UFTRACE_MSG_SEND_DATA_CONN:
+		return 1;
+	case UFTRACE_MSG_SEND_NR_CONN:
+	case UFTRACE_MSG_SEND_DATA:
+	case UFTRACE_MSG_SEND_KERNEL_DATA:
+	case UFTRACE_MSG_SEND_PERF_DATA:
+	case UFTRACE_MSG_SEND_META_DATA:
+		return sizeof(int32_t);
+	case UFTRACE_MSG_SEND_DATA_BATCH:
+		return sizeof(struct uftrace_msg_batch);
+	case UFTRACE_MSG_SEND_INFO:
+		return sizeof(struct uftrace_file_header);
+	default:
+		return -1;
+	}
+}
 
-	int pid = fork();
-	if (pid < 0)
-		pr_err("cannot start child process");
+/* returns -1 if the client sent an invalid message */
+static int handle_recv_work(struct recv_work *work, struct opts *opts)
+{
+	struct client_data *client = work->client;
+	void *buf = work->body;
+	int type = work->type;
+	int len = work->len;
+	int min_len;
+
+	if (work->spliced) {
+		pr_dbg3("write %d bytes of spliced data\n", len);
+		return recv_trace_spliced_data(client, work);
+	}
 
-	if (pid == 0) {
-		execvp(argv[0], argv);
-		pr_err("Failed to execute '%s'", argv[0]);
+	min_len = recv_msg_min_len(type);
+	if (len < min_len) {
+		pr_warn("too short message (type %d, %d bytes)\n", type, len);
+		return -1;
+	}
+
+	switch (type) {
+	case UFTRACE_MSG_SEND_DIR_NAME:
+		pr_dbg2("receive UFTRACE_MSG_SEND_DIR_NAME\n");
+		if (len >= PATH_MAX)
+			break;
+		return recv_trace_dir_name(client, buf, len, true);
+	case UFTRACE_MSG_SEND_DATA_CONN:
+		pr_dbg2("receive UFTRACE_MSG_SEND_DATA_CONN\n");
+		if (len >= PATH_MAX)
+			break;
+		return recv_trace_dir_name(client, buf, len, false);
+	case UFTRACE_MSG_SEND_NR_CONN:
+		pr_dbg2("receive UFTRACE_MSG_SEND_NR_CONN\n");
+		return recv_trace_nr_conn(client, buf, len);
+	case UFTRACE_MSG_SEND_DATA:
+		pr_dbg2("receive UFTRACE_MSG_SEND_DATA\n");
+		return recv_trace_data(client, buf, len);
+	case UFTRACE_MSG_SEND_DATA_BATCH:
+		pr_dbg2("receive UFTRACE_MSG_SEND_DATA_BATCH\n");
+		return recv_trace_data_batch(client, buf, len);
+	case UFTRACE_MSG_SEND_KERNEL_DATA:
+		pr_dbg2("receive UFTRACE_MSG_SEND_KERNEL_DATA\n");
+		return recv_trace_cpu_data(client, buf, len, type);
+	case UFTRACE_MSG_SEND_PERF_DATA:
+		pr_dbg2("receive UFTRACE_MSG_SEND_PERF_DATA\n");
+		return recv_trace_cpu_data(client, buf, len, type);
+	case UFTRACE_MSG_SEND_INFO:
+		pr_dbg2("receive UFTRACE_MSG_SEND_INFO\n");
+		return recv_trace_info(client, buf, len);
+	case UFTRACE_MSG_SEND_META_DATA:
+		pr_dbg2("receive UFTRACE_MSG_SEND_META_DATA\n");
+		return recv_trace_metadata(client, buf, len);
+	case UFTRACE_MSG_SEND_END:
+		pr_dbg2("receive UFTRACE_MSG_SEND_END\n");
+		return recv_trace_end(client, opts);
+	default:
+		pr_dbg("unknown message: %d\n", type);
+		return 0;
 	}
+
+	pr_warn("too long directory name (%d bytes)\n", len);
+	return -1;
 }
 
 static void epoll_add(int efd, int fd, unsigned event)
@@ -523,85 +1101,518 @@ static void epoll_add(int efd, int fd, unsigned event)
 		pr_err("epoll add failed");
 }
 
+static void *recv_worker_thread(void *arg)
+{
+	struct recv_worker *w = arg;
+	struct recv_work *work;
+	struct client_data *client;
+	bool dropped;
+	int ret;
+
+	pthread_mutex_lock(&w->lock);
+
+	while (true) {
+		while (list_empty(&w->works) && !w->done)
+			pthread_cond_wait(&w->cond, &w->lock);
+
+		if (list_empty(&w->works))
+			break;
+
+		work = list_first_entry(&w->works, struct recv_work, list);
+		list_del(&work->list);
+		client = work->client;
+
+		if (work->type == RECV_WORK_CLOSE) {
+			/* it's the last work of the client */
+			release_client(client);
+			free(work);
+			continue;
+		}
+
+		dropped = client->dropped;
+		pthread_mutex_unlock(&w->lock);
+
+		/* the rest of a dropped client will be discarded */
+		ret = dropped ? 0 : handle_recv_work(work, w->opts);
+		if ((dropped || ret < 0) && work->spliced)
+			discard_client_pipe(client, work->len);
+
+		pthread_mutex_lock(&w->lock);
+
+		if (ret < 0) {
+			pr_warn("drop client: invalid data\n");
+			client->dropped = true;
+			/* the main thread will see EOF and close it */
+			shutdown(client->sock, SHUT_RDWR);
+		}
+
+		client->pending -= work->len;
+		if (work->spliced)
+			client->piped -= work->len;
+
+		if (client->paused && client->pending < RECV_PENDING_MAX / 2 &&
+		    client->piped < client->pipe_size) {
+			pr_dbg2("resume reading client\n");
+			client->paused = false;
+			epoll_add(w->efd, client->sock, EPOLLIN);
+		}
+
+		free(work->body);
+		free(work);
+	}
+
+	pthread_mutex_unlock(&w->lock);
+	return NULL;
+}
+
+static void setup_recv_workers(struct opts *opts, int efd)
+{
+	int i;
+
+	nr_workers = opts->nr_thread;
+	if (nr_workers <= 0)
+		nr_workers = DIV_ROUND_UP(sysconf(_SC_NPROCESSORS_ONLN), 4);
+
+	pr_dbg("creating %d thread(s) for receiving\n", nr_workers);
+	workers = xcalloc(nr_workers, sizeof(*workers));
+
+	for (i = 0; i < nr_workers; i++) {
+		struct recv_worker *w = &workers[i];
+
+		pthread_mutex_init(&w->lock, NULL);
+		pthread_cond_init(&w->cond, NULL);
+		INIT_LIST_HEAD(&w->works);
+		w->efd = efd;
+		w->opts = opts;
+
+		pthread_create(&w->th, NULL, recv_worker_thread, w);
+	}
+}
+
+static void finish_recv_workers(void)
+{
+	int i;
+
+	for (i = 0; i < nr_workers; i++) {
+		struct recv_worker *w = &workers[i];
+
+		pthread_mutex_lock(&w->lock);
+		w->done = true;
+		pthread_cond_signal(&w->cond);
+		pthread_mutex_unlock(&w->lock);
+
+		pthread_join(w->th, NULL);
+	}
+
+	free(workers);
+}
+
+/* should be called with the worker lock held */
+static void pause_client(struct client_data *client)
+{
+	if (client->paused)
+		return;
+
+	pr_dbg2("pause reading client\n");
+	client->paused = true;
+
+	if (epoll_ctl(client->worker->efd, EPOLL_CTL_DEL, client->sock, NULL) < 0)
+		pr_err("epoll del failed");
+}
+
+/* pass a work to the worker of the client (in the main thread) */
+static void add_recv_work(struct client_data *client, struct recv_work *work)
+{
+	struct recv_worker *w = client->worker;
+
+	pthread_mutex_lock(&w->lock);
+
+	list_add_tail(&work->list, &w->works);
+
+	if (work->type != RECV_WORK_CLOSE) {
+		client->pending += work->len;
+		if (work->spliced)
+			client->piped += work->len;
+
+		/* stop reading until the worker catches up */
+		if (client->pending > RECV_PENDING_MAX)
+			pause_client(client);
+	}
+
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+}
+
+static void queue_recv_work(struct client_data *client, int type,
+			    int len, void *body)
+{
+	struct recv_work *work = xzalloc(sizeof(*work));
+
+	work->client = client;
+	work->type   = type;
+	work->len    = len;
+	work->body   = body;
+
+	add_recv_work(client, work);
+}
+
+static void queue_splice_work(struct client_data *client, int len)
+{
+	struct recv_work *work = xzalloc(sizeof(*work));
+
+	work->client  = client;
+	work->type    = client->data_type;
+	work->id      = client->data_id;
+	work->len     = len;
+	work->spliced = true;
+
+	add_recv_work(client, work);
+}
+
+static void close_client(struct client_data *client, int efd)
+{
+	struct recv_worker *w = client->worker;
+
+	/* a paused client is not in the epoll set */
+	if (epoll_ctl(efd, EPOLL_CTL_DEL, client->sock, NULL) < 0 &&
+	    errno != ENOENT)
+		pr_err("epoll del failed");
+
+	/* don't let the worker resume it */
+	pthread_mutex_lock(&w->lock);
+	client->paused = false;
+	pthread_mutex_unlock(&w->lock);
+
+	list_del(&client->list);
+	queue_recv_work(client, RECV_WORK_CLOSE, 0, NULL);
+}
+
 static void handle_server_sock(struct epoll_event *ev, int efd)
 {
-	int client;
 	int sock = ev->data.fd;
+	struct client_data *client;
 	struct sockaddr_in addr;
 	socklen_t len = sizeof(addr);
 	char hbuf[NI_MAXHOST];
+	int fd;
 
-	client = accept(sock, &addr, &len);
-	if (client < 0)
+	fd = accept4(sock, &addr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0)
 		pr_err("socket accept failed");
 
 	getnameinfo((struct sockaddr *)&addr, len, hbuf, sizeof(hbuf),
 		    NULL, 0, NI_NUMERICHOST);
 
-	epoll_add(efd, client, EPOLLIN);
+	client = xzalloc(sizeof(*client));
+	client->sock = fd;
+	client->state = RECV_MSG_HEADER;
+	client->worker = &workers[next_worker++ % nr_workers];
+	INIT_LIST_HEAD(&client->files);
+	list_add(&client->list, &client_list);
+
+	/* data will be copied if it cannot use a pipe to splice */
+	if (pipe2(client->pipe, O_CLOEXEC) < 0) {
+		pr_dbg("cannot create pipe for client: %m\n");
+		client->pipe[0] = client->pipe[1] = -1;
+	}
+	else {
+		fcntl(client->pipe[1], F_SETPIPE_SZ, RECV_PIPE_SIZE);
+		client->pipe_size = fcntl(client->pipe[1], F_GETPIPE_SZ);
+	}
+
+	epoll_add(efd, fd, EPOLLIN);
 	pr_dbg("new connection added from %s\n", hbuf);
 }
 
-static void handle_client_sock(struct epoll_event *ev, int efd, struct opts *opts)
+/* size of the fixed part before data to be spliced, or 0 */
+static size_t splice_prefix_len(struct client_data *client)
 {
-	int sock = ev->data.fd;
-	struct uftrace_msg msg;
+	if (client->pipe[0] < 0)
+		return 0;
+
+	switch (client->msg.type) {
+	case UFTRACE_MSG_SEND_DATA:
+	case UFTRACE_MSG_SEND_KERNEL_DATA:
+	case UFTRACE_MSG_SEND_PERF_DATA:
+		return sizeof(int32_t);
+	case UFTRACE_MSG_SEND_DATA_BATCH:
+		return sizeof(struct uftrace_msg_batch);
+	default:
+		return 0;
+	}
+}
 
-	if (ev->events & (EPOLLERR | EPOLLHUP)) {
-		pr_dbg("client socket closed\n");
-		recv_trace_end(sock, efd);
+/* it will be closed by the main loop */
+static void invalid_client(struct client_data *client)
+{
+	pr_warn("drop client: invalid message\n");
+	client->state = RECV_MSG_INVALID;
+}
+
+static void read_client_prefix(struct client_data *client, size_t len)
+{
+	if (len > client->msg_left) {
+		invalid_client(client);
 		return;
 	}
 
-	if (read_all(sock, &msg, sizeof(msg)) < 0)
-		pr_err("message recv failed");
+	client->state = RECV_MSG_PREFIX;
+	client->prefix_len = len;
+	client->pos = 0;
+}
 
-	msg.magic = ntohs(msg.magic);
-	msg.type  = ntohs(msg.type);
-	msg.len   = ntohl(msg.len);
+/* move to the next buffer in a batch, or the next message */
+static void next_client_data(struct client_data *client)
+{
+	if (client->in_batch && client->batch_nr) {
+		read_client_prefix(client, sizeof(struct uftrace_msg_batch_buf));
+		return;
+	}
 
-	if (msg.magic != UFTRACE_MSG_MAGIC)
-		pr_err_ns("invalid message\n");
+	if (client->msg_left) {
+		invalid_client(client);
+		return;
+	}
 
-	switch (msg.type) {
-	case UFTRACE_MSG_SEND_DIR_NAME:
-		pr_dbg2("receive UFTRACE_MSG_SEND_DIR_NAME\n");
-		recv_trace_dir_name(sock, msg.len);
-		break;
-	case UFTRACE_MSG_SEND_DATA:
-		pr_dbg2("receive UFTRACE_MSG_SEND_DATA\n");
-		recv_trace_data(sock, msg.len);
-		break;
-	case UFTRACE_MSG_SEND_KERNEL_DATA:
-		pr_dbg2("receive UFTRACE_MSG_SEND_KERNEL_DATA\n");
-		recv_trace_kernel_data(sock, msg.len);
-		break;
-	case UFTRACE_MSG_SEND_PERF_DATA:
-		pr_dbg2("receive UFTRACE_MSG_SEND_PERF_DATA\n");
-		recv_trace_perf_data(sock, msg.len);
-		break;
-	case UFTRACE_MSG_SEND_INFO:
-		pr_dbg2("receive UFTRACE_MSG_SEND_INFO\n");
-		recv_trace_info(sock, msg.len);
-		break;
-	case UFTRACE_MSG_SEND_META_DATA:
-		pr_dbg2("receive UFTRACE_MSG_SEND_META_DATA\n");
-		recv_trace_metadata(sock, msg.len);
-		break;
-	case UFTRACE_MSG_SEND_END:
-		pr_dbg2("receive UFTRACE_MSG_SEND_END\n");
-		recv_trace_end(sock, efd);
-		execute_run_cmd(opts->run_cmd);
+	client->in_batch = false;
+	client->state = RECV_MSG_HEADER;
+	client->pos = 0;
+}
+
+static void start_client_splice(struct client_data *client, int type, int id,
+				size_t len)
+{
+	if (len > client->msg_left) {
+		invalid_client(client);
+		return;
+	}
+
+	client->data_type = type;
+	client->data_id   = id;
+	client->remain    = len;
+	client->msg_left -= len;
+	client->state     = RECV_MSG_SPLICE;
+
+	if (len == 0)
+		next_client_data(client);
+}
+
+static void recv_client_prefix(struct client_data *client)
+{
+	struct uftrace_msg_batch hdr;
+	struct uftrace_msg_batch_buf bb;
+	int32_t id;
+
+	client->msg_left -= client->prefix_len;
+
+	if (client->msg.type != UFTRACE_MSG_SEND_DATA_BATCH) {
+		memcpy(&id, client->prefix, sizeof(id));
+		start_client_splice(client, client->msg.type, ntohl(id),
+				    client->msg_left);
+		return;
+	}
+
+	if (client->in_batch) {
+		memcpy(&bb, client->prefix, sizeof(bb));
+		client->batch_nr--;
+		start_client_splice(client, UFTRACE_MSG_SEND_DATA,
+				    ntohl(bb.tid), ntohl(bb.len));
+		return;
+	}
+
+	memcpy(&hdr, client->prefix, sizeof(hdr));
+
+	/* it needs the whole message to uncompress */
+	if (ntohl(hdr.flags) & UFTRACE_BATCH_COMPRESSED) {
+		client->body = xmalloc(client->msg.len);
+		memcpy(client->body, &hdr, sizeof(hdr));
+		client->pos = sizeof(hdr);
+		client->state = RECV_MSG_BODY;
+		return;
+	}
+
+	if (ntohl(hdr.size) != client->msg_left) {
+		invalid_client(client);
+		return;
+	}
+
+	client->in_batch = true;
+	client->batch_nr = ntohl(hdr.nr);
+	next_client_data(client);
+}
+
+/* move data from the socket to the pipe, the worker will write it */
+static ssize_t splice_client_data(struct client_data *client, size_t budget)
+{
+	struct recv_worker *w = client->worker;
+	size_t len = client->remain;
+	size_t space;
+	ssize_t n;
+
+	pthread_mutex_lock(&w->lock);
+	space = client->pipe_size - client->piped;
+	if (space == 0)
+		pause_client(client);
+	pthread_mutex_unlock(&w->lock);
+
+	if (space == 0) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	if (len > space)
+		len = space;
+	if (len > budget)
+		len = budget;
+
+	n = splice(client->sock, NULL, client->pipe[1], NULL, len,
+		   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (n > 0) {
+		client->remain -= n;
+		queue_splice_work(client, n);
+	}
+	else if (n < 0 && errno == EAGAIN) {
+		int avail = 0;
+
+		/* the pipe can be full of small chunks */
+		if (ioctl(client->sock, FIONREAD, &avail) == 0 && avail > 0) {
+			pthread_mutex_lock(&w->lock);
+			if (client->piped)
+				pause_client(client);
+			pthread_mutex_unlock(&w->lock);
+		}
+	}
+
+	return n;
+}
+
+/* returns false if the client should not be read anymore */
+static bool recv_client_msg(struct client_data *client)
+{
+	struct uftrace_msg *msg = &client->msg;
+	size_t prefix_len;
+
+	switch (client->state) {
+	case RECV_MSG_HEADER:
+		msg->magic = ntohs(msg->magic);
+		msg->type  = ntohs(msg->type);
+		msg->len   = ntohl(msg->len);
+
+		if (msg->magic != UFTRACE_MSG_MAGIC || msg->len > INT_MAX) {
+			invalid_client(client);
+			return true;
+		}
+
+		client->msg_left = msg->len;
+
+		/* data messages will be spliced without copy */
+		prefix_len = splice_prefix_len(client);
+		if (prefix_len && msg->len >= prefix_len) {
+			read_client_prefix(client, prefix_len);
+			return true;
+		}
+
+		client->state = RECV_MSG_BODY;
+		client->pos = 0;
+		client->body = msg->len ? xmalloc(msg->len) : NULL;
+
+		if (msg->len)
+			return true;
 		break;
+	case RECV_MSG_PREFIX:
+		recv_client_prefix(client);
+		return !client->paused;
 	default:
-		pr_dbg("unknown message: %d\n", msg.type);
 		break;
 	}
+
+	queue_recv_work(client, msg->type, msg->len, client->body);
+
+	client->state = RECV_MSG_HEADER;
+	client->pos = 0;
+	client->body = NULL;
+
+	return !client->paused;
+}
+
+static void handle_client_sock(struct epoll_event *ev, int efd)
+{
+	int sock = ev->data.fd;
+	struct client_data *client;
+	size_t budget = RECV_READ_BUDGET;
+
+	client = find_client(sock);
+	if (client == NULL)
+		return;
+
+	while (budget && client->state != RECV_MSG_INVALID) {
+		void *buf;
+		size_t size;
+		ssize_t n;
+
+		switch (client->state) {
+		case RECV_MSG_HEADER:
+			buf  = &client->msg;
+			size = sizeof(client->msg);
+			break;
+		case RECV_MSG_PREFIX:
+			buf  = client->prefix;
+			size = client->prefix_len;
+			break;
+		default:
+			buf  = client->body;
+			size = client->msg.len;
+			break;
+		}
+
+		if (client->state == RECV_MSG_SPLICE)
+			n = splice_client_data(client, budget);
+		else
+			n = read(sock, buf + client->pos, size - client->pos);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return;
+
+			pr_dbg("client socket error: %m\n");
+			close_client(client, efd);
+			return;
+		}
+
+		if (n == 0) {
+			if (client->state != RECV_MSG_HEADER || client->pos)
+				pr_warn("client closed in the middle of message\n");
+
+			pr_dbg("client socket closed\n");
+			close_client(client, efd);
+			return;
+		}
+
+		budget -= (size_t)n < budget ? (size_t)n : budget;
+
+		if (client->state == RECV_MSG_SPLICE) {
+			if (client->remain == 0)
+				next_client_data(client);
+			if (client->paused)
+				break;
+			continue;
+		}
+
+		client->pos += n;
+		if (client->pos == size && !recv_client_msg(client))
+			break;
+	}
+
+	if (client->state == RECV_MSG_INVALID)
+		close_client(client, efd);
 }
 
 int command_recv(int argc, char *argv[], struct opts *opts)
 {
 	struct signalfd_siginfo si;
+	struct client_data *client, *tmp;
 	int sock;
 	int sigfd;
 	int efd;
@@ -626,13 +1637,19 @@ int command_recv(int argc, char *argv[], struct opts *opts)
 	epoll_add(efd, sock,  EPOLLIN);
 	epoll_add(efd, sigfd, EPOLLIN);
 
+	/* signals are blocked already, so workers don't get them */
+	setup_recv_workers(opts, efd);
+
 	while (!uftrace_done) {
 		struct epoll_event ev[10];
 		int i, len;
 
 		len = epoll_wait(efd, ev, 10, -1);
-		if (len < 0)
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
 			pr_err("epoll wait failed");
+		}
 
 		for (i = 0; i < len; i++) {
 			if (ev[i].data.fd == sigfd) {
@@ -645,10 +1662,15 @@ int command_recv(int argc, char *argv[], struct opts *opts)
 			else if (ev[i].data.fd == sock)
 				handle_server_sock(&ev[i], efd);
 			else
-				handle_client_sock(&ev[i], efd, opts);
+				handle_client_sock(&ev[i], efd);
 		}
 	}
 
+	list_for_each_entry_safe(client, tmp, &client_list, list)
+		close_client(client, efd);
+
+	finish_recv_workers();
+
 	close(efd);
 	close(sigfd);
 	close(sock);
@@ -310,6 +310,8 @@ static void print_event(struct ftrace_task_handle *task,
 			struct uftrace_pmu_cycle  *cycle;
 			struct uftrace_pmu_cache  *cache;
 			struct uftrace_pmu_branch *branch;
+			struct uftrace_buffer_stall *stall;
+			struct uftrace_script_queue *sq;
 		} u;
 
 		switch (evt_id) {
@@ -366,6 +368,16 @@ static void print_event(struct ftrace_task_handle *task,
 				 evt_name, u.branch->branch, u.branch->misses,
 				 (u.branch->branch - u.branch->misses) * 100 / u.branch->branch);
 			return;
+		case EVENT_ID_BUFFER_STALL:
+			u.stall = task->args.data;
+			pr_color(color, "%s (time=%"PRIu64"ns)",
+				 evt_name, u.stall->time);
+			return;
+		case EVENT_ID_SCRIPT_QUEUE:
+			u.sq = task->args.data;
+			pr_color(color, "%s (dropped=%"PRIu64" time=%"PRIu64"ns)",
+				 evt_name, u.sq->dropped, u.sq->time);
+			return;
 		default:
 			pr_color(color, "%s", evt_name);
 			break;
@@ -626,7 +638,8 @@ void get_argspec_string(struct ftrace_task_handle *task,
 						 (uint64_t)val.i);
 
 			if (sym)
-				n += snprintf(args + n, len, "&%s", sym->name);
+				n += snprintf(args + n, len, "&%s",
+					      symbol_getname(sym, sym->addr));
 			else
 				n += snprintf(args + n, len, "%p", val.p);
 		}
@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include <inttypes.h>
 #include <assert.h>
+#include <signal.h>
+#include <pthread.h>
 
 #include "uftrace.h"
 #include "utils/utils.h"
@@ -8,6 +10,7 @@
 #include "utils/symbol.h"
 #include "utils/list.h"
 #include "utils/fstack.h"
+#include "utils/kernel.h"
 
 
 enum {
@@ -20,6 +23,7 @@ enum {
 struct trace_entry {
 	int pid;
 	struct sym *sym;
+	unsigned name_id;
 	uint64_t addr;
 	uint64_t time_total;
 	uint64_t time_self;
@@ -47,17 +51,47 @@ static bool diff_full = false;
 /* maximum length of symbol */
 static int maxlen = 20;
 
-static void insert_entry(struct rb_root *root, struct trace_entry *te, bool thread)
+static uint64_t get_entry_time(struct trace_entry *te)
+{
+	if (avg_mode == AVG_TOTAL)
+		return te->time_total;
+	else if (avg_mode == AVG_SELF)
+		return te->time_self;
+	return 0;
+}
+
+/* add times of @te to @entry, @time_min and @time_max are of @te */
+static void sum_entry(struct trace_entry *entry, struct trace_entry *te,
+		      uint64_t time_min, uint64_t time_max)
+{
+	entry->time_total += te->time_total;
+	entry->time_self  += te->time_self;
+	entry->nr_called  += te->nr_called;
+
+	if (entry->time_min > time_min)
+		entry->time_min = time_min;
+	if (entry->time_max < time_max)
+		entry->time_max = time_max;
+
+	entry->time_recursive += te->time_recursive;
+}
+
+static void __insert_entry(struct rb_root *root, struct trace_entry *te,
+			   bool thread, uint64_t time_min, uint64_t time_max)
 {
 	struct trace_entry *entry;
 	struct rb_node *parent = NULL;
 	struct rb_node **p = &root->rb_node;
-	uint64_t entry_time = 0;
+	unsigned name_id = 0;
 	int len = 0;
 
 	pr_dbg3("%s: [%5d] %"PRIu64"/%"PRIu64" (%lu) %-s\n",
 		__func__, te->pid, te->time_total, te->time_self, te->nr_called,
-		te->sym ? te->sym->name : "<unknown>");
+		te->sym ? symbol_getname(te->sym, te->addr) : "<unknown>");
+
+	/* same names can be found by the id, but the tree is sorted by name */
+	if (!thread && te->sym)
+		name_id = symbol_getname_id(te->sym, te->addr);
 
 	while (*p) {
 		int cmp;
@@ -67,33 +101,26 @@ static void insert_entry(struct rb_root *root, struct trace_entry *te, bool thre
 
 		if (thread)
 			cmp = te->pid - entry->pid;
-		else if (te->sym && entry->sym)
-			cmp = strcmp(te->sym->name, entry->sym->name);
+		else if (te->sym && entry->sym) {
+			if (name_id == entry->name_id)
+				cmp = 0;
+			else
+				cmp = strcmp(symbol_getname(te->sym, te->addr),
+					     symbol_getname(entry->sym, entry->addr));
+		}
 		else
 			cmp = te->addr - entry->addr;
 
 		if (cmp == 0) {
-			entry->time_total += te->time_total;
-			entry->time_self  += te->time_self;
-			entry->nr_called  += te->nr_called;
-
-			if (avg_mode == AVG_TOTAL)
-				entry_time = te->time_total;
-			else if (avg_mode == AVG_SELF)
-				entry_time = te->time_self;
-
-			if (entry->time_min > entry_time)
-				entry->time_min = entry_time;
-			if (entry->time_max < entry_time)
-				entry->time_max = entry_time;
-
-			entry->time_recursive += te->time_recursive;
+			sum_entry(entry, te, time_min, time_max);
 
 			if (entry->sym == NULL && te->sym) {
 				entry->sym = te->sym;
+				entry->name_id = name_id;
 
 				if (entry->sym)
-					len = strlen(entry->sym->name);
+					len = strlen(symbol_getname(entry->sym,
+								    entry->addr));
 				if (maxlen < len)
 					maxlen = len;
 			}
@@ -110,23 +137,19 @@ static void insert_entry(struct rb_root *root, struct trace_entry *te, bool thre
 	entry = xmalloc(sizeof(*entry));
 	entry->pid = te->pid;
 	entry->sym = te->sym;
+	entry->name_id = name_id;
 	entry->addr = te->addr;
 	entry->time_total = te->time_total;
 	entry->time_self  = te->time_self;
 	entry->nr_called  = te->nr_called;
 	entry->pair = NULL;
 
-	if (avg_mode == AVG_TOTAL)
-		entry_time = te->time_total;
-	else if (avg_mode == AVG_SELF)
-		entry_time = te->time_self;
-
-	entry->time_min = entry_time;
-	entry->time_max = entry_time;
+	entry->time_min = time_min;
+	entry->time_max = time_max;
 	entry->time_recursive = te->time_recursive;
 
 	if (entry->sym)
-		len = strlen(entry->sym->name);
+		len = strlen(symbol_getname(entry->sym, entry->addr));
 	if (maxlen < len)
 		maxlen = len;
 
@@ -134,6 +157,182 @@ static void insert_entry(struct rb_root *root, struct trace_entry *te, bool thre
 	rb_insert_color(&entry->link, root);
 }
 
+static void insert_entry(struct rb_root *root, struct trace_entry *te, bool thread)
+{
+	uint64_t entry_time = get_entry_time(te);
+
+	__insert_entry(root, te, thread, entry_time, entry_time);
+}
+
+/*
+ * Functions are aggregated in a hash table keyed by session and address
+ * rather than inserting each record to the tree.  The symbol is resolved
+ * once for each entry when it's merged to the (name) tree at last.  But
+ * symbols in dlopen-ed libraries depend on the time so they're resolved
+ * for each record and the symbol is also used as a key.
+ */
+struct report_hash_entry {
+	struct uftrace_session		*sess;
+	uint64_t			addr;
+	struct sym			*sym;
+	bool				used;
+	struct trace_entry		te;
+};
+
+struct report_hash {
+	struct report_hash_entry	*entries;
+	unsigned			nr;
+	int				bits;
+};
+
+/*
+ * Without kernel or perf data, the (user) records of a task can be
+ * processed independently as the report only sums up the time of each
+ * function.  So each task is processed in a worker thread (if --jobs is
+ * given) and the workers save the result to their own hash table.  The
+ * tables are merged to the tree at last.
+ */
+struct report_parallel {
+	struct ftrace_file_handle	*handle;
+	struct opts			*opts;
+	bool				thread;
+	int				next;      /* next task to process */
+	pthread_mutex_t			sym_lock;  /* symbols are loaded lazily */
+};
+
+struct report_worker {
+	pthread_t			thread;
+	struct report_parallel		*rp;
+	struct report_hash		hash;
+};
+
+static inline unsigned hash_report_key(struct uftrace_session *sess,
+				       uint64_t addr, struct sym *sym,
+				       int bits)
+{
+	uint64_t key = addr ^ ((uintptr_t)sess >> 4) ^ ((uintptr_t)sym << 16);
+
+	return (key * 0x9e3779b97f4a7c15ULL) >> (64 - bits);
+}
+
+static struct report_hash_entry *
+find_hash_slot(struct report_hash *hash, struct uftrace_session *sess,
+	       uint64_t addr, struct sym *sym)
+{
+	unsigned mask = (1U << hash->bits) - 1;
+	unsigned pos = hash_report_key(sess, addr, sym, hash->bits);
+	struct report_hash_entry *e;
+
+	while (1) {
+		e = &hash->entries[pos];
+
+		if (!e->used)
+			return e;
+		if (e->sess == sess && e->addr == addr && e->sym == sym)
+			return e;
+
+		pos = (pos + 1) & mask;
+	}
+}
+
+static void grow_report_hash(struct report_hash *hash)
+{
+	struct report_hash_entry *old = hash->entries;
+	struct report_hash_entry *e;
+	unsigned i, old_size = old ? 1U << hash->bits : 0;
+
+	hash->bits = old ? hash->bits + 1 : 10;
+	hash->entries = xcalloc(1U << hash->bits, sizeof(*hash->entries));
+
+	for (i = 0; i < old_size; i++) {
+		if (!old[i].used)
+			continue;
+
+		e = find_hash_slot(hash, old[i].sess, old[i].addr, old[i].sym);
+		*e = old[i];
+	}
+	free(old);
+}
+
+/* returns the entry of the key, it's not used if it's newly added */
+static struct report_hash_entry *
+get_hash_entry(struct report_hash *hash, struct uftrace_session *sess,
+	       uint64_t addr, struct sym *sym)
+{
+	struct report_hash_entry *e;
+
+	/* keep it less than half full */
+	if (hash->entries == NULL || hash->nr * 2 >= (1U << hash->bits))
+		grow_report_hash(hash);
+
+	e = find_hash_slot(hash, sess, addr, sym);
+	if (!e->used) {
+		e->sess = sess;
+		e->addr = addr;
+		e->sym  = sym;
+		hash->nr++;
+	}
+	return e;
+}
+
+static void add_hash_entry(struct report_hash_entry *e, struct trace_entry *te)
+{
+	uint64_t entry_time = get_entry_time(te);
+
+	if (!e->used) {
+		e->te = *te;
+		e->te.time_min = entry_time;
+		e->te.time_max = entry_time;
+		e->used = true;
+		return;
+	}
+
+	sum_entry(&e->te, te, entry_time, entry_time);
+
+	if (e->te.sym == NULL)
+		e->te.sym = te->sym;
+}
+
+/* same as task_find_sym_addr() but it doesn't check dlopen-ed libraries */
+static struct sym *find_entry_sym(struct uftrace_session_link *sessions,
+				  struct report_hash_entry *e)
+{
+	struct uftrace_session *sess = e->sess;
+
+	if (sess == NULL) {
+		sess = sessions->first;
+
+		if (!is_kernel_address(&sess->symtabs, e->addr))
+			return NULL;
+	}
+
+	return find_symtabs(&sess->symtabs, e->addr);
+}
+
+static void merge_report_hash(struct ftrace_file_handle *handle,
+			      struct rb_root *root, struct report_hash *hash,
+			      bool thread)
+{
+	struct report_hash_entry *e;
+	unsigned i;
+
+	for (i = 0; hash->entries && i < (1U << hash->bits); i++) {
+		e = &hash->entries[i];
+		if (!e->used)
+			continue;
+
+		if (!thread && e->te.sym == NULL)
+			e->te.sym = find_entry_sym(&handle->sessions, e);
+
+		__insert_entry(root, &e->te, thread,
+			       e->te.time_min, e->te.time_max);
+	}
+
+	free(hash->entries);
+	hash->entries = NULL;
+	hash->nr = 0;
+}
+
 static void fill_entry_sym(struct trace_entry *te,
 			   struct ftrace_task_handle *task,
 			   struct sym *sym, uint64_t addr)
@@ -163,20 +362,31 @@ static void fill_entry_sym(struct trace_entry *te,
 	}
 }
 
-static bool fill_entry(struct trace_entry *te, struct ftrace_task_handle *task,
-		       uint64_t time, uint64_t addr, struct opts *opts)
+static void add_function_entry(struct report_hash *hash,
+			       struct ftrace_task_handle *task,
+			       uint64_t time, uint64_t addr)
 {
 	struct uftrace_session_link *sessions = &task->h->sessions;
-	struct sym *sym;
+	struct uftrace_session *sess;
+	struct report_hash_entry *e;
+	struct trace_entry te;
+	struct sym *sym = NULL;
+
+	sess = find_task_session(sessions, task->tid, time);
+	if (sess == NULL)
+		sess = find_task_session(sessions, task->t->pid, time);
 
-	sym = task_find_sym_addr(sessions, task, time, addr);
+	/* it's not called in parallel (see can_read_tasks_parallel) */
+	if (sess && !list_empty(&sess->dlopen_libs))
+		sym = task_find_sym_addr(sessions, task, time, addr);
 
-	fill_entry_sym(te, task, sym, addr);
-	return true;
+	fill_entry_sym(&te, task, sym, addr);
+	e = get_hash_entry(hash, sess, addr, sym);
+	add_hash_entry(e, &te);
 }
 
 static void build_function_tree(struct ftrace_file_handle *handle,
-				struct rb_root *root, struct opts *opts)
+				struct report_hash *hash, struct opts *opts)
 {
 	struct trace_entry te;
 	struct uftrace_record *rstack;
@@ -210,7 +420,9 @@ static void build_function_tree(struct ftrace_file_handle *handle,
 
 				fill_entry_sym(&te, task, &sched_sym,
 					       sched_sym.addr);
-				insert_entry(root, &te, false);
+				add_hash_entry(get_hash_entry(hash, NULL,
+							      sched_sym.addr,
+							      &sched_sym), &te);
 			}
 			continue;
 		}
@@ -221,10 +433,10 @@ static void build_function_tree(struct ftrace_file_handle *handle,
 				fstack = &task->func_stack[task->stack_count];
 
 				if (fstack_enabled && fstack->valid &&
-				    !(fstack->flags & FSTACK_FL_NORECORD) &&
-				    fill_entry(&te, task, task->timestamp_last,
-					       fstack->addr, opts)) {
-					insert_entry(root, &te, false);
+				    !(fstack->flags & FSTACK_FL_NORECORD)) {
+					add_function_entry(hash, task,
+							   task->timestamp_last,
+							   fstack->addr);
 				}
 
 				fstack_exit(task);
@@ -234,8 +446,7 @@ static void build_function_tree(struct ftrace_file_handle *handle,
 		}
 
 		/* rstack->type == UFTRACE_EXIT */
-		if (fill_entry(&te, task, rstack->time, rstack->addr, opts))
-			insert_entry(root, &te, false);
+		add_function_entry(hash, task, rstack->time, rstack->addr);
 	}
 
 	if (uftrace_done)
@@ -271,8 +482,8 @@ static void build_function_tree(struct ftrace_file_handle *handle,
 			if (task->stack_count > 0)
 				fstack[-1].child_time += fstack->total_time;
 
-			if (fill_entry(&te, task, last_time, fstack->addr, opts))
-				insert_entry(root, &te, false);
+			add_function_entry(hash, task, last_time,
+					   fstack->addr);
 		}
 	}
 }
@@ -470,7 +681,8 @@ static struct sort_item sort_diff_time_total = {
 static int cmp_func_name(struct trace_entry *a, struct trace_entry *b,
 			       int sort_column)
 {
-	return strcmp(b->sym->name, a->sym->name);
+	return strcmp(symbol_getname(b->sym, b->addr),
+		      symbol_getname(a->sym, a->addr));
 }
 
 static struct sort_item sort_func = {
@@ -692,46 +904,6 @@ static void print_function(struct trace_entry *entry)
 	symbol_putname(entry->sym, symname);
 }
 
-static void report_functions(struct ftrace_file_handle *handle, struct opts *opts)
-{
-	struct rb_root name_tree = RB_ROOT;
-	struct rb_root sort_tree = RB_ROOT;
-	const char f_format[] = "  %10.10s  %10.10s  %10.10s  %-.*s\n";
-	const char line[] = "=================================================";
-
-	build_function_tree(handle, &name_tree, opts);
-
-	while (!RB_EMPTY_ROOT(&name_tree) && !uftrace_done) {
-		struct rb_node *node;
-		struct trace_entry *entry;
-
-		node = rb_first(&name_tree);
-		rb_erase(node, &name_tree);
-
-		entry = rb_entry(node, struct trace_entry, link);
-		if (avg_mode == AVG_TOTAL)
-			entry->time_avg = entry->time_total / entry->nr_called;
-		else if (avg_mode == AVG_SELF)
-			entry->time_avg = entry->time_self / entry->nr_called;
-
-		sort_entries(&sort_tree, entry);
-	}
-
-	if (uftrace_done)
-		return;
-
-	if (avg_mode == AVG_NONE)
-		pr_out(f_format, "Total time", "Self time", "Calls", maxlen, "Function");
-	else if (avg_mode == AVG_TOTAL)
-		pr_out(f_format, "Avg total", "Min total", "Max total", maxlen, "Function");
-	else if (avg_mode == AVG_SELF)
-		pr_out(f_format, "Avg self", "Min self", "Max self", maxlen, "Function");
-
-	pr_out(f_format, line, line, line, maxlen, line);
-
-	print_and_delete(&sort_tree, print_function);
-}
-
 static struct sym * find_task_sym(struct ftrace_file_handle *handle,
 				  struct ftrace_task_handle *task,
 				  struct uftrace_record *rstack)
@@ -767,26 +939,30 @@ static struct sym * find_task_sym(struct ftrace_file_handle *handle,
 	return sym;
 }
 
-static void print_thread(struct trace_entry *entry)
+static struct sym *find_worker_task_sym(struct report_worker *w,
+					struct ftrace_task_handle *task,
+					struct uftrace_record *rstack)
 {
-	char *symname = symbol_getname(entry->sym, entry->addr);
+	struct sym *sym;
 
-	pr_out("  %5d  ", entry->pid);
-	print_time_unit(entry->time_self);
-	pr_out("  %10lu  %-s\n", entry->nr_called, symname);
+	if (task->func)
+		return task->func;
 
-	symbol_putname(entry->sym, symname);
+	pthread_mutex_lock(&w->rp->sym_lock);
+	sym = find_task_sym(w->rp->handle, task, rstack);
+	pthread_mutex_unlock(&w->rp->sym_lock);
+
+	return sym;
 }
 
-static void report_threads(struct ftrace_file_handle *handle, struct opts *opts)
+static void build_thread_tree(struct ftrace_file_handle *handle,
+			      struct report_hash *hash, struct opts *opts,
+			      struct report_worker *w)
 {
 	struct trace_entry te;
 	struct uftrace_record *rstack;
-	struct rb_root name_tree = RB_ROOT;
 	struct ftrace_task_handle *task;
 	struct fstack *fstack;
-	const char t_format[] = "  %5.5s  %10.10s  %10.10s  %-.*s\n";
-	const char line[] = "=================================================";
 
 	while (read_rstack(handle, &task) >= 0 && !uftrace_done) {
 		rstack = task->rstack;
@@ -809,10 +985,15 @@ static void report_threads(struct ftrace_file_handle *handle, struct opts *opts)
 		fstack = &task->func_stack[task->stack_count];
 
 		te.pid = task->tid;
-		te.sym = find_task_sym(handle, task, rstack);
 		te.addr = rstack->addr;
 		te.time_recursive = 0;
 
+		/* the main task should be checked in the original handle */
+		if (w)
+			te.sym = find_worker_task_sym(w, task, rstack);
+		else
+			te.sym = find_task_sym(handle, task, rstack);
+
 		if (rstack->type == UFTRACE_ENTRY) {
 			te.time_total = te.time_self = 0;
 			te.nr_called = 0;
@@ -823,8 +1004,146 @@ static void report_threads(struct ftrace_file_handle *handle, struct opts *opts)
 			te.nr_called = 1;
 		}
 
-		insert_entry(&name_tree, &te, true);
+		add_hash_entry(get_hash_entry(hash, NULL, te.pid, NULL), &te);
 	}
+}
+
+static void *report_worker_thread(void *arg)
+{
+	struct report_worker *w = arg;
+	struct report_parallel *rp = w->rp;
+	struct ftrace_file_handle *handle = rp->handle;
+	struct ftrace_file_handle sub;
+	sigset_t sigset;
+	int idx;
+
+	/* signals should be handled by the main thread */
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+
+	while (!uftrace_done) {
+		idx = __sync_fetch_and_add(&rp->next, 1);
+		if (idx >= handle->nr_tasks)
+			break;
+
+		setup_single_task_handle(handle, idx, &sub);
+
+		if (rp->thread)
+			build_thread_tree(&sub, &w->hash, rp->opts, w);
+		else
+			build_function_tree(&sub, &w->hash, rp->opts);
+
+		finish_single_task_handle(handle, &sub);
+	}
+
+	return NULL;
+}
+
+static void build_report_tree(struct ftrace_file_handle *handle,
+			      struct rb_root *root, struct opts *opts,
+			      bool thread)
+{
+	struct report_parallel rp = {
+		.handle = handle,
+		.opts   = opts,
+		.thread = thread,
+	};
+	struct report_hash hash = {};
+	struct report_worker *workers;
+	int i, nr = handle->nr_jobs;
+
+	if (!can_read_tasks_parallel(handle, opts)) {
+		if (thread)
+			build_thread_tree(handle, &hash, opts, NULL);
+		else
+			build_function_tree(handle, &hash, opts);
+
+		merge_report_hash(handle, root, &hash, thread);
+		return;
+	}
+
+	if (nr > handle->nr_tasks)
+		nr = handle->nr_tasks;
+
+	pr_dbg("start %d worker thread(s) for %d task(s)\n",
+	       nr, handle->nr_tasks);
+
+	pthread_mutex_init(&rp.sym_lock, NULL);
+
+	workers = xcalloc(nr, sizeof(*workers));
+	for (i = 0; i < nr; i++) {
+		workers[i].rp = &rp;
+		pthread_create(&workers[i].thread, NULL,
+			       report_worker_thread, &workers[i]);
+	}
+
+	for (i = 0; i < nr; i++) {
+		pthread_join(workers[i].thread, NULL);
+		merge_report_hash(handle, root, &workers[i].hash, thread);
+	}
+
+	pthread_mutex_destroy(&rp.sym_lock);
+	free(workers);
+}
+
+static void report_functions(struct ftrace_file_handle *handle, struct opts *opts)
+{
+	struct rb_root name_tree = RB_ROOT;
+	struct rb_root sort_tree = RB_ROOT;
+	const char f_format[] = "  %10.10s  %10.10s  %10.10s  %-.*s\n";
+	const char line[] = "=================================================";
+
+	build_report_tree(handle, &name_tree, opts, false);
+
+	while (!RB_EMPTY_ROOT(&name_tree) && !uftrace_done) {
+		struct rb_node *node;
+		struct trace_entry *entry;
+
+		node = rb_first(&name_tree);
+		rb_erase(node, &name_tree);
+
+		entry = rb_entry(node, struct trace_entry, link);
+		if (avg_mode == AVG_TOTAL)
+			entry->time_avg = entry->time_total / entry->nr_called;
+		else if (avg_mode == AVG_SELF)
+			entry->time_avg = entry->time_self / entry->nr_called;
+
+		sort_entries(&sort_tree, entry);
+	}
+
+	if (uftrace_done)
+		return;
+
+	if (avg_mode == AVG_NONE)
+		pr_out(f_format, "Total time", "Self time", "Calls", maxlen, "Function");
+	else if (avg_mode == AVG_TOTAL)
+		pr_out(f_format, "Avg total", "Min total", "Max total", maxlen, "Function");
+	else if (avg_mode == AVG_SELF)
+		pr_out(f_format, "Avg self", "Min self", "Max self", maxlen, "Function");
+
+	pr_out(f_format, line, line, line, maxlen, line);
+
+	print_and_delete(&sort_tree, print_function);
+}
+
+static void print_thread(struct trace_entry *entry)
+{
+	char *symname = symbol_getname(entry->sym, entry->addr);
+
+	pr_out("  %5d  ", entry->pid);
+	print_time_unit(entry->time_self);
+	pr_out("  %10lu  %-s\n", entry->nr_called, symname);
+
+	symbol_putname(entry->sym, symname);
+}
+
+static void report_threads(struct ftrace_file_handle *handle, struct opts *opts)
+{
+	struct rb_root name_tree = RB_ROOT;
+	const char t_format[] = "  %5.5s  %10.10s  %10.10s  %-.*s\n";
+	const char line[] = "=================================================";
+
+	build_report_tree(handle, &name_tree, opts, true);
 
 	if (uftrace_done)
 		return;
@@ -860,7 +1179,8 @@ static void sort_by_name(struct rb_root *root, struct trace_entry *te)
 			continue;
 		}
 
-		ret = strcmp(entry->sym->name, te->sym->name);
+		ret = strcmp(symbol_getname(entry->sym, entry->addr),
+			     symbol_getname(te->sym, te->addr));
 		if (ret == 0) {
 			entry->time_total += te->time_total;
 			entry->time_self  += te->time_self;
@@ -897,11 +1217,12 @@ static struct trace_entry * find_by_name(struct rb_root *root,
 	struct rb_node *parent = NULL;
 	struct rb_node **p = &root->rb_node;
 	char *name;
+	int cmp;
 
 	if (base->sym == NULL)
 		return NULL;
 
-	name = base->sym->name;
+	name = symbol_getname(base->sym, base->addr);
 	while (*p) {
 		parent = *p;
 		entry = rb_entry(parent, struct trace_entry, link);
@@ -914,10 +1235,11 @@ static struct trace_entry * find_by_name(struct rb_root *root,
 			continue;
 		}
 
-		if (strcmp(entry->sym->name, name) == 0)
+		cmp = strcmp(symbol_getname(entry->sym, entry->addr), name);
+		if (cmp == 0)
 			return entry;
 
-		if (strcmp(entry->sym->name, name) < 0)
+		if (cmp < 0)
 			p = &parent->rb_left;
 		else
 			p = &parent->rb_right;
@@ -1149,7 +1471,7 @@ static void report_diff(struct ftrace_file_handle *handle, struct opts *opts)
 		f_idx = 3;
 	}
 
-	build_function_tree(handle, &tmp, opts);
+	build_report_tree(handle, &tmp, opts, false);
 	sort_function_name(&tmp, &name_tree);
 
 	tmp = RB_ROOT;
@@ -1160,7 +1482,7 @@ static void report_diff(struct ftrace_file_handle *handle, struct opts *opts)
 	}
 
 	fstack_setup_filters(&dummy_opts, &data.handle);
-	build_function_tree(&data.handle, &tmp, &dummy_opts);
+	build_report_tree(&data.handle, &tmp, &dummy_opts, false);
 	sort_function_name(&tmp, &data.root);
 
 	calculate_diff(&name_tree, &data.root, &diff_tree, opts->sort_column);
@@ -7,25 +7,60 @@
 #include <ncurses.h>
 #include <locale.h>
 #include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include "uftrace.h"
 #include "utils/utils.h"
 #include "utils/fstack.h"
 #include "utils/graph.h"
+#include "utils/intern.h"
 #include "utils/list.h"
 #include "utils/rbtree.h"
 #include "utils/field.h"
 
 #define KEY_ESCAPE  27
 
+/* number of records to load at once and screen refresh interval (msec) */
+#define TUI_LOAD_BATCH    1024
+#define TUI_REFRESH_MSEC  200
+
 static bool tui_finished;
 static bool tui_debug;
 
+/*
+ * The graphs and report are built by a loader thread while the UI is
+ * running.  They're protected by a big lock which the loader releases
+ * after each batch of records and the UI holds while handling a key.
+ */
+static pthread_t tui_loader;
+static pthread_mutex_t tui_lock = PTHREAD_MUTEX_INITIALIZER;
+static int tui_ui_waiting;
+static bool tui_loaded;
+static bool tui_load_stop;
+static unsigned long tui_load_gen;
+static uint64_t tui_nr_records;
+
+/* fold state of the children, it's applied when they're shown */
+enum tui_fold_state {
+	TUI_FOLD_NONE,
+	TUI_FOLD_ALL,
+	TUI_UNFOLD_ALL,
+};
+
 struct tui_graph_node {
 	struct uftrace_graph_node n;
 	struct list_head link; // for tui_report_node.head
 	struct tui_graph *graph;
 	bool folded;
+	enum tui_fold_state pending;
+	/* creation order (same as the sibling order) and depth in the tree */
+	unsigned long seq;
+	int level;
+	/* lines of the (visible) subtree and the line offset from the parent */
+	int lines;
+	int line_offset;
+	bool lines_valid;
 };
 
 struct tui_report_node {
@@ -33,6 +68,7 @@ struct tui_report_node {
 	struct rb_node sort_link;
 	struct list_head head; // links tui_graph_node.link
 	char *name;
+	unsigned name_id;
 	uint64_t time;
 	uint64_t min_time;
 	uint64_t max_time;
@@ -41,6 +77,7 @@ struct tui_report_node {
 	uint64_t max_self_time;
 	uint64_t recursive_time;
 	unsigned calls;
+	bool match;
 };
 
 struct tui_report {
@@ -55,6 +92,29 @@ struct tui_report {
 	int nr_sess;
 	int nr_func;
 	int nr_search;
+	/* report nodes indexed by name id */
+	struct tui_report_node **nodes;
+	unsigned nr_nodes;
+	unsigned long load_gen;
+};
+
+/* graph nodes with a same name */
+struct tui_name_nodes {
+	struct tui_graph_node **nodes;
+	int nr;
+	int alloc;
+};
+
+/* inverted index of graph nodes for search */
+struct tui_search_index {
+	struct tui_name_nodes *names;  /* indexed by name id */
+	unsigned nr_names;
+	unsigned *ids;                 /* name ids in the index */
+	unsigned nr_ids;
+	struct tui_graph_node **match; /* nodes matching the search */
+	unsigned nr_match;
+	bool match_sorted;             /* in the display order */
+	bool root_match;
 };
 
 struct tui_graph {
@@ -71,6 +131,11 @@ struct tui_graph {
 	bool *curr_mask;
 	size_t mask_size;
 	int nr_search;
+	unsigned long load_gen;
+	uint64_t root_time;
+	struct tui_search_index index;
+	/* line offsets of the children of the root are valid */
+	bool lines_valid;
 };
 
 static LIST_HEAD(tui_graph_list);
@@ -78,6 +143,7 @@ static LIST_HEAD(graph_output_fields);
 static struct tui_report tui_report;
 static struct tui_graph partial_graph;
 static char *tui_search;
+static unsigned long tui_node_seq;
 
 #define FIELD_SPACE  2
 #define FIELD_SEP  " :"
@@ -294,12 +360,18 @@ static struct uftrace_graph * get_graph(struct ftrace_task_handle *task,
 }
 
 static struct tui_report_node * find_report_node(struct tui_report *report,
-						 char *symname)
+						 unsigned name_id)
 {
 	struct tui_report_node *node;
 	struct rb_node *parent = NULL;
 	struct rb_node **p = &report->name_tree.rb_node;
+	char *symname;
 
+	if (name_id < report->nr_nodes && report->nodes[name_id])
+		return report->nodes[name_id];
+
+	/* the tree is sorted by name, only new names are added here */
+	symname = intern_name(name_id);
 	while (*p) {
 		int cmp;
 
@@ -317,13 +389,25 @@ static struct tui_report_node * find_report_node(struct tui_report *report,
 	}
 
 	node = xzalloc(sizeof(*node));
-	node->name = xstrdup(symname);
+	node->name = symname;
+	node->name_id = name_id;
 	INIT_LIST_HEAD(&node->head);
 
 	rb_link_node(&node->name_link, parent, p);
 	rb_insert_color(&node->name_link, &report->name_tree);
 	report->nr_func++;
 
+	if (name_id >= report->nr_nodes) {
+		unsigned nr = ALIGN(name_id + 1, 1024);
+
+		report->nodes = xrealloc(report->nodes,
+					 nr * sizeof(*report->nodes));
+		memset(report->nodes + report->nr_nodes, 0,
+		       (nr - report->nr_nodes) * sizeof(*report->nodes));
+		report->nr_nodes = nr;
+	}
+	report->nodes[name_id] = node;
+
 	return node;
 }
 
@@ -331,6 +415,11 @@ static void prepare_report_node(struct tui_report_node *node)
 {
 	struct tui_graph_node *gn;
 
+	/* it can be sorted again while loading */
+	node->time      = 0;
+	node->self_time = 0;
+	node->calls     = 0;
+
 	list_for_each_entry(gn, &node->head, link) {
 		node->time      += gn->n.time;
 		node->self_time += gn->n.time - gn->n.child_time;
@@ -380,6 +469,8 @@ static void sort_tui_report(struct tui_report *report)
 	struct rb_node *node = rb_first(&report->name_tree);
 	struct tui_report_node *tui_node;
 
+	report->sort_tree = RB_ROOT;
+
 	while (node) {
 		tui_node = rb_entry(node, struct tui_report_node, name_link);
 		sort_report_node(report, tui_node);
@@ -388,6 +479,88 @@ static void sort_tui_report(struct tui_report *report)
 	}
 }
 
+static int node_level(struct tui_graph_node *node)
+{
+	/* root is not a tui_graph_node, do not access the fields */
+	if (node->n.parent == NULL)
+		return 0;
+
+	return node->level;
+}
+
+/*
+ * Line counts are updated lazily.  When a node is added or (un)folded,
+ * the node and its parents are marked invalid.  It stops at an invalid
+ * node as its parents should be invalid already (or it's in a folded
+ * subtree which doesn't change the line count of the parents).
+ */
+static void invalidate_graph_lines(struct uftrace_graph_node *n)
+{
+	struct tui_graph_node *node;
+
+	while (n->parent) {
+		node = (struct tui_graph_node *)n;
+		if (!node->lines_valid)
+			return;
+
+		node->lines_valid = false;
+		n = n->parent;
+	}
+
+	/* root is not a tui_graph_node */
+	container_of(n, struct tui_graph, ug.root)->lines_valid = false;
+}
+
+static void add_search_index(struct tui_graph *graph,
+			     struct tui_graph_node *node)
+{
+	struct tui_search_index *index = &graph->index;
+	struct tui_name_nodes *nn;
+	unsigned id = node->n.name_id;
+
+	node->seq = ++tui_node_seq;
+	node->level = node_level((void *)node->n.parent) + 1;
+
+	if (id >= index->nr_names) {
+		unsigned nr = ALIGN(id + 1, 1024);
+
+		index->names = xrealloc(index->names,
+					nr * sizeof(*index->names));
+		memset(index->names + index->nr_names, 0,
+		       (nr - index->nr_names) * sizeof(*index->names));
+		index->nr_names = nr;
+	}
+
+	nn = &index->names[id];
+	if (nn->nr == 0) {
+		if (index->nr_ids % 1024 == 0) {
+			index->ids = xrealloc(index->ids,
+					      (index->nr_ids + 1024) * sizeof(*index->ids));
+		}
+		index->ids[index->nr_ids++] = id;
+	}
+
+	if (nn->nr == nn->alloc) {
+		nn->alloc = nn->alloc ? nn->alloc * 2 : 4;
+		nn->nodes = xrealloc(nn->nodes, nn->alloc * sizeof(*nn->nodes));
+	}
+	nn->nodes[nn->nr++] = node;
+}
+
+static void reset_search_index(struct tui_search_index *index)
+{
+	unsigned i;
+
+	for (i = 0; i < index->nr_ids; i++)
+		free(index->names[index->ids[i]].nodes);
+
+	free(index->names);
+	free(index->ids);
+	free(index->match);
+
+	memset(index, 0, sizeof(*index));
+}
+
 static bool list_is_none(struct list_head *list)
 {
 	return list->next == NULL && list->prev == NULL;
@@ -400,7 +573,7 @@ static int build_tui_node(struct ftrace_task_handle *task,
 	struct uftrace_graph *graph;
 	struct tui_graph_node *graph_node;
 	struct sym *sym;
-	char *name;
+	unsigned name_id;
 
 	tg = graph_get_task(task, sizeof(*tg));
 	graph = get_graph(task, rec->time, rec->addr);
@@ -412,7 +585,7 @@ static int build_tui_node(struct ftrace_task_handle *task,
 
 	sym = task_find_sym_addr(&task->h->sessions,
 				 task, rec->time, rec->addr);
-	name = symbol_getname(sym, rec->addr);
+	name_id = symbol_getname_id(sym, rec->addr);
 
 	if (rec->type == UFTRACE_EXIT) {
 		struct fstack *fstack = &task->func_stack[task->stack_count];
@@ -421,7 +594,7 @@ static int build_tui_node(struct ftrace_task_handle *task,
 		struct tui_report_node *node;
 		int i;
 
-		node = find_report_node(&tui_report, name);
+		node = find_report_node(&tui_report, name_id);
 
 		graph_node = (struct tui_graph_node *)tg->node;
 		if (list_is_none(&graph_node->link))
@@ -444,31 +617,33 @@ static int build_tui_node(struct ftrace_task_handle *task,
 		}
 	}
 
-	graph_add_node(tg, rec->type, name, sizeof(struct tui_graph_node));
+	graph_add_node(tg, rec->type, name_id, sizeof(struct tui_graph_node));
 	if (tg->node && tg->node != &graph->root) {
 		graph_node = (struct tui_graph_node *)tg->node;
 		graph_node->graph = (struct tui_graph *)graph;
+
+		/* it's a new node */
+		if (graph_node->seq == 0) {
+			add_search_index(graph_node->graph, graph_node);
+			invalidate_graph_lines(graph_node->n.parent);
+		}
 	}
 
-	symbol_putname(sym, name);
 	return 0;
 }
 
 static struct tui_graph_node * append_graph_node(struct uftrace_graph_node *dst,
 						 struct tui_graph *graph,
-						 char *name)
+						 unsigned name_id)
 {
 	struct tui_graph_node *node;
 
-	node = xzalloc(sizeof(*node));
-
-	node->n.name = xstrdup(name);
-	INIT_LIST_HEAD(&node->n.head);
-
-	node->n.parent = dst;
+	node = (void *)graph_add_child(&partial_graph.ug, dst, name_id,
+				       sizeof(*node));
 	node->graph = graph;
-	list_add_tail(&node->n.list, &dst->head);
-	dst->nr_edges++;
+
+	add_search_index(&partial_graph, node);
+	invalidate_graph_lines(dst);
 
 	return node;
 }
@@ -480,19 +655,16 @@ static void copy_graph_node(struct uftrace_graph_node *dst,
 	struct tui_graph_node *node;
 
 	list_for_each_entry(child, &src->head, list) {
-		list_for_each_entry(node, &dst->head, n.list) {
-			if (!strcmp(child->name, node->n.name))
-				break;
-		}
+		node = (void *)graph_find_child(dst, child->name_id);
 
-		if (list_no_entry(node, &dst->head, n.list)) {
+		if (node == NULL) {
 			struct tui_graph *graph;
 
 			node = (struct tui_graph_node *)src;
 			graph = node->graph;
 
 			node = append_graph_node(dst, graph,
-						 child->name);
+						 child->name_id);
 		}
 
 		node->n.time       += child->time;
@@ -511,6 +683,8 @@ static void build_partial_graph(struct tui_report_node *root_node,
 	char *str;
 
 	graph_destroy(&graph->ug);
+	reset_search_index(&graph->index);
+	graph->lines_valid = false;
 
 	graph->ug.sess = target->ug.sess;
 
@@ -526,7 +700,7 @@ static void build_partial_graph(struct tui_report_node *root_node,
 
 	/* special node */
 	root = append_graph_node(&graph->ug.root, target,
-				 "========== Back-trace ==========");
+				 intern_id("========== Back-trace =========="));
 
 	list_for_each_entry(node, &root_node->head, link) {
 		struct tui_graph_node *tmp, *parent;
@@ -539,7 +713,7 @@ static void build_partial_graph(struct tui_report_node *root_node,
 		parent = node;
 
 		while (parent->n.parent) {
-			tmp = append_graph_node(&tmp->n, target, parent->n.name);
+			tmp = append_graph_node(&tmp->n, target, parent->n.name_id);
 
 			tmp->n.time       = node->n.time;
 			tmp->n.child_time = node->n.child_time;
@@ -559,9 +733,9 @@ static void build_partial_graph(struct tui_report_node *root_node,
 
 	/* special node */
 	root = append_graph_node(&graph->ug.root, target,
-				 "========== Call Graph ==========");
+				 intern_id("========== Call Graph =========="));
 
-	root = append_graph_node(&root->n, target, root_node->name);
+	root = append_graph_node(&root->n, target, root_node->name_id);
 
 	list_for_each_entry(node, &root_node->head, link) {
 		if (node->graph != target)
@@ -586,6 +760,93 @@ static inline bool is_special_node(struct uftrace_graph_node *node)
 	return node->name[0] == '=';
 }
 
+static void fold_graph_node(struct tui_graph_node *node, bool fold)
+{
+	/* do not fold leaf nodes - it's meaningless but confusing */
+	if (list_empty(&node->n.head))
+		return;
+
+	node->folded = fold;
+
+	/* descendants will be updated when they're shown */
+	node->pending = fold ? TUI_FOLD_ALL : TUI_UNFOLD_ALL;
+	invalidate_graph_lines(&node->n);
+}
+
+/* caller should not pass the root node which is not a tui_graph_node */
+static void apply_pending_fold(struct tui_graph_node *node)
+{
+	struct tui_graph_node *child;
+
+	if (node->pending == TUI_FOLD_NONE)
+		return;
+
+	list_for_each_entry(child, &node->n.head, n.list)
+		fold_graph_node(child, node->pending == TUI_FOLD_ALL);
+
+	node->pending = TUI_FOLD_NONE;
+}
+
+static int get_subtree_lines(struct tui_graph_node *node);
+
+/* update line offsets of the children, returns lines of the subtree */
+static int update_child_lines(struct uftrace_graph_node *parent)
+{
+	struct tui_graph_node *child;
+	int offset = 1;
+
+	list_for_each_entry(child, &parent->head, n.list) {
+		child->line_offset = offset;
+		/* an empty line between siblings */
+		offset += get_subtree_lines(child) + 1;
+	}
+
+	return offset - 1;
+}
+
+/* caller should not pass the root node which is not a tui_graph_node */
+static int get_subtree_lines(struct tui_graph_node *node)
+{
+	if (node->lines_valid)
+		return node->lines;
+
+	if (list_empty(&node->n.head) || node->folded) {
+		node->lines = 1;
+	}
+	else {
+		/* children will be shown */
+		apply_pending_fold(node);
+		node->lines = update_child_lines(&node->n);
+	}
+
+	node->lines_valid = true;
+	return node->lines;
+}
+
+/* line index of a (visible) node, the root is at 0 */
+static int get_graph_index(struct tui_graph *graph,
+			   struct tui_graph_node *node)
+{
+	struct tui_graph_node *parent = (void *)node->n.parent;
+	int index;
+
+	if (parent == NULL)
+		return 0;
+
+	index = get_graph_index(graph, parent);
+
+	if (parent->n.parent == NULL) {
+		if (!graph->lines_valid)
+			update_child_lines(&graph->ug.root);
+		graph->lines_valid = true;
+	}
+	else {
+		get_subtree_lines(parent);
+	}
+
+	return index + node->line_offset;
+}
+
 static struct tui_graph_node * graph_prev_node(struct tui_graph_node *node,
 					       int *depth, bool *indent_mask)
 {
@@ -615,6 +876,8 @@ static struct tui_graph_node * graph_prev_node(struct tui_graph_node *node,
 
 	/* if it has children, move to the last child */
 	while (!list_empty(&n->head) && !node->folded) {
+		apply_pending_fold(node);
+
 		if (!list_is_singular(&n->head)) {
 			if (indent_mask)
 				indent_mask[*depth] = false;
@@ -646,6 +909,9 @@ static struct tui_graph_node * graph_next_node(struct tui_graph_node *node,
 
 	/* simple case: if it has children, move to it */
 	if (!list_empty(&n->head) && (parent == NULL || !node->folded)) {
+		if (parent)
+			apply_pending_fold(node);
+
 		if (!list_is_singular(&n->head)) {
 			if (indent_mask)
 				indent_mask[*depth] = true;
@@ -684,6 +950,46 @@ static struct tui_graph_node * graph_next_node(struct tui_graph_node *node,
 	return NULL;
 }
 
+/* depth and indent mask of a node as if it's reached from the root */
+static int get_graph_depth(struct tui_graph_node *node, bool *indent_mask,
+			   bool self)
+{
+	struct tui_graph_node *parent = (void *)node->n.parent;
+	int depth;
+
+	if (parent == NULL || is_special_node(&node->n))
+		return 0;
+
+	depth = get_graph_depth(parent, indent_mask, false);
+	if (list_is_singular(&parent->n.head))
+		return depth;
+
+	/* the line continues to the node itself or to the next sibling */
+	indent_mask[depth] = self || !is_last_child(parent, node);
+	return depth + 1;
+}
+
+/* estimate loading progress (in percent) from the task data files */
+static int tui_load_progress(struct ftrace_file_handle *handle)
+{
+	uint64_t pos = 0, size = 0;
+	int i;
+
+	for (i = 0; i < handle->nr_tasks; i++) {
+		struct uftrace_data_map *dm = handle->tasks[i].map;
+
+		if (dm == NULL)
+			continue;
+
+		pos  += dm->pos;
+		size += dm->size;
+	}
+
+	if (size == 0)
+		return 0;
+	return pos * 100 / size;
+}
+
 static void print_graph_header(struct ftrace_file_handle *handle,
 			       struct tui_graph *graph)
 {
@@ -732,6 +1038,11 @@ static void print_graph_footer(struct ftrace_file_handle *handle,
 		snprintf(buf, COLS, "uftrace graph: searching \"%s\"  (%d match, %s)",
 			 tui_search, graph->nr_search, "use '<' and '>' keys to navigate");
 	}
+	else if (!tui_loaded) {
+		snprintf(buf, COLS, "uftrace graph: session %.*s (%s)  loading %d%% (%"PRIu64" records)",
+			 SESSION_ID_LEN, sess->sid, sess->exename,
+			 tui_load_progress(handle), tui_nr_records);
+	}
 	else {
 		snprintf(buf, COLS, "uftrace graph: session %.*s (%s)",
 			 SESSION_ID_LEN, sess->sid, sess->exename);
@@ -893,21 +1204,32 @@ next:
 	print_graph_footer(handle, graph);
 }
 
+/* top (root) is an artificial node, fill the info */
+static void update_graph_root(struct tui_graph *graph)
+{
+	struct uftrace_graph_node *root = &graph->ug.root;
+	struct uftrace_graph_node *node;
+	uint64_t time = 0;
+
+	list_for_each_entry(node, &root->head, list)
+		time += node->time;
+
+	/* root might have its own time, only update the children part */
+	root->time       += time - graph->root_time;
+	root->child_time += time - graph->root_time;
+	root->nr_calls = 1;
+
+	graph->root_time = time;
+}
+
 static void tui_graph_init(struct opts *opts)
 {
 	struct tui_graph *graph;
-	struct uftrace_graph_node *node;
 
 	list_for_each_entry(graph, &tui_graph_list, list) {
-		/* top (root) is an artificial node, fill the info */
 		graph->top = (struct tui_graph_node*)&graph->ug.root;
 		graph->top->n.name = basename(graph->ug.sess->exename);
-
-		list_for_each_entry(node, &graph->ug.root.head, list) {
-			graph->top->n.time       += node->time;
-			graph->top->n.child_time += node->time;
-		}
-		graph->top->n.nr_calls = 1;
+		update_graph_root(graph);
 
 		graph->curr = graph->top;
 		graph->curr_index = graph->top_index;
@@ -934,11 +1256,13 @@ static void tui_graph_finish(void)
 
 	list_for_each_entry(graph, &tui_graph_list, list) {
 		graph_destroy(&graph->ug);
+		reset_search_index(&graph->index);
 		free(graph->top_mask);
 		free(graph->curr_mask);
 	}
 
 	graph_destroy(&partial_graph.ug);
+	reset_search_index(&partial_graph.index);
 	free(partial_graph.top_mask);
 	free(partial_graph.curr_mask);
 }
@@ -1190,22 +1514,10 @@ static void tui_graph_enter(struct tui_graph *graph)
 	if (graph->curr->n.parent == NULL)
 		return;
 
-	if (!list_empty(&graph->curr->n.head))
+	if (!list_empty(&graph->curr->n.head)) {
 		graph->curr->folded = !graph->curr->folded;
-}
-
-static void fold_graph_node(struct tui_graph_node *node, bool fold)
-{
-	struct tui_graph_node *child;
-
-	/* do not fold leaf nodes - it's meaningless but confusing */
-	if (list_empty(&node->n.head))
-		return;
-
-	node->folded = fold;
-
-	list_for_each_entry(child, &node->n.head, n.list)
-		fold_graph_node(child, fold);
+		invalidate_graph_lines(&graph->curr->n);
+	}
 }
 
 static void tui_graph_collapse(struct tui_graph *graph)
@@ -1229,8 +1541,11 @@ static void tui_report_init(struct opts *opts)
 	struct rb_node *node;
 
 	sort_tui_report(&tui_report);
+	tui_report.load_gen = tui_load_gen;
 
 	node = rb_first(&tui_report.sort_tree);
+	if (node == NULL)
+		return;  /* nothing loaded yet */
 
 	tui_report.top = rb_entry(node, struct tui_report_node, sort_link);
 	tui_report.curr = tui_report.top;
@@ -1387,6 +1702,11 @@ static void print_report_footer(struct ftrace_file_handle *handle,
 		snprintf(buf, COLS, "uftrace report: searching \"%s\"  (%d match, %s)",
 			 tui_search, report->nr_search, "use '<' and '>' keys to navigate");
 	}
+	else if (!tui_loaded) {
+		snprintf(buf, COLS, "uftrace report: %s (%d sessions, %d functions)  loading %d%%",
+			 handle->dirname, report->nr_sess, report->nr_func,
+			 tui_load_progress(handle));
+	}
 	else {
 		snprintf(buf, COLS, "uftrace report: %s (%d sessions, %d functions)",
 			 handle->dirname, report->nr_sess, report->nr_func);
@@ -1517,29 +1837,38 @@ out:
 	return str;
 }
 
-static int count_graph_node(struct uftrace_graph_node *node)
-{
-	int n = 0;
-	struct uftrace_graph_node *child;
-
-	if (strstr(node->name, tui_search))
-		n = 1;
-
-	list_for_each_entry(child, &node->head, list)
-		n += count_graph_node(child);
-
-	return n;
-}
-
 static void tui_search_graph_count(struct tui_graph *graph)
 {
+	struct tui_search_index *index = &graph->index;
+	unsigned i;
+
 	if (tui_search == NULL)
 		return;
 
 	if (graph->nr_search != -1)
 		return;
 
-	graph->nr_search = count_graph_node(&graph->ug.root);
+	/* check each name once, not every node */
+	index->nr_match = 0;
+	index->match_sorted = false;
+
+	index->root_match = strstr(graph->ug.root.name, tui_search);
+	graph->nr_search = index->root_match;
+
+	for (i = 0; i < index->nr_ids; i++) {
+		struct tui_name_nodes *nn = &index->names[index->ids[i]];
+
+		if (!strstr(nn->nodes[0]->n.name, tui_search))
+			continue;
+
+		index->match = xrealloc(index->match,
+					(index->nr_match + nn->nr) * sizeof(*index->match));
+		memcpy(&index->match[index->nr_match], nn->nodes,
+		       nn->nr * sizeof(*index->match));
+
+		index->nr_match += nn->nr;
+		graph->nr_search += nn->nr;
+	}
 }
 
 static void tui_search_report_count(struct tui_report *report)
@@ -1559,53 +1888,243 @@ static void tui_search_report_count(struct tui_report *report)
 	while (rb) {
 		node = rb_entry(rb, typeof(*node), sort_link);
 
-		if (strstr(node->name, tui_search))
+		node->match = strstr(node->name, tui_search);
+		if (node->match)
 			report->nr_search++;
 
 		rb = rb_next(rb);
 	}
 }
 
-static void tui_search_graph_prev(struct tui_graph *graph)
+/* compare position of nodes in the graph (as if it's fully expanded) */
+static int cmp_graph_pos(struct tui_graph_node *a, struct tui_graph_node *b)
+{
+	int level_a = node_level(a);
+	int level_b = node_level(b);
+
+	if (a == b)
+		return 0;
+
+	/* a descendant comes after the ancestor */
+	while (level_a > level_b) {
+		a = (void *)a->n.parent;
+		if (a == b)
+			return 1;
+		level_a--;
+	}
+	while (level_b > level_a) {
+		b = (void *)b->n.parent;
+		if (a == b)
+			return -1;
+		level_b--;
+	}
+
+	while (a->n.parent != b->n.parent) {
+		a = (void *)a->n.parent;
+		b = (void *)b->n.parent;
+	}
+
+	/* siblings are added in order */
+	return a->seq < b->seq ? -1 : 1;
+}
+
+/* returns the (top-most) folded node which hides the node, or NULL */
+static struct tui_graph_node * get_folded_parent(struct tui_graph_node *node)
+{
+	struct tui_graph_node *parent = (void *)node->n.parent;
+	struct tui_graph_node *child = node;
+	struct tui_graph_node *folded = NULL;
+
+	/* root is always expanded */
+	while (parent && parent->n.parent) {
+		/* pending state overrides the nodes below */
+		if (parent->pending != TUI_FOLD_NONE) {
+			if (child != node && parent->pending == TUI_FOLD_ALL)
+				folded = child;
+			else
+				folded = NULL;
+		}
+
+		if (parent->folded)
+			folded = parent;
+
+		child = parent;
+		parent = (void *)parent->n.parent;
+	}
+
+	return folded;
+}
+
+static int cmp_match_node(const void *a, const void *b)
+{
+	struct tui_graph_node * const *pa = a;
+	struct tui_graph_node * const *pb = b;
+
+	return cmp_graph_pos(*pa, *pb);
+}
+
+/* check if the node is in the subtree of the parent (but not itself) */
+static bool is_descendant(struct tui_graph_node *node,
+			  struct tui_graph_node *parent)
+{
+	int level = node_level(parent);
+
+	if (node == parent)
+		return false;
+
+	while (node_level(node) > level)
+		node = (void *)node->n.parent;
+
+	return node == parent;
+}
+
+/* first index of the matches which comes after the node (or in the subtree) */
+static unsigned search_match_index(struct tui_search_index *index,
+				   struct tui_graph_node *node, bool subtree)
+{
+	unsigned lo = 0, hi = index->nr_match;
+
+	while (lo < hi) {
+		unsigned mid = (lo + hi) / 2;
+		struct tui_graph_node *m = index->match[mid];
+
+		if (cmp_graph_pos(m, node) <= 0 ||
+		    (subtree && is_descendant(m, node)))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* find the closest (visible) node in the search index */
+static struct tui_graph_node * find_search_node(struct tui_graph *graph,
+						bool forward)
 {
-	struct tui_graph_node *node = graph->curr;
+	struct tui_search_index *index = &graph->index;
+	struct tui_graph_node *curr = graph->curr;
+	struct tui_graph_node *folded;
+	unsigned i;
+
+	tui_search_graph_count(graph);
+
+	/* matches are kept in the display order (as if fully expanded) */
+	if (!index->match_sorted) {
+		qsort(index->match, index->nr_match, sizeof(*index->match),
+		      cmp_match_node);
+		index->match_sorted = true;
+	}
+
+	if (forward) {
+		i = search_match_index(index, curr, false);
+
+		while (i < index->nr_match) {
+			folded = get_folded_parent(index->match[i]);
+			if (folded == NULL)
+				return index->match[i];
+
+			/* skip the matches in the folded subtree */
+			i = search_match_index(index, folded, true);
+		}
+		return NULL;
+	}
+
+	/* the matches before the current node (excluding itself) */
+	i = search_match_index(index, curr, false);
+	if (i > 0 && index->match[i - 1] == curr)
+		i--;
+
+	while (i > 0) {
+		folded = get_folded_parent(index->match[i - 1]);
+		if (folded == NULL)
+			return index->match[i - 1];
+
+		/* the folded node comes before the matches in the subtree */
+		i = search_match_index(index, folded, false);
+	}
+
+	/* root is the first node */
+	if (index->root_match && curr->n.parent != NULL)
+		return (struct tui_graph_node *)&graph->ug.root;
+
+	return NULL;
+}
+
+/* move the cursor to the node as if it moves up or down step by step */
+static void tui_graph_jump(struct tui_graph *graph,
+			   struct tui_graph_node *target, bool forward)
+{
+	struct tui_graph_node *node;
 	int depth;
+	int next_index;
 
-	if (tui_search == NULL)
+	graph->curr = target;
+	graph->curr_index = get_graph_index(graph, target);
+
+	/* simple case: it's in the current screen */
+	if (graph->curr_index >= graph->top_index &&
+	    graph->curr_index - graph->top_index < LINES - 2)
 		return;
 
-	while (true) {
-		node = graph_prev_node(node, &depth, NULL);
-		if (node == NULL)
-			return;
+	memset(graph->curr_mask, 0, graph->mask_size);
+	depth = get_graph_depth(target, graph->curr_mask, true);
+
+	/* moving up: the target will be the top */
+	if (!forward) {
+		graph->top = target;
+		graph->top_index = graph->curr_index;
+		graph->top_depth = depth;
+		memcpy(graph->top_mask, graph->curr_mask, graph->mask_size);
+		return;
+	}
+
+	/* moving down: the target will be at the bottom */
+	next_index = graph->curr_index;
+	node = target;
 
-		if (strstr(node->n.name, tui_search))
+	do {
+		graph->top = node;
+		graph->top_index = next_index;
+		graph->top_depth = depth;
+		memcpy(graph->top_mask, graph->curr_mask, graph->mask_size);
+
+		node = graph_prev_node(graph->top, &depth, graph->curr_mask);
+		if (node == NULL)
 			break;
+		next_index--;
+
+		if (!is_first_child(node, graph->top))
+			next_index--;
 	}
+	while (graph->curr_index - next_index < LINES - 2);
+}
 
-	while (graph->curr != node)
-		tui_graph_move_up(graph);
+static void tui_search_graph_prev(struct tui_graph *graph)
+{
+	struct tui_graph_node *node;
+
+	if (tui_search == NULL)
+		return;
+
+	node = find_search_node(graph, false);
+	if (node == NULL)
+		return;
+
+	tui_graph_jump(graph, node, false);
 }
 
 static void tui_search_graph_next(struct tui_graph *graph)
 {
-	struct tui_graph_node *node = graph->curr;
-	int depth;
+	struct tui_graph_node *node;
 
 	if (tui_search == NULL)
 		return;
 
-	while (true) {
-		node = graph_next_node(node, &depth, NULL);
-		if (node == NULL)
-			return;
-
-		if (strstr(node->n.name, tui_search))
-			break;
-	}
+	node = find_search_node(graph, true);
+	if (node == NULL)
+		return;
 
-	while (graph->curr != node)
-		tui_graph_move_down(graph);
+	tui_graph_jump(graph, node, true);
 }
 
 static void tui_search_report_prev(struct tui_report *report)
@@ -1615,6 +2134,8 @@ static void tui_search_report_prev(struct tui_report *report)
 	if (tui_search == NULL)
 		return;
 
+	tui_search_report_count(report);
+
 	while (true) {
 		struct rb_node *n = rb_prev(&node->sort_link);
 
@@ -1623,7 +2144,7 @@ static void tui_search_report_prev(struct tui_report *report)
 
 		node = rb_entry(n, typeof(*node), sort_link);
 
-		if (strstr(node->name, tui_search))
+		if (node->match)
 			break;
 	}
 
@@ -1638,6 +2159,8 @@ static void tui_search_report_next(struct tui_report *report)
 	if (tui_search == NULL)
 		return;
 
+	tui_search_report_count(report);
+
 	while (true) {
 		struct rb_node *n = rb_next(&node->sort_link);
 
@@ -1646,7 +2169,7 @@ static void tui_search_report_next(struct tui_report *report)
 
 		node = rb_entry(n, typeof(*node), sort_link);
 
-		if (strstr(node->name, tui_search))
+		if (node->match)
 			break;
 	}
 
@@ -1654,16 +2177,120 @@ static void tui_search_report_next(struct tui_report *report)
 		tui_report_move_down(report);
 }
 
+/* update the graph after the loader added new nodes */
+static void tui_graph_refresh(struct tui_graph *graph)
+{
+	struct tui_graph_node *node = graph->top;
+	int depth;
+	int count = 0;
+
+	graph->load_gen = tui_load_gen;
+	update_graph_root(graph);
+
+	/* new nodes above the top move it down */
+	graph->top_index = get_graph_index(graph, graph->top);
+
+	/* new siblings can change the depth and mask of the top node */
+	memset(graph->top_mask, 0, graph->mask_size);
+	graph->top_depth = get_graph_depth(graph->top, graph->top_mask, true);
+
+	/* and new nodes between top and curr move the curr down */
+	depth = graph->top_depth;
+	memcpy(graph->curr_mask, graph->top_mask, graph->mask_size);
+
+	while (node != graph->curr && count < LINES - 2) {
+		struct tui_graph_node *next;
+
+		next = graph_next_node(node, &depth, graph->curr_mask);
+		if (next == NULL)
+			break;
+		count++;
+
+		if (!is_first_child(node, next))
+			count++;
+
+		node = next;
+	}
+
+	if (node == graph->curr && count < LINES - 2) {
+		graph->curr_index = graph->top_index + count;
+	}
+	else {
+		/* it's out of the screen, show it at the top */
+		graph->curr_index = get_graph_index(graph, graph->curr);
+		graph->top = graph->curr;
+		graph->top_index = graph->curr_index;
+
+		memset(graph->top_mask, 0, graph->mask_size);
+		graph->top_depth = get_graph_depth(graph->top, graph->top_mask, true);
+	}
+
+	graph->nr_search = -1;
+	tui_search_graph_count(graph);
+}
+
+/* sort the report again but keep the current node in the screen */
+static void tui_report_refresh(struct tui_report *report)
+{
+	struct rb_node *rb;
+	int offset = report->curr_index - report->top_index;
+
+	if (report->curr == NULL) {
+		tui_report_init(NULL);
+		goto out;
+	}
+
+	sort_tui_report(report);
+	report->load_gen = tui_load_gen;
+
+	report->curr_index = 0;
+	for (rb = rb_prev(&report->curr->sort_link); rb; rb = rb_prev(rb))
+		report->curr_index++;
+
+	report->top = report->curr;
+	report->top_index = report->curr_index;
+
+	while (offset-- > 0) {
+		rb = rb_prev(&report->top->sort_link);
+		if (rb == NULL)
+			break;
+
+		report->top = rb_entry(rb, struct tui_report_node, sort_link);
+		report->top_index--;
+	}
+
+out:
+	report->nr_search = -1;
+	tui_search_report_count(report);
+}
+
+static void tui_ui_lock(void)
+{
+	/* ask the loader to yield the lock */
+	__atomic_store_n(&tui_ui_waiting, 1, __ATOMIC_RELEASE);
+	pthread_mutex_lock(&tui_lock);
+	__atomic_store_n(&tui_ui_waiting, 0, __ATOMIC_RELEASE);
+}
+
+static void tui_ui_unlock(void)
+{
+	pthread_mutex_unlock(&tui_lock);
+}
+
 static void tui_main_loop(struct opts *opts, struct ftrace_file_handle *handle)
 {
 	int key = 0;
 	bool graph_mode = true;
 	bool full_redraw = true;
+	bool load_redraw = false;
+	bool loading;
 	struct tui_graph *graph;
 	struct tui_report *report;
 	struct tui_graph_node *old_graph_top = NULL;
 	struct tui_report_node *old_report_top = NULL;
 
+	tui_ui_lock();
+
 	tui_graph_init(opts);
 	tui_report_init(opts);
 	graph = list_first_entry(&tui_graph_list, typeof(*graph), list);
@@ -1735,9 +2362,14 @@ static void tui_main_loop(struct opts *opts, struct ftrace_file_handle *handle)
 		case 'g':
 			if (graph_mode) {
 				struct tui_report_node *func;
-				char *name = graph->curr->n.name;
+				struct uftrace_graph_node *node = &graph->curr->n;
+				unsigned name_id = node->name_id;
+
+				/* top (root) node doesn't have the id */
+				if (name_id == 0)
+					name_id = intern_id(node->name);
 
-				func = find_report_node(report, name);
+				func = find_report_node(report, name_id);
 				build_partial_graph(func, graph->curr->graph);
 			}
 			else {
@@ -1758,6 +2390,12 @@ static void tui_main_loop(struct opts *opts, struct ftrace_file_handle *handle)
 		case 'R':
 		case 'r':
 			if (graph_mode) {
+				if (report->load_gen != tui_load_gen)
+					tui_report_refresh(report);
+				/* nothing to show yet */
+				if (report->curr == NULL)
+					break;
+
 				graph_mode = false;  /* report mode */
 				full_redraw = true;
 				tui_search_report_count(report);
@@ -1818,11 +2456,23 @@ static void tui_main_loop(struct opts *opts, struct ftrace_file_handle *handle)
 			tui_debug = !tui_debug;
 			break;
 		case 'q':
+			tui_ui_unlock();
 			return;
 		default:
 			break;
 		}
 
+		/* the loader added more records */
+		if (graph_mode && graph != &partial_graph &&
+		    graph->load_gen != tui_load_gen) {
+			tui_graph_refresh(graph);
+			load_redraw = true;
+		}
+		if (!graph_mode && report->load_gen != tui_load_gen) {
+			tui_report_refresh(report);
+			load_redraw = true;
+		}
+
 		if (graph_mode && graph->top != old_graph_top)
 			full_redraw = true;
 		if (!graph_mode && report->top != old_report_top)
@@ -1830,54 +2480,57 @@ static void tui_main_loop(struct opts *opts, struct ftrace_file_handle *handle)
 
 		if (full_redraw)
 			clear();
+		else if (load_redraw)
+			erase();  /* do not clear the terminal to avoid flicker */
 
 		if (graph_mode)
-			tui_graph_display(handle, graph, full_redraw);
+			tui_graph_display(handle, graph, full_redraw || load_redraw);
 		else
-			tui_report_display(handle, report, full_redraw);
+			tui_report_display(handle, report, full_redraw || load_redraw);
 		refresh();
 
 		full_redraw = false;
+		load_redraw = false;
+		loading = !tui_loaded;
 
 		graph->old = graph->curr;
 		report->old = report->curr;
 		old_graph_top = graph->top;
 		old_report_top = report->top;
 
+		tui_ui_unlock();
+
+		/* update the screen periodically while loading */
+		timeout(loading ? TUI_REFRESH_MSEC : -1);
+
 		move(LINES-1, COLS-1);
 		key = getch();
+
+		tui_ui_lock();
 	}
 
 	tui_graph_finish();
 	tui_report_finish();
 }
 
-int command_tui(int argc, char *argv[], struct opts *opts)
+struct tui_loader_arg {
+	struct ftrace_file_handle *handle;
+	struct opts *opts;
+};
+
+/* returns false if there's no more record to load */
+static bool load_tui_records(struct ftrace_file_handle *handle,
+			     struct opts *opts, int count)
 {
-	int ret;
-	struct ftrace_file_handle handle;
 	struct ftrace_task_handle *task;
 
-	ret = open_data_file(opts, &handle);
-	if (ret < 0) {
-		pr_warn("cannot open record data: %s: %m\n", opts->dirname);
-		return -1;
-	}
+	while (count-- > 0) {
+		struct uftrace_record *rec;
 
-	setlocale(LC_ALL, "");
+		if (uftrace_done || read_rstack(handle, &task) != 0)
+			return false;
 
-	initscr();
-	init_colors();
-	keypad(stdscr, true);
-	noecho();
-
-	atexit(tui_cleanup);
-
-	tui_setup(&handle, opts);
-	fstack_setup_filters(opts, &handle);
-
-	while (read_rstack(&handle, &task) == 0 && !uftrace_done) {
-		struct uftrace_record *rec = task->rstack;
+		rec = task->rstack;
 
 		/* skip user functions if --kernel-only is set */
 		if (opts->kernel_only && !is_kernel_record(task, rec))
@@ -1895,13 +2548,79 @@ int command_tui(int argc, char *argv[], struct opts *opts)
 				continue;
 		}
 
-		ret = build_tui_node(task, rec);
-		if (ret)
-			break;
+		if (build_tui_node(task, rec))
+			return false;
+
+		tui_nr_records++;
 	}
 
+	return true;
+}
+
+static void *tui_load_thread(void *arg)
+{
+	struct tui_loader_arg *loader = arg;
+	bool more = true;
+
+	pthread_mutex_lock(&tui_lock);
+	while (more && !tui_load_stop) {
+		more = load_tui_records(loader->handle, loader->opts,
+					TUI_LOAD_BATCH);
+		tui_load_gen++;
+
+		pthread_mutex_unlock(&tui_lock);
+
+		/* let the UI handle the key (or refresh) first */
+		while (__atomic_load_n(&tui_ui_waiting, __ATOMIC_ACQUIRE))
+			sched_yield();
+
+		pthread_mutex_lock(&tui_lock);
+	}
+	tui_loaded = true;
+	pthread_mutex_unlock(&tui_lock);
+
+	pr_dbg("tui: loaded %"PRIu64" records\n", tui_nr_records);
+	return NULL;
+}
+
+int command_tui(int argc, char *argv[], struct opts *opts)
+{
+	int ret;
+	struct ftrace_file_handle handle;
+	struct tui_loader_arg loader = {
+		.handle = &handle,
+		.opts   = opts,
+	};
+
+	ret = open_data_file(opts, &handle);
+	if (ret < 0) {
+		pr_warn("cannot open record data: %s: %m\n", opts->dirname);
+		return -1;
+	}
+
+	setlocale(LC_ALL, "");
+
+	initscr();
+	init_colors();
+	keypad(stdscr, true);
+	noecho();
+
+	atexit(tui_cleanup);
+
+	tui_setup(&handle, opts);
+	fstack_setup_filters(opts, &handle);
+
+	/* show the UI while building the graphs */
+	if (pthread_create(&tui_loader, NULL, tui_load_thread, &loader) != 0)
+		pr_err("cannot create a loader thread");
+
 	tui_main_loop(opts, &handle);
 
+	tui_ui_lock();
+	tui_load_stop = true;
+	tui_ui_unlock();
+	pthread_join(tui_loader, NULL);
+
 	close_data_file(opts, &handle);
 
 	tui_cleanup();
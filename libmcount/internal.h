@@ -70,6 +70,19 @@ struct mcount_event {
 
 #define MAX_EVENT  4
 
+/* async script queue was full (not reported yet) */
+struct mcount_script_stat {
+	uint64_t	time;		/* when it was full at first */
+	uint64_t	dropped;
+	uint64_t	waited;
+};
+
+/* waited for a shmem buffer (--no-loss) but not reported yet */
+struct mcount_stall_stat {
+	uint64_t	time;		/* when it waited at first */
+	uint64_t	waited;
+};
+
 /*
  * The idx and record_idx are to save current index of the rstack.
  * In general, both will have same value but in case of cygprof
@@ -94,6 +107,8 @@ struct mcount_thread_data {
 	struct mcount_shmem		shmem;
 	struct mcount_event		event[MAX_EVENT];
 	int				nr_events;
+	struct mcount_script_stat	script;
+	struct mcount_stall_stat	stall;
 	struct mcount_arch_context	arch;
 };
 
@@ -123,6 +138,8 @@ void mcount_unguard_recursion(struct mcount_thread_data *mtdp);
 extern uint64_t mcount_threshold;  /* nsec */
 extern pthread_key_t mtd_key;
 extern int shmem_bufsize;
+extern int shmem_max_buf;
+extern bool shmem_no_loss;
 extern int pfd;
 extern char *mcount_exename;
 extern int page_size_in_kb;
@@ -312,6 +329,63 @@ void save_trigger_read(struct mcount_thread_data *mtdp,
 		       enum trigger_read_type type, bool diff);
 #endif  /* DISABLE_MCOUNT_FILTER */
 
+enum script_async_policy {
+	SCRIPT_ASYNC_DROP,
+	SCRIPT_ASYNC_BLOCK,
+};
+
+enum script_event_kind {
+	SCRIPT_EV_ENTRY,
+	SCRIPT_EV_EXIT,
+};
+
+/* arguments larger than this are not passed to the async script */
+#define SCRIPT_ARGBUF_SIZE  256
+
+/* a slot in the script queue to be passed to the script thread */
+struct script_event {
+	unsigned		seq;
+	unsigned		pos;
+	enum script_event_kind	kind;
+	int			tid;
+	int			depth;
+	int			arglen;
+	uint64_t		timestamp;
+	uint64_t		duration;
+	unsigned long		address;
+	struct list_head	*argspec;
+	char			argbuf[SCRIPT_ARGBUF_SIZE];
+};
+
+/* bounded multi-producer, single-consumer queue */
+struct script_queue {
+	struct script_event	*ring;
+	unsigned		mask;
+	unsigned		head;	/* next slot to reserve (producers) */
+	unsigned		tail;	/* next slot to read (consumer) */
+	unsigned		sleeping;
+	unsigned		waiters;
+	bool			stop;
+};
+
+extern bool script_async;
+
+void script_queue_init(struct script_queue *q, unsigned size);
+void script_queue_finish(struct script_queue *q);
+struct script_event *script_queue_reserve(struct script_queue *q);
+void script_queue_commit(struct script_queue *q, struct script_event *ev);
+struct script_event *script_queue_peek(struct script_queue *q);
+void script_queue_release(struct script_queue *q, struct script_event *ev);
+
+int script_async_init(const char *policy);
+void script_async_push(struct mcount_thread_data *mtdp,
+		       struct mcount_ret_stack *rstack,
+		       enum script_event_kind kind,
+		       struct list_head *argspec);
+void script_async_drain(void);
+void script_async_restart(void);
+void script_async_finish(void);
+
 struct mcount_dynamic_info {
 	struct mcount_dynamic_info *next;
 	char *mod_name;
@@ -41,6 +41,12 @@ struct symtabs symtabs = {
 /* size of shmem buffer to save uftrace_record */
 int shmem_bufsize = SHMEM_BUFFER_SIZE;
 
+/* max number of shmem buffers per thread (0 means no limit) */
+int shmem_max_buf;
+
+/* wait for the recorder rather than losing records */
+bool shmem_no_loss;
+
 /* global flag to control mcount behavior */
 unsigned long mcount_global_flags = MCOUNT_GFL_SETUP;
 
@@ -229,8 +235,10 @@ static void mcount_trace_finish(void)
 		return;
 
 	/* dtor for script support */
-	if (SCRIPT_ENABLED && script_str)
+	if (SCRIPT_ENABLED && script_str) {
+		script_async_finish();
 		script_uftrace_end();
+	}
 
 	if (pfd != -1) {
 		close(pfd);
@@ -543,8 +551,17 @@ static void script_hook_entry(struct mcount_thread_data *mtdp,
 {
 	struct script_context sc_ctx;
 	unsigned long entry_addr = rstack->child_ip;
-	struct sym *sym = find_symtabs(&symtabs, entry_addr);
-	char *symname = symbol_getname(sym, entry_addr);
+	struct sym *sym;
+	char *symname;
+
+	if (script_async) {
+		script_async_push(mtdp, rstack, SCRIPT_EV_ENTRY,
+				  tr->flags & TRIGGER_FL_ARGUMENT ? tr->pargs : NULL);
+		return;
+	}
+
+	sym = find_symtabs(&symtabs, entry_addr);
+	symname = symbol_getname(sym, entry_addr);
 
 	if (script_save_context(&sc_ctx, mtdp, rstack, symname,
 				tr->flags & TRIGGER_FL_ARGUMENT,
@@ -565,8 +582,17 @@ static void script_hook_exit(struct mcount_thread_data *mtdp,
 {
 	struct script_context sc_ctx;
 	unsigned long entry_addr = rstack->child_ip;
-	struct sym *sym = find_symtabs(&symtabs, entry_addr);
-	char *symname = symbol_getname(sym, entry_addr);
+	struct sym *sym;
+	char *symname;
+
+	if (script_async) {
+		script_async_push(mtdp, rstack, SCRIPT_EV_EXIT,
+				  rstack->flags & MCOUNT_FL_RETVAL ? rstack->pargs : NULL);
+		return;
+	}
+
+	sym = find_symtabs(&symtabs, entry_addr);
+	symname = symbol_getname(sym, entry_addr);
 
 	if (script_save_context(&sc_ctx, mtdp, rstack, symname,
 				rstack->flags & MCOUNT_FL_RETVAL,
@@ -1143,8 +1169,10 @@ static void atfork_prepare_handler(void)
 	};
 
 	/* call script atfork preparation routine */
-	if (SCRIPT_ENABLED && script_str)
+	if (SCRIPT_ENABLED && script_str) {
+		script_async_drain();
 		script_atfork_prepare();
+	}
 
 	uftrace_send_message(UFTRACE_MSG_FORK_START, &tmsg, sizeof(tmsg));
 }
@@ -1180,6 +1208,9 @@ static void atfork_child_handler(void)
 	clear_shmem_buffer(mtdp);
 	prepare_shmem_buffer(mtdp);
 
+	if (SCRIPT_ENABLED && script_str)
+		script_async_restart();
+
 	uftrace_send_message(UFTRACE_MSG_FORK_END, &tmsg, sizeof(tmsg));
 
 	update_kernel_tid(tmsg.tid);
@@ -1195,13 +1226,17 @@ static void mcount_script_init(enum uftrace_pattern_type patt_type)
 		.recording      = true,
 	};
 	char *args_str;
+	char *async_str;
 
 	args_str = getenv("UFTRACE_ARGS");
+	async_str = getenv("UFTRACE_SCRIPT_ASYNC");
 	if (args_str)
 		strv_split(&info.args, args_str, "\n");
 
 	if (script_init(&info, patt_type) < 0)
 		script_str = NULL;
+	else if (async_str)
+		script_async_init(async_str);
 
 	strv_free(&info.args);
 }
@@ -1212,6 +1247,7 @@ static void mcount_startup(void)
 	char *logfd_str;
 	char *debug_str;
 	char *bufsize_str;
+	char *maxbuf_str;
 	char *maxstack_str;
 	char *threshold_str;
 	char *color_str;
@@ -1240,6 +1276,8 @@ static void mcount_startup(void)
 	logfd_str = getenv("UFTRACE_LOGFD");
 	debug_str = getenv("UFTRACE_DEBUG");
 	bufsize_str = getenv("UFTRACE_BUFFER");
+	maxbuf_str = getenv("UFTRACE_MAX_BUFFER");
+	shmem_no_loss = !!getenv("UFTRACE_NO_LOSS");
 	maxstack_str = getenv("UFTRACE_MAX_STACK");
 	color_str = getenv("UFTRACE_COLOR");
 	threshold_str = getenv("UFTRACE_THRESHOLD");
@@ -1299,6 +1337,9 @@ static void mcount_startup(void)
 	if (bufsize_str)
 		shmem_bufsize = strtol(bufsize_str, NULL, 0);
 
+	if (maxbuf_str)
+		shmem_max_buf = strtol(maxbuf_str, NULL, 0);
+
 	dirname = getenv("UFTRACE_DIR");
 	if (dirname == NULL)
 		dirname = UFTRACE_DIR_NAME;
@@ -1359,8 +1400,10 @@ static void mcount_cleanup(void)
 #ifndef DISABLE_MCOUNT_FILTER
 	uftrace_cleanup_filter(&mcount_triggers);
 #endif
-	if (SCRIPT_ENABLED && script_str)
+	if (SCRIPT_ENABLED && script_str) {
+		script_async_finish();
 		script_finish();
+	}
 
 	unload_symtabs(&symtabs);
 	finish_pmu_event();
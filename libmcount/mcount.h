@@ -71,12 +71,14 @@ enum shmem_buffer_flags {
 	SHMEM_FL_NEW		= (1U << 0),
 	SHMEM_FL_WRITTEN	= (1U << 1),
 	SHMEM_FL_RECORDING	= (1U << 2),
+	SHMEM_FL_WAITING	= (1U << 3),  /* producer waits on the flag (futex) */
 };
 
 struct mcount_shmem_buffer {
 	unsigned size;
 	unsigned flag;
-	unsigned unused[2];
+	int      cpu;  /* cpu of the producer when finished, -1 if unknown */
+	unsigned seq;  /* sequence number in the producer */
 	char data[];
 };
 
@@ -4,9 +4,11 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <pthread.h>
+#include <sched.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/resource.h>
+#include <linux/futex.h>
 
 /* This should be defined before #include "utils.h" */
 #define PR_FMT     "mcount"
@@ -22,6 +24,11 @@
 
 #define ARG_STR_MAX	98
 
+/* how long it waits for the recorder with --no-loss */
+#define SHMEM_SPIN_COUNT  1000
+#define SHMEM_WAIT_MSEC   10
+#define SHMEM_STALL_MAX   (10ULL * NSEC_PER_SEC)
+
 static struct mcount_shmem_buffer *allocate_shmem_buffer(char *buf, size_t size,
 							 int tid, int idx)
 {
@@ -53,6 +60,7 @@ static struct mcount_shmem_buffer *allocate_shmem_buffer(char *buf, size_t size,
 		goto out;
 	}
 
+	buffer->cpu = -1;
 	close(fd);
 
 out:
@@ -90,6 +98,143 @@ void prepare_shmem_buffer(struct mcount_thread_data *mtdp)
 	shmem->buffer[0]->flag = SHMEM_FL_RECORDING | SHMEM_FL_NEW;
 }
 
+static void shmem_set_cpu(struct mcount_shmem_buffer *buf)
+{
+	buf->cpu = sched_getcpu();
+}
+
+static int find_shmem_buffer(struct mcount_shmem *shmem)
+{
+	int idx;
+
+	/* always use first buffer available */
+	for (idx = 0; idx < shmem->nr_buf; idx++) {
+		if (!(shmem->buffer[idx]->flag & SHMEM_FL_RECORDING))
+			return idx;
+	}
+
+	return -1;
+}
+
+/*
+ * The stall is found while it's saving a record, so it's kept in the
+ * stat and converted to an async event before the next record.  Pending
+ * async events are sorted by time.
+ */
+static void save_stall_event(struct mcount_thread_data *mtdp)
+{
+	struct mcount_stall_stat *stat = &mtdp->stall;
+	struct mcount_event *event;
+	struct uftrace_buffer_stall *stall;
+	int i;
+
+	if (mtdp->nr_events >= MAX_EVENT)
+		return;
+
+	for (i = mtdp->nr_events; i > 0; i--) {
+		if (mtdp->event[i - 1].time <= stat->time)
+			break;
+
+		mcount_memcpy4(&mtdp->event[i], &mtdp->event[i - 1],
+			       sizeof(*mtdp->event));
+	}
+	mtdp->nr_events++;
+
+	event = &mtdp->event[i];
+	event->id    = EVENT_ID_BUFFER_STALL;
+	event->time  = stat->time;
+	event->dsize = sizeof(*stall);
+	event->idx   = ASYNC_IDX;
+
+	stall = (void *)event->data;
+	stall->time = stat->waited;
+
+	stat->time   = 0;
+	stat->waited = 0;
+}
+
+static int futex_wait(unsigned *addr, unsigned val, int msec)
+{
+	struct timespec ts = {
+		.tv_sec  = msec / 1000,
+		.tv_nsec = (msec % 1000) * NSEC_PER_MSEC,
+	};
+
+	/* the buffer is shared with the recorder, so not FUTEX_PRIVATE */
+	return syscall(SYS_futex, addr, FUTEX_WAIT, val, &ts, NULL, 0);
+}
+
+/*
+ * Wait for the recorder to write one of the buffers out (--no-loss).
+ * It spins for a while and then sleeps on the flag of the oldest buffer
+ * which will be written first.  The recorder will wake it up if it sees
+ * SHMEM_FL_WAITING.  Returns an index of the available buffer or -1.
+ */
+static int wait_shmem_buffer(struct mcount_thread_data *mtdp)
+{
+	struct mcount_shmem *shmem = &mtdp->shmem;
+	struct mcount_shmem_buffer *oldest = NULL;
+	uint64_t start = mcount_gettime();
+	unsigned flag;
+	int i, idx = -1;
+
+	if (shmem->nr_buf == 0)
+		return -1;
+
+	for (i = 0; i < SHMEM_SPIN_COUNT; i++) {
+		idx = find_shmem_buffer(shmem);
+		if (idx >= 0)
+			goto out;
+
+		cpu_relax();
+	}
+
+	for (i = 0; i < shmem->nr_buf; i++) {
+		struct mcount_shmem_buffer *buf = shmem->buffer[i];
+
+		if (oldest == NULL || (int)(buf->seq - oldest->seq) < 0)
+			oldest = buf;
+	}
+
+	while (mcount_gettime() - start < SHMEM_STALL_MAX) {
+		/* paired with write_buf_list() in the recorder */
+		flag = __sync_fetch_and_or(&oldest->flag, SHMEM_FL_WAITING);
+		flag |= SHMEM_FL_WAITING;
+
+		if (flag & SHMEM_FL_RECORDING)
+			futex_wait(&oldest->flag, flag, SHMEM_WAIT_MSEC);
+
+		idx = find_shmem_buffer(shmem);
+		if (idx >= 0)
+			break;
+	}
+	__sync_fetch_and_and(&oldest->flag, ~SHMEM_FL_WAITING);
+
+	if (idx < 0) {
+		pr_dbg("waiting for shmem buffer timed out\n");
+		return -1;
+	}
+
+out:
+	pr_dbg2("waited %"PRIu64" nsec for shmem buffer\n",
+		mcount_gettime() - start);
+
+	if (mtdp->stall.waited == 0)
+		mtdp->stall.time = start;
+	mtdp->stall.waited += mcount_gettime() - start;
+	return idx;
+}
+
+/*
+ * Make the record (of @size) written in the buffer visible.  The
+ * recorder might read the buffer while it's being used (live --stream)
+ * so the size should be updated after the contents.
+ */
+static void commit_shmem_buffer(struct mcount_shmem_buffer *buf, size_t size)
+{
+	__atomic_store_n(&buf->size, buf->size + size, __ATOMIC_RELEASE);
+}
+
 static void get_new_shmem_buffer(struct mcount_thread_data *mtdp)
 {
 	char buf[128];
@@ -98,35 +243,48 @@ static void get_new_shmem_buffer(struct mcount_thread_data *mtdp)
 	struct mcount_shmem_buffer **new_buffer;
 	int idx;
 
-	/* always use first buffer available */
-	for (idx = 0; idx < shmem->nr_buf; idx++) {
+	idx = find_shmem_buffer(shmem);
+	if (idx >= 0) {
 		curr_buf = shmem->buffer[idx];
-		if (!(curr_buf->flag & SHMEM_FL_RECORDING))
-			goto reuse;
+		goto reuse;
 	}
 
-	new_buffer = realloc(shmem->buffer, sizeof(*new_buffer) * (idx + 1));
-	if (new_buffer) {
-		/*
-		 * it already free'd the old buffer, keep the new buffer
-		 * regardless of allocation failure.
-		 */
-		shmem->buffer = new_buffer;
+	idx = shmem->nr_buf;
+	if (shmem_max_buf == 0 || idx < shmem_max_buf) {
+		new_buffer = realloc(shmem->buffer,
+				     sizeof(*new_buffer) * (idx + 1));
+		if (new_buffer) {
+			/*
+			 * it already free'd the old buffer, keep the new
+			 * buffer regardless of allocation failure.
+			 */
+			shmem->buffer = new_buffer;
+
+			curr_buf = allocate_shmem_buffer(buf, sizeof(buf),
+							 mcount_gettid(mtdp),
+							 idx);
+		}
 
-		curr_buf = allocate_shmem_buffer(buf, sizeof(buf),
-						 mcount_gettid(mtdp), idx);
+		if (new_buffer && curr_buf) {
+			shmem->buffer[idx] = curr_buf;
+			shmem->nr_buf++;
+			if (shmem->nr_buf > shmem->max_buf)
+				shmem->max_buf = shmem->nr_buf;
+			goto reuse;
+		}
 	}
 
-	if (new_buffer == NULL || curr_buf == NULL) {
-		shmem->losts++;
-		shmem->curr = -1;
-		return;
+	if (shmem_no_loss) {
+		idx = wait_shmem_buffer(mtdp);
+		if (idx >= 0) {
+			curr_buf = shmem->buffer[idx];
+			goto reuse;
+		}
 	}
 
-	shmem->buffer[idx] = curr_buf;
-	shmem->nr_buf++;
-	if (shmem->nr_buf > shmem->max_buf)
-		shmem->max_buf = shmem->nr_buf;
+	shmem->losts++;
+	shmem->curr = -1;
+	return;
 
 reuse:
 	/*
@@ -138,9 +296,13 @@ reuse:
 	shmem->seqnum++;
 	shmem->curr = idx;
 	curr_buf->size = 0;
+	curr_buf->seq = shmem->seqnum;
 
-	/* shrink unused buffers */
-	if (idx + 3 <= shmem->nr_buf) {
+	/*
+	 * shrink unused buffers, but keep them if the number of buffers
+	 * is limited by the user (--max-buffer).
+	 */
+	if (shmem_max_buf == 0 && idx + 3 <= shmem->nr_buf) {
 		int i;
 		int count = 0;
 		struct mcount_shmem_buffer *b;
@@ -166,6 +328,10 @@ reuse:
 
 	if (shmem->losts) {
 		struct uftrace_record *frstack = (void *)curr_buf->data;
+		struct uftrace_msg_lost lmsg = {
+			.lost = shmem->losts,
+			.tid  = mcount_gettid(mtdp),
+		};
 
 		frstack->time   = 0;
 		frstack->type   = UFTRACE_LOST;
@@ -173,10 +339,9 @@ reuse:
 		frstack->more   = 0;
 		frstack->addr   = shmem->losts;
 
-		uftrace_send_message(UFTRACE_MSG_LOST, &shmem->losts,
-				    sizeof(shmem->losts));
+		uftrace_send_message(UFTRACE_MSG_LOST, &lmsg, sizeof(lmsg));
 
-		curr_buf->size = sizeof(*frstack);
+		commit_shmem_buffer(curr_buf, sizeof(*frstack));
 		shmem->losts = 0;
 	}
 }
@@ -185,6 +350,9 @@ static void finish_shmem_buffer(struct mcount_thread_data *mtdp, int idx)
 {
 	char buf[64];
 
+	/* let the recorder pick a writer on the same NUMA node */
+	shmem_set_cpu(mtdp->shmem.buffer[idx]);
+
 	snprintf(buf, sizeof(buf), SHMEM_SESSION_FMT,
 		 mcount_session_name(), mcount_gettid(mtdp), idx);
 
@@ -640,7 +808,7 @@ static int record_event(struct mcount_thread_data *mtdp,
 		memcpy(ptr + 2, event->data, data_size);
 	}
 
-	curr_buf->size += size;
+	commit_shmem_buffer(curr_buf, size);
 
 	return 0;
 }
@@ -728,19 +896,20 @@ static int record_ret_stack(struct mcount_thread_data *mtdp,
 	buf[1] = rec;
 #endif
 
-	curr_buf->size += sizeof(*frstack);
-	mrstack->flags |= MCOUNT_FL_WRITTEN;
-
 	if (argbuf) {
-		unsigned int *ptr = (void *)curr_buf->data + curr_buf->size;
+		unsigned int *ptr = (void *)curr_buf->data + curr_buf->size +
+				    sizeof(*frstack);
 
 		size -= sizeof(*frstack);
 
 		mcount_memcpy4(ptr, argbuf + 4, size);
 
-		curr_buf->size += ALIGN(size, 8);
+		size = sizeof(*frstack) + ALIGN(size, 8);
 	}
 
+	commit_shmem_buffer(curr_buf, size);
+	mrstack->flags |= MCOUNT_FL_WRITTEN;
+
 	pr_dbg3("rstack[%d] %s %lx\n", mrstack->depth,
 	       type == UFTRACE_ENTRY? "ENTRY" : "EXIT ", mrstack->child_ip);
 
@@ -780,6 +949,9 @@ int record_trace_data(struct mcount_thread_data *mtdp,
 	if (mrstack < mtdp->rstack)
 		return 0;
 
+	if (unlikely(mtdp->stall.waited))
+		save_stall_event(mtdp);
+
 	if (!(mrstack->flags & MCOUNT_FL_WRITTEN)) {
 		non_written_mrstack = mrstack;
 
@@ -897,6 +1069,13 @@ void record_proc_maps(char *dirname, const char *sess_id,
 		map->symtab.sym_names = NULL;
 		map->symtab.nr_sym = 0;
 		map->symtab.nr_alloc = 0;
+		map->symtab.lazy_demangle = false;
+		map->symtab.map = NULL;
+		map->symtab.map_size = 0;
+		map->symtab.map_owner = false;
+		map->symtab.addr_idx = NULL;
+		map->symtab.sym_idx = NULL;
+		map->symtab.nr_idx = 0;
 		mcount_memcpy1(map->libname, path, namelen);
 		map->libname[strlen(path)] = '\0';
 		last_libname = map->libname;
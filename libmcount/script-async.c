@@ -0,0 +1,563 @@
+/*
+ * Asynchronous script execution for record time
+ *
+ * Running a script callback in the traced thread adds a lot of overhead
+ * to every function call and serializes threads on the interpreter lock.
+ * With --script-async, the traced threads only copy the script context
+ * into a (bounded, lock-free) queue and a dedicated thread runs the
+ * script callbacks.  When the queue is full, the traced thread either
+ * drops the event or waits for the script thread depending on the policy.
+ *
+ * Released under the GPL v2.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <signal.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/* This should be defined before #include "utils.h" */
+#define PR_FMT     "mcount"
+#define PR_DOMAIN  DBG_MCOUNT
+
+#include "libmcount/mcount.h"
+#include "libmcount/internal.h"
+#include "utils/utils.h"
+#include "utils/symbol.h"
+#include "utils/script.h"
+
+/* number of events in the queue (should be power of 2) */
+#define SCRIPT_QUEUE_SIZE   4096
+
+/* how long the traced thread waits for the queue with 'block' policy */
+#define SCRIPT_SPIN_COUNT   1000
+#define SCRIPT_WAIT_MSEC    1
+#define SCRIPT_STALL_MAX    (10ULL * NSEC_PER_SEC)
+
+/* minimum (accumulated) time to wait before saving an event for it */
+#define SCRIPT_REPORT_TIME  NSEC_PER_MSEC
+
+/* how long the script thread sleeps when the queue is empty */
+#define SCRIPT_IDLE_MSEC    10
+
+extern struct symtabs symtabs;
+extern void * get_argbuf(struct mcount_thread_data *, struct mcount_ret_stack *);
+
+bool script_async;
+static enum script_async_policy script_policy;
+static struct script_queue script_queue;
+static pthread_t script_thread;
+static bool script_thread_running;
+
+/* total number of events dropped (for debugging) */
+static unsigned long script_dropped;
+
+static int futex_wait(unsigned *addr, unsigned val, int msec)
+{
+	struct timespec ts = {
+		.tv_sec  = msec / 1000,
+		.tv_nsec = (msec % 1000) * NSEC_PER_MSEC,
+	};
+
+	return syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, &ts, NULL, 0);
+}
+
+static void futex_wake(unsigned *addr, int nr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, nr, NULL, NULL, 0);
+}
+
+void script_queue_init(struct script_queue *q, unsigned size)
+{
+	unsigned i;
+
+	q->ring = xmalloc(size * sizeof(*q->ring));
+	q->mask = size - 1;
+	q->head = 0;
+	q->tail = 0;
+	q->sleeping = 0;
+	q->waiters = 0;
+
+	/* slot N is available for the producer when seq == N */
+	for (i = 0; i < size; i++)
+		q->ring[i].seq = i;
+}
+
+void script_queue_finish(struct script_queue *q)
+{
+	free(q->ring);
+	q->ring = NULL;
+}
+
+/**
+ * script_queue_reserve - get an empty slot in the queue
+ * @q: script queue
+ *
+ * This function returns a slot to be filled by the caller or %NULL if
+ * the queue is full.  The caller should call script_queue_commit()
+ * after filling the slot.  It's safe to be called by multiple threads.
+ */
+struct script_event *script_queue_reserve(struct script_queue *q)
+{
+	struct script_event *ev;
+	unsigned pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+	unsigned seq;
+	int diff;
+
+	while (true) {
+		ev = &q->ring[pos & q->mask];
+		seq = __atomic_load_n(&ev->seq, __ATOMIC_ACQUIRE);
+		diff = (int)(seq - pos);
+
+		if (diff == 0) {
+			unsigned old = __sync_val_compare_and_swap(&q->head,
+								   pos, pos + 1);
+			if (old == pos)
+				break;
+			pos = old;
+		}
+		else if (diff < 0) {
+			/* the consumer didn't take the event yet */
+			return NULL;
+		}
+		else {
+			/* other thread got the slot, retry */
+			pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+		}
+	}
+
+	ev->pos = pos;
+	return ev;
+}
+
+void script_queue_commit(struct script_queue *q, struct script_event *ev)
+{
+	__atomic_store_n(&ev->seq, ev->pos + 1, __ATOMIC_RELEASE);
+
+	/* wake the consumer up if it's sleeping */
+	if (__atomic_load_n(&q->sleeping, __ATOMIC_RELAXED) &&
+	    __sync_bool_compare_and_swap(&q->sleeping, 1, 0))
+		futex_wake(&q->head, 1);
+}
+
+/**
+ * script_queue_peek - get the oldest event in the queue
+ * @q: script queue
+ *
+ * This function returns the oldest event or %NULL if the queue is empty
+ * or the producer is still filling it.  It should be called only by a
+ * single consumer and the event should be released by
+ * script_queue_release() after used.
+ */
+struct script_event *script_queue_peek(struct script_queue *q)
+{
+	struct script_event *ev = &q->ring[q->tail & q->mask];
+
+	if (__atomic_load_n(&ev->seq, __ATOMIC_ACQUIRE) != q->tail + 1)
+		return NULL;
+
+	return ev;
+}
+
+void script_queue_release(struct script_queue *q, struct script_event *ev)
+{
+	/* the slot can be used for the next round */
+	__atomic_store_n(&ev->seq, q->tail + q->mask + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&q->tail, q->tail + 1, __ATOMIC_RELEASE);
+
+	if (__atomic_load_n(&q->waiters, __ATOMIC_RELAXED))
+		futex_wake(&q->tail, INT_MAX);
+}
+
+static bool script_queue_empty(struct script_queue *q)
+{
+	return __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) ==
+		__atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+}
+
+/* wait for the consumer to release a slot ('block' policy) */
+static struct script_event *wait_script_queue(struct script_queue *q,
+					      uint64_t start)
+{
+	struct script_event *ev;
+	unsigned tail;
+	int i;
+
+	for (i = 0; i < SCRIPT_SPIN_COUNT; i++) {
+		ev = script_queue_reserve(q);
+		if (ev)
+			return ev;
+
+		cpu_relax();
+	}
+
+	while (mcount_gettime() - start < SCRIPT_STALL_MAX) {
+		__sync_add_and_fetch(&q->waiters, 1);
+
+		tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+		ev = script_queue_reserve(q);
+		if (ev == NULL)
+			futex_wait(&q->tail, tail, SCRIPT_WAIT_MSEC);
+
+		__sync_sub_and_fetch(&q->waiters, 1);
+
+		if (ev == NULL)
+			ev = script_queue_reserve(q);
+		if (ev)
+			return ev;
+	}
+
+	pr_dbg("waiting for script queue timed out\n");
+	return NULL;
+}
+
+/* it'll be saved before the next record (as an async event) */
+static void save_script_queue_event(struct mcount_thread_data *mtdp,
+				    struct mcount_script_stat *stat)
+{
+	struct mcount_event *event;
+	struct uftrace_script_queue *sq;
+
+	if (mtdp->nr_events >= MAX_EVENT)
+		return;
+
+	event = &mtdp->event[mtdp->nr_events++];
+	event->id    = EVENT_ID_SCRIPT_QUEUE;
+	event->time  = stat->time;
+	event->dsize = sizeof(*sq);
+	event->idx   = ASYNC_IDX;
+
+	sq = (void *)event->data;
+	sq->dropped = stat->dropped;
+	sq->time    = stat->waited;
+}
+
+/**
+ * script_async_push - pass the script context to the script thread
+ * @mtdp: thread data of the traced thread
+ * @rstack: return stack of the function
+ * @kind: SCRIPT_EV_ENTRY or SCRIPT_EV_EXIT
+ * @argspec: argument spec (or %NULL if no argument or return value)
+ *
+ * This function copies the information to the queue without looking up
+ * the symbol.  Arguments larger than the slot are not passed.  It saves
+ * a 'uftrace:script-queue' event if the queue was full.  Consecutive
+ * drops are merged into a single event and waits are accumulated until
+ * it reaches SCRIPT_REPORT_TIME.
+ */
+void script_async_push(struct mcount_thread_data *mtdp,
+		       struct mcount_ret_stack *rstack,
+		       enum script_event_kind kind,
+		       struct list_head *argspec)
+{
+	struct script_queue *q = &script_queue;
+	struct script_event *ev;
+
+	ev = script_queue_reserve(q);
+	if (unlikely(ev == NULL)) {
+		struct mcount_script_stat *stat = &mtdp->script;
+		uint64_t start = mcount_gettime();
+
+		if (script_policy == SCRIPT_ASYNC_BLOCK)
+			ev = wait_script_queue(q, start);
+
+		if (stat->dropped == 0 && stat->waited == 0)
+			stat->time = start;
+
+		if (ev == NULL) {
+			stat->dropped++;
+			__sync_add_and_fetch(&script_dropped, 1);
+			return;
+		}
+
+		stat->waited += mcount_gettime() - start;
+	}
+
+	/* do not save an event for every short wait */
+	if (unlikely(mtdp->script.dropped ||
+		     mtdp->script.waited >= SCRIPT_REPORT_TIME)) {
+		save_script_queue_event(mtdp, &mtdp->script);
+		mtdp->script.dropped = 0;
+		mtdp->script.waited  = 0;
+	}
+
+	ev->kind      = kind;
+	ev->tid       = mcount_gettid(mtdp);
+	ev->depth     = rstack->depth;
+	ev->address   = rstack->child_ip;
+	ev->timestamp = rstack->start_time;
+	ev->duration  = 0;
+	ev->argspec   = NULL;
+	ev->arglen    = 0;
+
+	if (kind == SCRIPT_EV_EXIT)
+		ev->duration = rstack->end_time - rstack->start_time;
+
+	if (argspec) {
+		unsigned *argbuf = get_argbuf(mtdp, rstack);
+
+		if (argbuf[0] <= sizeof(ev->argbuf)) {
+			ev->argspec = argspec;
+			ev->arglen  = argbuf[0];
+			mcount_memcpy1(ev->argbuf, &argbuf[1], argbuf[0]);
+		}
+	}
+
+	script_queue_commit(q, ev);
+}
+
+static void run_script_event(struct script_event *ev)
+{
+	struct script_context sc_ctx;
+	struct sym *sym = find_symtabs(&symtabs, ev->address);
+	char *symname = symbol_getname(sym, ev->address);
+
+	if (!script_match_filter(symname))
+		goto out;
+
+	sc_ctx.tid       = ev->tid;
+	sc_ctx.depth     = ev->depth;
+	sc_ctx.address   = ev->address;
+	sc_ctx.name      = symname;
+	sc_ctx.timestamp = ev->timestamp;
+	sc_ctx.duration  = ev->duration;
+	sc_ctx.arglen    = ev->arglen;
+	sc_ctx.argbuf    = ev->argbuf;
+	sc_ctx.argspec   = ev->argspec;
+
+	if (ev->kind == SCRIPT_EV_ENTRY)
+		script_uftrace_entry(&sc_ctx);
+	else
+		script_uftrace_exit(&sc_ctx);
+
+out:
+	symbol_putname(sym, symname);
+}
+
+static int run_script_queue(struct script_queue *q)
+{
+	struct script_event *ev;
+	int n = 0;
+
+	while ((ev = script_queue_peek(q)) != NULL) {
+		run_script_event(ev);
+		script_queue_release(q, ev);
+		n++;
+	}
+	return n;
+}
+
+static void *script_thread_fn(void *arg)
+{
+	struct script_queue *q = arg;
+	unsigned head;
+	int i;
+
+	/* do not trace the script thread itself */
+	mtd.recursion_marker = true;
+
+	while (true) {
+		bool stop = __atomic_load_n(&q->stop, __ATOMIC_ACQUIRE);
+
+		if (run_script_queue(q))
+			continue;
+
+		if (stop && script_queue_empty(q))
+			break;
+
+		/* the producer might be filling the slot */
+		for (i = 0; i < SCRIPT_SPIN_COUNT; i++) {
+			if (script_queue_peek(q))
+				break;
+			cpu_relax();
+		}
+		if (i < SCRIPT_SPIN_COUNT)
+			continue;
+
+		__atomic_store_n(&q->sleeping, 1, __ATOMIC_SEQ_CST);
+		head = __atomic_load_n(&q->head, __ATOMIC_SEQ_CST);
+
+		if (head == q->tail && !stop)
+			futex_wait(&q->head, head, SCRIPT_IDLE_MSEC);
+
+		__atomic_store_n(&q->sleeping, 0, __ATOMIC_RELAXED);
+	}
+
+	return NULL;
+}
+
+static int start_script_thread(void)
+{
+	sigset_t sigset, oldset;
+	int ret;
+
+	/* signals should be handled by the target threads */
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_BLOCK, &sigset, &oldset);
+
+	script_queue.stop = false;
+	ret = pthread_create(&script_thread, NULL, script_thread_fn,
+			     &script_queue);
+
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+	if (ret != 0) {
+		pr_dbg("cannot create script thread: %s\n", strerror(ret));
+		return -1;
+	}
+
+	script_thread_running = true;
+	return 0;
+}
+
+/**
+ * script_async_init - start the script thread
+ * @policy: "drop" or "block" - what to do when the queue is full
+ *
+ * This function returns 0 if the script callbacks will be called in
+ * the script thread.  Otherwise they are called in the traced threads.
+ */
+int script_async_init(const char *policy)
+{
+#ifdef SINGLE_THREAD
+	/* thread data is not thread-local, fall back to sync mode */
+	pr_dbg("async script is not supported in single thread mode\n");
+	return -1;
+#else
+	if (!strcmp(policy, "block"))
+		script_policy = SCRIPT_ASYNC_BLOCK;
+	else
+		script_policy = SCRIPT_ASYNC_DROP;
+
+	script_queue_init(&script_queue, SCRIPT_QUEUE_SIZE);
+
+	if (start_script_thread() < 0) {
+		script_queue_finish(&script_queue);
+		return -1;
+	}
+
+	pr_dbg("run script in a separate thread (policy: %s)\n",
+	       script_policy == SCRIPT_ASYNC_BLOCK ? "block" : "drop");
+
+	script_async = true;
+	return 0;
+#endif
+}
+
+static void stop_script_thread(void)
+{
+	if (!script_thread_running)
+		return;
+
+	__atomic_store_n(&script_queue.stop, true, __ATOMIC_RELEASE);
+	futex_wake(&script_queue.head, 1);
+
+	pthread_join(script_thread, NULL);
+	script_thread_running = false;
+}
+
+/* wait until the script thread handles all events (before fork) */
+void script_async_drain(void)
+{
+	uint64_t start = mcount_gettime();
+
+	if (!script_async)
+		return;
+
+	while (!script_queue_empty(&script_queue) &&
+	       mcount_gettime() - start < SCRIPT_STALL_MAX) {
+		__sync_add_and_fetch(&script_queue.waiters, 1);
+		futex_wait(&script_queue.tail, script_queue.tail,
+			   SCRIPT_WAIT_MSEC);
+		__sync_sub_and_fetch(&script_queue.waiters, 1);
+	}
+}
+
+/* the script thread is gone in the child, start a new one */
+void script_async_restart(void)
+{
+	unsigned i;
+
+	if (!script_async)
+		return;
+
+	script_thread_running = false;
+
+	/* discard events from other threads (in the parent) */
+	script_queue.head = script_queue.tail = 0;
+	script_queue.sleeping = script_queue.waiters = 0;
+	for (i = 0; i <= script_queue.mask; i++)
+		script_queue.ring[i].seq = i;
+
+	if (start_script_thread() < 0)
+		script_async = false;
+}
+
+/* run remaining events and stop the script thread */
+void script_async_finish(void)
+{
+	if (!script_async)
+		return;
+
+	script_async = false;
+	stop_script_thread();
+
+	if (script_dropped)
+		pr_dbg("%lu script events were dropped\n", script_dropped);
+}
+
+#ifdef UNIT_TEST
+TEST_CASE(script_async_queue)
+{
+	struct script_queue q;
+	struct script_event *ev;
+	int i;
+
+	script_queue_init(&q, 4);
+
+	TEST_EQ(script_queue_peek(&q), NULL);
+
+	pr_dbg("fill the queue until it's full\n");
+	for (i = 0; i < 4; i++) {
+		ev = script_queue_reserve(&q);
+		TEST_NE(ev, NULL);
+
+		ev->tid = i;
+		/* not committed yet */
+		TEST_EQ(script_queue_peek(&q) == NULL, i == 0);
+		script_queue_commit(&q, ev);
+	}
+	TEST_EQ(script_queue_reserve(&q), NULL);
+
+	pr_dbg("events should be read in order\n");
+	for (i = 0; i < 2; i++) {
+		ev = script_queue_peek(&q);
+		TEST_NE(ev, NULL);
+		TEST_EQ(ev->tid, i);
+		script_queue_release(&q, ev);
+	}
+
+	pr_dbg("released slots can be used again\n");
+	for (i = 4; i < 6; i++) {
+		ev = script_queue_reserve(&q);
+		TEST_NE(ev, NULL);
+		ev->tid = i;
+		script_queue_commit(&q, ev);
+	}
+	TEST_EQ(script_queue_reserve(&q), NULL);
+
+	for (i = 2; i < 6; i++) {
+		ev = script_queue_peek(&q);
+		TEST_NE(ev, NULL);
+		TEST_EQ(ev->tid, i);
+		script_queue_release(&q, ev);
+	}
+	TEST_EQ(script_queue_peek(&q), NULL);
+	TEST_EQ(script_queue_empty(&q), true);
+
+	script_queue_finish(&q);
+	return TEST_OK;
+}
+#endif /* UNIT_TEST */
@@ -0,0 +1,201 @@
+/*
+ * Benchmark for the internal simple demangler
+ *
+ * It reads mangled names (one per line) from the corpus file generated
+ * by misc/gen-demangle-corpus.py and reports how many names can be
+ * demangled per second compared to __cxa_demangle() in libstdc++.
+ *
+ * Released under the GPL v2.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <argp.h>
+
+#include "uftrace.h"
+#include "version.h"
+#include "utils/utils.h"
+
+/* output of --version option (generated by argp runtime) */
+const char *argp_program_version = "bench-demangle " UFTRACE_VERSION;
+
+char *demangle(char *str);
+
+extern enum symbol_demangler demangler;
+
+#ifdef HAVE_CXA_DEMANGLE
+extern char * __cxa_demangle(const char *name, char *output,
+			     size_t *len, int *status);
+#endif
+
+struct bench_opts {
+	char *corpus;
+	int repeat;
+};
+
+static struct argp_option bench_options[] = {
+	{ "repeat", 'r', "N", 0, "Repeat the corpus N times (default: 1)" },
+	{ 0 }
+};
+
+static error_t parse_option(int key, char *arg, struct argp_state *state)
+{
+	struct bench_opts *opts = state->input;
+
+	switch (key) {
+	case 'r':
+		opts->repeat = strtol(arg, NULL, 0);
+		if (opts->repeat <= 0)
+			argp_error(state, "invalid repeat count: %s", arg);
+		break;
+
+	case ARGP_KEY_ARG:
+		if (state->arg_num)
+			return ARGP_ERR_UNKNOWN;
+		opts->corpus = arg;
+		break;
+
+	case ARGP_KEY_END:
+		if (state->arg_num < 1)
+			argp_usage(state);
+		break;
+
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+
+	return 0;
+}
+
+static char **read_corpus(char *filename, int *nr_names)
+{
+	FILE *fp;
+	char *line = NULL;
+	size_t len = 0;
+	ssize_t n;
+	char **names = NULL;
+	int nr = 0, alloc = 0;
+
+	fp = fopen(filename, "r");
+	if (fp == NULL)
+		pr_err("cannot open corpus file: %s", filename);
+
+	while ((n = getline(&line, &len, fp)) > 0) {
+		if (line[n - 1] == '\n')
+			line[--n] = '\0';
+		if (n == 0)
+			continue;
+
+		if (nr == alloc) {
+			alloc = alloc ? alloc * 2 : 4096;
+			names = xrealloc(names, alloc * sizeof(*names));
+		}
+		names[nr++] = xstrdup(line);
+	}
+
+	free(line);
+	fclose(fp);
+
+	*nr_names = nr;
+	return names;
+}
+
+static double get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void print_result(const char *name, int nr, int failed, double elapsed)
+{
+	printf("%-16s %10d names  %8.3f sec  %12.0f names/sec  (%d failed)\n",
+	       name, nr, elapsed, nr / elapsed, failed);
+}
+
+static double bench_simple(char **names, int nr, int repeat)
+{
+	double start, elapsed;
+	int i, k, failed = 0;
+	char *str;
+
+	demangler = DEMANGLE_SIMPLE;
+
+	start = get_time();
+	for (k = 0; k < repeat; k++) {
+		for (i = 0; i < nr; i++) {
+			str = demangle(names[i]);
+			if (k == 0 && !strcmp(str, names[i]))
+				failed++;
+			free(str);
+		}
+	}
+	elapsed = get_time() - start;
+
+	print_result("simple", nr * repeat, failed, elapsed);
+	return elapsed;
+}
+
+#ifdef HAVE_CXA_DEMANGLE
+static double bench_cxa(char **names, int nr, int repeat)
+{
+	double start, elapsed;
+	int i, k, failed = 0;
+	int status;
+	char *str;
+
+	start = get_time();
+	for (k = 0; k < repeat; k++) {
+		for (i = 0; i < nr; i++) {
+			str = __cxa_demangle(names[i], NULL, NULL, &status);
+			if (k == 0 && status < 0)
+				failed++;
+			free(str);
+		}
+	}
+	elapsed = get_time() - start;
+
+	print_result("__cxa_demangle", nr * repeat, failed, elapsed);
+	return elapsed;
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+	struct bench_opts opts = {
+		.repeat = 1,
+	};
+	struct argp argp = {
+		.options = bench_options,
+		.parser = parse_option,
+		.args_doc = "<corpus file>",
+		.doc = "bench-demangle -- benchmark for internal simple demangler",
+	};
+	char **names;
+	int i, nr;
+	double simple;
+
+	argp_parse(&argp, argc, argv, 0, NULL, &opts);
+
+	names = read_corpus(opts.corpus, &nr);
+	if (nr == 0)
+		pr_err_ns("no names in the corpus: %s\n", opts.corpus);
+
+	printf("read %d names from %s\n\n", nr, opts.corpus);
+
+	simple = bench_simple(names, nr, opts.repeat);
+#ifdef HAVE_CXA_DEMANGLE
+	printf("\nsimple demangler is %.2fx faster than __cxa_demangle\n",
+	       bench_cxa(names, nr, opts.repeat) / simple);
+#else
+	(void)simple;
+#endif
+
+	for (i = 0; i < nr; i++)
+		free(names[i]);
+	free(names);
+
+	return 0;
+}
@@ -0,0 +1,49 @@
+/*
+ * Workload for the report benchmark (see misc/bench-report.sh)
+ *
+ * It calls 256 small functions through a function table in a loop so
+ * that the trace has lots of records spread over many functions.  The
+ * number of loops can be given as an argument (default: 4000) and each
+ * loop makes 256 calls (512 records).
+ *
+ * Released under the GPL v2.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#define FUNC1(n)   __attribute__((noinline)) int f##n(int x) { return x + 1; }
+#define FUNC4(n)   FUNC1(n##0)  FUNC1(n##1)  FUNC1(n##2)  FUNC1(n##3)
+#define FUNC16(n)  FUNC4(n##0)  FUNC4(n##1)  FUNC4(n##2)  FUNC4(n##3)
+#define FUNC64(n)  FUNC16(n##0) FUNC16(n##1) FUNC16(n##2) FUNC16(n##3)
+
+#define ADDR1(n)   f##n,
+#define ADDR4(n)   ADDR1(n##0)  ADDR1(n##1)  ADDR1(n##2)  ADDR1(n##3)
+#define ADDR16(n)  ADDR4(n##0)  ADDR4(n##1)  ADDR4(n##2)  ADDR4(n##3)
+#define ADDR64(n)  ADDR16(n##0) ADDR16(n##1) ADDR16(n##2) ADDR16(n##3)
+
+/* f0000 ... f3333 */
+FUNC64(0) FUNC64(1) FUNC64(2) FUNC64(3)
+
+static int (* volatile table[])(int) = {
+	ADDR64(0) ADDR64(1) ADDR64(2) ADDR64(3)
+};
+
+#define NR_FUNC  (int)(sizeof(table) / sizeof(table[0]))
+
+int main(int argc, char *argv[])
+{
+	int nr_loop = 4000;
+	int sum = 0;
+	int i, k;
+
+	if (argc > 1)
+		nr_loop = strtol(argv[1], NULL, 0);
+
+	for (i = 0; i < nr_loop; i++) {
+		for (k = 0; k < NR_FUNC; k++)
+			sum = table[k](sum);
+	}
+
+	printf("%d calls\n", sum);
+	return 0;
+}
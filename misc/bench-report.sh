@@ -0,0 +1,35 @@
+#!/bin/sh
+#
+# Benchmark for the report command
+#
+# It records the misc/bench-report workload once and runs the report
+# command on the data several times.  The options are passed to the
+# report command as is (e.g. --threads or --jobs=4).
+#
+#   usage: bench-report.sh <objdir> [<report options>...]
+#
+# The size of the data can be changed by NR_LOOP (default: 20000, which
+# makes about 10M records) and the number of runs by NR_RUN (default: 3).
+#
+
+objdir=$1
+shift
+
+NR_LOOP=${NR_LOOP:-20000}
+NR_RUN=${NR_RUN:-3}
+
+uftrace="${objdir}/uftrace --no-pager -L${objdir}"
+datadir=$(mktemp -d ${TMPDIR:-/tmp}/bench-report.XXXXXX) || exit 1
+trap "rm -rf ${datadir}" EXIT
+
+echo "recording ${NR_LOOP} loops of 256 functions ..."
+${uftrace} record -d ${datadir}/uftrace.data --no-libcall \
+	${objdir}/misc/bench-report ${NR_LOOP} > /dev/null || exit 1
+
+echo "running 'uftrace report${*:+ $*}' ${NR_RUN} times"
+for i in $(seq ${NR_RUN}); do
+	start=$(date +%s.%N)
+	${uftrace} report -d ${datadir}/uftrace.data "$@" > /dev/null || exit 1
+	end=$(date +%s.%N)
+	echo "${start} ${end}" | awk '{ printf "  run %d: %.3f sec\n", '$i', $2 - $1 }'
+done
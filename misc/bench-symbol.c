@@ -0,0 +1,315 @@
+/*
+ * Benchmark for symbol address lookup
+ *
+ * It builds synthetic symbol tables (or loads symbols from the given
+ * binaries) and looks up random addresses with find_symtabs().  The
+ * result is compared to a plain linear search of the maps followed by
+ * bsearch() on the symbol table which was used before the address index.
+ *
+ * Released under the GPL v2.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <argp.h>
+
+#include "uftrace.h"
+#include "version.h"
+#include "utils/utils.h"
+#include "utils/symbol.h"
+
+/* output of --version option (generated by argp runtime) */
+const char *argp_program_version = "bench-symbol " UFTRACE_VERSION;
+
+struct bench_opts {
+	int nr_sym;
+	int nr_map;
+	int nr_lookup;
+	char **files;
+	int nr_files;
+};
+
+static struct argp_option bench_options[] = {
+	{ "symbols", 'n', "N", 0, "Number of symbols in a map (default: 1048576)" },
+	{ "maps", 'm', "N", 0, "Number of maps (default: 64)" },
+	{ "lookups", 'l', "N", 0, "Number of address lookups (default: 10000000)" },
+	{ 0 }
+};
+
+static error_t parse_option(int key, char *arg, struct argp_state *state)
+{
+	struct bench_opts *opts = state->input;
+
+	switch (key) {
+	case 'n':
+		opts->nr_sym = strtol(arg, NULL, 0);
+		if (opts->nr_sym <= 0)
+			argp_error(state, "invalid number of symbols: %s", arg);
+		break;
+
+	case 'm':
+		opts->nr_map = strtol(arg, NULL, 0);
+		if (opts->nr_map <= 0)
+			argp_error(state, "invalid number of maps: %s", arg);
+		break;
+
+	case 'l':
+		opts->nr_lookup = strtol(arg, NULL, 0);
+		if (opts->nr_lookup <= 0)
+			argp_error(state, "invalid number of lookups: %s", arg);
+		break;
+
+	case ARGP_KEY_ARG:
+		opts->files = xrealloc(opts->files,
+				       (opts->nr_files + 1) * sizeof(*opts->files));
+		opts->files[opts->nr_files++] = arg;
+		break;
+
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+
+	return 0;
+}
+
+static double get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* same as the addrfind() in utils/symbol.c */
+static int addrfind(const void *a, const void *b)
+{
+	uint64_t addr = *(uint64_t *) a;
+	const struct sym *sym = b;
+
+	if (sym->addr <= addr && addr < sym->addr + sym->size)
+		return 0;
+
+	if (sym->addr > addr)
+		return -1;
+	return 1;
+}
+
+static struct sym * find_symtabs_bsearch(struct symtabs *symtabs, uint64_t addr)
+{
+	struct uftrace_mmap *map = symtabs->maps;
+
+	while (map) {
+		if (map->start <= addr && addr < map->end)
+			break;
+		map = map->next;
+	}
+
+	if (map == NULL)
+		return NULL;
+
+	return bsearch(&addr, map->symtab.sym, map->symtab.nr_sym,
+		       sizeof(struct sym), addrfind);
+}
+
+static struct uftrace_mmap * new_map(uint64_t start, uint64_t end,
+				     const char *name)
+{
+	size_t namelen = ALIGN(strlen(name) + 1, 4);
+	struct uftrace_mmap *map = xzalloc(sizeof(*map) + namelen);
+
+	map->start = start;
+	map->end   = end;
+	map->len   = namelen;
+	memcpy(map->prot, "r-xp", 4);
+	strcpy(map->libname, name);
+
+	return map;
+}
+
+static void add_synthetic_maps(struct symtabs *symtabs,
+			       struct bench_opts *opts)
+{
+	struct uftrace_mmap **pmap = &symtabs->maps;
+	uint64_t base = 0x10000000;
+	char name[32];
+	int i, k;
+
+	for (i = 0; i < opts->nr_map; i++) {
+		struct uftrace_mmap *map;
+		struct symtab *stab;
+		uint64_t addr = base;
+
+		snprintf(name, sizeof(name), "libbench%d.so", i);
+		map = new_map(base, base, name);
+		stab = &map->symtab;
+
+		/* only the last map has many symbols */
+		stab->nr_sym = (i == opts->nr_map - 1) ? opts->nr_sym : 1000;
+		stab->nr_alloc = stab->nr_sym;
+		stab->sym = xcalloc(stab->nr_sym, sizeof(*stab->sym));
+
+		for (k = 0; k < (int)stab->nr_sym; k++) {
+			stab->sym[k].addr = addr;
+			stab->sym[k].size = 16 + (random() % 64) * 16;
+			stab->sym[k].type = ST_GLOBAL;
+			stab->sym[k].name = xstrdup("func");
+
+			addr += stab->sym[k].size + (random() % 4) * 16;
+		}
+		map->end = addr;
+		base = ALIGN(addr, 0x100000) + 0x100000;
+
+		*pmap = map;
+		pmap = &map->next;
+	}
+}
+
+static int add_binary_maps(struct symtabs *symtabs, struct bench_opts *opts)
+{
+	struct uftrace_mmap **pmap = &symtabs->maps;
+	uint64_t base = 0x10000000;
+	int i, nr = 0;
+
+	for (i = 0; i < opts->nr_files; i++) {
+		struct symtabs tmp = {
+			.flags = SYMTAB_FL_SKIP_DYNAMIC,
+		};
+		struct symtab *stab = &tmp.symtab;
+		struct uftrace_mmap *map;
+		uint64_t start, end;
+		size_t k;
+
+		load_symtabs(&tmp, NULL, opts->files[i]);
+		if (stab->nr_sym == 0) {
+			pr_warn("no symbols in %s\n", opts->files[i]);
+			unload_symtabs(&tmp);
+			continue;
+		}
+
+		start = stab->sym[0].addr;
+		end = stab->sym[stab->nr_sym - 1].addr +
+			stab->sym[stab->nr_sym - 1].size;
+
+		map = new_map(base, base + end - start, opts->files[i]);
+		map->symtab = *stab;
+		for (k = 0; k < stab->nr_sym; k++)
+			map->symtab.sym[k].addr += base - start;
+
+		printf("%s: %zd symbols\n", opts->files[i], stab->nr_sym);
+		base = ALIGN(map->end, 0x100000) + 0x100000;
+		nr++;
+
+		*pmap = map;
+		pmap = &map->next;
+	}
+
+	return nr;
+}
+
+static uint64_t * make_addrs(struct symtabs *symtabs, int nr)
+{
+	uint64_t *addrs = xmalloc(nr * sizeof(*addrs));
+	struct uftrace_mmap *map;
+	size_t total = 0, idx;
+	int i, k;
+
+	for (map = symtabs->maps; map; map = map->next)
+		total += map->symtab.nr_sym;
+
+	/* lookups are distributed to maps by number of symbols */
+	for (i = 0; i < nr; i++) {
+		idx = ((size_t)random() << 16 ^ random()) % total;
+		for (map = symtabs->maps; map; map = map->next) {
+			if (idx < map->symtab.nr_sym)
+				break;
+			idx -= map->symtab.nr_sym;
+		}
+
+		k = random() % 8;
+		addrs[i] = map->symtab.sym[idx].addr +
+			map->symtab.sym[idx].size * k / 8;
+	}
+
+	return addrs;
+}
+
+static void print_result(const char *name, int nr, double elapsed)
+{
+	printf("%-16s %10d lookups  %8.3f sec  %12.0f lookups/sec\n",
+	       name, nr, elapsed, nr / elapsed);
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_opts opts = {
+		.nr_sym = 1024 * 1024,
+		.nr_map = 64,
+		.nr_lookup = 10 * 1000 * 1000,
+	};
+	struct argp argp = {
+		.options = bench_options,
+		.parser = parse_option,
+		.args_doc = "[<binary>...]",
+		.doc = "bench-symbol -- benchmark for symbol address lookup",
+	};
+	struct symtabs symtabs = {
+		.kernel_base = -1ULL,
+	};
+	struct uftrace_mmap *map, *tmp;
+	uint64_t *addrs;
+	double start, t_index, t_bsearch;
+	int i, failed = 0;
+
+	argp_parse(&argp, argc, argv, 0, NULL, &opts);
+
+	srandom(0);
+	if (opts.nr_files == 0)
+		add_synthetic_maps(&symtabs, &opts);
+	else if (add_binary_maps(&symtabs, &opts) == 0)
+		pr_err_ns("no symbols to lookup\n");
+
+	addrs = make_addrs(&symtabs, opts.nr_lookup);
+
+	/* it also builds the index before measuring */
+	for (i = 0; i < opts.nr_lookup; i++) {
+		if (find_symtabs(&symtabs, addrs[i]) !=
+		    find_symtabs_bsearch(&symtabs, addrs[i]))
+			failed++;
+	}
+	if (failed)
+		pr_err_ns("%d lookups returned different symbols\n", failed);
+
+	start = get_time();
+	for (i = 0; i < opts.nr_lookup; i++)
+		find_symtabs_bsearch(&symtabs, addrs[i]);
+	t_bsearch = get_time() - start;
+	print_result("bsearch", opts.nr_lookup, t_bsearch);
+
+	start = get_time();
+	for (i = 0; i < opts.nr_lookup; i++)
+		find_symtabs(&symtabs, addrs[i]);
+	t_index = get_time() - start;
+	print_result("index", opts.nr_lookup, t_index);
+
+	printf("\naddress index is %.2fx faster than bsearch\n",
+	       t_bsearch / t_index);
+
+	map = symtabs.maps;
+	while (map) {
+		struct symtabs mstabs = {
+			.symtab = map->symtab,
+		};
+
+		tmp = map;
+		map = map->next;
+
+		unload_symtabs(&mstabs);
+		free(tmp);
+	}
+	unload_symtabs(&symtabs);
+	free(addrs);
+	free(opts.files);
+
+	return 0;
+}
@@ -0,0 +1,171 @@
+#!/usr/bin/env python
+
+#
+# Mangled C++ symbol name corpus generator for demangler benchmark
+#
+# It extracts real symbol names from the C++ test programs and libstdc++
+# and fills up the rest with synthesized (template) names.
+#
+# Released under the GPL v2.
+#
+
+from __future__ import print_function
+import os
+import sys
+import glob
+import random
+import shutil
+import tempfile
+import subprocess as sp
+
+# types which are not substitution candidates (so they can be repeated)
+builtin_types = [ "v", "b", "c", "a", "h", "s", "t", "i", "j",
+                  "l", "m", "x", "y", "f", "d", "e", "w" ]
+
+compound_types = [ "PKc", "Pv", "PKv", "RKi", "Ri", "Pi", "PFviE", "RKd" ]
+
+words = [ "alloc", "buffer", "cache", "detail", "entry", "field", "graph",
+          "handle", "index", "jobs", "kernel", "list", "map", "node",
+          "option", "parser", "queue", "record", "session", "task",
+          "util", "vector", "writer", "xattr", "yield", "zone", "impl",
+          "base", "traits", "policy", "iterator", "allocator", "stream" ]
+
+
+def identifier(used):
+    while True:
+        name = random.choice(words) + str(random.randint(0, 99))
+        if name not in used:
+            used.add(name)
+            return "%d%s" % (len(name), name)
+
+
+def template_args(used, depth):
+    args = ""
+    for i in range(random.randint(1, 3)):
+        r = random.random()
+        if r < 0.5 or depth > 1:
+            args += random.choice(builtin_types[1:])
+        elif r < 0.8:
+            # nested class type in a namespace
+            args += "N" + identifier(used) + identifier(used) + "E"
+        else:
+            args += identifier(used)
+            args += "I" + template_args(used, depth + 1) + "E"
+    return args
+
+
+def synthesize():
+    used = set()
+    prefix = ""
+
+    for i in range(random.randint(1, 3)):
+        prefix += identifier(used)
+
+    prefix += identifier(used)  # class name
+    if random.random() < 0.6:
+        prefix += "I" + template_args(used, 0) + "E"
+
+    r = random.random()
+    if r < 0.1:
+        func = random.choice([ "C1", "C2" ])
+    elif r < 0.15:
+        func = random.choice([ "D0", "D1", "D2" ])
+    else:
+        func = identifier(used)
+
+    qual = "K" if func[0] not in "CD" and random.random() < 0.3 else ""
+
+    params = ""
+    for i in range(random.randint(0, 4)):
+        params += random.choice(builtin_types[1:])
+    if random.random() < 0.3:
+        params += random.choice(compound_types)
+    if params == "":
+        params = "v"
+
+    return "_ZN" + qual + prefix + func + "E" + params
+
+
+def parse_nm(output, names):
+    for line in output.decode('utf-8', 'replace').split('\n'):
+        fields = line.split()
+        if len(fields) == 0:
+            continue
+        name = fields[-1].split('@')[0]
+        if name.startswith("_Z"):
+            names.add(name)
+
+
+def extract_names(cxx, sources, libs):
+    names = set()
+    tmpdir = tempfile.mkdtemp(prefix="demangle-corpus.")
+
+    try:
+        for src in sources:
+            obj = os.path.join(tmpdir, os.path.basename(src) + ".o")
+            try:
+                sp.check_call([cxx, "-c", "-O0", "-o", obj, src],
+                              stderr=open(os.devnull, 'w'))
+                parse_nm(sp.check_output(["nm", obj]), names)
+            except (OSError, sp.CalledProcessError):
+                pass
+
+        for lib in libs:
+            try:
+                parse_nm(sp.check_output(["nm", "-D", lib]), names)
+            except (OSError, sp.CalledProcessError):
+                pass
+    finally:
+        shutil.rmtree(tmpdir)
+
+    return sorted(names)
+
+
+def find_libstdcxx(cxx):
+    try:
+        path = sp.check_output([cxx, "-print-file-name=libstdc++.so"])
+        path = os.path.realpath(path.decode().strip())
+        if os.path.exists(path):
+            return [ path ]
+    except (OSError, sp.CalledProcessError):
+        pass
+    return []
+
+
+def usage():
+    print("Usage: %s [-o <output>] [-n <count>] [<test dir>]" % sys.argv[0])
+    sys.exit(1)
+
+
+if __name__ == "__main__":
+    output = "demangle-corpus.txt"
+    count = 1000000
+    testdir = "tests"
+    cxx = os.environ.get("CXX", "c++")
+
+    args = sys.argv[1:]
+    while args:
+        arg = args.pop(0)
+        if arg == "-o" and args:
+            output = args.pop(0)
+        elif arg == "-n" and args:
+            count = int(args.pop(0))
+        elif arg.startswith("-"):
+            usage()
+        else:
+            testdir = arg
+
+    sources = sorted(glob.glob(os.path.join(testdir, "s-*.cpp")))
+    names = extract_names(cxx, sources, find_libstdcxx(cxx))
+
+    # use a fixed seed to get same corpus always
+    random.seed(0)
+
+    with open(output, "w") as f:
+        for name in names[:count]:
+            print(name, file=f)
+        for i in range(count - len(names)):
+            print(synthesize(), file=f)
+
+    print("%s: %d real + %d synthesized names" %
+          (output, min(len(names), count), max(count - len(names), 0)))
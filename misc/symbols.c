@@ -54,7 +54,7 @@ static int print_session_symbol(struct uftrace_session *s, void *arg)
 	if (sym == NULL)
 		return 0;
 
-	printf("  %s", sym->name);
+	printf("  %s", symbol_getname(sym, addr));
 	if (needs_session)
 		printf(" [in %.*s]\n", SESSION_ID_LEN, s->sid);
 	return 0;
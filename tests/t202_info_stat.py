@@ -0,0 +1,41 @@
+#!/usr/bin/env python
+
+from runtest import TestBase
+import subprocess as sp
+
+TDIR='xxx'
+
+class TestCase(TestBase):
+    def __init__(self):
+        TestBase.__init__(self, 'abc', """
+# recorder statistics
+# ===================
+# buffers             : 1 / 1 / 0 (received / written / reused)
+# buffer rate         : 1000 / 1000 (received / written per sec)
+# write bandwidth     : 0.10 / 0.10 MB/s (average / max)
+# shmem buffers       : 1
+# lost records        : 0
+# max queue depth     : 1
+# write latency       : < 64 / < 64 / < 64 usec (p50 / p99 / max)""")
+
+    def pre(self):
+        record_cmd = '%s record -d %s %s' % \
+                     (TestBase.uftrace_cmd, TDIR, 't-' + self.name)
+        sp.call(record_cmd.split())
+        return TestBase.TEST_SUCCESS
+
+    def runcmd(self):
+        return '%s info -d %s' % (TestBase.uftrace_cmd, TDIR)
+
+    def post(self, ret):
+        sp.call(['rm', '-rf', TDIR])
+        return ret
+
+    def sort(self, output):
+        result = []
+        for ln in output.split('\n'):
+            # rates and latency depend on the system
+            if ln.startswith('# buffers') or ln.startswith('# shmem') or \
+               ln.startswith('# lost'):
+                result.append(ln)
+        return '\n'.join(result)
@@ -0,0 +1,41 @@
+#!/usr/bin/env python
+
+from runtest import TestBase
+import subprocess as sp
+
+TDIR='xxx'
+
+# It uses small buffers so that the program should wait for the recorder.
+# Check the recorder statistics to see if any record was lost.
+class TestCase(TestBase):
+    def __init__(self):
+        TestBase.__init__(self, 'fibonacci', """
+# recorder statistics
+# ===================
+# buffers             : 58 / 58 / 56 (received / written / reused)
+# buffer rate         : 4833 / 4833 (received / written per sec)
+# write bandwidth     : 18.56 / 18.56 MB/s (average / max)
+# shmem buffers       : 2
+# lost records        : 0
+# max queue depth     : 2
+# write latency       : < 256 / < 1024 / < 2048 usec (p50 / p99 / max)""")
+
+    def pre(self):
+        record_cmd = '%s record -d %s -b 4K --max-buffer=2 --no-loss %s 20' % \
+                     (TestBase.uftrace_cmd, TDIR, 't-' + self.name)
+        sp.call(record_cmd.split())
+        return TestBase.TEST_SUCCESS
+
+    def runcmd(self):
+        return '%s info -d %s' % (TestBase.uftrace_cmd, TDIR)
+
+    def post(self, ret):
+        sp.call(['rm', '-rf', TDIR])
+        return ret
+
+    def sort(self, output):
+        result = []
+        for ln in output.split('\n'):
+            if ln.startswith('# shmem') or ln.startswith('# lost'):
+                result.append(ln)
+        return '\n'.join(result)
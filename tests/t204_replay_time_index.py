@@ -0,0 +1,60 @@
+#!/usr/bin/env python
+
+from runtest import TestBase
+import subprocess as sp
+import glob
+import os
+
+TDIR='xxx'
+NDIR='yyy'
+START=0
+
+# It records with small buffers to have many chunks in the time index.
+# The result of replay using the index should be same as the one without
+# the index (which reads all records from the beginning).
+class TestCase(TestBase):
+    def __init__(self):
+        TestBase.__init__(self, 'fibonacci', '')
+
+    def replay_cmd(self, dirname):
+        return '%s replay -f time,elapsed,duration -r %s~ -d %s' % \
+               (TestBase.uftrace_cmd, START, dirname)
+
+    def pre(self):
+        global START
+
+        record_cmd = '%s record -d %s -b 4K %s 20' % \
+                     (TestBase.uftrace_cmd, TDIR, 't-' + self.name)
+        sp.call(record_cmd.split())
+
+        if len(glob.glob(TDIR + '/*.idx')) == 0:
+            return TestBase.TEST_NONZERO_RETURN
+
+        # find a timestamp in the middle
+        replay_cmd = '%s replay -f time -d %s' % (TestBase.uftrace_cmd, TDIR)
+        p = sp.Popen(replay_cmd, shell=True, stdout=sp.PIPE, stderr=sp.PIPE)
+        r = p.communicate()[0].decode(errors='ignore').split('\n')
+        p.wait()
+
+        START = r[len(r) // 2].split()[0]
+
+        # get the expected result without the index
+        sp.call(['cp', '-r', TDIR, NDIR])
+        for f in glob.glob(NDIR + '/*.idx'):
+            os.remove(f)
+
+        p = sp.Popen(self.replay_cmd(NDIR), shell=True, stdout=sp.PIPE, stderr=sp.PIPE)
+        self.result = p.communicate()[0].decode(errors='ignore')
+        p.wait()
+
+        return TestBase.TEST_SUCCESS
+
+    def runcmd(self):
+        return self.replay_cmd(TDIR)
+
+    def post(self, ret):
+        sp.call(['rm', '-rf', TDIR, NDIR])
+        return ret
+
+    def sort(self, output):
+        return '\n'.join([ln for ln in output.split('\n') if ln.strip() != ''])
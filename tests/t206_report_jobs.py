@@ -0,0 +1,38 @@
+#!/usr/bin/env python
+
+from runtest import TestBase
+import subprocess as sp
+
+TDIR='xxx'
+
+# It processes each task in a separate thread and merges the result.
+# The result should be same as processing all tasks in time order.
+# Perf data without schedule events (only task and comm events) doesn't
+# prevent it.  See t213_report_jobs_sched for the other case.
+class TestCase(TestBase):
+    def __init__(self):
+        TestBase.__init__(self, 'fork', """
+  Total time   Self time       Calls  Function
+  ==========  ==========  ==========  ====================================
+    0.686 us    0.686 us           1  __cxa_atexit
+    1.148 us    1.148 us           1  __monstartup
+    6.747 us    0.448 us           2  a
+    6.299 us    0.444 us           2  b
+    5.855 us    1.188 us           2  c
+  136.127 us  136.127 us           2  fork
+    4.667 us    4.667 us           2  getpid
+  828.211 us   14.181 us           2  main
+  671.156 us  671.156 us           1  wait
+""", sort='report')
+
+    def pre(self):
+        record_cmd = '%s record -d %s %s' % (TestBase.uftrace_cmd, TDIR, 't-' + self.name)
+        sp.call(record_cmd.split())
+        return TestBase.TEST_SUCCESS
+
+    def runcmd(self):
+        return '%s report -d %s --jobs=2 -s func' % (TestBase.uftrace_cmd, TDIR)
+
+    def post(self, ret):
+        sp.call(['rm', '-rf', TDIR])
+        return ret
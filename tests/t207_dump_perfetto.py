@@ -0,0 +1,91 @@
+#!/usr/bin/env python
+
+import sys
+from runtest import TestBase
+import subprocess as sp
+
+TDIR='xxx'
+
+class TestCase(TestBase):
+    def __init__(self):
+        TestBase.__init__(self, 'abc', """
+                | process t-abc
+                | thread t-abc
+58348873444.000 | B main
+58348873444.000 | B a
+58348873445.000 | B b
+58348873445.000 | B c
+58348873448.000 | E c
+58348873448.000 | E b
+58348873448.000 | E a
+58348873449.000 | E main
+""", sort='simple')
+
+    def pre(self):
+        record_cmd = '%s record -d %s %s' % (TestBase.uftrace_cmd, TDIR, 't-' + self.name)
+        sp.call(record_cmd.split())
+        return TestBase.TEST_SUCCESS
+
+    def runcmd(self):
+        # decode the binary output with this script (see below)
+        return '%s dump -d %s -F main -D 4 --perfetto | %s %s' % \
+            (TestBase.uftrace_cmd, TDIR, sys.executable, __file__.replace('.pyc', '.py'))
+
+    def post(self, ret):
+        sp.call(['rm', '-rf', TDIR])
+        return ret
+
+
+# a tiny protobuf decoder for the perfetto trace (from stdin)
+def varint(data, pos):
+    val = shift = 0
+    while True:
+        b = data[pos]
+        pos += 1
+        val |= (b & 0x7f) << shift
+        shift += 7
+        if b < 0x80:
+            return val, pos
+
+def fields(data):
+    pos = 0
+    while pos < len(data):
+        tag, pos = varint(data, pos)
+        if tag & 7 == 0:
+            val, pos = varint(data, pos)
+        else:
+            size, pos = varint(data, pos)
+            val = data[pos:pos+size]
+            pos += size
+        yield tag >> 3, val
+
+def decode(data):
+    names = {}
+    clocks = {}
+    for _, packet in fields(data):
+        pkt = dict(fields(packet))
+        seq = pkt.get(10, 0)
+        if 60 in pkt:
+            for f, desc in fields(pkt[60]):
+                if f in (3, 4):
+                    name = dict(fields(desc))[6 if f == 3 else 5]
+                    kind = 'process' if f == 3 else 'thread'
+                    print('%15s | %s %s' % ('', kind, name.decode()))
+        if 6 in pkt:
+            clocks[seq] = pkt[8]
+            names[seq] = {}
+            continue
+        if 11 not in pkt:
+            continue
+        clocks[seq] += pkt[8]
+        for f, interned in fields(pkt.get(12, b'')):
+            entry = dict(fields(interned))
+            names[seq][entry[1]] = entry[2].decode()
+        event = dict(fields(pkt[11]))
+        ts = clocks[seq]
+        print('%d.%03d | %s %s' % (ts // 1000, ts % 1000, 'BE'[event[9] - 1],
+                                   names[seq][event[10]]))
+
+if __name__ == '__main__':
+    data = sys.stdin.buffer.read() if hasattr(sys.stdin, 'buffer') else sys.stdin.read()
+    decode(bytearray(data))
@@ -0,0 +1,70 @@
+#!/usr/bin/env python
+
+import json
+from runtest import TestBase
+import subprocess as sp
+
+TDIR='xxx'
+
+# Each split file should be a valid JSON having matching entry and exit.
+# Removing the events added at the boundary should give the same result.
+class TestCase(TestBase):
+    def __init__(self):
+        TestBase.__init__(self, 'abc', """
+split
+B main
+B a
+B b
+B c
+E c
+E b
+E a
+E main
+""")
+
+    def pre(self):
+        record_cmd = '%s record -d %s %s' % (TestBase.uftrace_cmd, TDIR, 't-' + self.name)
+        sp.call(record_cmd.split())
+        return TestBase.TEST_SUCCESS
+
+    def runcmd(self):
+        return '%s dump -d %s -F main -D 4 --chrome --split=1us > /dev/null && ' \
+            'cat %s.*.json' % (TestBase.uftrace_cmd, TDIR, TDIR)
+
+    def sort(self, output, ignore_children=False):
+        if not output.startswith('{'):
+            return output.strip()
+
+        files = []
+        for data in output.split('{"traceEvents"')[1:]:
+            try:
+                o = json.loads('{"traceEvents"' + data)
+            except:
+                return ''
+            files.append([e for e in o['traceEvents'] if e['ph'] in 'BE'])
+
+        result = ['split' if len(files) > 1 else 'no split']
+        events = []
+        for evs in files:
+            depth = 0
+            for e in evs:
+                depth += 1 if e['ph'] == 'B' else -1
+                if depth < 0:
+                    return ''
+            if depth != 0:
+                return ''
+
+            # remove the exits and entries added at the boundary
+            while events and evs and events[-1]['ph'] == 'E' and evs[0]['ph'] == 'B' and \
+                  events[-1]['name'] == evs[0]['name'] and events[-1]['ts'] == evs[0]['ts']:
+                events.pop()
+                evs.pop(0)
+            events += evs
+
+        for e in events:
+            result.append('%s %s' % (e['ph'], e['name']))
+        return '\n'.join(result)
+
+    def post(self, ret):
+        sp.call('rm -rf %s %s.*.json' % (TDIR, TDIR), shell=True)
+        return ret
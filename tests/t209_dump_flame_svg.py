@@ -0,0 +1,55 @@
+#!/usr/bin/env python
+
+import re
+from runtest import TestBase
+import subprocess as sp
+
+TDIR='xxx'
+
+# Each thread is processed separately and merged into a flame graph.
+# The frames are shown with the depth (as indentation) and samples.
+class TestCase(TestBase):
+    def __init__(self):
+        TestBase.__init__(self, 'thread', """
+main 9
+  pthread_create 4
+  pthread_join 4
+foo 16
+  a 12
+    b 8
+      c 4
+""")
+
+    def pre(self):
+        record_cmd = '%s record -d %s %s' % (TestBase.uftrace_cmd, TDIR, 't-' + self.name)
+        sp.call(record_cmd.split())
+        return TestBase.TEST_SUCCESS
+
+    def runcmd(self):
+        return '%s dump -d %s --jobs=2 --flame-svg' % (TestBase.uftrace_cmd, TDIR)
+
+    def post(self, ret):
+        sp.call(['rm', '-rf', TDIR])
+        return ret
+
+    def sort(self, output):
+        if not output.startswith('<?xml'):
+            return output.strip()
+
+        frame = re.compile(r'<title>(\S+) \((\d+) samples, [0-9.]+%\)</title>'
+                           r'<rect x="[0-9.]+" y="(\d+)"')
+        result = []
+        bottom = None
+        for ln in output.split('\n'):
+            m = frame.search(ln)
+            if m is None:
+                continue
+            name, samples, y = m.group(1), m.group(2), int(m.group(3))
+            if name == 'all':
+                bottom = y
+                continue
+            if name in ['__monstartup', '__cxa_atexit']:
+                continue
+            depth = (bottom - y) // 16 - 1
+            result.append('%s%s %s' % ('  ' * depth, name, samples))
+        return '\n'.join(result)
@@ -0,0 +1,25 @@
+#!/usr/bin/env python
+
+from runtest import TestBase
+import subprocess as sp
+
+TDIR='xxx'
+
+# The script runs in a separate thread but it should see all the events
+# from every thread (the 'block' policy doesn't drop events).
+class TestCase(TestBase):
+    def __init__(self):
+        TestBase.__init__(self, 'thread', '25')
+
+    def runcmd(self):
+        uftrace = TestBase.uftrace_cmd
+        options = '-N ^__ -S ../scripts/count.py --script-async=block'
+        program = 't-' + self.name
+        return '%s record -d %s %s %s' % (uftrace, TDIR, options, program)
+
+    def sort(self, output):
+        return output.strip().split('\n')[-1]
+
+    def post(self, ret):
+        sp.call(['rm', '-rf', TDIR])
+        return ret
@@ -0,0 +1,46 @@
+#!/usr/bin/env python
+
+from runtest import TestBase
+import subprocess as sp
+
+TDIR='xxx'
+
+# Schedule events need records of all tasks in time order, so --jobs
+# should fall back to read them in order and give the same result.  The
+# number of schedule events depends on timing, so compare it with the
+# report of the same data without --jobs.
+class TestCase(TestBase):
+    def __init__(self):
+        TestBase.__init__(self, 'fork', '')
+
+    def report_cmd(self, jobs):
+        return '%s report -d %s --jobs=%d -s func' % \
+               (TestBase.uftrace_cmd, TDIR, jobs)
+
+    def pre(self):
+        if not TestBase.check_perf_paranoid(self):
+            return TestBase.TEST_SKIP
+
+        options = '-d %s -E %s' % (TDIR, 'linux:schedule')
+        record_cmd = '%s record %s %s' % (TestBase.uftrace_cmd, options, 't-' + self.name)
+        sp.call(record_cmd.split())
+
+        # get the expected result in the main thread
+        p = sp.Popen(self.report_cmd(0), shell=True, stdout=sp.PIPE, stderr=sp.PIPE)
+        self.result = p.communicate()[0].decode(errors='ignore')
+        p.wait()
+
+        if 'linux:schedule' not in self.result:
+            return TestBase.TEST_NONZERO_RETURN
+
+        return TestBase.TEST_SUCCESS
+
+    def runcmd(self):
+        return self.report_cmd(2)
+
+    def post(self, ret):
+        sp.call(['rm', '-rf', TDIR])
+        return ret
+
+    def sort(self, output):
+        return '\n'.join([ln for ln in output.split('\n') if ln.strip() != ''])
@@ -0,0 +1,27 @@
+#!/usr/bin/env python
+
+import os
+from runtest import TestBase
+from t201_recv_batch import TestCase as RecvBatchTest
+
+LOGFILE = 'recv.log'
+
+# same as t201 but data is spliced into files as it's not compressed
+class TestCase(RecvBatchTest):
+    recv_opts = '-vvv'
+    record_opts = '--num-conn=2'
+
+    def pre(self):
+        self.recv_log = open(LOGFILE, 'w')
+        return RecvBatchTest.pre(self)
+
+    def post(self, ret):
+        ret = RecvBatchTest.post(self, ret)
+        self.recv_log.close()
+
+        # check the data was written by splice
+        if 'spliced data' not in open(LOGFILE).read():
+            ret = TestBase.TEST_DIFF_RESULT
+
+        os.remove(LOGFILE)
+        return ret
@@ -38,6 +38,7 @@
 #include "utils/list.h"
 #include "utils/fstack.h"
 #include "utils/filter.h"
+#include "utils/live-stream.h"
 
 /* output of --version option (generated by argp runtime) */
 const char *argp_program_version = "uftrace " UFTRACE_VERSION;
@@ -73,6 +74,7 @@ enum options {
 	OPT_task_newline,
 	OPT_chrome_trace,
 	OPT_flame_graph,
+	OPT_flame_svg,
 	OPT_sample_time,
 	OPT_diff,
 	OPT_sort_column,
@@ -97,6 +99,18 @@ enum options {
 	OPT_libname,
 	OPT_match_type,
 	OPT_no_randomize_addr,
+	OPT_writer_affinity,
+	OPT_num_conn,
+	OPT_compress,
+	OPT_stat,
+	OPT_no_loss,
+	OPT_max_buffer,
+	OPT_jobs,
+	OPT_perfetto,
+	OPT_split,
+	OPT_script_async,
+	OPT_stream,
+	OPT_stream_window,
 };
 
 static struct argp_option uftrace_options[] = {
@@ -152,6 +166,7 @@ static struct argp_option uftrace_options[] = {
 	{ "kernel-full", OPT_kernel_full, 0, 0, "Show kernel functions outside of user" },
 	{ "kernel-only", OPT_kernel_only, 0, 0, "Dump kernel data only" },
 	{ "flame-graph", OPT_flame_graph, 0, 0, "Dump recorded data in FlameGraph format" },
+	{ "flame-svg", OPT_flame_svg, 0, 0, "Dump recorded data as a FlameGraph SVG image" },
 	{ "sample-time", OPT_sample_time, "TIME", 0, "Show flame graph with this sampling time" },
 	{ "output-fields", 'f', "FIELD", 0, "Show FIELDs in the replay or graph output" },
 	{ "time-range", 'r', "TIME~TIME", 0, "Show output within the TIME(timestamp or elapsed time) range only" },
@@ -170,6 +185,18 @@ static struct argp_option uftrace_options[] = {
 	{ "libname", OPT_libname, 0, 0, "Show libname name with symbol name" },
 	{ "match", OPT_match_type, "TYPE", 0, "Support pattern match: regex, glob (default: regex)" },
 	{ "no-randomize-addr", OPT_no_randomize_addr, 0, 0, "Disable ASLR (Address Space Layout Randomization)" },
+	{ "writer-affinity", OPT_writer_affinity, "MODE", 0, "Pin recorder threads to NUMA nodes: auto, none (default: none)" },
+	{ "num-conn", OPT_num_conn, "NUM", 0, "Send data to the host using NUM connections (default: 1)" },
+	{ "compress", OPT_compress, 0, 0, "Compress data sent to the host" },
+	{ "stat", OPT_stat, 0, 0, "Show recorder statistics every second" },
+	{ "no-loss", OPT_no_loss, 0, 0, "Wait for the recorder rather than losing records" },
+	{ "max-buffer", OPT_max_buffer, "NUM", 0, "Use at most NUM buffers per thread (default: no limit)" },
+	{ "jobs", OPT_jobs, "NUM", 0, "Use NUM threads to read data (default: 0)" },
+	{ "perfetto", OPT_perfetto, 0, 0, "Dump recorded data in perfetto trace format" },
+	{ "split", OPT_split, "TIME|SIZE", 0, "Split chrome trace into files of TIME or SIZE" },
+	{ "script-async", OPT_script_async, "POLICY", 0, "Run script in a separate thread: drop, block (if queue is full)" },
+	{ "stream", OPT_stream, 0, 0, "Show live output as it's recorded (without writing data)" },
+	{ "stream-window", OPT_stream_window, "TIME", 0, "Wait TIME for reordering records in stream (default: 100ms)" },
 	{ "help", 'h', 0, 0, "Give this help list" },
 	{ 0 }
 };
@@ -205,6 +232,36 @@ static unsigned long parse_size(char *str)
 	return size;
 }
 
+/*
+ * The SIZE has one of K, M or G unit (case-insensitive except for 'M')
+ * since 'm' is used for minutes.  Otherwise it's a TIME.
+ */
+static bool parse_split(struct opts *opts, char *arg)
+{
+	const char *time_units[] = {
+		"ns", "nsec", "us", "usec", "ms", "msec", "s", "sec", "m", "min",
+	};
+	char *unit;
+	size_t i;
+
+	strtod(arg, &unit);
+	if (unit == arg || *unit == '\0')
+		return false;
+
+	if (strchr("kKMgG", *unit) || !strcasecmp(unit, "mb")) {
+		opts->split_size = parse_size(arg);
+		return opts->split_size != 0;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(time_units); i++) {
+		if (!strcasecmp(unit, time_units[i])) {
+			opts->split_time = parse_time(arg, 9);
+			return opts->split_time != 0;
+		}
+	}
+	return false;
+}
+
 static char * opt_add_string(char *old_opt, char *new_opt)
 {
 	return strjoin(old_opt, new_opt, ";");
@@ -607,6 +664,11 @@ static error_t parse_option(int key, char *arg, struct argp_state *state)
 		opts->flame_graph = true;
 		break;
 
+	case OPT_flame_svg:
+		opts->flame_graph = true;
+		opts->flame_svg = true;
+		break;
+
 	case OPT_diff:
 		opts->diff = arg;
 		break;
@@ -729,6 +791,78 @@ static error_t parse_option(int key, char *arg, struct argp_state *state)
 		opts->no_randomize_addr = true;
 		break;
 
+	case OPT_writer_affinity:
+		if (!strcmp(arg, "auto"))
+			opts->writer_affinity = true;
+		else if (!strcmp(arg, "none"))
+			opts->writer_affinity = false;
+		else
+			pr_use("invalid writer affinity: %s (ignoring...)\n", arg);
+		break;
+
+	case OPT_num_conn:
+		opts->nr_conn = strtol(arg, NULL, 0);
+		if (opts->nr_conn < 1 || opts->nr_conn > 64) {
+			pr_use("invalid number of connections: %s (ignoring...)\n", arg);
+			opts->nr_conn = 1;
+		}
+		break;
+
+	case OPT_compress:
+		opts->compress = true;
+		break;
+
+	case OPT_stat:
+		opts->stat = true;
+		break;
+
+	case OPT_no_loss:
+		opts->no_loss = true;
+		break;
+
+	case OPT_max_buffer:
+		opts->max_buffer = strtol(arg, NULL, 0);
+		if (opts->max_buffer < 2) {
+			pr_use("invalid number of buffers: %s (ignoring...)\n", arg);
+			opts->max_buffer = 0;
+		}
+		break;
+
+	case OPT_script_async:
+		if (!strcmp(arg, "drop") || !strcmp(arg, "block"))
+			opts->script_async = arg;
+		else
+			pr_use("invalid script async policy: %s (ignoring...)\n", arg);
+		break;
+
+	case OPT_stream:
+		opts->stream = true;
+		break;
+
+	case OPT_stream_window:
+		opts->stream_window = parse_time(arg, 9);
+		opts->stream = true;
+		break;
+
+	case OPT_jobs:
+		opts->nr_jobs = strtol(arg, NULL, 0);
+		if (opts->nr_jobs < 0) {
+			pr_use("invalid number of jobs: %s (ignoring...)\n", arg);
+			opts->nr_jobs = 0;
+		}
+		break;
+
+	case OPT_split:
+		if (!parse_split(opts, arg))
+			pr_use("invalid split time or size: %s (ignoring...)\n", arg);
+		break;
+
+	case OPT_perfetto:
+		opts->perfetto = true;
+		/* binary output should not go to the pager */
+		opts->use_pager = false;
+		break;
+
 	case ARGP_KEY_ARG:
 		if (state->arg_num) {
 			/*
@@ -952,6 +1086,7 @@ int main(int argc, char *argv[])
 		.depth		= OPT_DEPTH_DEFAULT,
 		.max_stack	= OPT_RSTACK_DEFAULT,
 		.port		= UFTRACE_RECV_PORT,
+		.nr_conn	= 1,
 		.use_pager	= true,
 		.color		= COLOR_AUTO,  /* default to 'auto' (turn on if terminal) */
 		.column_offset	= 8,
@@ -961,6 +1096,7 @@ int main(int argc, char *argv[])
 		.sort_column	= 2,
 		.event_skip_out = true,
 		.patt_type      = PATT_REGEX,
+		.stream_window  = LIVE_STREAM_WINDOW,
 	};
 	struct argp argp = {
 		.options = uftrace_options,
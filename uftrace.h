@@ -140,6 +140,8 @@ struct uftrace_rstack_list;
 struct uftrace_session;
 struct uftrace_kernel_reader;
 struct uftrace_perf_reader;
+struct uftrace_rstack_merge;
+struct uftrace_decoder;
 
 struct uftrace_session_link {
 	struct rb_root		root;
@@ -156,8 +158,13 @@ struct ftrace_file_handle {
 	struct uftrace_kernel_reader *kernel;
 	struct uftrace_perf_reader *perf;
 	struct ftrace_task_handle *tasks;
+	struct ftrace_task_handle **task_hash;
+	struct uftrace_rstack_merge *merge;
+	struct uftrace_decoder *decoder;
 	struct uftrace_session_link sessions;
 	int nr_tasks;
+	int task_hash_bits;
+	int nr_jobs;
 	int nr_perf;
 	int last_perf_idx;
 	int depth;
@@ -165,6 +172,7 @@ struct ftrace_file_handle {
 	bool needs_bit_swap;
 	uint64_t time_filter;
 	struct uftrace_time_range time_range;
+	bool range_seeked;
 	struct list_head events;
 };
 
@@ -201,6 +209,7 @@ struct opts {
 	char **run_cmd;
 	char *opt_file;
 	char *script_file;
+	char *script_async;
 	char *diff_policy;
 	int mode;
 	int idx;
@@ -213,10 +222,16 @@ struct opts {
 	int sort_column;
 	int nr_thread;
 	int rt_prio;
+	int nr_conn;
+	int max_buffer;
+	int nr_jobs;
 	unsigned long bufsize;
 	unsigned long kernel_bufsize;
 	uint64_t threshold;
 	uint64_t sample_time;
+	uint64_t split_time;
+	uint64_t split_size;
+	uint64_t stream_window;
 	bool flat;
 	bool libcall;
 	bool print_symtab;
@@ -237,6 +252,7 @@ struct opts {
 	bool chrome_trace;
 	bool comment;
 	bool flame_graph;
+	bool flame_svg;
 	bool libmcount_single;
 	bool kernel;
 	bool kernel_skip_out;  /* also affects VDSO filter */
@@ -249,6 +265,12 @@ struct opts {
 	bool auto_args;
 	bool libname;
 	bool no_randomize_addr;
+	bool writer_affinity;
+	bool compress;
+	bool stat;
+	bool no_loss;
+	bool perfetto;
+	bool stream;
 	struct uftrace_time_range range;
 	enum uftrace_pattern_type patt_type;
 };
@@ -343,6 +365,9 @@ enum uftrace_msg_type {
 	UFTRACE_MSG_SEND_INFO,
 	UFTRACE_MSG_SEND_META_DATA,
 	UFTRACE_MSG_SEND_END,
+	UFTRACE_MSG_SEND_DATA_BATCH,
+	UFTRACE_MSG_SEND_NR_CONN,
+	UFTRACE_MSG_SEND_DATA_CONN,
 };
 
 /* msg format for communicating by pipe */
@@ -353,6 +378,23 @@ struct uftrace_msg {
 	unsigned char data[];
 };
 
+/* header of UFTRACE_MSG_SEND_DATA_BATCH, followed by (compressed) buffers */
+struct uftrace_msg_batch {
+	uint32_t nr;     /* number of buffers */
+	uint32_t flags;  /* UFTRACE_BATCH_* */
+	uint32_t size;   /* total size of buffers before compression */
+	uint32_t unused;
+};
+
+#define UFTRACE_BATCH_COMPRESSED  (1U << 0)
+
+/* each buffer in a batch */
+struct uftrace_msg_batch_buf {
+	int32_t  tid;
+	uint32_t len;
+	unsigned char data[];
+};
+
 struct uftrace_msg_task {
 	uint64_t time;
 	int32_t  pid;
@@ -367,6 +409,11 @@ struct uftrace_msg_sess {
 	char exename[];
 };
 
+struct uftrace_msg_lost {
+	int32_t  lost;
+	int32_t  tid;
+};
+
 struct uftrace_msg_dlopen {
 	struct uftrace_msg_task task;
 	uint64_t base_addr;
@@ -420,6 +467,30 @@ void send_trace_metadata(int sock, const char *dirname, char *filename);
 void send_trace_info(int sock, struct uftrace_file_header *hdr,
 		     void *info, int len);
 void send_trace_end(int sock);
+void send_trace_nr_conn(int sock, int nr);
+void send_trace_data_conn(int sock, char *name);
+
+#define UFTRACE_SEND_BATCH_SIZE  (1024 * 1024)
+/* max (uncompressed) size of a compressed batch the receiver accepts */
+#define UFTRACE_BATCH_MAX_SIZE   (UFTRACE_SEND_BATCH_SIZE * 16)
+
+/* buffers of a writer to be sent in a single message */
+struct uftrace_send_batch {
+	int	sock;
+	int	nr;
+	bool	compress;
+	size_t	size;
+	size_t	alloc;
+	void	*buf;
+	size_t	zalloc;
+	void	*zbuf;
+};
+
+void init_send_batch(struct uftrace_send_batch *batch, bool compress);
+void add_send_batch(struct uftrace_send_batch *batch, int sock, int tid,
+		    void *data, size_t len);
+void flush_send_batch(struct uftrace_send_batch *batch);
+void finish_send_batch(struct uftrace_send_batch *batch);
 
 void write_task_info(const char *dirname, struct uftrace_msg_task *tmsg);
 void write_fork_info(const char *dirname, struct uftrace_msg_task *tmsg);
@@ -516,6 +587,8 @@ enum uftrace_event_id {
 	EVENT_ID_DIFF_PMU_CACHE,
 	EVENT_ID_READ_PMU_BRANCH,
 	EVENT_ID_DIFF_PMU_BRANCH,
+	EVENT_ID_BUFFER_STALL,
+	EVENT_ID_SCRIPT_QUEUE,
 
 	/* supported perf events */
 	EVENT_ID_PERF		= 200000U,
@@ -529,6 +602,17 @@ enum uftrace_event_id {
 	EVENT_ID_USER	= 1000000U,
 };
 
+/* data of EVENT_ID_BUFFER_STALL: waited for the recorder (--no-loss) */
+struct uftrace_buffer_stall {
+	uint64_t		time;  /* in nsec */
+};
+
+/* data of EVENT_ID_SCRIPT_QUEUE: the async script queue was full */
+struct uftrace_script_queue {
+	uint64_t		dropped;  /* number of dropped script events */
+	uint64_t		time;     /* waited for the script thread in nsec */
+};
+
 struct uftrace_event {
 	struct list_head	list;
 	enum uftrace_event_id	id;
@@ -0,0 +1,173 @@
+/*
+ * Arena (bump) allocator for objects freed together
+ *
+ * Analysis commands allocate lots of small objects like graph nodes and
+ * their names which live until the end.  Allocating them one by one with
+ * malloc() wastes memory for the headers and takes long to free them.
+ * The arena carves them from large chunks and frees the chunks at once.
+ *
+ * Released under the GPL v2.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "utils/utils.h"
+#include "utils/arena.h"
+
+/* alignment of objects (not strings) */
+#define ARENA_ALIGN  sizeof(uint64_t)
+
+void arena_init(struct uftrace_arena *arena, size_t chunk_size)
+{
+	memset(arena, 0, sizeof(*arena));
+	arena->chunk_size = chunk_size;
+}
+
+/**
+ * arena_destroy - free all objects in the arena
+ * @arena: arena to destroy
+ *
+ * This function frees all memory allocated from @arena.  The @arena
+ * can be used again for new objects after this.
+ */
+void arena_destroy(struct uftrace_arena *arena)
+{
+	struct uftrace_arena_chunk *chunk, *next;
+
+	chunk = arena->chunks;
+	while (chunk) {
+		next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+
+	arena->chunks = NULL;
+	arena->pos = NULL;
+	arena->avail = 0;
+	arena->total = 0;
+}
+
+static void *arena_new_chunk(struct uftrace_arena *arena, size_t size)
+{
+	struct uftrace_arena_chunk *chunk;
+	size_t chunk_size = arena->chunk_size ?: ARENA_CHUNK_SIZE;
+
+	/* large objects get their own chunk, keep using the current one */
+	if (size > chunk_size / 4) {
+		chunk = xmalloc(sizeof(*chunk) + size);
+		chunk->size = size;
+		arena->total += size;
+
+		if (arena->chunks) {
+			chunk->next = arena->chunks->next;
+			arena->chunks->next = chunk;
+		}
+		else {
+			chunk->next = NULL;
+			arena->chunks = chunk;
+		}
+		return chunk->data;
+	}
+
+	chunk = xmalloc(sizeof(*chunk) + chunk_size);
+	chunk->size = chunk_size;
+	chunk->next = arena->chunks;
+	arena->chunks = chunk;
+	arena->total += chunk_size;
+
+	arena->pos = chunk->data + size;
+	arena->avail = chunk_size - size;
+	return chunk->data;
+}
+
+static void *__arena_alloc(struct uftrace_arena *arena, size_t size,
+			   size_t align)
+{
+	size_t pad = -(uintptr_t)arena->pos & (align - 1);
+	void *ptr;
+
+	if (size + pad > arena->avail)
+		return arena_new_chunk(arena, size);
+
+	ptr = arena->pos + pad;
+	arena->pos += size + pad;
+	arena->avail -= size + pad;
+	return ptr;
+}
+
+/**
+ * arena_alloc - allocate an object from the arena
+ * @arena: arena to allocate from
+ * @size: size of the object
+ *
+ * This function returns a memory of @size bytes aligned to 8 bytes.
+ * It cannot be freed individually.
+ */
+void *arena_alloc(struct uftrace_arena *arena, size_t size)
+{
+	return __arena_alloc(arena, size, ARENA_ALIGN);
+}
+
+void *arena_zalloc(struct uftrace_arena *arena, size_t size)
+{
+	void *ptr = __arena_alloc(arena, size, ARENA_ALIGN);
+
+	memset(ptr, 0, size);
+	return ptr;
+}
+
+/* strings don't need to be aligned */
+char *arena_strdup(struct uftrace_arena *arena, const char *str)
+{
+	size_t len = strlen(str) + 1;
+	char *ptr = __arena_alloc(arena, len, 1);
+
+	memcpy(ptr, str, len);
+	return ptr;
+}
+
+#ifdef UNIT_TEST
+TEST_CASE(arena_alloc)
+{
+	struct uftrace_arena arena = {};
+	uint64_t *p, *q;
+	char *s, *big;
+	int i;
+
+	s = arena_strdup(&arena, "abc");
+	TEST_STREQ(s, "abc");
+
+	p = arena_zalloc(&arena, sizeof(*p) * 4);
+	TEST_EQ((uintptr_t)p % ARENA_ALIGN, 0);
+	for (i = 0; i < 4; i++)
+		TEST_EQ(p[i], 0);
+	TEST_EQ(arena.total, ARENA_CHUNK_SIZE);
+
+	/* a large object should not waste the current chunk */
+	big = arena_alloc(&arena, ARENA_CHUNK_SIZE);
+	memset(big, 'x', ARENA_CHUNK_SIZE);
+	q = arena_alloc(&arena, sizeof(*q));
+	TEST_EQ((char *)q, (char *)(p + 4));
+	TEST_EQ(arena.total, 2 * ARENA_CHUNK_SIZE);
+
+	/* fill up the current chunk */
+	while (arena.total == 2 * ARENA_CHUNK_SIZE)
+		arena_strdup(&arena, "0123456789");
+	TEST_EQ(arena.total, 3 * ARENA_CHUNK_SIZE);
+	TEST_STREQ(s, "abc");
+
+	arena_destroy(&arena);
+	TEST_EQ(arena.chunks, NULL);
+	TEST_EQ(arena.total, 0);
+
+	/* it can be used again */
+	arena_init(&arena, 1024);
+	s = arena_strdup(&arena, "def");
+	TEST_STREQ(s, "def");
+	TEST_EQ(arena.total, 1024);
+	arena_destroy(&arena);
+
+	return TEST_OK;
+}
+#endif /* UNIT_TEST */
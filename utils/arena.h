@@ -0,0 +1,35 @@
+#ifndef UFTRACE_ARENA_H
+#define UFTRACE_ARENA_H
+
+#include <stddef.h>
+
+/* default size of a chunk when it's not given */
+#define ARENA_CHUNK_SIZE  (64 * 1024)
+
+struct uftrace_arena_chunk {
+	struct uftrace_arena_chunk *next;
+	size_t size;
+	char data[];
+};
+
+/*
+ * Simple bump allocator for objects with the same lifetime.  Objects
+ * cannot be freed individually but all of them are freed at once by
+ * arena_destroy().  A zero-initialized arena is ready to use.
+ */
+struct uftrace_arena {
+	struct uftrace_arena_chunk *chunks;
+	char *pos;         /* next free byte in the current chunk */
+	size_t avail;      /* remaining bytes in the current chunk */
+	size_t chunk_size;
+	size_t total;      /* total size of chunks */
+};
+
+void arena_init(struct uftrace_arena *arena, size_t chunk_size);
+void arena_destroy(struct uftrace_arena *arena);
+
+void *arena_alloc(struct uftrace_arena *arena, size_t size);
+void *arena_zalloc(struct uftrace_arena *arena, size_t size);
+char *arena_strdup(struct uftrace_arena *arena, const char *str);
+
+#endif /* UFTRACE_ARENA_H */
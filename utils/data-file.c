@@ -403,8 +403,13 @@ ok:
 	handle->depth = opts->depth;
 	handle->nr_tasks = 0;
 	handle->tasks = NULL;
+	handle->task_hash = NULL;
+	handle->merge = NULL;
+	handle->decoder = NULL;
+	handle->nr_jobs = opts->nr_jobs;
 	handle->time_filter = opts->threshold;
 	handle->time_range = opts->range;
+	handle->range_seeked = false;
 	handle->sessions.root  = RB_ROOT;
 	handle->sessions.tasks = RB_ROOT;
 	handle->sessions.first = NULL;
@@ -0,0 +1,172 @@
+/*
+ * Memory-mapped reader for data files
+ *
+ * Reading a record with stdio costs a function call and a copy for each
+ * (16-byte) record.  Instead, map the file (or a window of it for a large
+ * file) and return pointers to the data directly.  As records are read
+ * sequentially, it tells the kernel to read ahead the next window.
+ *
+ * Released under the GPL v2.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* This should be defined before #include "utils.h" */
+#define PR_FMT     "fstack"
+#define PR_DOMAIN  DBG_FSTACK
+
+#include "utils/utils.h"
+#include "utils/data-map.h"
+
+/**
+ * data_map_open - open a data file to read using mmap
+ * @filename: name of the data file
+ *
+ * This function opens @filename and returns a reader for it.  The file
+ * will be mapped when it's read.  It returns NULL if failed.
+ */
+struct uftrace_data_map *data_map_open(const char *filename)
+{
+	struct uftrace_data_map *dm;
+	struct stat stbuf;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &stbuf) < 0) {
+		close(fd);
+		return NULL;
+	}
+
+	dm = xzalloc(sizeof(*dm));
+	dm->fd     = fd;
+	dm->size   = stbuf.st_size;
+	dm->window = DATA_MAP_WINDOW;
+
+	return dm;
+}
+
+void data_map_close(struct uftrace_data_map *dm)
+{
+	if (dm == NULL)
+		return;
+
+	if (dm->map)
+		munmap(dm->map, dm->len);
+	close(dm->fd);
+	free(dm);
+}
+
+static int map_window(struct uftrace_data_map *dm, size_t size)
+{
+	size_t pagesize = getpagesize();
+	uint64_t start = dm->pos & ~(pagesize - 1);
+	size_t len = dm->window;
+
+	if (dm->pos + size > start + len)
+		len = ALIGN(dm->pos + size - start, pagesize);
+	if (start + len > dm->size)
+		len = dm->size - start;
+
+	if (dm->map)
+		munmap(dm->map, dm->len);
+
+	dm->map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, dm->fd, start);
+	if (dm->map == MAP_FAILED) {
+		pr_dbg("mapping data file failed: %m\n");
+		dm->map = NULL;
+		dm->start = dm->len = 0;
+		return -1;
+	}
+
+	dm->start = start;
+	dm->len   = len;
+
+	madvise(dm->map, len, MADV_SEQUENTIAL);
+
+	/* start reading the next window in advance */
+	if (start + len < dm->size)
+		readahead(dm->fd, start + len, dm->window);
+
+	return 0;
+}
+
+/* slow path of data_map_read(): move the window to the current position */
+void *__data_map_read(struct uftrace_data_map *dm, size_t size)
+{
+	void *ptr;
+
+	if (dm->pos + size > dm->size)
+		return NULL;
+
+	if (map_window(dm, size) < 0)
+		return NULL;
+
+	ptr = dm->map + (dm->pos - dm->start);
+	dm->pos += size;
+	return ptr;
+}
+
+#ifdef UNIT_TEST
+TEST_CASE(data_map_window)
+{
+	char filename[] = "data-map-test.XXXXXX";
+	struct uftrace_data_map *dm;
+	size_t pagesize = getpagesize();
+	uint64_t i, nr = pagesize * 3 / sizeof(i);
+	uint64_t *val;
+	char *str;
+	int fd;
+
+	fd = mkstemp(filename);
+	TEST_GE(fd, 0);
+
+	for (i = 0; i < nr; i++)
+		TEST_EQ(write(fd, &i, sizeof(i)), (ssize_t)sizeof(i));
+	/* unaligned data across the window */
+	TEST_EQ(write(fd, "uftrace", 8), 8);
+	close(fd);
+
+	dm = data_map_open(filename);
+	TEST_NE(dm, NULL);
+	TEST_EQ(dm->size, nr * sizeof(i) + 8);
+
+	/* use a small window to check remapping */
+	dm->window = pagesize;
+
+	for (i = 0; i < nr; i++) {
+		val = data_map_read(dm, sizeof(*val));
+		TEST_NE(val, NULL);
+		TEST_EQ(*val, i);
+	}
+	TEST_EQ(dm->len, pagesize);
+
+	str = data_map_read(dm, 8);
+	TEST_NE(str, NULL);
+	TEST_STREQ(str, "uftrace");
+	TEST_EQ(data_map_read(dm, 1), NULL);
+
+	/* read across the window */
+	data_map_seek(dm, pagesize - 4);
+	val = data_map_read(dm, sizeof(*val));
+	TEST_NE(val, NULL);
+	TEST_EQ(dm->start, 0);
+
+	data_map_seek(dm, 0);
+	data_map_skip(dm, sizeof(*val) * 2);
+	val = data_map_read(dm, sizeof(*val));
+	TEST_NE(val, NULL);
+	TEST_EQ(*val, 2);
+
+	data_map_close(dm);
+	unlink(filename);
+
+	return TEST_OK;
+}
+#endif /* UNIT_TEST */
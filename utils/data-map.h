@@ -0,0 +1,52 @@
+#ifndef UFTRACE_DATA_MAP_H
+#define UFTRACE_DATA_MAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* maximum size to map at once, small files are mapped entirely */
+#define DATA_MAP_WINDOW  (64 * 1024 * 1024)
+
+/*
+ * Memory-mapped reader of a (task) data file.  It maps a window of the
+ * file and returns pointers to the data directly.  The pointer is valid
+ * until next call of data_map_read() as it might move the window.
+ */
+struct uftrace_data_map {
+	int fd;
+	uint64_t size;     /* file size */
+	uint64_t pos;      /* current file offset */
+	uint64_t start;    /* file offset of the mapped window */
+	size_t len;        /* length of the mapped window */
+	size_t window;
+	void *map;
+};
+
+struct uftrace_data_map *data_map_open(const char *filename);
+void data_map_close(struct uftrace_data_map *dm);
+void *__data_map_read(struct uftrace_data_map *dm, size_t size);
+
+/* returns pointer to @size bytes at current position or NULL at the end */
+static inline void *data_map_read(struct uftrace_data_map *dm, size_t size)
+{
+	void *ptr;
+
+	if (dm->pos < dm->start || dm->pos + size > dm->start + dm->len)
+		return __data_map_read(dm, size);
+
+	ptr = dm->map + (dm->pos - dm->start);
+	dm->pos += size;
+	return ptr;
+}
+
+static inline void data_map_seek(struct uftrace_data_map *dm, uint64_t pos)
+{
+	dm->pos = pos;
+}
+
+static inline void data_map_skip(struct uftrace_data_map *dm, size_t size)
+{
+	dm->pos += size;
+}
+
+#endif /* UFTRACE_DATA_MAP_H */
@@ -0,0 +1,310 @@
+/*
+ * Decode task data files ahead using multiple threads
+ *
+ * Reading (user) records from task data files includes byte-swapping and
+ * copying arguments which need to find the session and the filter.  The
+ * decoder threads do that for each task ahead and pass the result to the
+ * main thread in batches.  The main thread still merges the records in
+ * time order and updates the function stack as before.
+ *
+ * Released under the GPL v2.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+
+/* This should be defined before #include "utils.h" */
+#define PR_FMT     "fstack"
+#define PR_DOMAIN  DBG_FSTACK
+
+#include "uftrace.h"
+#include "utils/utils.h"
+#include "utils/fstack.h"
+#include "utils/decoder.h"
+
+struct decoder_arg {
+	struct uftrace_decoder	*dec;
+	int			idx;
+};
+
+static void save_decoded_args(struct decode_batch *b,
+			      struct decoded_record *dr,
+			      struct fstack_arguments *args)
+{
+	dr->args   = args->args;
+	dr->len    = args->len;
+	dr->offset = b->data_len;
+
+	if (args->len == 0)
+		return;
+
+	if (b->data_len + args->len > b->data_size) {
+		b->data_size = ALIGN(b->data_len + args->len, 4096);
+		b->data = xrealloc(b->data, b->data_size);
+	}
+
+	memcpy(b->data + b->data_len, args->data, args->len);
+	b->data_len += args->len;
+}
+
+static void fill_batch(struct uftrace_decoder *dec, struct decode_queue *q,
+		       struct decode_batch *b)
+{
+	struct ftrace_task_handle *task = q->shadow;
+	struct decoded_record *dr;
+
+	if (b->recs == NULL)
+		b->recs = xmalloc(dec->batch_size * sizeof(*b->recs));
+
+	b->nr = 0;
+	b->pos = 0;
+	b->last = false;
+	b->data_len = 0;
+
+	while (b->nr < dec->batch_size) {
+		if (decode_task_ustack(task) < 0) {
+			b->last = true;
+			break;
+		}
+
+		dr = &b->recs[b->nr++];
+		dr->rec = task->ustack;
+		dr->len = 0;
+
+		if (task->ustack.more)
+			save_decoded_args(b, dr, &task->args);
+	}
+}
+
+static void *decoder_thread(void *arg)
+{
+	struct decoder_arg *darg = arg;
+	struct uftrace_decoder *dec = darg->dec;
+	struct decode_queue *q;
+	struct decode_batch *b;
+	sigset_t sigset;
+	bool busy;
+	int alive;
+	int i;
+
+	/* signals should be handled by the main thread */
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+
+	pthread_mutex_lock(&dec->lock);
+	while (!dec->stop) {
+		busy = false;
+		alive = 0;
+
+		for (i = darg->idx; i < dec->nr_queue; i += dec->nr_thread) {
+			q = dec->queues[i];
+
+			if (q->done)
+				continue;
+			alive++;
+
+			if (q->head - q->tail == DECODE_QUEUE_DEPTH)
+				continue;
+
+			b = &q->batch[q->head % DECODE_QUEUE_DEPTH];
+
+			pthread_mutex_unlock(&dec->lock);
+			fill_batch(dec, q, b);
+			pthread_mutex_lock(&dec->lock);
+
+			q->head++;
+			q->done = b->last;
+			pthread_cond_broadcast(&dec->filled);
+
+			busy = true;
+			if (dec->stop)
+				break;
+		}
+
+		if (!alive)
+			break;
+		if (!busy)
+			pthread_cond_wait(&dec->freed, &dec->lock);
+	}
+	pthread_mutex_unlock(&dec->lock);
+
+	free(darg);
+	return NULL;
+}
+
+/**
+ * setup_task_decoder - start decoder threads for the tasks
+ * @handle: file handle
+ * @nr_thread: number of decoder threads
+ *
+ * This function starts @nr_thread threads to decode task data files
+ * ahead.  It should be called before reading any records (but after
+ * seeking to the time range) as the threads start to read the data
+ * files from the current position.  Returns 0 on success, -1 if there's
+ * nothing to decode.
+ */
+int setup_task_decoder(struct ftrace_file_handle *handle, int nr_thread)
+{
+	struct uftrace_decoder *dec;
+	struct ftrace_task_handle *task;
+	struct decode_queue *q;
+	int i, nr = 0;
+
+	for (i = 0; i < handle->nr_tasks; i++) {
+		task = &handle->tasks[i];
+		if (!task->done && task->map)
+			nr++;
+	}
+
+	if (nr == 0 || nr_thread <= 0)
+		return -1;
+
+	if (nr_thread > nr)
+		nr_thread = nr;
+
+	dec = xzalloc(sizeof(*dec));
+	pthread_mutex_init(&dec->lock, NULL);
+	pthread_cond_init(&dec->filled, NULL);
+	pthread_cond_init(&dec->freed, NULL);
+
+	/* limit memory usage for many tasks */
+	dec->batch_size = DECODE_MAX_RECORDS / (nr * DECODE_QUEUE_DEPTH);
+	if (dec->batch_size > DECODE_BATCH_SIZE)
+		dec->batch_size = DECODE_BATCH_SIZE;
+	if (dec->batch_size < 64)
+		dec->batch_size = 64;
+
+	dec->queues = xcalloc(nr, sizeof(*dec->queues));
+	for (i = 0; i < handle->nr_tasks; i++) {
+		task = &handle->tasks[i];
+		if (task->done || task->map == NULL)
+			continue;
+
+		q = xzalloc(sizeof(*q));
+		q->shadow = xzalloc(sizeof(*q->shadow));
+		q->shadow->tid = task->tid;
+		q->shadow->h   = handle;
+		q->shadow->t   = task->t;
+		q->shadow->map = task->map;
+
+		task->decode = q;
+		dec->queues[dec->nr_queue++] = q;
+	}
+
+	pr_dbg("start %d decoder thread(s) for %d task(s)\n", nr_thread, nr);
+
+	dec->nr_thread = nr_thread;
+	dec->threads = xcalloc(nr_thread, sizeof(*dec->threads));
+	for (i = 0; i < nr_thread; i++) {
+		struct decoder_arg *darg = xmalloc(sizeof(*darg));
+
+		darg->dec = dec;
+		darg->idx = i;
+		pthread_create(&dec->threads[i], NULL, decoder_thread, darg);
+	}
+
+	handle->decoder = dec;
+	return 0;
+}
+
+void finish_task_decoder(struct ftrace_file_handle *handle)
+{
+	struct uftrace_decoder *dec = handle->decoder;
+	struct decode_queue *q;
+	int i, k;
+
+	if (dec == NULL)
+		return;
+
+	pthread_mutex_lock(&dec->lock);
+	dec->stop = true;
+	pthread_cond_broadcast(&dec->freed);
+	pthread_mutex_unlock(&dec->lock);
+
+	for (i = 0; i < dec->nr_thread; i++)
+		pthread_join(dec->threads[i], NULL);
+
+	for (i = 0; i < handle->nr_tasks; i++)
+		handle->tasks[i].decode = NULL;
+
+	for (i = 0; i < dec->nr_queue; i++) {
+		q = dec->queues[i];
+
+		for (k = 0; k < DECODE_QUEUE_DEPTH; k++) {
+			free(q->batch[k].recs);
+			free(q->batch[k].data);
+		}
+
+		/* the data map is owned by the task */
+		free(q->shadow->args.data);
+		free(q->shadow);
+		free(q);
+	}
+
+	pthread_mutex_destroy(&dec->lock);
+	pthread_cond_destroy(&dec->filled);
+	pthread_cond_destroy(&dec->freed);
+
+	free(dec->queues);
+	free(dec->threads);
+	free(dec);
+
+	handle->decoder = NULL;
+}
+
+/**
+ * read_decoded_ustack - read next user record decoded ahead
+ * @task: tracee task
+ *
+ * This function is called from read_task_ustack() when the decoder is
+ * running.  It saves the next record and its arguments in @task like
+ * reading them from the data file directly.  It returns 0 if succeeded,
+ * -1 if there's no more record.
+ */
+int read_decoded_ustack(struct ftrace_task_handle *task)
+{
+	struct uftrace_decoder *dec = task->h->decoder;
+	struct decode_queue *q = task->decode;
+	struct decode_batch *b = q->curr;
+	struct decoded_record *dr;
+
+	while (b == NULL || b->pos == b->nr) {
+		if (b) {
+			bool last = b->last;
+
+			/* release the batch to the decoder */
+			pthread_mutex_lock(&dec->lock);
+			q->tail++;
+			pthread_cond_broadcast(&dec->freed);
+			pthread_mutex_unlock(&dec->lock);
+
+			q->curr = NULL;
+			if (last)
+				return -1;
+		}
+
+		pthread_mutex_lock(&dec->lock);
+		while (q->head == q->tail)
+			pthread_cond_wait(&dec->filled, &dec->lock);
+		pthread_mutex_unlock(&dec->lock);
+
+		b = q->curr = &q->batch[q->tail % DECODE_QUEUE_DEPTH];
+	}
+
+	dr = &b->recs[b->pos++];
+	task->ustack = dr->rec;
+
+	if (dr->rec.more) {
+		task->args.args = dr->args;
+		task->args.len  = dr->len;
+
+		if (dr->len) {
+			task->args.data = xrealloc(task->args.data, dr->len);
+			memcpy(task->args.data, b->data + dr->offset, dr->len);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,67 @@
+#ifndef UFTRACE_DECODER_H
+#define UFTRACE_DECODER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "uftrace.h"
+
+/* max number of records in all batches, it limits the batch size */
+#define DECODE_MAX_RECORDS  (1024 * 1024)
+#define DECODE_BATCH_SIZE   1024
+#define DECODE_QUEUE_DEPTH  2
+
+struct fstack_arguments;
+struct ftrace_task_handle;
+
+/* a (user) record and its argument data decoded ahead */
+struct decoded_record {
+	struct uftrace_record	rec;
+	struct list_head	*args;    /* argument spec */
+	unsigned		len;      /* length of argument data */
+	unsigned		offset;   /* offset of argument data in batch */
+};
+
+struct decode_batch {
+	struct decoded_record	*recs;
+	int			nr;
+	int			pos;      /* next record to read (consumer) */
+	bool			last;     /* no more records after this */
+	char			*data;    /* argument data of the records */
+	size_t			data_len;
+	size_t			data_size;
+};
+
+/*
+ * A single-producer, single-consumer queue of decoded batches for a task.
+ * A decoder thread fills batches using the shadow task handle and the main
+ * thread reads them in read_task_ustack().  The head and tail are protected
+ * by the decoder lock but it's taken once for a batch.
+ */
+struct decode_queue {
+	struct ftrace_task_handle	*shadow;
+	struct decode_batch		batch[DECODE_QUEUE_DEPTH];
+	unsigned			head;   /* number of batches filled */
+	unsigned			tail;   /* number of batches consumed */
+	bool				done;   /* decoder reached the end */
+	struct decode_batch		*curr;  /* batch being read */
+};
+
+struct uftrace_decoder {
+	pthread_mutex_t		lock;
+	pthread_cond_t		filled;  /* a batch is filled */
+	pthread_cond_t		freed;   /* a batch is consumed */
+	bool			stop;
+	int			nr_thread;
+	int			nr_queue;
+	int			batch_size;
+	pthread_t		*threads;
+	struct decode_queue	**queues;
+};
+
+int setup_task_decoder(struct ftrace_file_handle *handle, int nr_thread);
+void finish_task_decoder(struct ftrace_file_handle *handle);
+int read_decoded_ustack(struct ftrace_task_handle *task);
+
+#endif /* UFTRACE_DECODER_H */
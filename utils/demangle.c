@@ -20,11 +20,34 @@
 
 #define MAX_DEBUG_DEPTH  128
 
+/* initial size of output buffer and arena (on stack) */
+#define DD_BUFSIZE    256
+#define DD_ARENASIZE  256
+
 enum symbol_demangler demangler = DEMANGLE_SIMPLE;
 
+/*
+ * A bump allocator for temporary strings during a demangle call.  It
+ * uses a buffer on stack first and allocates a (bigger) chunk only
+ * when it's full.  All of them are released at once at the end.
+ */
+struct demangle_arena {
+	char *buf;
+	int used;
+	int size;
+	struct demangle_chunk *chunks;
+};
+
+struct demangle_chunk {
+	struct demangle_chunk *next;
+	char data[];
+};
+
 struct demangle_data {
 	char *old;
 	char *new;
+	char *newbuf;    /* initial output buffer (on stack) */
+	struct demangle_arena arena;
 	const char *func;
 	char *expected;
 	int line;
@@ -35,7 +58,7 @@ struct demangle_data {
 	int level;
 	int type;
 	int nr_dbg;
-	const char *debug[MAX_DEBUG_DEPTH];
+	const char **debug;  /* no need to clear (on stack) */
 };
 
 static char dd_expbuf[2];
@@ -253,14 +276,74 @@ static int dd_decltype(struct demangle_data *dd);
 static int dd_expression(struct demangle_data *dd);
 static int dd_expr_primary(struct demangle_data *dd);
 
+static void *dd_arena_alloc(struct demangle_data *dd, int size)
+{
+	struct demangle_arena *arena = &dd->arena;
+	struct demangle_chunk *chunk;
+	void *ptr;
+
+	if (arena->used + size > arena->size) {
+		int chunk_size = arena->size * 2;
+
+		if (chunk_size < size)
+			chunk_size = size;
+
+		chunk = xmalloc(sizeof(*chunk) + chunk_size);
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+
+		arena->buf = chunk->data;
+		arena->size = chunk_size;
+		arena->used = 0;
+	}
+
+	ptr = arena->buf + arena->used;
+	arena->used += size;
+	return ptr;
+}
+
+static char *dd_arena_strdup(struct demangle_data *dd, char *str, int len)
+{
+	char *ptr = dd_arena_alloc(dd, len + 1);
+
+	memcpy(ptr, str, len);
+	ptr[len] = '\0';
+	return ptr;
+}
+
+static void dd_arena_release(struct demangle_data *dd)
+{
+	struct demangle_chunk *chunk = dd->arena.chunks;
+
+	while (chunk) {
+		struct demangle_chunk *next = chunk->next;
+
+		free(chunk);
+		chunk = next;
+	}
+	dd->arena.chunks = NULL;
+}
+
 static int dd_append_len(struct demangle_data *dd, char *str, int size)
 {
 	if (dd->newpos + size >= dd->alloc) {
-		dd->alloc = ALIGN(dd->newpos + size + 1, 16);
-		dd->new = xrealloc(dd->new, dd->alloc);
+		int alloc = dd->alloc * 2;
+
+		if (alloc < dd->newpos + size + 1)
+			alloc = ALIGN(dd->newpos + size + 1, 16);
+
+		/* move to heap when the buffer on stack is full */
+		if (dd->new == dd->newbuf) {
+			dd->new = xmalloc(alloc);
+			memcpy(dd->new, dd->newbuf, dd->newpos);
+		}
+		else {
+			dd->new = xrealloc(dd->new, alloc);
+		}
+		dd->alloc = alloc;
 	}
 
-	strncpy(&dd->new[dd->newpos], str, size);
+	memcpy(&dd->new[dd->newpos], str, size);
 	dd->newpos += size;
 	dd->new[dd->newpos] = '\0';
 
@@ -1164,8 +1247,8 @@ static int dd_ctor_dtor_name(struct demangle_data *dd)
 		pos++;
 
 	/* pos can be invalidated after dd_apend() below, so copy it */
-	pos = xstrdup(pos);
-	len = strlen(pos);
+	len = dd->new + dd->newpos - pos;
+	pos = dd_arena_strdup(dd, pos, len);
 
 	if (c0 == 'C')
 		dd_append(dd, "::");
@@ -1173,7 +1256,6 @@ static int dd_ctor_dtor_name(struct demangle_data *dd)
 		dd_append(dd, "::~");
 
 	dd_append_len(dd, pos, len);
-	free(pos);
 	return 0;
 }
 
@@ -1442,25 +1524,47 @@ static int dd_encoding(struct demangle_data *dd)
 
 static char *demangle_simple(char *str)
 {
+	char newbuf[DD_BUFSIZE];
+	char arena[DD_ARENASIZE];
+	const char *debug[MAX_DEBUG_DEPTH];
 	struct demangle_data dd = {
 		.old = str,
 		.len = strlen(str),
+		.new = newbuf,
+		.newbuf = newbuf,
+		.alloc = sizeof(newbuf),
+		.debug = debug,
+		.arena = {
+			.buf = arena,
+			.size = sizeof(arena),
+		},
 	};
+	char *name;
 
 	if (str[0] != '_' || str[1] != 'Z')
 		return xstrdup(str);
 
 	dd.pos = 2;
-	dd.new = xzalloc(0);
+	newbuf[0] = '\0';
 
 	if (dd_encoding(&dd) < 0 || !dd_eof(&dd) || dd.level != 0) {
 		dd_debug_print(&dd);
-		free(dd.new);
-		return xstrdup(str);
+		name = xstrdup(str);
+	}
+	else if (dd.new == newbuf) {
+		name = xmalloc(dd.newpos + 1);
+		memcpy(name, newbuf, dd.newpos + 1);
+	}
+	else {
+		/* caller should free it */
+		name = dd.new;
+		dd.new = NULL;
 	}
 
-	/* caller should free it */
-	return dd.new;
+	if (dd.new != newbuf)
+		free(dd.new);
+	dd_arena_release(&dd);
+	return name;
 }
 
 #ifdef HAVE_CXA_DEMANGLE
@@ -382,7 +382,7 @@ static int add_exact_filter(struct rb_root *root, struct symtab *symtab,
 	if (sym == NULL)
 		return 0;
 
-	filter.name = sym->name;
+	filter.name = symbol_getname(sym, sym->addr);
 	filter.start = sym->addr;
 	filter.end = sym->addr + sym->size;
 
@@ -394,17 +394,29 @@ static int add_pattern_filter(struct rb_root *root, struct symtab *symtab,
 			      struct uftrace_trigger *tr)
 {
 	struct uftrace_filter filter;
+	struct sym_match_key key;
 	struct sym *sym;
+	bool has_key = false;
+	char *name;
 	unsigned i;
 	int ret = 0;
 
+	/* regex can match to a part of the name, so it needs to check all */
+	if (patt->type == PATT_GLOB)
+		has_key = symbol_get_match_key(patt->patt, &key);
+
 	for (i = 0; i < symtab->nr_sym; i++) {
 		sym = &symtab->sym[i];
 
-		if (!match_filter_pattern(patt, sym->name))
+		/* avoid demangling symbols which cannot match */
+		if (has_key && !symbol_may_match(sym, &key))
 			continue;
 
-		filter.name = sym->name;
+		name = symbol_getname(sym, sym->addr);
+		if (!match_filter_pattern(patt, name))
+			continue;
+
+		filter.name = name;
 		filter.start = sym->addr;
 		filter.end = sym->addr + sym->size;
 
@@ -1084,6 +1096,51 @@ void uftrace_setup_retval(char *retval_str, struct symtabs *symtabs,
 	setup_trigger(retval_str, symtabs, root, flags, NULL, false, patt_type);
 }
 
+/**
+ * uftrace_trigger_flags - get flags of all actions in the trigger
+ * @trigger_str - CSV of trigger string (FUNC @ act)
+ *
+ * This function only parses the actions (without symbols) and returns
+ * the union of TRIGGER_FL_* flags they set.
+ */
+unsigned long uftrace_trigger_flags(char *trigger_str)
+{
+	struct strv triggers = STRV_INIT;
+	unsigned long flags = 0;
+	char *name;
+	int j;
+
+	if (trigger_str == NULL)
+		return 0;
+
+	strv_split(&triggers, trigger_str, ";");
+
+	strv_for_each(&triggers, name, j) {
+		LIST_HEAD(args);
+		struct uftrace_trigger tr = {
+			.pargs = &args,
+		};
+		struct uftrace_arg_spec *arg;
+		char *module = NULL;
+
+		if (setup_trigger_action(name, &tr, &module, 0) == 0)
+			flags |= tr.flags;
+
+		while (!list_empty(&args)) {
+			arg = list_first_entry(&args, typeof(*arg), list);
+			list_del(&arg->list);
+
+			if (arg->fmt == ARG_FMT_ENUM)
+				free(arg->enum_str);
+			free(arg);
+		}
+		free(module);
+	}
+
+	strv_free(&triggers);
+	return flags;
+}
+
 /**
  * uftrace_cleanup_filter - delete filters in rbtree
  * @root - root of the filter rbtree
@@ -1156,16 +1213,16 @@ char * uftrace_clear_kernel(char *filter_str)
 static void filter_test_load_symtabs(struct symtabs *stabs)
 {
 	static struct sym syms[] = {
-		{ 0x1000, 0x1000, ST_GLOBAL, "foo::foo" },
-		{ 0x2000, 0x1000, ST_GLOBAL, "foo::bar" },
-		{ 0x3000, 0x1000, ST_GLOBAL, "foo::baz1" },
-		{ 0x4000, 0x1000, ST_GLOBAL, "foo::baz2" },
-		{ 0x5000, 0x1000, ST_GLOBAL, "foo::baz3" },
-		{ 0x6000, 0x1000, ST_GLOBAL, "foo::~foo" },
+		{ 0x1000, 0x1000, ST_GLOBAL, 0, "foo::foo" },
+		{ 0x2000, 0x1000, ST_GLOBAL, 0, "foo::bar" },
+		{ 0x3000, 0x1000, ST_GLOBAL, 0, "foo::baz1" },
+		{ 0x4000, 0x1000, ST_GLOBAL, 0, "foo::baz2" },
+		{ 0x5000, 0x1000, ST_GLOBAL, 0, "foo::baz3" },
+		{ 0x6000, 0x1000, ST_GLOBAL, 0, "foo::~foo" },
 	};
 	static struct sym dsyms[] = {
-		{ 0x21000, 0x1000, ST_PLT, "malloc" },
-		{ 0x22000, 0x1000, ST_PLT, "free" },
+		{ 0x21000, 0x1000, ST_PLT, 0, "malloc" },
+		{ 0x22000, 0x1000, ST_PLT, 0, "free" },
 	};
 
 	stabs->symtab.sym = syms;
@@ -1310,6 +1367,55 @@ TEST_CASE(filter_setup_glob)
 	return TEST_OK;
 }
 
+TEST_CASE(filter_setup_mangled)
+{
+	static struct sym syms[] = {
+		{ 0x1000, 0x1000, ST_GLOBAL, 0, "_ZN3foo3barEv" },
+		{ 0x2000, 0x1000, ST_GLOBAL, 0, "_ZN3foo3bazEv" },
+		{ 0x3000, 0x1000, ST_GLOBAL, 0, "_ZN3qux3barEi" },
+		{ 0x4000, 0x1000, ST_GLOBAL, 0, "bar" },
+	};
+	struct symtabs stabs = {
+		.loaded = false,
+	};
+	struct rb_root root = RB_ROOT;
+	struct rb_node *node;
+	struct uftrace_filter *filter;
+	struct sym_match_key key;
+	enum uftrace_pattern_type ptype = PATT_GLOB;
+
+	stabs.symtab.sym = syms;
+	stabs.symtab.nr_sym = ARRAY_SIZE(syms);
+	stabs.loaded = true;
+
+	TEST_EQ(symbol_get_match_key("*::bar", &key), true);
+	TEST_STREQ(key.str, "3bar");
+	TEST_EQ(symbol_may_match(&syms[0], &key), true);
+	TEST_EQ(symbol_may_match(&syms[1], &key), false);
+	TEST_EQ(symbol_may_match(&syms[3], &key), true);
+	TEST_EQ(symbol_get_match_key("foo::b*", &key), false);
+
+	uftrace_setup_filter("*::bar", &stabs, &root, NULL, false, ptype);
+	TEST_EQ(RB_EMPTY_ROOT(&root), false);
+
+	node = rb_first(&root);
+	filter = rb_entry(node, struct uftrace_filter, node);
+	TEST_STREQ(filter->name, "foo::bar");
+	TEST_EQ(filter->start, 0x1000UL);
+
+	node = rb_next(node);
+	filter = rb_entry(node, struct uftrace_filter, node);
+	TEST_STREQ(filter->name, "qux::bar");
+	TEST_EQ(filter->start, 0x3000UL);
+
+	TEST_EQ(rb_next(node), NULL);
+
+	uftrace_cleanup_filter(&root);
+	TEST_EQ(RB_EMPTY_ROOT(&root), true);
+
+	return TEST_OK;
+}
+
 TEST_CASE(filter_setup_notrace)
 {
 	struct symtabs stabs = {
@@ -1435,6 +1541,18 @@ TEST_CASE(trigger_setup_actions)
 	uftrace_cleanup_filter(&root);
 	TEST_EQ(RB_EMPTY_ROOT(&root), true);
 
+	/* it only checks actions, not function names */
+	TEST_EQ(uftrace_trigger_flags("parse_args@depth=2"),
+		TRIGGER_FL_DEPTH);
+	TEST_EQ(uftrace_trigger_flags("get_retval@libfoo.so,trace_on"),
+		TRIGGER_FL_TRACE_ON);
+	TEST_EQ(uftrace_trigger_flags("foo@arg1/x32;bar@retval,color=red"),
+		TRIGGER_FL_ARGUMENT | TRIGGER_FL_RETVAL | TRIGGER_FL_COLOR);
+	TEST_EQ(uftrace_trigger_flags("foo@read=proc/statm"),
+		TRIGGER_FL_READ);
+	TEST_EQ(uftrace_trigger_flags("foo"), 0);
+	TEST_EQ(uftrace_trigger_flags(NULL), 0);
+
 	return TEST_OK;
 }
 
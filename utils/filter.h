@@ -167,6 +167,7 @@ void uftrace_setup_argument(char *trigger_str, struct symtabs *symtabs,
 void uftrace_setup_retval(char *trigger_str, struct symtabs *symtabs,
 			  struct rb_root *root, bool auto_args,
 			  enum uftrace_pattern_type ptype);
+unsigned long uftrace_trigger_flags(char *trigger_str);
 
 struct uftrace_filter *uftrace_match_filter(uint64_t ip, struct rb_root *root,
 					    struct uftrace_trigger *tr);
@@ -15,6 +15,8 @@
 #include "utils/fstack.h"
 #include "utils/rbtree.h"
 #include "utils/kernel.h"
+#include "utils/time-index.h"
+#include "utils/decoder.h"
 #include "libmcount/mcount.h"
 
 
@@ -24,15 +26,70 @@ bool live_disabled = false;
 static enum filter_mode fstack_filter_mode = FILTER_MODE_NONE;
 
 static int __read_task_ustack(struct ftrace_task_handle *task);
+static void finish_rstack_merge(struct ftrace_file_handle *handle);
 
+static inline unsigned int hash_tid(int tid, int bits)
+{
+	return ((uint32_t)tid * 0x9e370001U) >> (32 - bits);
+}
+
+/* build an (open-addressing) hash table of the tasks using tid */
+static void setup_task_hash(struct ftrace_file_handle *handle)
+{
+	struct ftrace_task_handle *task;
+	unsigned int mask, pos;
+	int i, bits = 1;
+
+	/* keep it less than half full */
+	while ((1 << bits) < handle->nr_tasks * 2)
+		bits++;
+
+	mask = (1U << bits) - 1;
+	handle->task_hash = xcalloc(mask + 1, sizeof(*handle->task_hash));
+	handle->task_hash_bits = bits;
+
+	for (i = 0; i < handle->nr_tasks; i++) {
+		task = &handle->tasks[i];
+		pos = hash_tid(task->tid, bits);
+
+		while (handle->task_hash[pos]) {
+			/* the first one wins like the linear search */
+			if (handle->task_hash[pos]->tid == task->tid)
+				break;
+			pos = (pos + 1) & mask;
+		}
+
+		if (handle->task_hash[pos] == NULL)
+			handle->task_hash[pos] = task;
+	}
+}
+
+/*
+ * get_task_handle - find the task handle of @tid
+ *
+ * It's called for each kernel and perf record so use a hash table
+ * rather than searching all tasks.  The table is built at the first
+ * call as the task handles are set up.
+ */
 struct ftrace_task_handle *get_task_handle(struct ftrace_file_handle *handle,
 					   int tid)
 {
-	int i;
+	struct ftrace_task_handle *task;
+	unsigned int mask, pos;
 
-	for (i = 0; i < handle->nr_tasks; i++) {
-		if (handle->tasks[i].tid == tid)
-			return &handle->tasks[i];
+	if (unlikely(handle->task_hash == NULL)) {
+		if (handle->nr_tasks == 0)
+			return NULL;
+		setup_task_hash(handle);
+	}
+
+	mask = (1U << handle->task_hash_bits) - 1;
+	pos = hash_tid(tid, handle->task_hash_bits);
+
+	while ((task = handle->task_hash[pos]) != NULL) {
+		if (task->tid == tid)
+			return task;
+		pos = (pos + 1) & mask;
 	}
 	return NULL;
 }
@@ -68,15 +125,16 @@ void reset_task_handle(struct ftrace_file_handle *handle)
 	int i;
 	struct ftrace_task_handle *task;
 
+	/* decoder threads might access the data files */
+	finish_task_decoder(handle);
+
 	for (i = 0; i < handle->nr_tasks; i++) {
 		task = &handle->tasks[i];
 
 		task->done = true;
 
-		if (task->fp) {
-			fclose(task->fp);
-			task->fp = NULL;
-		}
+		data_map_close(task->map);
+		task->map = NULL;
 
 		free(task->args.data);
 		task->args.data = NULL;
@@ -90,9 +148,115 @@ void reset_task_handle(struct ftrace_file_handle *handle)
 	free(handle->tasks);
 	handle->tasks = NULL;
 
+	free(handle->task_hash);
+	handle->task_hash = NULL;
+
+	finish_rstack_merge(handle);
+
 	handle->nr_tasks = 0;
 }
 
+/**
+ * setup_single_task_handle - setup a handle to read a task only
+ * @handle: file handle
+ * @idx: index of the task in @handle
+ * @sub: handle to be setup
+ *
+ * This function sets up @sub to read user records of a single task in
+ * @handle independently.  It shares the sessions and other (read-only)
+ * data with @handle but has its own merge state so that tasks can be
+ * read in different threads.  Kernel and perf data are not available
+ * as they're shared by all tasks.  It should be called before reading
+ * any record of @handle.
+ */
+void setup_single_task_handle(struct ftrace_file_handle *handle, int idx,
+			      struct ftrace_file_handle *sub)
+{
+	*sub = *handle;
+
+	sub->tasks     = &handle->tasks[idx];
+	sub->nr_tasks  = 1;
+	sub->task_hash = NULL;
+	sub->merge     = NULL;
+	sub->decoder   = NULL;
+	sub->nr_jobs   = 0;
+	sub->kernel    = NULL;
+	sub->perf      = NULL;
+	sub->nr_perf   = 0;
+
+	/* the list head cannot be copied */
+	INIT_LIST_HEAD(&sub->events);
+
+	sub->tasks->h = sub;
+}
+
+void finish_single_task_handle(struct ftrace_file_handle *handle,
+			       struct ftrace_file_handle *sub)
+{
+	finish_rstack_merge(sub);
+
+	free(sub->task_hash);
+	sub->task_hash = NULL;
+
+	sub->tasks->h = handle;
+}
+
+/**
+ * can_read_tasks_parallel - check whether tasks can be read independently
+ * @handle: file handle
+ * @opts: uftrace command line options
+ *
+ * This function returns %true if each task in @handle can be read with
+ * setup_single_task_handle() in a separate thread and gives the same
+ * result.  It needs at least two tasks and --jobs option.
+ */
+bool can_read_tasks_parallel(struct ftrace_file_handle *handle,
+			     struct opts *opts)
+{
+	struct uftrace_time_range *range = &handle->time_range;
+	struct rb_node *node;
+	struct uftrace_session *sess;
+
+	if (handle->nr_jobs <= 0 || handle->nr_tasks <= 1)
+		return false;
+
+	/*
+	 * they need records of all tasks in time order.  Other perf events
+	 * (task and comm) are always recorded, so check schedule events.
+	 */
+	if (has_kernel_data(handle->kernel)) {
+		pr_dbg("read tasks in order: kernel data\n");
+		return false;
+	}
+	if (has_perf_sched_event(handle)) {
+		pr_dbg("read tasks in order: schedule events\n");
+		return false;
+	}
+
+	/* trace-on/off trigger affects all tasks */
+	if (opts->trigger || opts->disabled) {
+		pr_dbg("read tasks in order: trace on/off\n");
+		return false;
+	}
+
+	/* elapsed time is from the first record of all tasks */
+	if (range->start_elapsed || range->stop_elapsed) {
+		pr_dbg("read tasks in order: elapsed time range\n");
+		return false;
+	}
+
+	/* symbols in dlopen-ed libraries depend on the time */
+	for (node = rb_first(&handle->sessions.root); node; node = rb_next(node)) {
+		sess = rb_entry(node, struct uftrace_session, node);
+		if (!list_empty(&sess->dlopen_libs)) {
+			pr_dbg("read tasks in order: dlopen-ed libraries\n");
+			return false;
+		}
+	}
+
+	return true;
+}
+
 static void prepare_task_handle(struct ftrace_file_handle *handle,
 		       struct ftrace_task_handle *task, int tid)
 {
@@ -104,8 +268,8 @@ static void prepare_task_handle(struct ftrace_file_handle *handle,
 	task->t = find_task(&handle->sessions, tid);
 
 	xasprintf(&filename, "%s/%d.dat", handle->dirname, tid);
-	task->fp = fopen(filename, "rb");
-	if (task->fp == NULL) {
+	task->map = data_map_open(filename);
+	if (task->map == NULL) {
 		pr_dbg("cannot open task data file: %s: %m\n", filename);
 		task->done = true;
 	}
@@ -190,13 +354,13 @@ setup:
 			task->done = true;
 
 			/* need to read the data to check elapsed time */
-			if (task->fp) {
+			if (task->map) {
 				if (!__read_task_ustack(task)) {
 					update_first_timestamp(handle, task,
 							       &task->ustack);
 				}
-				fclose(task->fp);
-				task->fp = NULL;
+				data_map_close(task->map);
+				task->map = NULL;
 			}
 			continue;
 		}
@@ -299,8 +463,9 @@ static const char *fixup_syms[] = {
 	"fork", "vfork", "daemon",
 };
 
-static int setjmp_depth;
-static int setjmp_count;
+/* per-thread as tasks can be processed in parallel (e.g. report) */
+static __thread int setjmp_depth;
+static __thread int setjmp_count;
 
 static int build_fixup_filter(struct uftrace_session *s, void *arg)
 {
@@ -983,15 +1148,13 @@ static void swap_bitfields(struct uftrace_record *rstack)
 
 static int __read_task_ustack(struct ftrace_task_handle *task)
 {
-	FILE *fp = task->fp;
-
-	if (fread(&task->ustack, sizeof(task->ustack), 1, fp) != 1) {
-		if (feof(fp))
-			return -1;
+	struct uftrace_record *rec;
 
-		pr_warn("error reading rstack: %s\n", strerror(errno));
+	rec = data_map_read(task->map, sizeof(*rec));
+	if (rec == NULL)
 		return -1;
-	}
+
+	task->ustack = *rec;
 
 	if (task->h->needs_byte_swap)
 		swap_byte_order(&task->ustack);
@@ -1009,35 +1172,36 @@ static int __read_task_ustack(struct ftrace_task_handle *task)
 static int read_task_arg(struct ftrace_task_handle *task,
 			 struct uftrace_arg_spec *spec)
 {
-	FILE *fp = task->fp;
+	struct uftrace_data_map *dm = task->map;
 	struct fstack_arguments *args = &task->args;
 	unsigned size = spec->size;
+	void *ptr;
 	int rem;
 
 	if (spec->fmt == ARG_FMT_STR || spec->fmt == ARG_FMT_STD_STRING) {
-		args->data = xrealloc(args->data, args->len + 2);
+		ptr = data_map_read(dm, 2);
+		if (ptr == NULL)
+			return -1;
 
-		if (fread(args->data + args->len, 2, 1, fp) != 1) {
-			if (feof(fp))
-				return -1;
-		}
+		args->data = xrealloc(args->data, args->len + 2);
+		memcpy(args->data + args->len, ptr, 2);
 
 		size = *(unsigned short *)(args->data + args->len);
 		args->len += 2;
 	}
 
-	args->data = xrealloc(args->data, args->len + size);
+	ptr = data_map_read(dm, size);
+	if (ptr == NULL)
+		return -1;
 
-	if (fread(args->data + args->len, size, 1, fp) != 1) {
-		if (feof(fp))
-			return -1;
-	}
+	args->data = xrealloc(args->data, args->len + size);
+	memcpy(args->data + args->len, ptr, size);
 
 	args->len += size;
 
 	rem = args->len % 4;
 	if (rem) {
-		fseek(fp, 4 - rem, SEEK_CUR);
+		data_map_skip(dm, 4 - rem);
 		args->len += 4 - rem;
 	}
 
@@ -1093,7 +1257,7 @@ int read_task_args(struct ftrace_task_handle *task,
 
 	rem = task->args.len % 8;
 	if (rem)
-		fseek(task->fp, 8 - rem, SEEK_CUR);
+		data_map_skip(task->map, 8 - rem);
 
 	return 0;
 }
@@ -1101,16 +1265,20 @@ int read_task_args(struct ftrace_task_handle *task,
 static int read_task_event_size(struct ftrace_task_handle *task,
 				void *buf, size_t buflen)
 {
-	uint16_t len;
+	uint16_t *len;
+	void *ptr;
 
-	if (fread(&len, sizeof(len), 1, task->fp) != 1)
+	len = data_map_read(task->map, sizeof(*len));
+	if (len == NULL)
 		return -1;
 
-	assert(len == buflen);
+	assert(*len == buflen);
 
-	if (fread(buf, len, 1, task->fp) != 1)
+	ptr = data_map_read(task->map, buflen);
+	if (ptr == NULL)
 		return -1;
 
+	memcpy(buf, ptr, buflen);
 	return 0;
 }
 
@@ -1128,7 +1296,7 @@ static void save_task_event(struct ftrace_task_handle *task,
 	/* ensure 8-byte alignment */
 	rem = (buflen + 2) % 8;
 	if (rem)
-		fseek(task->fp, 8 - rem, SEEK_CUR);
+		data_map_skip(task->map, 8 - rem);
 }
 
 /**
@@ -1221,6 +1389,12 @@ char *get_event_name(struct ftrace_file_handle *handle, unsigned evt_id)
 		case EVENT_ID_DIFF_PMU_BRANCH:
 			xasprintf(&evt_name, "diff:pmu-branch");
 			break;
+		case EVENT_ID_BUFFER_STALL:
+			xasprintf(&evt_name, "uftrace:buffer-stall");
+			break;
+		case EVENT_ID_SCRIPT_QUEUE:
+			xasprintf(&evt_name, "uftrace:script-queue");
+			break;
 		default:
 			xasprintf(&evt_name, "builtin_event:%u", evt_id);
 			break;
@@ -1245,6 +1419,8 @@ int read_task_event(struct ftrace_task_handle *task,
 		struct uftrace_pmu_cycle  cycle;
 		struct uftrace_pmu_cache  cache;
 		struct uftrace_pmu_branch branch;
+		struct uftrace_buffer_stall stall;
+		struct uftrace_script_queue sq;
 	} u;
 
 	switch (rec->addr) {
@@ -1314,6 +1490,28 @@ int read_task_event(struct ftrace_task_handle *task,
 		save_task_event(task, &u.branch, sizeof(u.branch));
 		break;
 
+	case EVENT_ID_BUFFER_STALL:
+		if (read_task_event_size(task, &u.stall, sizeof(u.stall)) < 0)
+			return -1;
+
+		if (task->h->needs_byte_swap)
+			u.stall.time = bswap_64(u.stall.time);
+
+		save_task_event(task, &u.stall, sizeof(u.stall));
+		break;
+
+	case EVENT_ID_SCRIPT_QUEUE:
+		if (read_task_event_size(task, &u.sq, sizeof(u.sq)) < 0)
+			return -1;
+
+		if (task->h->needs_byte_swap) {
+			u.sq.dropped = bswap_64(u.sq.dropped);
+			u.sq.time    = bswap_64(u.sq.time);
+		}
+
+		save_task_event(task, &u.sq, sizeof(u.sq));
+		break;
+
 	default:
 		pr_err_ns("unknown event has data: %u\n", rec->addr);
 		break;
@@ -1338,17 +1536,43 @@ int read_task_event(struct ftrace_task_handle *task,
 int read_task_ustack(struct ftrace_file_handle *handle,
 		     struct ftrace_task_handle *task)
 {
+	int ret;
+
 	if (task->valid)
 		return 0;
 
-	if (task->done || task->fp == NULL)
+	if (task->done || task->map == NULL)
 		return -1;
 
-	if (__read_task_ustack(task) < 0) {
+	if (task->decode)
+		ret = read_decoded_ustack(task);
+	else
+		ret = decode_task_ustack(task);
+
+	if (ret < 0) {
 		task->done = true;
 		return -1;
 	}
 
+	task->valid = true;
+	return 0;
+}
+
+/**
+ * decode_task_ustack - read next user function record from data file
+ * @task: tracee task
+ *
+ * This function reads next record and its arguments (or event data) of
+ * @task from the data file.  It doesn't change other states of @task so
+ * that decoder threads can call it for their own task handles.
+ *
+ * This function returns 0 if succeeded, -1 otherwise.
+ */
+int decode_task_ustack(struct ftrace_task_handle *task)
+{
+	if (__read_task_ustack(task) < 0)
+		return -1;
+
 	if (task->ustack.more) {
 		if (task->ustack.type == UFTRACE_ENTRY)
 			read_task_args(task, &task->ustack, false);
@@ -1360,7 +1584,6 @@ int read_task_ustack(struct ftrace_file_handle *handle,
 			abort();
 	}
 
-	task->valid = true;
 	return 0;
 }
 
@@ -1511,32 +1734,6 @@ out:
 	return &task->ustack;
 }
 
-static int read_user_stack(struct ftrace_file_handle *handle,
-			   struct ftrace_task_handle **task)
-{
-	int i, next_i = -1;
-	uint64_t next_time = 0;
-	struct uftrace_record *tmp;
-
-	for (i = 0; i < handle->info.nr_tid; i++) {
-		tmp = get_task_ustack(handle, i);
-		if (tmp == NULL)
-			continue;
-
-		if (next_i < 0 || tmp->time < next_time) {
-			next_time = tmp->time;
-			next_i = i;
-		}
-	}
-
-	if (next_i < 0)
-		return -1;
-
-	*task = &handle->tasks[next_i];
-
-	return next_i;
-}
-
 /* convert perf sched events to a virtual schedule function */
 static bool convert_perf_event(struct ftrace_task_handle *task,
 			       struct uftrace_record *orig,
@@ -1868,70 +2065,341 @@ void fstack_consume(struct ftrace_file_handle *handle,
 	__fstack_consume(task, kernel, cpu);
 }
 
-static int __read_rstack(struct ftrace_file_handle *handle,
-			 struct ftrace_task_handle **taskp,
-			 bool consume)
+/* check the first record of the chunk to make sure the index is valid */
+static bool check_time_index(struct ftrace_task_handle *task,
+			     struct uftrace_time_index *idx)
 {
-	int u, k = -1, p = -1;
-	struct ftrace_task_handle *task = NULL;
-	struct ftrace_task_handle *utask = NULL;
-	struct ftrace_task_handle *ktask = NULL;
-	struct uftrace_kernel_reader *kernel = handle->kernel;
-	struct uftrace_perf_reader *perf;
-	uint64_t min_timestamp = ~0ULL;
-	enum { NONE, USER, KERNEL, PERF } source = NONE;
+	struct uftrace_record *rec;
 
-	u = read_user_stack(handle, &utask);
-	if (u >= 0) {
-		min_timestamp = utask->ustack.time;
-		source = USER;
-	}
+	data_map_seek(task->map, idx->offset);
 
-	if (has_kernel_data(kernel)) {
-		k = read_kernel_stack(handle, &ktask);
-		if (k < 0) {
-			static bool warn = false;
+	rec = data_map_read(task->map, sizeof(*rec));
+	if (rec && rec->type == UFTRACE_LOST)
+		rec = data_map_read(task->map, sizeof(*rec));
+	if (rec == NULL)
+		return false;
 
-			if (!warn && consume) {
-				pr_dbg2("no more kernel data\n");
-				warn = true;
-			}
+	return rec->magic == RECORD_MAGIC && rec->time == idx->time &&
+		rec->depth == idx->depth;
+}
+
+/* move to the chunk right before @time using the time index */
+static void seek_task_data(struct ftrace_file_handle *handle,
+			   struct ftrace_task_handle *task, uint64_t time)
+{
+	struct uftrace_time_index *idx;
+	char *filename;
+	int nr, k;
+
+	xasprintf(&filename, "%s/%d.idx", handle->dirname, task->tid);
+	nr = read_time_index(filename, &idx);
+	free(filename);
+
+	if (nr < 0)
+		return;
+
+	k = find_time_index(idx, nr, time);
+	if (k > 0) {
+		if (check_time_index(task, &idx[k])) {
+			data_map_seek(task->map, idx[k].offset);
+			pr_dbg2("skip task %d data to offset %"PRIu64"\n",
+				task->tid, idx[k].offset);
 		}
-		else if (ktask->kstack.time < min_timestamp) {
-			min_timestamp = ktask->kstack.time;
-			source = KERNEL;
+		else {
+			pr_dbg("invalid time index for task %d, ignoring\n",
+			       task->tid);
+			data_map_seek(task->map, 0);
 		}
 	}
 
-	if (has_perf_data(handle)) {
-		p = read_perf_data(handle);
-		perf = &handle->perf[p];
+	free(idx);
+}
+
+/* get the first timestamp as check_time_range() would see */
+static uint64_t get_first_task_time(struct ftrace_file_handle *handle)
+{
+	struct ftrace_task_handle *task;
+	uint64_t first = 0;
+	int i;
+
+	for (i = 0; i < handle->nr_tasks && first == 0; i++) {
+		task = &handle->tasks[i];
 
-		if (p < 0) {
-			static bool warn = false;
+		if (task->done || task->map == NULL)
+			continue;
 
-			if (!warn && consume) {
-				pr_dbg2("no more perf data\n");
-				warn = true;
-			}
+		/* LOST record doesn't have a timestamp */
+		while (first == 0 && __read_task_ustack(task) == 0)
+			first = task->ustack.time;
+
+		data_map_seek(task->map, 0);
+	}
+
+	return first;
+}
+
+/*
+ * Skip records before the time range using the time index (and kernel
+ * page headers) rather than reading and discarding all of them.  Since
+ * they were discarded before updating any state, the result is same.
+ * Perf events are not skipped as they're not filtered by time range.
+ * This is done at the first read_rstack() because raw dump reads all
+ * the records without it.
+ */
+static void seek_time_range(struct ftrace_file_handle *handle)
+{
+	struct uftrace_time_range *range = &handle->time_range;
+	uint64_t start = range->start;
+	int i;
+
+	handle->range_seeked = true;
+
+	if (!start || handle->needs_byte_swap || handle->needs_bit_swap)
+		return;
+
+	/* it's needed for elapsed time even if the range is absolute */
+	if (!range->first)
+		range->first = get_first_task_time(handle);
+	if (!range->first)
+		return;
+
+	if (range->start_elapsed)
+		start += range->first;
+
+	for (i = 0; i < handle->nr_tasks; i++) {
+		struct ftrace_task_handle *task = &handle->tasks[i];
+
+		if (task->done || task->map == NULL || task->valid)
+			continue;
+
+		seek_task_data(handle, task, start);
+	}
+
+	if (has_kernel_data(handle->kernel))
+		seek_kernel_data(handle->kernel, start);
+}
+
+/*
+ * Records from user tasks, kernel cpus and perf cpus are merged by the
+ * timestamp.  The current record of each source is kept in a binary
+ * heap so that it doesn't need to check all sources for each record.
+ * Only the source at the top is consumed, so it only needs to read the
+ * next record of the source and to push it down in the heap.
+ */
+enum rstack_source {
+	RSTACK_SRC_USER,
+	RSTACK_SRC_KERNEL,
+	RSTACK_SRC_PERF,
+};
+
+struct rstack_merge_node {
+	uint64_t	time;
+	int		src;
+	int		idx;
+};
+
+struct uftrace_rstack_merge {
+	struct rstack_merge_node	*heap;
+	int				nr;
+};
+
+/* same timestamp is ordered by user, kernel and perf then by the index */
+static bool merge_node_before(struct rstack_merge_node *a,
+			      struct rstack_merge_node *b)
+{
+	if (a->time != b->time)
+		return a->time < b->time;
+	if (a->src != b->src)
+		return a->src < b->src;
+	return a->idx < b->idx;
+}
+
+static void merge_sift_down(struct uftrace_rstack_merge *merge, int pos)
+{
+	struct rstack_merge_node *heap = merge->heap;
+	struct rstack_merge_node node = heap[pos];
+
+	while (pos * 2 + 1 < merge->nr) {
+		int child = pos * 2 + 1;
+
+		if (child + 1 < merge->nr &&
+		    merge_node_before(&heap[child + 1], &heap[child]))
+			child++;
+
+		if (!merge_node_before(&heap[child], &node))
+			break;
+
+		heap[pos] = heap[child];
+		pos = child;
+	}
+	heap[pos] = node;
+}
+
+/* read current record of the source, returns false if it's done */
+static bool read_merge_node(struct ftrace_file_handle *handle,
+			    struct rstack_merge_node *node)
+{
+	struct uftrace_kernel_reader *kernel = handle->kernel;
+	struct ftrace_task_handle *task;
+	struct uftrace_record *rec;
+
+	switch (node->src) {
+	case RSTACK_SRC_USER:
+		rec = get_task_ustack(handle, node->idx);
+		if (rec == NULL)
+			return false;
+		node->time = rec->time;
+		break;
+
+	case RSTACK_SRC_KERNEL:
+		if (read_kernel_cpu_stack(handle, node->idx, &task) < 0) {
+			pr_dbg2("no more kernel data on cpu %d\n", node->idx);
+			return false;
 		}
-		else if (perf->time < min_timestamp) {
-			min_timestamp = perf->time;
-			source = PERF;
+		node->time = kernel->rstacks[node->idx].time;
+		break;
+
+	case RSTACK_SRC_PERF:
+		if (read_perf_cpu_data(handle, node->idx) < 0) {
+			pr_dbg2("no more perf data on cpu %d\n", node->idx);
+			return false;
 		}
+		node->time = handle->perf[node->idx].time;
+		break;
 	}
+	return true;
+}
+
+/* check whether the current record of the source is consumed */
+static bool is_merge_node_valid(struct ftrace_file_handle *handle,
+				struct rstack_merge_node *node)
+{
+	switch (node->src) {
+	case RSTACK_SRC_USER:
+		return handle->tasks[node->idx].valid;
+	case RSTACK_SRC_KERNEL:
+		return handle->kernel->rstack_valid[node->idx];
+	case RSTACK_SRC_PERF:
+		return handle->perf[node->idx].valid;
+	}
+	return false;
+}
+
+static void add_merge_node(struct ftrace_file_handle *handle,
+			   int src, int idx)
+{
+	struct uftrace_rstack_merge *merge = handle->merge;
+	struct rstack_merge_node *node = &merge->heap[merge->nr];
+
+	node->src = src;
+	node->idx = idx;
 
-	switch (source) {
-	case USER:
-		utask->rstack = &utask->ustack;
-		task = utask;
+	if (read_merge_node(handle, node))
+		merge->nr++;
+}
+
+static void setup_rstack_merge(struct ftrace_file_handle *handle)
+{
+	struct uftrace_rstack_merge *merge;
+	int i, nr = handle->nr_tasks + handle->nr_perf;
+
+	if (has_kernel_data(handle->kernel))
+		nr += handle->kernel->nr_cpus;
+
+	merge = xmalloc(sizeof(*merge));
+	merge->heap = xcalloc(nr ?: 1, sizeof(*merge->heap));
+	merge->nr = 0;
+	handle->merge = merge;
+
+	/* read the first records in the same order as before */
+	for (i = 0; i < handle->nr_tasks; i++)
+		add_merge_node(handle, RSTACK_SRC_USER, i);
+
+	if (has_kernel_data(handle->kernel)) {
+		for (i = 0; i < handle->kernel->nr_cpus; i++)
+			add_merge_node(handle, RSTACK_SRC_KERNEL, i);
+	}
+
+	for (i = 0; i < handle->nr_perf; i++)
+		add_merge_node(handle, RSTACK_SRC_PERF, i);
+
+	for (i = merge->nr / 2 - 1; i >= 0; i--)
+		merge_sift_down(merge, i);
+}
+
+static void finish_rstack_merge(struct ftrace_file_handle *handle)
+{
+	if (handle->merge == NULL)
+		return;
+
+	free(handle->merge->heap);
+	free(handle->merge);
+	handle->merge = NULL;
+}
+
+/* returns the source of the oldest record, or NULL if all done */
+static struct rstack_merge_node *
+read_rstack_merge(struct ftrace_file_handle *handle)
+{
+	struct uftrace_rstack_merge *merge = handle->merge;
+	struct rstack_merge_node *top = &merge->heap[0];
+
+	while (merge->nr) {
+		if (is_merge_node_valid(handle, top))
+			return top;
+
+		/* it's consumed, read the next record of the source */
+		if (!read_merge_node(handle, top))
+			*top = merge->heap[--merge->nr];
+
+		merge_sift_down(merge, 0);
+	}
+	return NULL;
+}
+
+static int __read_rstack(struct ftrace_file_handle *handle,
+			 struct ftrace_task_handle **taskp,
+			 bool consume)
+{
+	int cpu = -1;
+	struct ftrace_task_handle *task = NULL;
+	struct uftrace_kernel_reader *kernel = handle->kernel;
+	struct uftrace_perf_reader *perf;
+	struct rstack_merge_node *node;
+
+	if (unlikely(!handle->range_seeked))
+		seek_time_range(handle);
+
+	if (unlikely(handle->merge == NULL)) {
+		if (handle->nr_jobs > 0)
+			setup_task_decoder(handle, handle->nr_jobs);
+
+		setup_rstack_merge(handle);
+	}
+
+	node = read_rstack_merge(handle);
+	if (node == NULL)
+		return -1;
+
+	switch (node->src) {
+	case RSTACK_SRC_USER:
+		task = &handle->tasks[node->idx];
+		task->rstack = &task->ustack;
 		break;
-	case KERNEL:
-		ktask->rstack = get_kernel_record(kernel, ktask, k);
-		task = ktask;
+
+	case RSTACK_SRC_KERNEL:
+		cpu = node->idx;
+		task = get_task_handle(handle, kernel->tids[cpu]);
+		memcpy(&task->kstack, &kernel->rstacks[cpu], sizeof(task->kstack));
+		kernel->last_read_cpu = cpu;
+
+		task->rstack = get_kernel_record(kernel, task, cpu);
 		break;
 
-	case PERF:
+	case RSTACK_SRC_PERF:
+		handle->last_perf_idx = node->idx;
+		perf = &handle->perf[node->idx];
+
 		task = get_task_handle(handle, perf->tid);
 		task->rstack = get_perf_record(handle, perf);
 
@@ -1941,15 +2409,11 @@ static int __read_rstack(struct ftrace_file_handle *handle,
 			task->args.len  = strlen(perf->u.comm.comm);
 		}
 		break;
-
-	case NONE:
-	default:
-		return -1;
 	}
 
 	/* update stack count when the rstack is actually used */
 	if (consume)
-		__fstack_consume(task, kernel, k);
+		__fstack_consume(task, kernel, cpu);
 
 	*taskp = task;
 	return 0;
@@ -2137,6 +2601,37 @@ TEST_CASE(fstack_read)
 	return TEST_OK;
 }
 
+TEST_CASE(fstack_read_decoder)
+{
+	struct ftrace_file_handle *handle = &fstack_test_handle;
+	struct ftrace_task_handle *task;
+	int i, k;
+
+	TEST_EQ(fstack_test_setup_file(handle, ARRAY_SIZE(test_tids)), 0);
+
+	/* decoder threads will be started at the first read */
+	handle->nr_jobs = 2;
+
+	for (i = 0; i < NUM_RECORD; i++) {
+		for (k = 0; k < NUM_TASK; k++) {
+			TEST_EQ(read_rstack(handle, &task), 0);
+			TEST_NE(task->decode, NULL);
+			TEST_EQ(task->tid, test_tids[k]);
+			TEST_EQ((uint64_t)task->rstack->type,  (uint64_t)test_record[k][i].type);
+			TEST_EQ((uint64_t)task->rstack->depth, (uint64_t)test_record[k][i].depth);
+			TEST_EQ((uint64_t)task->rstack->addr,  (uint64_t)test_record[k][i].addr);
+		}
+	}
+	TEST_EQ(read_rstack(handle, &task), -1);
+	TEST_NE(handle->decoder, NULL);
+
+	finish_task_decoder(handle);
+	TEST_EQ(handle->decoder, NULL);
+	TEST_EQ(handle->tasks[0].decode, NULL);
+
+	return TEST_OK;
+}
+
 TEST_CASE(fstack_skip)
 {
 	struct ftrace_file_handle *handle = &fstack_test_handle;
@@ -2199,4 +2694,29 @@ TEST_CASE(fstack_time)
 	return TEST_OK;
 }
 
+TEST_CASE(fstack_task_hash)
+{
+	struct ftrace_file_handle handle = {};
+	int i, nr = 100;
+
+	handle.nr_tasks = nr;
+	handle.tasks = xcalloc(nr, sizeof(*handle.tasks));
+
+	/* make some collisions */
+	for (i = 0; i < nr; i++)
+		handle.tasks[i].tid = 1000 + (i % 50) * 256 + i / 50;
+
+	for (i = 0; i < nr; i++)
+		TEST_EQ(get_task_handle(&handle, handle.tasks[i].tid), &handle.tasks[i]);
+
+	TEST_EQ(get_task_handle(&handle, 1), NULL);
+	TEST_EQ(get_task_handle(&handle, 999), NULL);
+	TEST_GE(1 << handle.task_hash_bits, nr * 2);
+
+	free(handle.task_hash);
+	free(handle.tasks);
+
+	return TEST_OK;
+}
+
 #endif /* UNIT_TEST */
@@ -7,6 +7,7 @@
 
 #include "uftrace.h"
 #include "utils/filter.h"
+#include "utils/data-map.h"
 
 struct sym;
 
@@ -39,7 +40,8 @@ struct ftrace_task_handle {
 	bool fork_handled;
 	bool fstack_set;
 	bool display_depth_set;
-	FILE *fp;
+	struct uftrace_data_map *map;
+	struct decode_queue *decode;
 	struct sym *func;
 	struct uftrace_task *t;
 	struct ftrace_file_handle *h;
@@ -99,6 +101,12 @@ extern bool live_disabled;
 struct ftrace_task_handle *get_task_handle(struct ftrace_file_handle *handle,
 					   int tid);
 void reset_task_handle(struct ftrace_file_handle *handle);
+void setup_single_task_handle(struct ftrace_file_handle *handle, int idx,
+			      struct ftrace_file_handle *sub);
+void finish_single_task_handle(struct ftrace_file_handle *handle,
+			       struct ftrace_file_handle *sub);
+bool can_read_tasks_parallel(struct ftrace_file_handle *handle,
+			     struct opts *opts);
 
 int read_rstack(struct ftrace_file_handle *handle,
 		struct ftrace_task_handle **task);
@@ -109,6 +117,7 @@ void fstack_consume(struct ftrace_file_handle *handle,
 
 int read_task_ustack(struct ftrace_file_handle *handle,
 		     struct ftrace_task_handle *task);
+int decode_task_ustack(struct ftrace_task_handle *task);
 int read_task_args(struct ftrace_task_handle *task,
 		   struct uftrace_record *rstack,
 		   bool is_retval);
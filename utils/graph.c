@@ -2,6 +2,7 @@
 #include "utils/list.h"
 #include "utils/rbtree.h"
 #include "utils/filter.h"
+#include "utils/intern.h"
 
 static graph_fn entry_cb;
 static graph_fn exit_cb;
@@ -57,7 +58,105 @@ struct uftrace_task_graph * graph_get_task(struct ftrace_task_handle *task,
 	return tg;
 }
 
-static int add_graph_entry(struct uftrace_task_graph *tg, char *name,
+static void add_hash_node(struct uftrace_graph_node *parent,
+			  struct uftrace_graph_node *node)
+{
+	struct uftrace_graph_node **pnode;
+
+	/* keep the list order in a chain to find the first one */
+	pnode = &parent->buckets[node->name_id & (parent->nr_buckets - 1)];
+	while (*pnode)
+		pnode = &(*pnode)->hash_next;
+
+	node->hash_next = NULL;
+	*pnode = node;
+}
+
+static void resize_child_hash(struct uftrace_graph *graph,
+			      struct uftrace_graph_node *parent)
+{
+	struct uftrace_graph_node *child;
+	unsigned nr = parent->nr_buckets ? parent->nr_buckets * 2 : GRAPH_HASH_MIN * 2;
+
+	/* old buckets are freed with the arena */
+	parent->buckets = arena_zalloc(&graph->arena, nr * sizeof(*parent->buckets));
+	parent->nr_buckets = nr;
+
+	list_for_each_entry(child, &parent->head, list)
+		add_hash_node(parent, child);
+}
+
+/**
+ * graph_find_child - find a child node with the given name
+ * @parent: parent node
+ * @name_id: interned id of the function name of the child
+ *
+ * This function returns the first child of @parent whose name is
+ * @name_id, or NULL if there's no such child.  It uses a hash table of
+ * the children if @parent has many children.
+ */
+struct uftrace_graph_node * graph_find_child(struct uftrace_graph_node *parent,
+					     unsigned name_id)
+{
+	struct uftrace_graph_node *node;
+
+	if (parent->buckets) {
+		node = parent->buckets[name_id & (parent->nr_buckets - 1)];
+		while (node) {
+			if (node->name_id == name_id)
+				return node;
+			node = node->hash_next;
+		}
+		return NULL;
+	}
+
+	list_for_each_entry(node, &parent->head, list) {
+		if (node->name_id == name_id)
+			return node;
+	}
+	return NULL;
+}
+
+/**
+ * graph_add_child - add a new child node
+ * @graph: graph to allocate the node from
+ * @parent: parent node
+ * @name_id: interned id of the function name of the new node
+ * @node_size: size of the node (might be larger than uftrace_graph_node)
+ *
+ * This function allocates a new node in @graph and adds it to the end
+ * of the children of @parent.  The node will be freed by graph_destroy()
+ * but the name is shared with others (and never freed).
+ */
+struct uftrace_graph_node * graph_add_child(struct uftrace_graph *graph,
+					    struct uftrace_graph_node *parent,
+					    unsigned name_id, size_t node_size)
+{
+	struct uftrace_graph_node *node;
+
+	node = arena_zalloc(&graph->arena, node_size);
+
+	node->name = intern_name(name_id);
+	node->name_id = name_id;
+	INIT_LIST_HEAD(&node->head);
+
+	node->parent = parent;
+	list_add_tail(&node->list, &parent->head);
+	parent->nr_edges++;
+
+	if (parent->buckets == NULL) {
+		if (parent->nr_edges >= GRAPH_HASH_MIN)
+			resize_child_hash(graph, parent);
+	}
+	else if ((unsigned)parent->nr_edges > parent->nr_buckets)
+		resize_child_hash(graph, parent);
+	else
+		add_hash_node(parent, node);
+
+	return node;
+}
+
+static int add_graph_entry(struct uftrace_task_graph *tg, unsigned name_id,
 			   size_t node_size)
 {
 	struct uftrace_graph_node *node = NULL;
@@ -76,24 +175,16 @@ static int add_graph_entry(struct uftrace_task_graph *tg, char *name,
 	if (curr == NULL)
 		return -1;
 
-	list_for_each_entry(node, &curr->head, list) {
-		if (name && !strcmp(name, node->name))
-			break;
-	}
+	if (name_id)
+		node = graph_find_child(curr, name_id);
 
-	if (list_no_entry(node, &curr->head, list)) {
+	if (node == NULL) {
 		struct uftrace_trigger tr;
 		struct uftrace_session *sess = tg->graph->sess;
 
-		node = xzalloc(node_size);
-
+		node = graph_add_child(tg->graph, curr,
+				       name_id ?: intern_id("none"), node_size);
 		node->addr = rstack->addr;
-		node->name = xstrdup(name ?: "none");
-		INIT_LIST_HEAD(&node->head);
-
-		node->parent = curr;
-		list_add_tail(&node->list, &node->parent->head);
-		node->parent->nr_edges++;
 
 		if (uftrace_match_filter(node->addr, &sess->fixups, &tr)) {
 			struct sym *sym;
@@ -191,7 +282,7 @@ static int add_graph_event(struct uftrace_task_graph *tg, size_t node_size)
 	if (rec->addr == EVENT_ID_PERF_SCHED_OUT) {
 		/* to match addr with sched-in */
 		rec->addr = EVENT_ID_PERF_SCHED_IN;
-		return add_graph_entry(tg, "sched-in", node_size);
+		return add_graph_entry(tg, intern_id("sched-in"), node_size);
 	}
 	else if (rec->addr == EVENT_ID_PERF_SCHED_IN) {
 		return add_graph_exit(tg);
@@ -200,11 +291,11 @@ static int add_graph_event(struct uftrace_task_graph *tg, size_t node_size)
 	return -1;
 }
 
-int graph_add_node(struct uftrace_task_graph *tg, int type, char *name,
+int graph_add_node(struct uftrace_task_graph *tg, int type, unsigned name_id,
 		   size_t node_size)
 {
 	if (type == UFTRACE_ENTRY)
-		return add_graph_entry(tg, name, node_size);
+		return add_graph_entry(tg, name_id, node_size);
 	else if (type == UFTRACE_EXIT)
 		return add_graph_exit(tg);
 	else if (type == UFTRACE_EVENT)
@@ -213,25 +304,16 @@ int graph_add_node(struct uftrace_task_graph *tg, int type, char *name,
 		return 0;
 }
 
-static void graph_destroy_node(struct uftrace_graph_node *node)
-{
-	struct uftrace_graph_node *child, *tmp;
-
-	list_for_each_entry_safe(child, tmp, &node->head, list)
-		graph_destroy_node(child);
-
-	list_del(&node->list);
-	free(node->name);
-	free(node);
-}
-
 void graph_destroy(struct uftrace_graph *graph)
 {
-	struct uftrace_graph_node *node, *tmp;
 	struct uftrace_special_node *snode, *stmp;
 
-	list_for_each_entry_safe(node, tmp, &graph->root.head, list)
-		graph_destroy_node(node);
+	/* all nodes are in the arena */
+	arena_destroy(&graph->arena);
+
+	INIT_LIST_HEAD(&graph->root.head);
+	graph->root.buckets = NULL;
+	graph->root.nr_buckets = 0;
 
 	list_for_each_entry_safe(snode, stmp, &graph->special_nodes, list) {
 		list_del(&snode->list);
@@ -252,3 +334,53 @@ void graph_remove_task(void)
 		free(tg);
 	}
 }
+
+#ifdef UNIT_TEST
+TEST_CASE(graph_child_hash)
+{
+	struct uftrace_graph graph;
+	struct uftrace_graph_node *node, *dup;
+	char name[32];
+	unsigned id;
+	int i;
+
+	graph_init(&graph, NULL);
+
+	for (i = 0; i < 1000; i++) {
+		snprintf(name, sizeof(name), "func%d", i);
+		id = intern_id(name);
+		TEST_EQ(graph_find_child(&graph.root, id), NULL);
+
+		node = graph_add_child(&graph, &graph.root, id, sizeof(*node));
+		TEST_EQ(node->parent, &graph.root);
+		TEST_STREQ(node->name, name);
+	}
+	TEST_EQ(graph.root.nr_edges, 1000);
+	TEST_NE(graph.root.buckets, NULL);
+
+	i = 0;
+	list_for_each_entry(node, &graph.root.head, list) {
+		snprintf(name, sizeof(name), "func%d", i++);
+		TEST_EQ(graph_find_child(&graph.root, intern_id(name)), node);
+	}
+
+	/* it should return the first one if there're duplicates */
+	id = intern_id("func42");
+	node = graph_find_child(&graph.root, id);
+	dup = graph_add_child(&graph, &graph.root, id, sizeof(*dup));
+	TEST_NE(dup, node);
+	TEST_EQ(graph_find_child(&graph.root, id), node);
+
+	/* small nodes don't have the hash table */
+	dup = graph_add_child(&graph, node, intern_id("child"), sizeof(*dup));
+	TEST_EQ(node->buckets, NULL);
+	TEST_EQ(graph_find_child(node, intern_id("child")), dup);
+	TEST_EQ(graph_find_child(node, id), NULL);
+
+	graph_destroy(&graph);
+	TEST_EQ(list_empty(&graph.root.head), true);
+	TEST_EQ(graph.root.buckets, NULL);
+
+	return TEST_OK;
+}
+#endif /* UNIT_TEST */
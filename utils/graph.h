@@ -8,6 +8,10 @@
 #include "utils/list.h"
 #include "utils/rbtree.h"
 #include "utils/fstack.h"
+#include "utils/arena.h"
+
+/* build a hash table of children when a node has this many children */
+#define GRAPH_HASH_MIN  8
 
 struct uftrace_graph_node {
 	uint64_t			addr;
@@ -19,6 +23,12 @@ struct uftrace_graph_node {
 	struct list_head		head;
 	struct list_head		list;
 	struct uftrace_graph_node	*parent;
+	/* interned name and hash chain in the parent */
+	unsigned			name_id;
+	struct uftrace_graph_node	*hash_next;
+	/* hash table of the children (if it has many) */
+	unsigned			nr_buckets;
+	struct uftrace_graph_node	**buckets;
 };
 
 enum uftrace_graph_node_type {
@@ -39,6 +49,8 @@ struct uftrace_graph {
 	struct uftrace_session		*sess;
 	struct list_head		special_nodes;
 	struct uftrace_graph_node	root;
+	/* nodes (and names) are freed at once */
+	struct uftrace_arena		arena;
 };
 
 struct uftrace_task_graph {
@@ -61,7 +73,13 @@ struct uftrace_task_graph * graph_get_task(struct ftrace_task_handle *task,
 					   size_t tg_size);
 void graph_remove_task(void);
 
-int graph_add_node(struct uftrace_task_graph *tg, int type, char *name,
+int graph_add_node(struct uftrace_task_graph *tg, int type, unsigned name_id,
 		   size_t node_size);
 
+struct uftrace_graph_node * graph_find_child(struct uftrace_graph_node *parent,
+					     unsigned name_id);
+struct uftrace_graph_node * graph_add_child(struct uftrace_graph *graph,
+					    struct uftrace_graph_node *parent,
+					    unsigned name_id, size_t node_size);
+
 #endif /* UFTRACE_GRAPH_H */
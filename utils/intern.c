@@ -0,0 +1,258 @@
+/*
+ * Global string interning for (symbol) names
+ *
+ * Analysis commands used to copy function names into graph nodes and
+ * report entries and compare them with strcmp().  Instead, each distinct
+ * name is saved once in the (process-wide) table and gets an id.  The
+ * names are never freed and can be used as long as the process runs.
+ *
+ * Released under the GPL v2.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "utils/utils.h"
+#include "utils/arena.h"
+#include "utils/intern.h"
+
+/*
+ * The lookup is lock-free as most calls find existing names.  The hash
+ * table (of ids) is replaced when it grows and old tables are kept so
+ * that concurrent lookups can still use them.  The entries are saved in
+ * chunks which are never moved.  Only new names take the lock.
+ */
+#define INTERN_CHUNK_BITS  16
+#define INTERN_CHUNK_SIZE  (1U << INTERN_CHUNK_BITS)
+#define INTERN_MAX_CHUNKS  (1U << (32 - INTERN_CHUNK_BITS))
+
+struct intern_entry {
+	char *name;
+	uint32_t hash;
+};
+
+struct intern_slots {
+	struct intern_slots *prev;  /* old table (not used anymore) */
+	unsigned bits;
+	unsigned slot[];            /* ids, 0 is empty */
+};
+
+static struct {
+	struct intern_slots *slots;
+	struct intern_entry *chunks[INTERN_MAX_CHUNKS];  /* indexed by id */
+	unsigned nr;
+	struct uftrace_arena arena;
+	pthread_mutex_t lock;
+} intern_table = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static uint32_t hash_name(const char *name)
+{
+	/* FNV-1a */
+	uint32_t hash = 2166136261U;
+
+	while (*name) {
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static struct intern_entry *get_entry(unsigned id)
+{
+	struct intern_entry *chunk;
+
+	chunk = intern_table.chunks[id >> INTERN_CHUNK_BITS];
+	return &chunk[id & (INTERN_CHUNK_SIZE - 1)];
+}
+
+/*
+ * returns the slot of the name (and its id) or an empty slot (and 0)
+ * to insert it.  The slot can be changed by other thread after return.
+ */
+static unsigned *find_slot(struct intern_slots *tab, const char *name,
+			   uint32_t hash, unsigned *pid)
+{
+	unsigned mask = (1U << tab->bits) - 1;
+	unsigned pos = hash & mask;
+	unsigned *slot;
+
+	while (1) {
+		slot = &tab->slot[pos];
+
+		/* pairs with the release store in intern_id() */
+		*pid = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+		if (*pid == 0)
+			return slot;
+		if (get_entry(*pid)->hash == hash &&
+		    !strcmp(get_entry(*pid)->name, name))
+			return slot;
+
+		pos = (pos + 1) & mask;
+	}
+}
+
+static void grow_table(void)
+{
+	struct intern_slots *old = intern_table.slots;
+	struct intern_slots *tab;
+	unsigned bits = old ? old->bits + 1 : 12;
+	unsigned id, tmp;
+
+	tab = xzalloc(sizeof(*tab) + (sizeof(*tab->slot) << bits));
+	tab->bits = bits;
+	tab->prev = old;
+
+	for (id = 1; id <= intern_table.nr; id++) {
+		struct intern_entry *e = get_entry(id);
+
+		*find_slot(tab, e->name, e->hash, &tmp) = id;
+	}
+
+	__atomic_store_n(&intern_table.slots, tab, __ATOMIC_RELEASE);
+}
+
+/**
+ * intern_id - get the id of the name
+ * @name: name to intern
+ *
+ * This function returns a unique id of @name.  If it's a new name, it
+ * saves a copy of @name in the table and assigns a new id.
+ */
+unsigned intern_id(const char *name)
+{
+	uint32_t hash = hash_name(name);
+	struct intern_slots *tab;
+	struct intern_entry *e;
+	unsigned *slot;
+	unsigned id;
+
+	tab = __atomic_load_n(&intern_table.slots, __ATOMIC_ACQUIRE);
+	if (tab) {
+		find_slot(tab, name, hash, &id);
+		if (id)
+			return id;
+	}
+
+	pthread_mutex_lock(&intern_table.lock);
+
+	/* keep it less than half full */
+	tab = intern_table.slots;
+	if (tab == NULL || (intern_table.nr + 1) * 2 >= (1U << tab->bits)) {
+		grow_table();
+		tab = intern_table.slots;
+	}
+
+	/* it might be added by other thread */
+	slot = find_slot(tab, name, hash, &id);
+	if (id == 0) {
+		id = intern_table.nr + 1;
+
+		if ((id & (INTERN_CHUNK_SIZE - 1)) == 0 || id == 1) {
+			intern_table.chunks[id >> INTERN_CHUNK_BITS] =
+				xcalloc(INTERN_CHUNK_SIZE, sizeof(*e));
+		}
+
+		e = get_entry(id);
+		e->name = arena_strdup(&intern_table.arena, name);
+		e->hash = hash;
+
+		/* publish the entry after it's filled */
+		__atomic_store_n(&intern_table.nr, id, __ATOMIC_RELEASE);
+		__atomic_store_n(slot, id, __ATOMIC_RELEASE);
+	}
+
+	pthread_mutex_unlock(&intern_table.lock);
+	return id;
+}
+
+/* returns the interned name of the id (or NULL if it's invalid) */
+char *intern_name(unsigned id)
+{
+	if (id == 0 || id > __atomic_load_n(&intern_table.nr, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	return get_entry(id)->name;
+}
+
+#ifdef UNIT_TEST
+#define INTERN_TEST_THREADS  4
+#define INTERN_TEST_NAMES    20000
+
+static void *intern_test_thread(void *arg)
+{
+	unsigned *ids = arg;
+	char buf[32];
+	int i;
+
+	for (i = 0; i < INTERN_TEST_NAMES; i++) {
+		snprintf(buf, sizeof(buf), "thread%d", i);
+		ids[i] = intern_id(buf);
+	}
+	return NULL;
+}
+
+TEST_CASE(intern_threads)
+{
+	pthread_t th[INTERN_TEST_THREADS];
+	unsigned *ids[INTERN_TEST_THREADS];
+	char buf[32];
+	int i, k;
+
+	for (k = 0; k < INTERN_TEST_THREADS; k++) {
+		ids[k] = xcalloc(INTERN_TEST_NAMES, sizeof(*ids[k]));
+		TEST_EQ(pthread_create(&th[k], NULL, intern_test_thread, ids[k]), 0);
+	}
+	for (k = 0; k < INTERN_TEST_THREADS; k++)
+		pthread_join(th[k], NULL);
+
+	/* all threads should get the same id for a name */
+	for (i = 0; i < INTERN_TEST_NAMES; i++) {
+		snprintf(buf, sizeof(buf), "thread%d", i);
+		TEST_STREQ(intern_name(ids[0][i]), buf);
+
+		for (k = 1; k < INTERN_TEST_THREADS; k++)
+			TEST_EQ(ids[k][i], ids[0][i]);
+	}
+
+	for (k = 0; k < INTERN_TEST_THREADS; k++)
+		free(ids[k]);
+
+	return TEST_OK;
+}
+
+TEST_CASE(intern_name)
+{
+	unsigned foo, bar;
+	char buf[32];
+	int i;
+
+	foo = intern_id("foo");
+	bar = intern_id("bar");
+
+	TEST_NE(foo, 0);
+	TEST_NE(bar, 0);
+	TEST_NE(foo, bar);
+	TEST_EQ(intern_id("foo"), foo);
+	TEST_STREQ(intern_name(foo), "foo");
+	TEST_EQ(intern_name(0), NULL);
+
+	/* ids and names should not change after the table grows */
+	for (i = 0; i < 10000; i++) {
+		snprintf(buf, sizeof(buf), "name%d", i);
+		TEST_EQ(intern_name(intern_id(buf)), intern_name(intern_id(buf)));
+	}
+
+	TEST_EQ(intern_id("foo"), foo);
+	TEST_EQ(intern_id("bar"), bar);
+	TEST_STREQ(intern_name(bar), "bar");
+
+	/* the pointer can be compared too */
+	snprintf(buf, sizeof(buf), "foo");
+	TEST_EQ(intern_name(intern_id(buf)), intern_name(foo));
+
+	return TEST_OK;
+}
+#endif /* UNIT_TEST */
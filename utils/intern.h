@@ -0,0 +1,12 @@
+#ifndef UFTRACE_INTERN_H
+#define UFTRACE_INTERN_H
+
+/*
+ * Interned strings (names) have a unique id and a stable pointer, so
+ * names can be compared by the id (or pointer) instead of strcmp().
+ * Id 0 is not used for any name.
+ */
+unsigned intern_id(const char *name);
+char *intern_name(unsigned id);
+
+#endif /* UFTRACE_INTERN_H */
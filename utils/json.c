@@ -0,0 +1,195 @@
+/*
+ * Buffered JSON writer
+ *
+ * The chrome trace output has a JSON object for each record.  Writing
+ * them with printf() spends most of the time parsing the format string
+ * so this writer keeps the output in a buffer and formats numbers and
+ * (escaped) strings directly.
+ *
+ * Released under the GPL v2.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils/utils.h"
+#include "utils/json.h"
+
+void json_writer_init(struct json_writer *jw, FILE *fp)
+{
+	jw->fp = fp;
+	jw->buf = xmalloc(JSON_BUF_SIZE);
+	jw->len = 0;
+	jw->written = 0;
+}
+
+void json_writer_flush(struct json_writer *jw)
+{
+	if (jw->len && fwrite(jw->buf, jw->len, 1, jw->fp) != 1)
+		pr_err("write json output failed");
+	jw->len = 0;
+}
+
+void json_writer_finish(struct json_writer *jw)
+{
+	json_writer_flush(jw);
+	fflush(jw->fp);
+
+	free(jw->buf);
+	jw->buf = NULL;
+}
+
+void json_add_raw(struct json_writer *jw, const char *str, size_t len)
+{
+	if (jw->len + len > JSON_BUF_SIZE) {
+		json_writer_flush(jw);
+
+		if (len > JSON_BUF_SIZE) {
+			if (fwrite(str, len, 1, jw->fp) != 1)
+				pr_err("write json output failed");
+			jw->written += len;
+			return;
+		}
+	}
+
+	memcpy(jw->buf + jw->len, str, len);
+	jw->len += len;
+	jw->written += len;
+}
+
+void json_add_str(struct json_writer *jw, const char *str)
+{
+	json_add_raw(jw, str, strlen(str));
+}
+
+static bool needs_escape(unsigned char c)
+{
+	return c < 0x20 || c == '"' || c == '\\';
+}
+
+/* add contents of a JSON string (without quotes) */
+void json_add_escape(struct json_writer *jw, const char *str)
+{
+	const char *p = str;
+	char esc[8];
+
+	while (*p && !needs_escape(*p))
+		p++;
+
+	/* fast path: most names don't need to be escaped */
+	json_add_raw(jw, str, p - str);
+
+	for (; *p; p++) {
+		unsigned char c = *p;
+
+		if (!needs_escape(c)) {
+			json_add_char(jw, c);
+			continue;
+		}
+
+		switch (c) {
+		case '"':
+		case '\\':
+			esc[0] = '\\';
+			esc[1] = c;
+			json_add_raw(jw, esc, 2);
+			break;
+		case '\n':
+			json_add_raw(jw, "\\n", 2);
+			break;
+		case '\t':
+			json_add_raw(jw, "\\t", 2);
+			break;
+		case '\r':
+			json_add_raw(jw, "\\r", 2);
+			break;
+		default:
+			snprintf(esc, sizeof(esc), "\\u%04x", c);
+			json_add_raw(jw, esc, 6);
+			break;
+		}
+	}
+}
+
+void json_add_uint(struct json_writer *jw, uint64_t val)
+{
+	char num[24];
+	int i = sizeof(num);
+
+	do {
+		num[--i] = '0' + val % 10;
+		val /= 10;
+	} while (val);
+
+	json_add_raw(jw, num + i, sizeof(num) - i);
+}
+
+void json_add_int(struct json_writer *jw, int64_t val)
+{
+	if (val < 0) {
+		json_add_char(jw, '-');
+		json_add_uint(jw, -(uint64_t)val);
+	}
+	else
+		json_add_uint(jw, val);
+}
+
+/* timestamp in usec with 3 decimal places (same as "%"PRIu64".%03d") */
+void json_add_time(struct json_writer *jw, uint64_t nsec)
+{
+	char frac[4];
+	unsigned rem = nsec % 1000;
+
+	frac[0] = '.';
+	frac[1] = '0' + rem / 100;
+	frac[2] = '0' + rem / 10 % 10;
+	frac[3] = '0' + rem % 10;
+
+	json_add_uint(jw, nsec / 1000);
+	json_add_raw(jw, frac, sizeof(frac));
+}
+
+#ifdef UNIT_TEST
+TEST_CASE(json_writer)
+{
+	struct json_writer jw;
+	char *str = NULL;
+	size_t len = 0;
+	FILE *fp;
+	int i;
+
+	fp = open_memstream(&str, &len);
+	TEST_NE(fp, NULL);
+
+	json_writer_init(&jw, fp);
+
+	json_add_char(&jw, '{');
+	json_add_str(&jw, "\"ts\":");
+	json_add_time(&jw, 123456789);
+	json_add_str(&jw, ",\"pid\":");
+	json_add_uint(&jw, 0);
+	json_add_str(&jw, ",\"val\":");
+	json_add_int(&jw, -42);
+	json_add_str(&jw, ",\"name\":\"");
+	json_add_escape(&jw, "operator\"\\\n\x01");
+	json_add_str(&jw, "\"}");
+
+	json_writer_flush(&jw);
+	fflush(fp);
+	TEST_STREQ("{\"ts\":123456.789,\"pid\":0,\"val\":-42,"
+		   "\"name\":\"operator\\\"\\\\\\n\\u0001\"}", str);
+	TEST_EQ(jw.written, (uint64_t)len);
+
+	/* output larger than the buffer */
+	for (i = 0; i < JSON_BUF_SIZE; i++)
+		json_add_time(&jw, 1000);
+
+	json_writer_finish(&jw);
+	TEST_EQ(jw.written, (uint64_t)len);
+	TEST_EQ(len, strlen(str));
+
+	fclose(fp);
+	free(str);
+	return TEST_OK;
+}
+#endif /* UNIT_TEST */
@@ -0,0 +1,42 @@
+#ifndef UFTRACE_JSON_H
+#define UFTRACE_JSON_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * A buffered writer for JSON output (e.g. chrome trace).  It formats
+ * integers and timestamps without printf and escapes strings only if
+ * they have special characters.
+ */
+#define JSON_BUF_SIZE  (64 * 1024)
+
+struct json_writer {
+	FILE		*fp;
+	char		*buf;
+	size_t		len;
+	uint64_t	written;  /* total bytes including the buffer */
+};
+
+void json_writer_init(struct json_writer *jw, FILE *fp);
+void json_writer_flush(struct json_writer *jw);
+void json_writer_finish(struct json_writer *jw);
+
+void json_add_raw(struct json_writer *jw, const char *str, size_t len);
+void json_add_str(struct json_writer *jw, const char *str);
+void json_add_escape(struct json_writer *jw, const char *str);
+void json_add_uint(struct json_writer *jw, uint64_t val);
+void json_add_int(struct json_writer *jw, int64_t val);
+void json_add_time(struct json_writer *jw, uint64_t nsec);
+
+static inline void json_add_char(struct json_writer *jw, char c)
+{
+	if (jw->len == JSON_BUF_SIZE)
+		json_writer_flush(jw);
+
+	jw->buf[jw->len++] = c;
+	jw->written++;
+}
+
+#endif /* UFTRACE_JSON_H */
@@ -7,12 +7,14 @@
  */
 
 #include <stdio.h>
+#include <inttypes.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <dirent.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <byteswap.h>
 
 /* This should be defined before #include "utils.h" */
 #define PR_FMT     "kernel"
@@ -1326,6 +1328,73 @@ generic_event_handler(struct trace_seq *s, struct pevent_record *record,
 	return 1;
 }
 
+/* each page (sub-buffer) starts with a header which has a timestamp */
+static uint64_t read_kernel_page_time(struct uftrace_kernel_reader *kernel,
+				      int cpu, int64_t offset)
+{
+	uint64_t timestamp;
+
+	if (pread(kernel->fds[cpu], &timestamp, sizeof(timestamp),
+		  offset) != sizeof(timestamp))
+		return -1ULL;
+
+	if (pevent_is_file_bigendian(kernel->pevent) !=
+	    pevent_is_host_bigendian(kernel->pevent))
+		timestamp = bswap_64(timestamp);
+
+	return timestamp;
+}
+
+/**
+ * seek_kernel_data - skip kernel tracing data before the given time
+ * @kernel - kernel ftrace handle
+ * @time   - start timestamp of the time range
+ *
+ * This function finds the last page starting before @time for each cpu
+ * using binary search and moves to it.  Events in the previous pages
+ * cannot be in the time range.  It should be called before reading any
+ * data.
+ */
+void seek_kernel_data(struct uftrace_kernel_reader *kernel, uint64_t time)
+{
+	int cpu;
+
+	for (cpu = 0; cpu < kernel->nr_cpus; cpu++) {
+		int64_t left = 0;
+		int64_t right = kernel->sizes[cpu] / kernel->pagesize;
+		int64_t offset;
+
+		if (kernel->rstack_done[cpu] || kernel->rstack_valid[cpu] ||
+		    kernel->offsets[cpu] != 0 || right == 0)
+			continue;
+
+		while (left < right) {
+			int64_t mid = (left + right) / 2;
+
+			offset = mid * kernel->pagesize;
+			if (read_kernel_page_time(kernel, cpu, offset) < time)
+				left = mid + 1;
+			else
+				right = mid;
+		}
+
+		if (left <= 1)
+			continue;
+
+		offset = (left - 1) * kernel->pagesize;
+		pr_dbg2("skip kernel data of cpu %d to offset %"PRId64"\n",
+			cpu, offset);
+
+		munmap(kernel->mmaps[cpu], kernel->pagesize);
+		kernel->offsets[cpu] = offset;
+
+		if (prepare_kbuffer(kernel, cpu) < 0) {
+			/* mark it done so that it won't access the map */
+			kernel->rstack_done[cpu] = true;
+		}
+	}
+}
+
 /**
  * read_kernel_cpu_data - read next kernel tracing data of specific cpu
  * @kernel - kernel ftrace handle
@@ -1580,6 +1649,59 @@ void * read_kernel_event(struct uftrace_kernel_reader *kernel, int cpu, int *psi
 	return kernel->trace_buf.buffer;
 }
 
+/**
+ * read_kernel_cpu_stack - peek next kernel ftrace data of a cpu
+ * @handle - ftrace file handle
+ * @cpu    - cpu number
+ * @taskp  - pointer to the task of the record
+ *
+ * This function reads next kernel function trace record of @cpu (if
+ * it's not read yet) and sets @taskp to the task of the record.  It
+ * discards records of unknown (or filtered) tasks.  The record will
+ * *NOT* be consumed and can be accessed by kernel->rstacks[@cpu].
+ *
+ * This function returns 0 if it reads a rstack, -1 if it's done.
+ */
+int read_kernel_cpu_stack(struct ftrace_file_handle *handle, int cpu,
+			  struct ftrace_task_handle **taskp)
+{
+	struct uftrace_kernel_reader *kernel = handle->kernel;
+	struct uftrace_record *rstack = &kernel->rstacks[cpu];
+	struct ftrace_task_handle *task;
+
+	while (true) {
+		if (kernel->rstack_done[cpu] && kernel->rstack_list[cpu].count == 0)
+			return -1;
+
+		if (!kernel->rstack_valid[cpu]) {
+			read_kernel_cpu(handle, cpu);
+			if (!kernel->rstack_valid[cpu])
+				return -1;
+		}
+
+		task = get_task_handle(handle, kernel->tids[cpu]);
+		if (task && task->map)
+			break;
+
+		/* force re-read on that cpu */
+		kernel->rstack_valid[cpu] = false;
+
+		if (rstack->more) {
+			struct uftrace_rstack_list_node *node;
+
+			node = list_first_entry(&kernel->rstack_list[cpu].read,
+						typeof(*node), list);
+			free(node->args.data);
+			node->args.data = NULL;
+		}
+
+		consume_first_rstack_list(&kernel->rstack_list[cpu]);
+	}
+
+	*taskp = task;
+	return 0;
+}
+
 /**
  * read_kernel_stack - peek next kernel ftrace data
  * @handle - ftrace file handle
@@ -1600,58 +1722,33 @@ int read_kernel_stack(struct ftrace_file_handle *handle,
 {
 	int i;
 	int first_cpu = -1;
-	int first_tid = -1;
 	uint64_t first_timestamp = 0;
 	struct uftrace_kernel_reader *kernel = handle->kernel;
-	struct uftrace_record *first_rstack;
+	struct ftrace_task_handle *task;
+	struct ftrace_task_handle *first_task = NULL;
 
-retry:
-	first_rstack = NULL;
 	for (i = 0; i < kernel->nr_cpus; i++) {
 		uint64_t timestamp;
 
-		if (kernel->rstack_done[i] && kernel->rstack_list[i].count == 0)
+		if (read_kernel_cpu_stack(handle, i, &task) < 0)
 			continue;
 
-		if (!kernel->rstack_valid[i]) {
-			read_kernel_cpu(handle, i);
-			if (!kernel->rstack_valid[i])
-				continue;
-		}
-
 		timestamp = kernel->rstacks[i].time;
-		if (!first_rstack || first_timestamp > timestamp) {
-			first_rstack = &kernel->rstacks[i];
+		if (!first_task || first_timestamp > timestamp) {
+			first_task = task;
 			first_timestamp = timestamp;
-			first_tid = kernel->tids[i];
 			first_cpu = i;
 		}
 	}
 
-	if (first_rstack == NULL)
+	if (first_task == NULL)
 		return -1;
 
-	*taskp = get_task_handle(handle, first_tid);
-	if (*taskp == NULL || (*taskp)->fp == NULL) {
-		/* force re-read on that cpu */
-		kernel->rstack_valid[first_cpu] = false;
-
-		if (first_rstack->more) {
-			struct uftrace_rstack_list_node *node;
-
-			node = list_first_entry(&kernel->rstack_list[first_cpu].read,
-						typeof(*node), list);
-			free(node->args.data);
-			node->args.data = NULL;
-		}
-
-		consume_first_rstack_list(&kernel->rstack_list[first_cpu]);
-		goto retry;
-	}
-
-	memcpy(&(*taskp)->kstack, first_rstack, sizeof(*first_rstack));
+	memcpy(&first_task->kstack, &kernel->rstacks[first_cpu],
+	       sizeof(first_task->kstack));
 	kernel->last_read_cpu = first_cpu;
 
+	*taskp = first_task;
 	return first_cpu;
 }
 
@@ -1977,7 +2074,7 @@ static int kernel_test_setup_handle(struct uftrace_kernel_reader *kernel,
 
 	for (i = 0; i < NUM_TASK; i++) {
 		handle->tasks[i].tid = test_tids[i];
-		handle->tasks[i].fp  = (void *)1;  /* prevent retry */
+		handle->tasks[i].map = (void *)1;  /* prevent retry */
 	}
 
 	test_sess.symtabs.kernel_base = 0xffff0000UL;
@@ -2027,6 +2124,9 @@ static void kernel_test_finish_handle(void)
 
 	free(handle->tasks);
 	handle->tasks = NULL;
+
+	free(handle->task_hash);
+	handle->task_hash = NULL;
 }
 
 TEST_CASE(kernel_read)
@@ -60,8 +60,11 @@ void list_kernel_events(void);
 int setup_kernel_data(struct uftrace_kernel_reader *kernel);
 int read_kernel_stack(struct ftrace_file_handle *handle,
 		      struct ftrace_task_handle **taskp);
+int read_kernel_cpu_stack(struct ftrace_file_handle *handle, int cpu,
+			  struct ftrace_task_handle **taskp);
 int read_kernel_cpu_data(struct uftrace_kernel_reader *kernel,
 			 int cpu);
+void seek_kernel_data(struct uftrace_kernel_reader *kernel, uint64_t time);
 void * read_kernel_event(struct uftrace_kernel_reader *kernel,
 			 int cpu, int *psize);
 struct uftrace_record * get_kernel_record(struct uftrace_kernel_reader *kernel,
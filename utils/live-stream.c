@@ -0,0 +1,568 @@
+/*
+ * Streaming output for the live command
+ *
+ * Normally 'uftrace live' records the data into a temp directory and
+ * replays it after the program finished.  In the stream mode, buffers
+ * consumed by the recorder are passed here and printed incrementally
+ * without writing them to the disk.
+ *
+ * As each task sends its buffer only when it's full, there's no way to
+ * know whether the other tasks have an older record yet.  So records are
+ * kept in a reorder window (in time) and printed after the window has
+ * passed.  A record came after that is printed out of order.
+ *
+ * Released under the GPL v2.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "uftrace.h"
+#include "utils/utils.h"
+#include "utils/symbol.h"
+#include "utils/live-stream.h"
+#include "utils/record-stat.h"
+
+void live_stream_init(struct live_stream *ls, struct opts *opts)
+{
+	memset(ls, 0, sizeof(*ls));
+
+	pthread_mutex_init(&ls->lock, NULL);
+
+	ls->sessions.root  = RB_ROOT;
+	ls->sessions.tasks = RB_ROOT;
+	ls->tasks = RB_ROOT;
+
+	ls->dirname  = opts->dirname;
+	ls->window   = opts->stream_window;
+	ls->no_merge = opts->no_merge;
+	ls->comment  = opts->comment;
+}
+
+void live_stream_session(struct live_stream *ls, struct uftrace_msg_sess *smsg,
+			 char *exename)
+{
+	pthread_mutex_lock(&ls->lock);
+	/* the recorder always sets SYM_REL_ADDR */
+	create_session(&ls->sessions, smsg, ls->dirname, exename, true);
+	pthread_mutex_unlock(&ls->lock);
+}
+
+void live_stream_task(struct live_stream *ls, struct uftrace_msg_task *tmsg,
+		      bool fork)
+{
+	pthread_mutex_lock(&ls->lock);
+	create_task(&ls->sessions, tmsg, fork, true);
+	pthread_mutex_unlock(&ls->lock);
+}
+
+void live_stream_dlopen(struct live_stream *ls, struct uftrace_msg_dlopen *dmsg,
+			char *libname)
+{
+	struct uftrace_session *s;
+
+	pthread_mutex_lock(&ls->lock);
+	s = get_session_from_sid(&ls->sessions, dmsg->sid);
+	if (s)
+		session_add_dlopen(s, dmsg->task.time, dmsg->base_addr, libname);
+	pthread_mutex_unlock(&ls->lock);
+}
+
+static struct live_stream_task *get_stream_task(struct live_stream *ls, int tid)
+{
+	struct live_stream_task *t;
+	struct rb_node *parent = NULL;
+	struct rb_node **p = &ls->tasks.rb_node;
+
+	while (*p) {
+		parent = *p;
+		t = rb_entry(parent, struct live_stream_task, node);
+
+		if (t->tid > tid)
+			p = &parent->rb_left;
+		else if (t->tid < tid)
+			p = &parent->rb_right;
+		else
+			return t;
+	}
+
+	t = xzalloc(sizeof(*t));
+	t->tid = tid;
+
+	rb_link_node(&t->node, parent, p);
+	rb_insert_color(&t->node, &ls->tasks);
+	return t;
+}
+
+static uint64_t head_time(struct live_stream_task *t)
+{
+	return t->recs[t->head].time;
+}
+
+/* same timestamp is ordered by the tid */
+static bool stream_task_before(struct live_stream_task *a,
+			       struct live_stream_task *b)
+{
+	if (head_time(a) != head_time(b))
+		return head_time(a) < head_time(b);
+	return a->tid < b->tid;
+}
+
+static void stream_heap_push(struct live_stream *ls,
+			     struct live_stream_task *t)
+{
+	struct live_stream_task **heap;
+	int pos = ls->nr_heap++;
+
+	if (ls->nr_heap > ls->heap_alloc) {
+		ls->heap_alloc = ls->heap_alloc ? ls->heap_alloc * 2 : 64;
+		ls->heap = xrealloc(ls->heap, ls->heap_alloc * sizeof(*heap));
+	}
+	heap = ls->heap;
+
+	while (pos > 0) {
+		int parent = (pos - 1) / 2;
+
+		if (!stream_task_before(t, heap[parent]))
+			break;
+
+		heap[pos] = heap[parent];
+		pos = parent;
+	}
+	heap[pos] = t;
+}
+
+/* the first record of the top task is changed (or consumed all) */
+static void stream_heap_update_top(struct live_stream *ls)
+{
+	struct live_stream_task **heap = ls->heap;
+	struct live_stream_task *t = heap[0];
+	int pos = 0;
+
+	if (t->head == t->tail)
+		t = heap[--ls->nr_heap];
+
+	while (pos * 2 + 1 < ls->nr_heap) {
+		int child = pos * 2 + 1;
+
+		if (child + 1 < ls->nr_heap &&
+		    stream_task_before(heap[child + 1], heap[child]))
+			child++;
+
+		if (!stream_task_before(heap[child], t))
+			break;
+
+		heap[pos] = heap[child];
+		pos = child;
+	}
+	heap[pos] = t;
+}
+
+static void queue_record(struct live_stream *ls, struct live_stream_task *t,
+			 struct uftrace_record *rec)
+{
+	bool empty = (t->head == t->tail);
+
+	if (empty)
+		t->head = t->tail = 0;
+
+	if (t->tail == t->alloc) {
+		/* reuse the space of printed records if it's large enough */
+		if (t->head && t->head >= t->alloc / 2) {
+			memmove(t->recs, t->recs + t->head,
+				(t->tail - t->head) * sizeof(*rec));
+			t->tail -= t->head;
+			t->head = 0;
+		}
+		else {
+			t->alloc = t->alloc ? t->alloc * 2 : 256;
+			t->recs = xrealloc(t->recs, t->alloc * sizeof(*rec));
+		}
+	}
+
+	t->recs[t->tail++] = *rec;
+	ls->nr_pending++;
+
+	if (empty)
+		stream_heap_push(ls, t);
+}
+
+static void set_entry_time(struct live_stream_task *t, int depth,
+			   uint64_t time)
+{
+	if (depth >= t->nr_stack) {
+		int n = ALIGN(depth + 1, 64);
+
+		t->entry_time = xrealloc(t->entry_time, n * sizeof(uint64_t));
+		memset(t->entry_time + t->nr_stack, 0,
+		       (n - t->nr_stack) * sizeof(uint64_t));
+		t->nr_stack = n;
+	}
+
+	t->entry_time[depth] = time;
+}
+
+static uint64_t get_entry_time(struct live_stream_task *t, int depth)
+{
+	uint64_t time;
+
+	/* the entry might not be seen due to LOST */
+	if (depth >= t->nr_stack)
+		return 0;
+
+	time = t->entry_time[depth];
+	t->entry_time[depth] = 0;
+	return time;
+}
+
+static struct sym *find_stream_sym(struct live_stream *ls, int tid,
+				   uint64_t time, uint64_t addr)
+{
+	struct uftrace_session *s;
+	struct uftrace_task *t;
+	struct sym *sym;
+
+	s = find_task_session(&ls->sessions, tid, time);
+	if (s == NULL) {
+		t = find_task(&ls->sessions, tid);
+		if (t)
+			s = find_task_session(&ls->sessions, t->pid, time);
+	}
+	if (s == NULL)
+		return NULL;
+
+	sym = find_symtabs(&s->symtabs, addr);
+	if (sym == NULL)
+		sym = session_find_dlsym(s, time, addr);
+
+	return sym;
+}
+
+/* check if other tasks have a record to be printed before @time */
+static bool has_older_record(struct live_stream *ls, uint64_t time)
+{
+	int i;
+
+	/* the current task is at the top, others are in the children */
+	for (i = 1; i <= 2 && i < ls->nr_heap; i++) {
+		if (head_time(ls->heap[i]) < time)
+			return true;
+	}
+	return false;
+}
+
+/* same as the default fields (duration and tid) of replay */
+static void print_stream_field(uint64_t duration, int tid)
+{
+	pr_out(" ");
+	print_time_unit(duration);
+	pr_out(" [%6d] | ", tid);
+}
+
+static void print_stream_record(struct live_stream *ls,
+				struct live_stream_task *t)
+{
+	struct uftrace_record *rec = &t->recs[t->head++];
+	struct uftrace_record *next = NULL;
+	struct sym *sym;
+	char *name;
+	int depth = rec->depth;
+	uint64_t entry_time;
+
+	ls->nr_pending--;
+
+	if (rec->time < ls->last_time)
+		ls->nr_late++;
+	else
+		ls->last_time = rec->time;
+
+	if (!ls->header_done) {
+		pr_out("# DURATION     TID     FUNCTION\n");
+		ls->header_done = true;
+	}
+
+	switch (rec->type) {
+	case UFTRACE_ENTRY:
+		sym = find_stream_sym(ls, t->tid, rec->time, rec->addr);
+		name = symbol_getname(sym, rec->addr);
+
+		/* exit record might not be received yet */
+		if (!ls->no_merge && t->head < t->tail)
+			next = &t->recs[t->head];
+
+		if (next && next->type == UFTRACE_EXIT &&
+		    next->depth == rec->depth &&
+		    !has_older_record(ls, next->time)) {
+			/* leaf function - also consume return record */
+			t->head++;
+			ls->nr_pending--;
+
+			print_stream_field(next->time - rec->time, t->tid);
+			pr_out("%*s%s();\n", depth * 2, "", name);
+			t->depth = depth;
+		}
+		else {
+			set_entry_time(t, depth, rec->time);
+
+			print_stream_field(0, t->tid);
+			pr_out("%*s%s() {\n", depth * 2, "", name);
+			t->depth = depth + 1;
+		}
+		symbol_putname(sym, name);
+		break;
+
+	case UFTRACE_EXIT:
+		sym = find_stream_sym(ls, t->tid, rec->time, rec->addr);
+		name = symbol_getname(sym, rec->addr);
+
+		entry_time = get_entry_time(t, depth);
+		print_stream_field(entry_time ? rec->time - entry_time : 0,
+				   t->tid);
+		pr_out("%*s}", depth * 2, "");
+		if (ls->comment)
+			pr_gray(" /* %s */\n", name);
+		else
+			pr_out("\n");
+		t->depth = depth;
+
+		symbol_putname(sym, name);
+		break;
+
+	case UFTRACE_LOST:
+		print_stream_field(0, t->tid);
+		pr_red("%*s/* LOST %d records!! */\n", t->depth * 2, "",
+		       (int)rec->addr);
+		break;
+
+	case UFTRACE_EVENT:
+		/* kernel and user events are not supported */
+		if (rec->addr >= EVENT_ID_BUILTIN && rec->addr < EVENT_ID_USER)
+			name = get_event_name(NULL, rec->addr);
+		else
+			xasprintf(&name, "event:%u", (unsigned)rec->addr);
+
+		print_stream_field(0, t->tid);
+		pr_color(DEFAULT_EVENT_COLOR, "%*s/* %s */\n", t->depth * 2, "",
+			 name);
+		free(name);
+		break;
+	}
+}
+
+/* print records older than the window (from @now) in time order */
+static int flush_stream(struct live_stream *ls, uint64_t now)
+{
+	struct live_stream_task *t;
+	int count = 0;
+
+	while (ls->nr_heap) {
+		/* the task has the oldest record */
+		t = ls->heap[0];
+
+		if (head_time(t) + ls->window > now &&
+		    ls->nr_pending <= LIVE_STREAM_MAX_PENDING)
+			break;
+
+		print_stream_record(ls, t);
+		stream_heap_update_top(ls);
+		count++;
+	}
+
+	if (count)
+		fflush(outfp);
+
+	return count;
+}
+
+/**
+ * live_stream_add - add records in a buffer
+ * @ls: live stream handle
+ * @tid: task id of the buffer
+ * @data: contents of the buffer
+ * @size: size of the @data
+ *
+ * This function copies records in @data to the queue of the task.  As
+ * argument and return values cannot be parsed without argspec, they
+ * are not supported and the remaining buffer will be ignored.
+ */
+void live_stream_add(struct live_stream *ls, int tid, void *data, size_t size)
+{
+	struct live_stream_task *t;
+	struct uftrace_record rec;
+	void *end = data + size;
+
+	pthread_mutex_lock(&ls->lock);
+
+	t = get_stream_task(ls, tid);
+
+	while (data + sizeof(rec) <= end) {
+		memcpy(&rec, data, sizeof(rec));
+		data += sizeof(rec);
+
+		if (rec.magic != RECORD_MAGIC) {
+			ls->nr_invalid++;
+			break;
+		}
+
+		if (rec.more) {
+			if (rec.type != UFTRACE_EVENT) {
+				ls->nr_invalid++;
+				break;
+			}
+			/* skip event data */
+			data += ALIGN(*(uint16_t *)data + 2, 8);
+			rec.more = 0;
+		}
+
+		/* LOST record has no timestamp */
+		if (rec.type == UFTRACE_LOST)
+			rec.time = t->last_time;
+		else
+			t->last_time = rec.time;
+
+		queue_record(ls, t, &rec);
+	}
+
+	/* do not wait for the window if it has too many records */
+	if (ls->nr_pending > LIVE_STREAM_MAX_PENDING)
+		flush_stream(ls, record_stat_now());
+
+	pthread_mutex_unlock(&ls->lock);
+}
+
+/**
+ * live_stream_update - print records older than the window
+ * @ls: live stream handle
+ *
+ * This function should be called periodically.  It returns time to
+ * the next call in msec.
+ */
+int live_stream_update(struct live_stream *ls)
+{
+	pthread_mutex_lock(&ls->lock);
+	flush_stream(ls, record_stat_now());
+	pthread_mutex_unlock(&ls->lock);
+
+	return DIV_ROUND_UP(ls->window / 4, NSEC_PER_MSEC) ?: 1;
+}
+
+void live_stream_finish(struct live_stream *ls)
+{
+	struct live_stream_task *t;
+	struct rb_node *n;
+
+	pthread_mutex_lock(&ls->lock);
+
+	/* no more records will come */
+	flush_stream(ls, -1ULL);
+
+	if (ls->nr_late) {
+		pr_warn("%"PRIu64" records were printed out of order "
+			"(try a larger --stream-window)\n", ls->nr_late);
+	}
+	if (ls->nr_invalid)
+		pr_warn("%"PRIu64" buffers have records cannot be shown\n",
+			ls->nr_invalid);
+
+	while (!RB_EMPTY_ROOT(&ls->tasks)) {
+		n = rb_first(&ls->tasks);
+		rb_erase(n, &ls->tasks);
+
+		t = rb_entry(n, struct live_stream_task, node);
+		free(t->recs);
+		free(t->entry_time);
+		free(t);
+	}
+	free(ls->heap);
+
+	delete_sessions(&ls->sessions);
+
+	pthread_mutex_unlock(&ls->lock);
+	pthread_mutex_destroy(&ls->lock);
+}
+
+#ifdef UNIT_TEST
+
+#define STREAM_REC(_time, _type, _depth, _addr)			\
+	{ .time = _time, .type = _type, .magic = RECORD_MAGIC,	\
+	  .depth = _depth, .addr = _addr, }
+
+TEST_CASE(live_stream_reorder)
+{
+	struct live_stream ls;
+	struct opts opts = {
+		.dirname = "unittest",
+		.stream_window = 100,
+		.comment = true,
+	};
+	struct uftrace_record task1[] = {
+		STREAM_REC(1000, UFTRACE_ENTRY, 0, 0x1000),
+		STREAM_REC(1100, UFTRACE_ENTRY, 1, 0x1100),
+		STREAM_REC(1150, UFTRACE_EXIT,  1, 0x1100),
+		STREAM_REC(1400, UFTRACE_EXIT,  0, 0x1000),
+	};
+	struct uftrace_record task2[] = {
+		STREAM_REC(1200, UFTRACE_ENTRY, 0, 0x2000),
+		STREAM_REC(1300, UFTRACE_EXIT,  0, 0x2000),
+	};
+	struct uftrace_record task3[] = {
+		STREAM_REC(1050, UFTRACE_ENTRY, 0, 0x3000),
+		STREAM_REC(1060, UFTRACE_EXIT,  0, 0x3000),
+	};
+	const char expected[] =
+		"# DURATION     TID     FUNCTION\n"
+		"            [     1] | <1000>() {\n"
+		"   0.050 us [     1] |   <1100>();\n"
+		"   0.100 us [     2] | <2000>();\n"
+		"   0.010 us [     3] | <3000>();\n"
+		"   0.400 us [     1] | } /* <1000> */\n";
+	FILE *fp, *old_outfp = outfp;
+	int old_color = out_color;
+	char *str = NULL;
+	size_t len = 0;
+
+	fp = open_memstream(&str, &len);
+	TEST_NE(fp, NULL);
+	outfp = fp;
+	out_color = COLOR_OFF;
+
+	live_stream_init(&ls, &opts);
+
+	/* task 1 sent the first 3 records only */
+	live_stream_add(&ls, 1, task1, 3 * sizeof(*task1));
+	live_stream_add(&ls, 2, task2, sizeof(task2));
+	TEST_EQ(ls.nr_pending, 5);
+
+	/* the window is not passed yet */
+	TEST_EQ(flush_stream(&ls, 1050), 0);
+
+	/* 1st and 2nd records (with the leaf exit) of task 1 are printed */
+	TEST_EQ(flush_stream(&ls, 1250), 2);
+	TEST_EQ(ls.nr_pending, 2);
+
+	/* task 2 is printed (leaf) and waits for the exit of task 1 */
+	TEST_EQ(flush_stream(&ls, 1500), 1);
+	TEST_EQ(ls.nr_pending, 0);
+	TEST_EQ(ls.nr_late, 0);
+
+	/* task 3 comes after the window */
+	live_stream_add(&ls, 3, task3, sizeof(task3));
+	live_stream_add(&ls, 1, &task1[3], sizeof(*task1));
+	TEST_EQ(flush_stream(&ls, 1500), 2);
+	TEST_EQ(ls.nr_late, 1);
+
+	live_stream_finish(&ls);
+
+	fflush(fp);
+	outfp = old_outfp;
+	out_color = old_color;
+
+	TEST_STREQ(expected, str);
+
+	fclose(fp);
+	free(str);
+	return TEST_OK;
+}
+
+#endif /* UNIT_TEST */
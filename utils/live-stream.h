@@ -0,0 +1,63 @@
+#ifndef UFTRACE_LIVE_STREAM_H
+#define UFTRACE_LIVE_STREAM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "uftrace.h"
+#include "utils/utils.h"
+#include "utils/rbtree.h"
+
+#define LIVE_STREAM_WINDOW       (100 * NSEC_PER_MSEC)
+#define LIVE_STREAM_MAX_PENDING  (1024 * 1024)  /* records */
+
+/* records of a task waiting to be printed (in FIFO order) */
+struct live_stream_task {
+	struct rb_node node;
+	int tid;
+	int depth;                      /* current (display) depth */
+	unsigned head, tail, alloc;
+	struct uftrace_record *recs;
+	uint64_t last_time;             /* for LOST records without time */
+	int nr_stack;
+	uint64_t *entry_time;           /* entry timestamp of each depth */
+};
+
+/*
+ * An incremental replay of the buffers consumed by the recorder.  The
+ * records are kept in per-task queues and printed in time order once
+ * they're older than the reorder window.  A record arriving later than
+ * that will be printed as soon as possible (out of order).
+ */
+struct live_stream {
+	pthread_mutex_t lock;
+	struct uftrace_session_link sessions;
+	struct rb_root tasks;
+	/* min-heap of tasks with pending records (by the first record time) */
+	struct live_stream_task **heap;
+	int nr_heap;
+	int heap_alloc;
+	char *dirname;
+	uint64_t window;
+	uint64_t last_time;             /* timestamp of the last printed record */
+	uint64_t nr_pending;
+	uint64_t nr_late;               /* records printed out of order */
+	uint64_t nr_invalid;            /* records cannot be parsed */
+	bool header_done;
+	bool no_merge;
+	bool comment;
+};
+
+void live_stream_init(struct live_stream *ls, struct opts *opts);
+void live_stream_session(struct live_stream *ls, struct uftrace_msg_sess *smsg,
+			 char *exename);
+void live_stream_task(struct live_stream *ls, struct uftrace_msg_task *tmsg,
+		      bool fork);
+void live_stream_dlopen(struct live_stream *ls, struct uftrace_msg_dlopen *dmsg,
+			char *libname);
+void live_stream_add(struct live_stream *ls, int tid, void *data, size_t size);
+int live_stream_update(struct live_stream *ls);
+void live_stream_finish(struct live_stream *ls);
+
+#endif /* UFTRACE_LIVE_STREAM_H */
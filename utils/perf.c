@@ -322,10 +322,16 @@ again:
 		h.size = bswap_16(h.size);
 	}
 
+	/* it cannot skip a broken record as the size is not known */
+	if (h.size < sizeof(h))
+		goto invalid;
+
 	len = h.size - sizeof(h);
 
 	switch (h.type) {
 	case PERF_RECORD_SWITCH:
+		if (len > sizeof(u.cs))
+			goto invalid;
 		if (fread(&u.cs, len, 1, perf->fp) != 1)
 			return -1;
 
@@ -342,6 +348,8 @@ again:
 
 	case PERF_RECORD_FORK:
 	case PERF_RECORD_EXIT:
+		if (len > sizeof(u.t))
+			goto invalid;
 		if (fread(&u.t, len, 1, perf->fp) != 1)
 			return -1;
 
@@ -361,7 +369,11 @@ again:
 
 	case PERF_RECORD_COMM:
 		/* length of comm event is variable */
+		if (len < sizeof(u.c.sample_id))
+			goto invalid;
 		comm_len = ALIGN(len - sizeof(u.c.sample_id), 8);
+		if (comm_len > (int)offsetof(struct perf_comm_event, sample_id))
+			goto invalid;
 		if (fread(&u.c, comm_len, 1, perf->fp) != 1)
 			return -1;
 
@@ -400,6 +412,31 @@ again:
 	perf->type = h.type;
 	perf->valid = true;
 	return 0;
+
+invalid:
+	pr_warn("invalid perf event: type %u, size %u\n", h.type, h.size);
+	perf->done = true;
+	return -1;
+}
+
+/**
+ * read_perf_cpu_data - read perf event data of a cpu
+ * @handle: uftrace data file handle
+ * @idx: index of the perf cpu data
+ *
+ * This function reads next perf event of @idx-th cpu data file if it's
+ * not read yet.  It returns 0 if the event is valid, -1 if it's done.
+ */
+int read_perf_cpu_data(struct ftrace_file_handle *handle, int idx)
+{
+	struct uftrace_perf_reader *perf = &handle->perf[idx];
+
+	if (perf->done)
+		return -1;
+	if (!perf->valid)
+		return read_perf_event(handle, perf);
+
+	return 0;
 }
 
 /**
@@ -423,12 +460,8 @@ int read_perf_data(struct ftrace_file_handle *handle)
 	for (i = 0; i < handle->nr_perf; i++) {
 		perf = &handle->perf[i];
 
-		if (perf->done)
+		if (read_perf_cpu_data(handle, i) < 0)
 			continue;
-		if (!perf->valid) {
-			if (read_perf_event(handle, perf) < 0)
-				continue;
-		}
 
 		if (perf->time < min_time) {
 			min_time = perf->time;
@@ -488,6 +521,56 @@ struct uftrace_record * get_perf_record(struct ftrace_file_handle *handle,
 	return &rec;
 }
 
+/**
+ * has_perf_sched_event - check if perf data has any schedule event
+ * @handle: uftrace data file handle
+ *
+ * This function checks the event types in the perf data files without
+ * changing the file positions.  The perf data always has task and comm
+ * events but the schedule (context switch) events are recorded only if
+ * it's requested.  Only schedule events are shown with user functions.
+ */
+bool has_perf_sched_event(struct ftrace_file_handle *handle)
+{
+	struct perf_event_header h;
+	bool found = false;
+	long pos;
+	int i;
+
+	for (i = 0; i < handle->nr_perf && !found; i++) {
+		FILE *fp = handle->perf[i].fp;
+
+		if (fp == NULL)
+			continue;
+
+		pos = ftell(fp);
+
+		while (fread(&h, sizeof(h), 1, fp) == 1) {
+			if (handle->needs_byte_swap) {
+				h.type = bswap_32(h.type);
+				h.size = bswap_16(h.size);
+			}
+
+			if (h.type == PERF_RECORD_SWITCH) {
+				found = true;
+				break;
+			}
+
+			/* broken data, it would go back (or stay) forever */
+			if (h.size < sizeof(h))
+				break;
+
+			if (fseek(fp, h.size - sizeof(h), SEEK_CUR) < 0)
+				break;
+		}
+
+		clearerr(fp);
+		fseek(fp, pos, SEEK_SET);
+	}
+
+	return found;
+}
+
 /**
  * update_perf_task_comm - read perf event data and update task's comm
  * @handle: uftrace data file handle
@@ -519,3 +602,34 @@ void update_perf_task_comm(struct ftrace_file_handle *handle)
 		}
 	}
 }
+
+#ifdef UNIT_TEST
+TEST_CASE(perf_broken_event)
+{
+	struct ftrace_file_handle handle = {};
+	struct uftrace_perf_reader perf = {};
+	struct perf_event_header h = {
+		.type = PERF_RECORD_COMM,
+		.size = 0,   /* it would seek back to the header forever */
+	};
+
+	perf.fp = tmpfile();
+	TEST_NE(perf.fp, NULL);
+	TEST_EQ(fwrite(&h, sizeof(h), 1, perf.fp), (size_t)1);
+	rewind(perf.fp);
+
+	handle.perf = &perf;
+	handle.nr_perf = 1;
+
+	pr_dbg("checking schedule events in broken data\n");
+	TEST_EQ(has_perf_sched_event(&handle), false);
+	TEST_EQ(ftell(perf.fp), 0);
+
+	pr_dbg("reading broken perf event\n");
+	TEST_EQ(read_perf_event(&handle, &perf), -1);
+	TEST_EQ(perf.done, true);
+
+	fclose(perf.fp);
+	return TEST_OK;
+}
+#endif /* UNIT_TEST */
@@ -124,8 +124,10 @@ struct uftrace_record;
 int setup_perf_data(struct ftrace_file_handle *handle);
 void finish_perf_data(struct ftrace_file_handle *handle);
 int read_perf_data(struct ftrace_file_handle *handle);
+int read_perf_cpu_data(struct ftrace_file_handle *handle, int idx);
 struct uftrace_record * get_perf_record(struct ftrace_file_handle *handle,
 					struct uftrace_perf_reader *perf);
 void update_perf_task_comm(struct ftrace_file_handle *handle);
+bool has_perf_sched_event(struct ftrace_file_handle *handle);
 
 #endif /* UFTRACE_PERF_H */
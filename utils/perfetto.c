@@ -0,0 +1,181 @@
+/*
+ * Small protobuf encoder to write Perfetto traces
+ *
+ * The Perfetto trace is a sequence of TracePacket messages.  Messages are
+ * encoded into a growable buffer and nested messages reserve a fixed size
+ * (redundant) varint for the length so that it can be patched after the
+ * contents are written, without an extra copy.
+ *
+ * Released under the GPL v2.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "utils/utils.h"
+#include "utils/perfetto.h"
+
+/* bytes reserved for the length of a nested message */
+#define PB_NESTED_LEN_SIZE  4
+
+enum pb_wire_type {
+	PB_WIRE_VARINT		= 0,
+	PB_WIRE_LENGTH		= 2,
+};
+
+static void pb_reserve(struct perfetto_buf *buf, size_t len)
+{
+	if (buf->len + len <= buf->size)
+		return;
+
+	buf->size = ALIGN(buf->len + len, 4096) * 2;
+	buf->data = xrealloc(buf->data, buf->size);
+}
+
+void perfetto_buf_reset(struct perfetto_buf *buf)
+{
+	buf->len = 0;
+}
+
+void perfetto_buf_free(struct perfetto_buf *buf)
+{
+	free(buf->data);
+	buf->data = NULL;
+	buf->len = buf->size = 0;
+}
+
+void pb_add_varint(struct perfetto_buf *buf, uint64_t val)
+{
+	pb_reserve(buf, 10);
+
+	while (val >= 0x80) {
+		buf->data[buf->len++] = (val & 0x7f) | 0x80;
+		val >>= 7;
+	}
+	buf->data[buf->len++] = val;
+}
+
+static void pb_add_tag(struct perfetto_buf *buf, int field,
+		       enum pb_wire_type type)
+{
+	pb_add_varint(buf, ((uint64_t)field << 3) | type);
+}
+
+void pb_add_uint(struct perfetto_buf *buf, int field, uint64_t val)
+{
+	pb_add_tag(buf, field, PB_WIRE_VARINT);
+	pb_add_varint(buf, val);
+}
+
+void pb_add_bytes(struct perfetto_buf *buf, int field,
+		  const void *data, size_t len)
+{
+	pb_add_tag(buf, field, PB_WIRE_LENGTH);
+	pb_add_varint(buf, len);
+
+	pb_reserve(buf, len);
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+}
+
+void pb_add_string(struct perfetto_buf *buf, int field, const char *str)
+{
+	pb_add_bytes(buf, field, str, strlen(str));
+}
+
+/**
+ * pb_begin - start a nested message
+ * @buf: buffer to write
+ * @field: field number of the message
+ *
+ * This function returns the position of the message contents which
+ * should be passed to pb_end() after writing the contents.
+ */
+size_t pb_begin(struct perfetto_buf *buf, int field)
+{
+	pb_add_tag(buf, field, PB_WIRE_LENGTH);
+
+	pb_reserve(buf, PB_NESTED_LEN_SIZE);
+	buf->len += PB_NESTED_LEN_SIZE;
+
+	return buf->len;
+}
+
+/**
+ * pb_end - finish a nested message
+ * @buf: buffer to write
+ * @pos: return value of the matching pb_begin()
+ *
+ * This function writes the length of the message contents in the space
+ * reserved by pb_begin().  Most messages (for each record) are small so
+ * the contents are moved to use a single byte length.  Otherwise the
+ * length is encoded as a varint padded to the fixed size which is still
+ * valid for protobuf decoders.
+ */
+void pb_end(struct perfetto_buf *buf, size_t pos)
+{
+	size_t len = buf->len - pos;
+	unsigned char *p = buf->data + pos - PB_NESTED_LEN_SIZE;
+	int i;
+
+	assert(len < (1UL << (7 * PB_NESTED_LEN_SIZE)));
+
+	if (len < 0x80) {
+		p[0] = len;
+		memmove(p + 1, p + PB_NESTED_LEN_SIZE, len);
+		buf->len -= PB_NESTED_LEN_SIZE - 1;
+		return;
+	}
+
+	for (i = 0; i < PB_NESTED_LEN_SIZE - 1; i++) {
+		p[i] = (len & 0x7f) | 0x80;
+		len >>= 7;
+	}
+	p[i] = len;
+}
+
+#ifdef UNIT_TEST
+TEST_CASE(perfetto_encode)
+{
+	struct perfetto_buf buf = {};
+	size_t pos;
+	int i;
+	unsigned char varint[] = { 0xac, 0x02 };
+	unsigned char packet[] = {
+		0x0a, 0x0a,				/* packet (len = 10) */
+		0x40, 0x96, 0x01,			/* timestamp = 150 */
+		0x50, 0x01,				/* sequence id = 1 */
+		0x12, 0x03, 'f', 'o', 'o',		/* name = "foo" */
+	};
+	unsigned char large[] = { 0x0a, 0x80, 0x80, 0x81, 0x00 };
+
+	pb_add_varint(&buf, 300);
+	TEST_EQ(buf.len, sizeof(varint));
+	TEST_MEMEQ(buf.data, varint, sizeof(varint));
+
+	perfetto_buf_reset(&buf);
+	TEST_EQ(buf.len, 0);
+
+	pos = pb_begin(&buf, PF_TRACE_PACKET);
+	pb_add_uint(&buf, PF_PACKET_TIMESTAMP, 150);
+	pb_add_uint(&buf, PF_PACKET_SEQUENCE_ID, 1);
+	pb_add_string(&buf, PF_TRACK_NAME, "foo");
+	pb_end(&buf, pos);
+
+	TEST_EQ(buf.len, sizeof(packet));
+	TEST_MEMEQ(buf.data, packet, sizeof(packet));
+
+	/* the buffer should grow for large data (len = 16384) */
+	perfetto_buf_reset(&buf);
+	pos = pb_begin(&buf, PF_TRACE_PACKET);
+	for (i = 0; i < 4096; i++)
+		pb_add_uint(&buf, PF_PACKET_SEQUENCE_ID, 1 << 14);
+	pb_end(&buf, pos);
+
+	TEST_EQ(buf.len, sizeof(large) + 4096 * 4);
+	TEST_MEMEQ(buf.data, large, sizeof(large));
+
+	perfetto_buf_free(&buf);
+	return TEST_OK;
+}
+#endif /* UNIT_TEST */
@@ -0,0 +1,104 @@
+#ifndef UFTRACE_PERFETTO_H
+#define UFTRACE_PERFETTO_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * A minimal protobuf encoder for the Perfetto trace format.
+ * Only the (wire) types used by the trace writer are supported:
+ * varint (type 0) and length-delimited (type 2) fields.
+ */
+struct perfetto_buf {
+	unsigned char	*data;
+	size_t		len;
+	size_t		size;
+};
+
+/* field numbers in the Perfetto protos (perfetto/trace/...) */
+enum perfetto_field {
+	/* Trace */
+	PF_TRACE_PACKET			= 1,
+
+	/* TracePacket */
+	PF_PACKET_CLOCK_SNAPSHOT	= 6,
+	PF_PACKET_TIMESTAMP		= 8,
+	PF_PACKET_SEQUENCE_ID		= 10,
+	PF_PACKET_TRACK_EVENT		= 11,
+	PF_PACKET_INTERNED_DATA		= 12,
+	PF_PACKET_SEQUENCE_FLAGS	= 13,
+	PF_PACKET_TIMESTAMP_CLOCK_ID	= 58,
+	PF_PACKET_DEFAULTS		= 59,
+	PF_PACKET_TRACK_DESCRIPTOR	= 60,
+
+	/* ClockSnapshot */
+	PF_CLOCK_SNAPSHOT_CLOCKS	= 1,
+	PF_CLOCK_SNAPSHOT_PRIMARY	= 2,
+	/* ClockSnapshot.Clock */
+	PF_CLOCK_ID			= 1,
+	PF_CLOCK_TIMESTAMP		= 2,
+	PF_CLOCK_IS_INCREMENTAL		= 3,
+
+	/* TracePacketDefaults */
+	PF_DEFAULTS_TRACK_EVENT		= 11,
+	PF_DEFAULTS_TIMESTAMP_CLOCK_ID	= 58,
+	/* TrackEventDefaults */
+	PF_TRACK_EVENT_DEFAULTS_UUID	= 11,
+
+	/* TrackDescriptor */
+	PF_TRACK_UUID			= 1,
+	PF_TRACK_NAME			= 2,
+	PF_TRACK_PROCESS		= 3,
+	PF_TRACK_THREAD			= 4,
+	PF_TRACK_PARENT_UUID		= 5,
+	/* ProcessDescriptor */
+	PF_PROCESS_PID			= 1,
+	PF_PROCESS_NAME			= 6,
+	/* ThreadDescriptor */
+	PF_THREAD_PID			= 1,
+	PF_THREAD_TID			= 2,
+	PF_THREAD_NAME			= 5,
+
+	/* TrackEvent */
+	PF_TRACK_EVENT_DEBUG_ANNOTATION	= 4,
+	PF_TRACK_EVENT_TYPE		= 9,
+	PF_TRACK_EVENT_NAME_IID		= 10,
+	PF_TRACK_EVENT_TRACK_UUID	= 11,
+	/* DebugAnnotation */
+	PF_ANNOTATION_STRING_VALUE	= 6,
+	PF_ANNOTATION_NAME		= 10,
+
+	/* InternedData */
+	PF_INTERNED_EVENT_NAMES		= 2,
+	/* EventName */
+	PF_EVENT_NAME_IID		= 1,
+	PF_EVENT_NAME_NAME		= 2,
+};
+
+/* TrackEvent.Type */
+enum perfetto_event_type {
+	PERFETTO_SLICE_BEGIN		= 1,
+	PERFETTO_SLICE_END		= 2,
+	PERFETTO_INSTANT		= 3,
+};
+
+/* TracePacket.SequenceFlags */
+#define PERFETTO_SEQ_INCREMENTAL_STATE_CLEARED  1
+#define PERFETTO_SEQ_NEEDS_INCREMENTAL_STATE    2
+
+/* builtin clock ids and the first sequence-scoped clock id */
+#define PERFETTO_CLOCK_MONOTONIC  3
+#define PERFETTO_CLOCK_SEQUENCE   64
+
+void perfetto_buf_reset(struct perfetto_buf *buf);
+void perfetto_buf_free(struct perfetto_buf *buf);
+
+void pb_add_varint(struct perfetto_buf *buf, uint64_t val);
+void pb_add_uint(struct perfetto_buf *buf, int field, uint64_t val);
+void pb_add_bytes(struct perfetto_buf *buf, int field,
+		  const void *data, size_t len);
+void pb_add_string(struct perfetto_buf *buf, int field, const char *str);
+size_t pb_begin(struct perfetto_buf *buf, int field);
+void pb_end(struct perfetto_buf *buf, size_t pos);
+
+#endif /* UFTRACE_PERFETTO_H */
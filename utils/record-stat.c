@@ -0,0 +1,464 @@
+/*
+ * Statistics of the recorder itself (to tune the buffer size and writers)
+ *
+ * The recorder samples its counters every RECORD_STAT_INTERVAL and appends
+ * them to the recorder.stats file in the data directory.  It's a text file
+ * so that it can be read with usual tools as well as 'uftrace info'.
+ *
+ * Released under the GPL v2.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "uftrace.h"
+#include "utils/utils.h"
+#include "utils/record-stat.h"
+
+uint64_t record_stat_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* bucket 0 is for 0, and bucket N (N > 0) is for [2^(N-1), 2^N) */
+int record_stat_hist_idx(uint64_t val)
+{
+	int idx;
+
+	if (val == 0)
+		return 0;
+
+	idx = 64 - __builtin_clzll(val);
+	if (idx >= RECORD_STAT_HIST)
+		idx = RECORD_STAT_HIST - 1;
+
+	return idx;
+}
+
+/* returns the bucket index which contains given percentile */
+int record_stat_percentile(uint64_t *hist, int percent)
+{
+	uint64_t total = 0;
+	uint64_t sum = 0;
+	int i;
+
+	for (i = 0; i < RECORD_STAT_HIST; i++)
+		total += hist[i];
+
+	if (total == 0)
+		return 0;
+
+	for (i = 0; i < RECORD_STAT_HIST; i++) {
+		sum += hist[i];
+		if (sum * 100 >= total * percent)
+			break;
+	}
+
+	return i;
+}
+
+static struct record_stat_task *get_stat_task(struct record_stat *rs, int tid)
+{
+	struct rb_node *parent = NULL;
+	struct rb_node **p = &rs->tasks.rb_node;
+	struct record_stat_task *t;
+
+	while (*p) {
+		parent = *p;
+		t = rb_entry(parent, struct record_stat_task, node);
+
+		if (t->tid == tid)
+			return t;
+
+		if (t->tid > tid)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+
+	t = xzalloc(sizeof(*t));
+	t->tid = tid;
+
+	rb_link_node(&t->node, parent, p);
+	rb_insert_color(&t->node, &rs->tasks);
+	return t;
+}
+
+static void print_live_header(void)
+{
+	fprintf(stderr, "%8s %8s %8s %8s %8s %8s %6s %6s\n",
+		"TIME(s)", "RECV/s", "WRITE/s", "REUSE/s", "LOST/s",
+		"MB/s", "QUEUE", "SHM");
+}
+
+void record_stat_init(struct record_stat *rs, const char *dirname, bool live)
+{
+	char *filename = NULL;
+
+	memset(rs, 0, sizeof(*rs));
+	rs->tasks = RB_ROOT;
+	rs->live = live;
+	rs->start = record_stat_now();
+	rs->next = rs->start + RECORD_STAT_INTERVAL * NSEC_PER_MSEC;
+
+	xasprintf(&filename, "%s/%s", dirname, RECORD_STAT_FILE);
+	rs->fp = fopen(filename, "w");
+	if (rs->fp == NULL)
+		pr_warn("cannot open %s: %m\n", filename);
+	else {
+		fprintf(rs->fp, "# uftrace recorder statistics "
+			"(interval: %d msec)\n", RECORD_STAT_INTERVAL);
+		fprintf(rs->fp, "# sample: TIME RECV WRITTEN REUSED LOST "
+			"BYTES QUEUED SHM\n");
+	}
+	free(filename);
+
+	if (live)
+		print_live_header();
+}
+
+/* called by the main thread when libmcount starts to use a buffer */
+void record_stat_start(struct record_stat *rs, int tid, int seq)
+{
+	struct record_stat_task *t = get_stat_task(rs, tid);
+
+	/* libmcount always uses the first available buffer */
+	if (seq < t->nr_shm)
+		return;
+
+	rs->nr_shm += seq + 1 - t->nr_shm;
+	t->nr_shm = seq + 1;
+
+	if (rs->nr_shm > rs->max_shm)
+		rs->max_shm = rs->nr_shm;
+}
+
+/* called by the main thread when a buffer is passed to writers */
+void record_stat_recv(struct record_stat *rs, int tid, int seq)
+{
+	struct record_stat_task *t = get_stat_task(rs, tid);
+
+	rs->total.recv++;
+
+	if (seq < t->nr_recv) {
+		rs->total.reused++;
+		return;
+	}
+
+	t->nr_recv = seq + 1;
+
+	/* old libmcount might not send the start message */
+	record_stat_start(rs, tid, seq);
+}
+
+/* libmcount releases the shmem buffers when a task exits */
+void record_stat_task_end(struct record_stat *rs, int tid)
+{
+	struct record_stat_task *t = get_stat_task(rs, tid);
+
+	if (t->exited)
+		return;
+
+	rs->nr_shm -= t->nr_shm;
+	t->exited = true;
+}
+
+void record_stat_lost(struct record_stat *rs, int tid, int lost)
+{
+	rs->total.lost += lost;
+
+	/* old libmcount might not send the tid */
+	if (tid > 0)
+		get_stat_task(rs, tid)->lost += lost;
+}
+
+void record_stat_enqueue(struct record_stat *rs)
+{
+	int depth = __sync_add_and_fetch(&rs->queued, 1);
+
+	if (depth > rs->max_queued)
+		rs->max_queued = depth;
+
+	rs->queue_hist[record_stat_hist_idx(depth)]++;
+}
+
+/* called by writer threads, start is the time it was enqueued */
+void record_stat_write(struct record_stat *rs, uint64_t size, uint64_t start)
+{
+	uint64_t usec = (record_stat_now() - start) / NSEC_PER_USEC;
+
+	__sync_sub_and_fetch(&rs->queued, 1);
+	__sync_add_and_fetch(&rs->total.written, 1);
+	__sync_add_and_fetch(&rs->total.bytes, size);
+	__sync_add_and_fetch(&rs->latency_hist[record_stat_hist_idx(usec)], 1);
+}
+
+static void write_sample(struct record_stat *rs, uint64_t now)
+{
+	struct record_stat_count curr;
+	uint64_t interval;
+	int queued = rs->queued;
+
+	/* writers might update the counts concurrently */
+	curr.recv    = rs->total.recv;
+	curr.written = __sync_add_and_fetch(&rs->total.written, 0);
+	curr.reused  = rs->total.reused;
+	curr.lost    = rs->total.lost;
+	curr.bytes   = __sync_add_and_fetch(&rs->total.bytes, 0);
+
+	interval = now - (rs->start + rs->elapsed);
+	if (interval == 0)
+		interval = 1;
+
+	if ((curr.bytes - rs->last.bytes) * NSEC_PER_SEC / interval > rs->max_bytes)
+		rs->max_bytes = (curr.bytes - rs->last.bytes) * NSEC_PER_SEC / interval;
+
+	rs->elapsed = now - rs->start;
+	rs->nr_sample++;
+
+	if (rs->fp) {
+		fprintf(rs->fp, "sample: %"PRIu64".%03"PRIu64" %"PRIu64" %"PRIu64
+			" %"PRIu64" %"PRIu64" %"PRIu64" %d %d\n",
+			rs->elapsed / NSEC_PER_SEC,
+			(rs->elapsed % NSEC_PER_SEC) / NSEC_PER_MSEC,
+			curr.recv - rs->last.recv,
+			curr.written - rs->last.written,
+			curr.reused - rs->last.reused,
+			curr.lost - rs->last.lost,
+			curr.bytes - rs->last.bytes,
+			queued, rs->nr_shm);
+		fflush(rs->fp);
+	}
+
+	if (rs->live) {
+		double sec = (double)interval / NSEC_PER_SEC;
+
+		fprintf(stderr, "%8.3f %8.0f %8.0f %8.0f %8.0f %8.2f %6d %6d\n",
+			(double)rs->elapsed / NSEC_PER_SEC,
+			(curr.recv - rs->last.recv) / sec,
+			(curr.written - rs->last.written) / sec,
+			(curr.reused - rs->last.reused) / sec,
+			(curr.lost - rs->last.lost) / sec,
+			(curr.bytes - rs->last.bytes) / sec / (1024 * 1024),
+			queued, rs->nr_shm);
+	}
+
+	rs->last = curr;
+}
+
+/* take a sample if needed and return msec until the next sample */
+int record_stat_update(struct record_stat *rs)
+{
+	uint64_t now = record_stat_now();
+
+	if (now >= rs->next) {
+		write_sample(rs, now);
+
+		while (rs->next <= now)
+			rs->next += RECORD_STAT_INTERVAL * NSEC_PER_MSEC;
+	}
+
+	return DIV_ROUND_UP(rs->next - now, NSEC_PER_MSEC);
+}
+
+static void write_hist(FILE *fp, const char *name, uint64_t *hist)
+{
+	int i;
+
+	fprintf(fp, "%s:", name);
+	for (i = 0; i < RECORD_STAT_HIST; i++)
+		fprintf(fp, " %"PRIu64, hist[i]);
+	fprintf(fp, "\n");
+}
+
+void record_stat_finish(struct record_stat *rs)
+{
+	struct rb_node *node;
+	struct record_stat_task *t;
+
+	/* the last (partial) interval */
+	write_sample(rs, record_stat_now());
+
+	if (rs->fp) {
+		for (node = rb_first(&rs->tasks); node; node = rb_next(node)) {
+			t = rb_entry(node, struct record_stat_task, node);
+			fprintf(rs->fp, "task: %d %d %"PRIu64"\n",
+				t->tid, t->nr_shm, t->lost);
+		}
+
+		fprintf(rs->fp, "max_queue: %d\n", rs->max_queued);
+		fprintf(rs->fp, "max_shm: %d\n", rs->max_shm);
+		write_hist(rs->fp, "queue", rs->queue_hist);
+		write_hist(rs->fp, "latency", rs->latency_hist);
+		fclose(rs->fp);
+		rs->fp = NULL;
+	}
+
+	free_record_stat(rs);
+}
+
+static void read_hist(char *str, uint64_t *hist)
+{
+	char *pos = str;
+	char *end;
+	int i;
+
+	for (i = 0; i < RECORD_STAT_HIST; i++) {
+		hist[i] = strtoull(pos, &end, 10);
+		if (pos == end)
+			break;
+		pos = end;
+	}
+}
+
+int read_record_stat(struct record_stat *rs, const char *dirname)
+{
+	FILE *fp;
+	char *filename = NULL;
+	char *line = NULL;
+	size_t len = 0;
+	uint64_t prev = 0;
+
+	xasprintf(&filename, "%s/%s", dirname, RECORD_STAT_FILE);
+	fp = fopen(filename, "r");
+	free(filename);
+
+	if (fp == NULL)
+		return -1;
+
+	memset(rs, 0, sizeof(*rs));
+	rs->tasks = RB_ROOT;
+
+	while (getline(&line, &len, fp) >= 0) {
+		struct record_stat_count c;
+		struct record_stat_task *t;
+		unsigned long sec, msec;
+		int tid, nr_shm, queued;
+		uint64_t lost;
+		uint64_t now;
+
+		if (line[0] == '#')
+			continue;
+
+		if (sscanf(line, "sample: %lu.%lu %"SCNu64" %"SCNu64" %"SCNu64
+			   " %"SCNu64" %"SCNu64" %d %d", &sec, &msec,
+			   &c.recv, &c.written, &c.reused, &c.lost, &c.bytes,
+			   &queued, &nr_shm) == 9) {
+			now = sec * NSEC_PER_SEC + msec * NSEC_PER_MSEC;
+
+			rs->total.recv    += c.recv;
+			rs->total.written += c.written;
+			rs->total.reused  += c.reused;
+			rs->total.lost    += c.lost;
+			rs->total.bytes   += c.bytes;
+
+			if (now > prev &&
+			    c.bytes * NSEC_PER_SEC / (now - prev) > rs->max_bytes)
+				rs->max_bytes = c.bytes * NSEC_PER_SEC / (now - prev);
+
+			if (queued > rs->max_queued)
+				rs->max_queued = queued;
+			if (nr_shm > rs->max_shm)
+				rs->max_shm = nr_shm;
+
+			rs->elapsed = prev = now;
+			rs->nr_sample++;
+		}
+		else if (sscanf(line, "task: %d %d %"SCNu64,
+				&tid, &nr_shm, &lost) == 3) {
+			t = get_stat_task(rs, tid);
+			t->nr_shm = nr_shm;
+			t->lost = lost;
+		}
+		else if (sscanf(line, "max_queue: %d", &queued) == 1)
+			rs->max_queued = queued;
+		else if (sscanf(line, "max_shm: %d", &nr_shm) == 1)
+			rs->max_shm = nr_shm;
+		else if (!strncmp(line, "queue:", 6))
+			read_hist(line + 6, rs->queue_hist);
+		else if (!strncmp(line, "latency:", 8))
+			read_hist(line + 8, rs->latency_hist);
+	}
+
+	free(line);
+	fclose(fp);
+	return 0;
+}
+
+void free_record_stat(struct record_stat *rs)
+{
+	struct rb_node *node;
+	struct record_stat_task *t;
+
+	while (!RB_EMPTY_ROOT(&rs->tasks)) {
+		node = rb_first(&rs->tasks);
+		rb_erase(node, &rs->tasks);
+
+		t = rb_entry(node, struct record_stat_task, node);
+		free(t);
+	}
+}
+
+#ifdef UNIT_TEST
+TEST_CASE(record_stat_histogram)
+{
+	uint64_t hist[RECORD_STAT_HIST] = { 0, };
+	int i;
+
+	TEST_EQ(record_stat_hist_idx(0), 0);
+	TEST_EQ(record_stat_hist_idx(1), 1);
+	TEST_EQ(record_stat_hist_idx(2), 2);
+	TEST_EQ(record_stat_hist_idx(3), 2);
+	TEST_EQ(record_stat_hist_idx(1024), 11);
+	TEST_EQ(record_stat_hist_idx(-1ULL), RECORD_STAT_HIST - 1);
+
+	TEST_EQ(record_stat_percentile(hist, 50), 0);
+
+	for (i = 1; i <= 100; i++)
+		hist[record_stat_hist_idx(i)]++;
+
+	/* 1, 2-3, 4-7, 8-15, 16-31, 32-63, 64-127 */
+	TEST_EQ(record_stat_percentile(hist, 50), 6);
+	TEST_EQ(record_stat_percentile(hist, 10), 4);
+	TEST_EQ(record_stat_percentile(hist, 100), 7);
+
+	return TEST_OK;
+}
+
+TEST_CASE(record_stat_shmem)
+{
+	struct record_stat rs = { .tasks = RB_ROOT, };
+
+	pr_dbg("two tasks use 3 buffers\n");
+	record_stat_start(&rs, 1, 0);
+	record_stat_start(&rs, 1, 1);
+	record_stat_start(&rs, 2, 0);
+	TEST_EQ(rs.nr_shm, 3);
+
+	record_stat_recv(&rs, 1, 0);
+	record_stat_start(&rs, 1, 0);
+	record_stat_recv(&rs, 1, 1);
+	record_stat_recv(&rs, 2, 0);
+	record_stat_recv(&rs, 1, 0);
+	TEST_EQ(rs.nr_shm, 3);
+	TEST_EQ(rs.total.reused, (uint64_t)1);
+
+	pr_dbg("buffers are released when a task exits\n");
+	record_stat_task_end(&rs, 1);
+	record_stat_task_end(&rs, 1);
+	TEST_EQ(rs.nr_shm, 1);
+
+	/* without the start message */
+	record_stat_recv(&rs, 3, 0);
+	TEST_EQ(rs.nr_shm, 2);
+	TEST_EQ(rs.max_shm, 3);
+
+	free_record_stat(&rs);
+	return TEST_OK;
+}
+#endif /* UNIT_TEST */
@@ -0,0 +1,69 @@
+#ifndef UFTRACE_RECORD_STAT_H
+#define UFTRACE_RECORD_STAT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "utils/rbtree.h"
+
+#define RECORD_STAT_FILE      "recorder.stats"
+#define RECORD_STAT_INTERVAL  1000  /* msec */
+#define RECORD_STAT_HIST      20    /* number of (log2) histogram buckets */
+
+struct record_stat_count {
+	uint64_t recv;     /* buffers received from libmcount */
+	uint64_t written;  /* buffers written to disk (or sent) */
+	uint64_t reused;   /* received buffers which were used before */
+	uint64_t lost;     /* records lost in libmcount */
+	uint64_t bytes;    /* bytes written */
+};
+
+/* per-task statistics */
+struct record_stat_task {
+	struct rb_node node;
+	int tid;
+	int nr_shm;        /* shmem buffers created by the task */
+	int nr_recv;       /* buffers received at least once */
+	bool exited;
+	uint64_t lost;
+};
+
+struct record_stat {
+	struct record_stat_count total;
+	struct record_stat_count last;   /* total at the last sample */
+	int queued;                      /* buffers waiting for writers */
+	int max_queued;
+	int nr_shm;                      /* shmem buffers of running tasks */
+	int max_shm;
+	int nr_sample;
+	uint64_t start;
+	uint64_t next;
+	uint64_t elapsed;
+	uint64_t max_bytes;              /* max bytes written in an interval */
+	/* queue depth at enqueue, and write latency in usec */
+	uint64_t queue_hist[RECORD_STAT_HIST];
+	uint64_t latency_hist[RECORD_STAT_HIST];
+	struct rb_root tasks;
+	FILE *fp;
+	bool live;
+};
+
+void record_stat_init(struct record_stat *rs, const char *dirname, bool live);
+void record_stat_start(struct record_stat *rs, int tid, int seq);
+void record_stat_recv(struct record_stat *rs, int tid, int seq);
+void record_stat_lost(struct record_stat *rs, int tid, int lost);
+void record_stat_task_end(struct record_stat *rs, int tid);
+void record_stat_enqueue(struct record_stat *rs);
+void record_stat_write(struct record_stat *rs, uint64_t size, uint64_t start);
+int record_stat_update(struct record_stat *rs);
+void record_stat_finish(struct record_stat *rs);
+
+uint64_t record_stat_now(void);
+int record_stat_hist_idx(uint64_t val);
+int record_stat_percentile(uint64_t *hist, int percent);
+
+int read_record_stat(struct record_stat *rs, const char *dirname);
+void free_record_stat(struct record_stat *rs);
+
+#endif /* UFTRACE_RECORD_STAT_H */
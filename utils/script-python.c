@@ -20,6 +20,7 @@
 #include "utils/filter.h"
 #include "utils/script.h"
 #include "utils/script-python.h"
+#include "utils/intern.h"
 
 /* python library name, it only supports python 2.7 as of now */
 static const char *libpython = "libpython2.7.so";
@@ -62,8 +63,10 @@ static PyAPI_FUNC(PyObject *) (*__PyTuple_New)(Py_ssize_t size);
 static PyAPI_FUNC(int) (*__PyTuple_SetItem)(PyObject *, Py_ssize_t, PyObject *);
 static PyAPI_FUNC(PyObject *) (*__PyTuple_GetItem)(PyObject *, Py_ssize_t);
 
+static PyAPI_FUNC(PyObject *) (*__PyList_New)(Py_ssize_t size);
 static PyAPI_FUNC(Py_ssize_t) (*__PyList_Size)(PyObject *);
 static PyAPI_FUNC(PyObject *) (*__PyList_GetItem)(PyObject *, Py_ssize_t);
+static PyAPI_FUNC(int) (*__PyList_Append)(PyObject *, PyObject *);
 
 static PyAPI_FUNC(PyObject *) (*__PyDict_New)(void);
 static PyAPI_FUNC(int) (*__PyDict_SetItem)(PyObject *mp, PyObject *key, PyObject *item);
@@ -71,6 +74,39 @@ static PyAPI_FUNC(int) (*__PyDict_SetItemString)(PyObject *dp, const char *key,
 static PyAPI_FUNC(PyObject *) (*__PyDict_GetItem)(PyObject *mp, PyObject *key);
 
 static PyObject *pModule, *pFuncBegin, *pFuncEntry, *pFuncExit, *pFuncEnd;
+static PyObject *pFuncBatch;
+
+/* "None" object in the python library */
+static PyObject *py_none;
+
+/* default number of records passed to uftrace_batch() at once */
+#define PY_BATCH_SIZE  4096
+
+/* records to be passed to uftrace_batch() */
+static PyObject *py_batch;
+static long py_batch_len;
+static long py_batch_size = PY_BATCH_SIZE;
+
+/* string objects of function names indexed by the interned id */
+static PyObject **py_names;
+static unsigned py_nr_names;
+
+/* kind of records in the batch: "entry" or "exit" */
+static PyObject *py_batch_kind[2];
+
+/* The order of fields in a record tuple passed to uftrace_batch() */
+enum py_batch_idx {
+	PY_BATCH_KIND = 0,
+	PY_BATCH_TID,
+	PY_BATCH_DEPTH,
+	PY_BATCH_TIMESTAMP,
+	PY_BATCH_DURATION,
+	PY_BATCH_ADDRESS,
+	PY_BATCH_NAME,
+	PY_BATCH_ARGS,
+
+	PY_BATCH_NR_FIELDS,
+};
 
 enum py_context_idx {
 	PY_CTX_TID = 0,
@@ -141,14 +177,22 @@ static int load_python_api_funcs(void)
 	INIT_PY_API_FUNC(PyTuple_SetItem);
 	INIT_PY_API_FUNC(PyTuple_GetItem);
 
+	INIT_PY_API_FUNC(PyList_New);
 	INIT_PY_API_FUNC(PyList_Size);
 	INIT_PY_API_FUNC(PyList_GetItem);
+	INIT_PY_API_FUNC(PyList_Append);
 
 	INIT_PY_API_FUNC(PyDict_New);
 	INIT_PY_API_FUNC(PyDict_SetItem);
 	INIT_PY_API_FUNC(PyDict_SetItemString);
 	INIT_PY_API_FUNC(PyDict_GetItem);
 
+	py_none = dlsym(python_handle, "_Py_NoneStruct");
+	if (py_none == NULL) {
+		pr_err("dlsym for \"_Py_NoneStruct\" is failed!\n");
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -325,17 +369,57 @@ static void insert_dict_bool(PyObject *dict, const char *key, bool v)
 
 #define PYCTX(_item)  py_context_table[PY_CTX_##_item]
 
+/*
+ * It returns a (borrowed) string object of the function name.  The
+ * objects are saved using the interned id of the name so that it can
+ * be reused for the next calls of the function.
+ */
+static PyObject *get_name_object(char *name)
+{
+	unsigned id = intern_id(name);
+
+	if (id >= py_nr_names) {
+		unsigned nr = ALIGN(id + 1, 1024);
+
+		py_names = xrealloc(py_names, nr * sizeof(*py_names));
+		memset(py_names + py_nr_names, 0,
+		       (nr - py_nr_names) * sizeof(*py_names));
+		py_nr_names = nr;
+	}
+
+	if (py_names[id] == NULL)
+		py_names[id] = __PyString_FromString(name);
+
+	return py_names[id];
+}
+
+static void release_name_objects(void)
+{
+	unsigned i;
+
+	for (i = 0; i < py_nr_names; i++)
+		Py_XDECREF(py_names[i]);
+
+	free(py_names);
+	py_names = NULL;
+	py_nr_names = 0;
+}
+
 static void setup_common_context(PyObject **pDict, struct script_context *sc_ctx)
 {
 	insert_dict_long(*pDict, PYCTX(TID), sc_ctx->tid);
 	insert_dict_long(*pDict, PYCTX(DEPTH), sc_ctx->depth);
 	insert_dict_ull(*pDict, PYCTX(TIMESTAMP), sc_ctx->timestamp);
 	insert_dict_long(*pDict, PYCTX(ADDRESS), sc_ctx->address);
-	insert_dict_string(*pDict, PYCTX(NAME), sc_ctx->name);
+	__PyDict_SetItemString(*pDict, PYCTX(NAME), get_name_object(sc_ctx->name));
 }
 
-static void setup_argument_context(PyObject **pDict, bool is_retval,
-				   struct script_context *sc_ctx)
+/*
+ * It returns a new tuple object of the arguments, or the return value
+ * object itself.  NULL will be returned if there's no such data.
+ */
+static PyObject *get_argument_object(bool is_retval,
+				     struct script_context *sc_ctx)
 {
 	struct uftrace_arg_spec *spec;
 	void *data = sc_ctx->argbuf;
@@ -362,7 +446,7 @@ static void setup_argument_context(PyObject **pDict, bool is_retval,
 	}
 
 	if (count == 0)
-		return;
+		return NULL;
 
 	args = __PyTuple_New(count);
 	if (args == NULL)
@@ -472,15 +556,114 @@ static void setup_argument_context(PyObject **pDict, bool is_retval,
 		PyObject *retval = __PyTuple_GetItem(args, 0);
 
 		/* single return value doesn't need a tuple */
-		__PyDict_SetItemString(*pDict, PYCTX(RETVAL), retval);
+		Py_XINCREF(retval);
+		Py_XDECREF(args);
+		return retval;
 	}
-	else {
-		/* arguments will be returned in a tuple */
+
+	/* arguments will be returned in a tuple */
+	return args;
+}
+
+static void setup_argument_context(PyObject **pDict, bool is_retval,
+				   struct script_context *sc_ctx)
+{
+	PyObject *args = get_argument_object(is_retval, sc_ctx);
+
+	if (args == NULL)
+		return;
+
+	if (is_retval)
+		__PyDict_SetItemString(*pDict, PYCTX(RETVAL), args);
+	else
 		__PyDict_SetItemString(*pDict, PYCTX(ARGS), args);
-	}
+
 	Py_XDECREF(args);
 }
 
+static void report_python_error(const char *func)
+{
+	if (debug) {
+		if (__PyErr_Occurred() && !python_error_reported) {
+			pr_dbg("%s failed:\n", func);
+			__PyErr_Print();
+
+			python_error_reported = true;
+		}
+	}
+}
+
+/* python_interpreter_lock should be held */
+static void flush_python_batch(void)
+{
+	PyObject *ctx;
+
+	if (py_batch == NULL)
+		return;
+
+	ctx = __PyTuple_New(1);
+	__PyTuple_SetItem(ctx, 0, py_batch);
+
+	/* Call python function "uftrace_batch" with the list of records. */
+	__PyObject_CallObject(pFuncBatch, ctx);
+	report_python_error("uftrace_batch");
+
+	/* it frees the list and records too */
+	Py_XDECREF(ctx);
+
+	py_batch = NULL;
+	py_batch_len = 0;
+}
+
+/*
+ * Records are saved in a tuple (rather than a dictionary) and passed
+ * to the script in a list of records at once in order to reduce the
+ * overhead of calling python functions.  Each record has the fields in
+ * the order of enum py_batch_idx.
+ */
+static void add_python_batch(struct script_context *sc_ctx, bool is_exit)
+{
+	PyObject *rec;
+	PyObject *args = NULL;
+	PyObject *name;
+
+	pthread_mutex_lock(&python_interpreter_lock);
+
+	rec = __PyTuple_New(PY_BATCH_NR_FIELDS);
+	if (py_batch == NULL)
+		py_batch = __PyList_New(0);
+
+	name = get_name_object(sc_ctx->name);
+	Py_XINCREF(name);
+	Py_INCREF(py_batch_kind[is_exit]);
+
+	if (sc_ctx->arglen)
+		args = get_argument_object(is_exit, sc_ctx);
+	if (args == NULL) {
+		args = py_none;
+		Py_INCREF(args);
+	}
+
+	/* PyTuple_SetItem() steals the reference */
+	__PyTuple_SetItem(rec, PY_BATCH_KIND, py_batch_kind[is_exit]);
+	insert_tuple_long(rec, PY_BATCH_TID, sc_ctx->tid);
+	insert_tuple_long(rec, PY_BATCH_DEPTH, sc_ctx->depth);
+	insert_tuple_ull(rec, PY_BATCH_TIMESTAMP, sc_ctx->timestamp);
+	insert_tuple_ull(rec, PY_BATCH_DURATION, is_exit ? sc_ctx->duration : 0);
+	insert_tuple_ull(rec, PY_BATCH_ADDRESS, sc_ctx->address);
+	__PyTuple_SetItem(rec, PY_BATCH_NAME, name);
+	__PyTuple_SetItem(rec, PY_BATCH_ARGS, args);
+
+	/* PyList_Append() doesn't steal the reference */
+	__PyList_Append(py_batch, rec);
+	Py_XDECREF(rec);
+
+	if (++py_batch_len >= py_batch_size)
+		flush_python_batch();
+
+	pthread_mutex_unlock(&python_interpreter_lock);
+}
+
 int python_uftrace_begin(struct script_info *info)
 {
 	if (unlikely(!pFuncBegin))
@@ -520,6 +703,11 @@ int python_uftrace_begin(struct script_info *info)
 
 int python_uftrace_entry(struct script_context *sc_ctx)
 {
+	if (pFuncBatch) {
+		add_python_batch(sc_ctx, false);
+		return 0;
+	}
+
 	if (unlikely(!pFuncEntry))
 		return -1;
 
@@ -540,14 +728,7 @@ int python_uftrace_entry(struct script_context *sc_ctx)
 
 	/* Call python function "uftrace_entry". */
 	__PyObject_CallObject(pFuncEntry, pythonContext);
-	if (debug) {
-		if (__PyErr_Occurred() && !python_error_reported) {
-			pr_dbg("uftrace_entry failed:\n");
-			__PyErr_Print();
-
-			python_error_reported = true;
-		}
-	}
+	report_python_error("uftrace_entry");
 
 	/* Free PyTuple. */
 	Py_XDECREF(pythonContext);
@@ -559,6 +740,11 @@ int python_uftrace_entry(struct script_context *sc_ctx)
 
 int python_uftrace_exit(struct script_context *sc_ctx)
 {
+	if (pFuncBatch) {
+		add_python_batch(sc_ctx, true);
+		return 0;
+	}
+
 	if (unlikely(!pFuncExit))
 		return -1;
 
@@ -582,14 +768,7 @@ int python_uftrace_exit(struct script_context *sc_ctx)
 
 	/* Call python function "uftrace_exit". */
 	__PyObject_CallObject(pFuncExit, pythonContext);
-	if (debug) {
-		if (__PyErr_Occurred() && !python_error_reported) {
-			pr_dbg("uftrace_exit failed:\n");
-			__PyErr_Print();
-
-			python_error_reported = true;
-		}
-	}
+	report_python_error("uftrace_exit");
 
 	/* Free PyTuple. */
 	Py_XDECREF(pythonContext);
@@ -601,6 +780,13 @@ int python_uftrace_exit(struct script_context *sc_ctx)
 
 int python_uftrace_end(void)
 {
+	/* pass the remaining records before the end */
+	if (pFuncBatch) {
+		pthread_mutex_lock(&python_interpreter_lock);
+		flush_python_batch();
+		pthread_mutex_unlock(&python_interpreter_lock);
+	}
+
 	if (unlikely(!pFuncEnd))
 		return -1;
 
@@ -627,6 +813,10 @@ int python_atfork_prepare(void)
 
 	pthread_mutex_lock(&python_interpreter_lock);
 
+	/* the child should not see the records of the parent */
+	if (pFuncBatch)
+		flush_python_batch();
+
 	__PyRun_SimpleStringFlags("sys.stdout.flush()", NULL);
 
 	pthread_mutex_unlock(&python_interpreter_lock);
@@ -698,6 +888,27 @@ int script_init_for_python(struct script_info *info,
 	pFuncEntry = get_python_callback("uftrace_entry");
 	pFuncExit  = get_python_callback("uftrace_exit");
 	pFuncEnd   = get_python_callback("uftrace_end");
+	pFuncBatch = get_python_callback("uftrace_batch");
+
+	if (pFuncBatch) {
+		py_batch_kind[0] = __PyString_FromString("entry");
+		py_batch_kind[1] = __PyString_FromString("exit");
+
+		/* check if script wants to change the batch size */
+		if (__PyObject_HasAttrString(pModule, "UFTRACE_BATCH_SIZE")) {
+			PyObject *size = __PyObject_GetAttrString(pModule,
+								  "UFTRACE_BATCH_SIZE");
+
+			py_batch_size = __PyLong_AsLong(size);
+			if (py_batch_size <= 0) {
+				__PyErr_Clear();
+				py_batch_size = PY_BATCH_SIZE;
+			}
+			Py_XDECREF(size);
+		}
+
+		pr_dbg("use uftrace_batch with %ld records\n", py_batch_size);
+	}
 
 	/* Call python function "uftrace_begin" immediately if possible. */
 	python_uftrace_begin(info);
@@ -717,6 +928,14 @@ void script_finish_for_python(void)
 
 	pthread_mutex_lock(&python_interpreter_lock);
 
+	if (pFuncBatch) {
+		flush_python_batch();
+
+		Py_XDECREF(py_batch_kind[0]);
+		Py_XDECREF(py_batch_kind[1]);
+	}
+	release_name_objects();
+
 	__Py_Finalize();
 
 	pthread_mutex_unlock(&python_interpreter_lock);
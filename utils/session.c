@@ -66,6 +66,13 @@ void read_session_map(char *dirname, struct symtabs *symtabs, char *sid)
 		map->symtab.sym_names = NULL;
 		map->symtab.nr_sym = 0;
 		map->symtab.nr_alloc = 0;
+		map->symtab.lazy_demangle = false;
+		map->symtab.map = NULL;
+		map->symtab.map_size = 0;
+		map->symtab.map_owner = false;
+		map->symtab.addr_idx = NULL;
+		map->symtab.sym_idx = NULL;
+		map->symtab.nr_idx = 0;
 		memcpy(map->libname, path, namelen);
 		map->libname[strlen(path)] = '\0';
 		last_libname = map->libname;
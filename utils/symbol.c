@@ -15,6 +15,10 @@
 #include <unistd.h>
 #include <assert.h>
 #include <inttypes.h>
+#include <pthread.h>
+#include <ctype.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 /* This should be defined before #include "utils.h" */
 #define PR_FMT     "symbol"
@@ -24,6 +28,7 @@
 #include "utils/utils.h"
 #include "utils/symbol.h"
 #include "utils/filter.h"
+#include "utils/intern.h"
 
 #ifndef  EM_AARCH64
 # define EM_AARCH64  183
@@ -193,19 +198,37 @@ elf_error:
 
 static void __unload_symtab(struct symtab *symtab)
 {
+	void *map_end = symtab->map + symtab->map_size;
 	size_t i;
 
 	for (i = 0; i < symtab->nr_sym; i++) {
 		struct sym *sym = symtab->sym + i;
+
+		/* names in the binary symbol file are not allocated */
+		if ((void *)sym->name >= symtab->map &&
+		    (void *)sym->name < map_end)
+			continue;
 		free(sym->name);
 	}
 
 	free(symtab->sym_names);
 	free(symtab->sym);
+	free(symtab->addr_idx);
+	free(symtab->sym_idx);
+
+	if (symtab->map_owner)
+		munmap(symtab->map, symtab->map_size);
 
 	symtab->nr_sym = 0;
 	symtab->sym = NULL;
 	symtab->sym_names = NULL;
+	symtab->map = NULL;
+	symtab->map_size = 0;
+	symtab->map_owner = false;
+	symtab->lazy_demangle = false;
+	symtab->addr_idx = NULL;
+	symtab->sym_idx = NULL;
+	symtab->nr_idx = 0;
 }
 
 void unload_symtabs(struct symtabs *symtabs)
@@ -214,6 +237,10 @@ void unload_symtabs(struct symtabs *symtabs)
 	__unload_symtab(&symtabs->symtab);
 	__unload_symtab(&symtabs->dsymtab);
 
+	free(symtabs->ranges);
+	symtabs->ranges = NULL;
+	symtabs->nr_ranges = 0;
+
 	symtabs->loaded = false;
 }
 
@@ -344,6 +371,7 @@ static int load_symtab(struct symtab *symtab, const char *filename,
 
 		sym->addr = elf_sym.st_value + offset;
 		sym->size = elf_sym.st_size;
+		sym->name_id = 0;
 
 		switch (GELF_ST_BIND(elf_sym.st_info)) {
 		case STB_LOCAL:
@@ -668,6 +696,7 @@ int load_elf_dynsymtab(struct symtab *dsymtab, Elf *elf,
 			sym->addr = prev_addr + plt_entsize;
 		sym->size = plt_entsize;
 		sym->type = ST_PLT;
+		sym->name_id = 0;
 
 		prev_addr = sym->addr;
 
@@ -1021,6 +1050,19 @@ struct uftrace_mmap *find_map_by_name(struct symtabs *symtabs,
 static int update_symtab_using_dynsym(struct symtab *symtab, const char *filename,
 				      unsigned long offset, unsigned long flags);
 
+static void update_addr_index(struct symtab *symtab);
+static void build_map_ranges(struct symtabs *symtabs);
+
+/*
+ * Lookup functions can be called from multiple threads (in libmcount or
+ * with --jobs) so the address index is built here, not on the first use.
+ */
+static void finish_symtab(struct symtab *symtab)
+{
+	if (symtab->nr_sym && symtab->nr_idx != symtab->nr_sym)
+		update_addr_index(symtab);
+}
+
 void load_symtabs(struct symtabs *symtabs, const char *dirname,
 		  const char *filename)
 {
@@ -1061,6 +1103,8 @@ void load_symtabs(struct symtabs *symtabs, const char *dirname,
 	    !(symtabs->flags & SYMTAB_FL_SKIP_DYNAMIC))
 		load_dynsymtab(&symtabs->dsymtab, filename, offset, symtabs->flags);
 
+	finish_symtab(&symtabs->symtab);
+	finish_symtab(&symtabs->dsymtab);
 	symtabs->loaded = true;
 }
 
@@ -1089,6 +1133,8 @@ void load_dlopen_symtabs(struct symtabs *symtabs, unsigned long offset,
 	    !(symtabs->flags & SYMTAB_FL_SKIP_DYNAMIC))
 		load_dynsymtab(&symtabs->dsymtab, filename, offset, symtabs->flags);
 
+	finish_symtab(&symtabs->symtab);
+	finish_symtab(&symtabs->dsymtab);
 	symtabs->loaded = true;
 }
 
@@ -1151,19 +1197,26 @@ void load_module_symtabs(struct symtabs *symtabs)
 		update_symtab_using_dynsym(&maps->symtab, maps->libname, maps->start, flags);
 
 next:
+		finish_symtab(&maps->symtab);
 		maps = maps->next;
 	}
+
+	/* the map list doesn't change once it's read */
+	build_map_ranges(symtabs);
 }
 
-int load_symbol_file(struct symtabs *symtabs, const char *symfile,
-		     unsigned long offset)
+/*
+ * read symbols in the text symbol file.  Symbols of ST_PLT type are
+ * saved to @dtab if it's not NULL.  The tables are not sorted yet.
+ */
+static int read_symbol_file(const char *symfile, unsigned long offset,
+			    struct symtab *stab, struct symtab *dtab)
 {
 	FILE *fp;
 	char *line = NULL;
 	size_t len = 0;
-	unsigned int i;
 	unsigned int grow = SYMTAB_GROW;
-	struct symtab *stab = &symtabs->symtab;
+	struct symtab *symtab = stab;
 	char allowed_types[] = "TtwPK";
 	uint64_t prev_addr = -1;
 	char prev_type = 'X';
@@ -1209,7 +1262,7 @@ int load_symbol_file(struct symtabs *symtabs, const char *symfile,
 			*pos = '\0';
 
 		if (addr == prev_addr && type == prev_type) {
-			sym = &stab->sym[stab->nr_sym - 1];
+			sym = &symtab->sym[symtab->nr_sym - 1];
 
 			/* for kernel symbols, replace SyS_xxx to sys_xxx */
 			if (!strncmp(sym->name, "SyS_", 4) &&
@@ -1232,58 +1285,512 @@ int load_symbol_file(struct symtabs *symtabs, const char *symfile,
 		prev_addr = addr;
 		prev_type = type;
 
-		if (type == ST_PLT)
-			stab = &symtabs->dsymtab;
+		if (type == ST_PLT && dtab)
+			symtab = dtab;
 		else
-			stab = &symtabs->symtab;
+			symtab = stab;
 
-		if (stab->nr_sym >= stab->nr_alloc) {
-			if (stab->nr_alloc >= grow * 4)
+		if (symtab->nr_sym >= symtab->nr_alloc) {
+			if (symtab->nr_alloc >= grow * 4)
 				grow *= 2;
-			stab->nr_alloc += grow;
-			stab->sym = xrealloc(stab->sym,
-					     stab->nr_alloc * sizeof(*sym));
+			symtab->nr_alloc += grow;
+			symtab->sym = xrealloc(symtab->sym,
+					       symtab->nr_alloc * sizeof(*sym));
 		}
 
-		sym = &stab->sym[stab->nr_sym++];
+		sym = &symtab->sym[symtab->nr_sym++];
 
 		sym->addr = addr + offset;
 		sym->type = type;
-		sym->name = demangle(name);
+		sym->name = xstrdup(name);
 		sym->size = 0;
+		sym->name_id = 0;
 
-		pr_dbg3("[%zd] %c %"PRIx64" + %-5u %s\n", stab->nr_sym,
+		pr_dbg3("[%zd] %c %"PRIx64" + %-5u %s\n", symtab->nr_sym,
 			sym->type, sym->addr, sym->size, sym->name);
 
-		if (stab->nr_sym > 1)
+		if (symtab->nr_sym > 1)
 			sym[-1].size = sym->addr - sym[-1].addr;
 	}
 	free(line);
+	fclose(fp);
+	return 0;
+}
+
+static void sort_symtab(struct symtab *symtab)
+{
+	unsigned int i;
+
+	qsort(symtab->sym, symtab->nr_sym, sizeof(*symtab->sym), addrsort);
+
+	symtab->sym_names = xmalloc(sizeof(*symtab->sym_names) * symtab->nr_sym);
+
+	for (i = 0; i < symtab->nr_sym; i++)
+		symtab->sym_names[i] = &symtab->sym[i];
+	qsort(symtab->sym_names, symtab->nr_sym, sizeof(*symtab->sym_names),
+	      namesort);
+
+	symtab->name_sorted = true;
+}
+
+/*
+ * Binary symbol file (XXX.symbin) is saved with the text symbol file
+ * (XXX.sym) so that it can be mapped directly without parsing and
+ * sorting.  It has the symbol entries (normal and dynamic) sorted by
+ * address, index arrays and a string table.  The index of the normal
+ * symbols is sorted by the (demangled) name and the index of dynamic
+ * symbols keeps the original order like ->sym_names[].  The names are
+ * demangled using the demangler when it's saved.  The text symbol file
+ * is still saved for compatibility and it's used if the binary file is
+ * not usable or it doesn't match to the text file (by size and checksum
+ * of the contents, so that a copied or received file is still usable).
+ */
+#define SYMBIN_MAGIC    "UFTSYMB"
+#define SYMBIN_VERSION  3
+
+struct symbin_table {
+	uint32_t nr_sym;
+	uint32_t pad;
+	uint64_t sym_offset;   /* file offset of symbin_entry array */
+	uint64_t idx_offset;   /* file offset of uint32_t index array */
+};
+
+struct symbin_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t demangler;
+	struct symbin_table table[2];   /* normal and dynamic symbols */
+	uint64_t str_offset;
+	uint64_t str_size;
+	uint64_t sym_size;     /* size of the text symbol file */
+	uint64_t sym_csum;     /* checksum of the text symbol file */
+};
+
+struct symbin_entry {
+	uint64_t addr;         /* without the load offset */
+	uint32_t size;
+	uint32_t type;
+	uint32_t name;         /* offset of the name in the string table */
+	uint32_t dname;        /* offset of the demangled name */
+};
+
+/* FNV-1a (64-bit) checksum of the text symbol file */
+static int get_symfile_checksum(const char *symfile, uint64_t *size,
+				uint64_t *csum)
+{
+	struct stat stbuf;
+	unsigned char *map;
+	uint64_t hash = 14695981039346656037ULL;
+	size_t i;
+	int fd;
+
+	fd = open(symfile, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &stbuf) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	*size = stbuf.st_size;
+	if (stbuf.st_size == 0) {
+		*csum = hash;
+		close(fd);
+		return 0;
+	}
+
+	map = mmap(NULL, stbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	for (i = 0; i < (size_t)stbuf.st_size; i++) {
+		hash ^= map[i];
+		hash *= 1099511628211ULL;
+	}
+	munmap(map, stbuf.st_size);
+
+	*csum = hash;
+	return 0;
+}
+
+static char *get_symbin_name(const char *symfile)
+{
+	size_t len = strlen(symfile);
+	char *binfile;
+
+	if (len < 4 || strcmp(symfile + len - 4, ".sym"))
+		return NULL;
+
+	xasprintf(&binfile, "%sbin", symfile);
+	return binfile;
+}
+
+struct symbin_strtab {
+	char *buf;
+	size_t len;
+	size_t size;
+};
+
+static uint32_t add_symbin_string(struct symbin_strtab *strtab,
+				  const char *str)
+{
+	size_t len = strlen(str) + 1;
+	uint32_t pos = strtab->len;
+
+	if (strtab->len + len > strtab->size) {
+		strtab->size = ALIGN(strtab->len + len, 4096);
+		strtab->buf = xrealloc(strtab->buf, strtab->size);
+	}
+
+	memcpy(strtab->buf + pos, str, len);
+	strtab->len += len;
+	return pos;
+}
+
+struct symbin_name {
+	char *name;
+	uint32_t idx;
+};
+
+static int symbin_namesort(const void *a, const void *b)
+{
+	const struct symbin_name *na = a;
+	const struct symbin_name *nb = b;
+
+	return strcmp(na->name, nb->name);
+}
+
+static void write_symbin_table(FILE *fp, struct symtab *symtab,
+			       struct symbin_strtab *strtab, bool dynamic)
+{
+	struct symbin_name *names;
+	struct symbin_entry ent;
+	uint32_t idx;
+	size_t i;
+
+	names = xcalloc(symtab->nr_sym ?: 1, sizeof(*names));
+
+	for (i = 0; i < symtab->nr_sym; i++) {
+		struct sym *sym = &symtab->sym[i];
+
+		names[i].name = demangle(sym->name);
+		names[i].idx = i;
+
+		ent.addr = sym->addr;
+		ent.size = sym->size;
+		ent.type = sym->type;
+		ent.name = add_symbin_string(strtab, sym->name);
+		if (strcmp(names[i].name, sym->name))
+			ent.dname = add_symbin_string(strtab, names[i].name);
+		else
+			ent.dname = ent.name;
+
+		fwrite(&ent, sizeof(ent), 1, fp);
+	}
+
+	if (!dynamic)
+		qsort(names, symtab->nr_sym, sizeof(*names), symbin_namesort);
+
+	for (i = 0; i < symtab->nr_sym; i++) {
+		if (dynamic)
+			idx = symtab->sym_names[i] - symtab->sym;
+		else
+			idx = names[i].idx;
+
+		fwrite(&idx, sizeof(idx), 1, fp);
+	}
+
+	/* keep 8-byte alignment */
+	if (symtab->nr_sym % 2) {
+		idx = 0;
+		fwrite(&idx, sizeof(idx), 1, fp);
+	}
+
+	for (i = 0; i < symtab->nr_sym; i++)
+		free(names[i].name);
+	free(names);
+}
+
+/*
+ * save_symbol_binary - save binary symbol file from the text file
+ * @symfile: text symbol file just saved
+ * @module: whether it's for a module (all symbols in a single table)
+ *
+ * It reads the text file back so that the binary file has exactly the
+ * same symbols as it'd be loaded from the text file.
+ */
+static void save_symbol_binary(const char *symfile, bool module)
+{
+	struct symtab stab = {}, dtab = {};
+	struct symtab *tabs[2] = { &stab, &dtab };
+	struct symbin_header hdr = {
+		.magic     = SYMBIN_MAGIC,
+		.version   = SYMBIN_VERSION,
+		.demangler = demangler,
+	};
+	struct symbin_strtab strtab = {};
+	uint64_t pos = sizeof(hdr);
+	char *binfile;
+	FILE *fp;
+	int i;
+
+	binfile = get_symbin_name(symfile);
+	if (binfile == NULL)
+		return;
+
+	if (get_symfile_checksum(symfile, &hdr.sym_size, &hdr.sym_csum) < 0)
+		goto out;
+
+	if (read_symbol_file(symfile, 0, &stab, module ? NULL : &dtab) < 0)
+		goto out;
+
+	qsort(stab.sym, stab.nr_sym, sizeof(*stab.sym), addrsort);
+	if (dtab.nr_sym)
+		sort_dynsymtab(&dtab);
+
+	fp = fopen(binfile, "wx");
+	if (fp == NULL) {
+		if (errno != EEXIST)
+			pr_dbg("cannot open %s file: %m\n", binfile);
+		goto out;
+	}
+
+	pr_dbg2("saving binary symbols to %s\n", binfile);
+
+	for (i = 0; i < 2; i++) {
+		size_t nr = tabs[i]->nr_sym;
+
+		hdr.table[i].nr_sym = nr;
+		hdr.table[i].sym_offset = pos;
+		pos += nr * sizeof(struct symbin_entry);
+		hdr.table[i].idx_offset = pos;
+		pos += ALIGN(nr, 2) * sizeof(uint32_t);
+	}
+
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+	write_symbin_table(fp, &stab, &strtab, false);
+	write_symbin_table(fp, &dtab, &strtab, true);
+
+	/* update the string table info at last */
+	hdr.str_offset = pos;
+	hdr.str_size = strtab.len;
+	fwrite(strtab.buf, 1, strtab.len, fp);
+
+	rewind(fp);
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+
+	if (ferror(fp)) {
+		pr_dbg("writing %s failed\n", binfile);
+		unlink(binfile);
+	}
+	fclose(fp);
+
+out:
+	free(strtab.buf);
+	__unload_symtab(&stab);
+	__unload_symtab(&dtab);
+	free(binfile);
+}
+
+static bool check_symbin_table(struct symbin_table *tab, size_t size)
+{
+	uint64_t nr = tab->nr_sym;
+
+	if (tab->sym_offset + nr * sizeof(struct symbin_entry) > size)
+		return false;
+	if (tab->idx_offset + nr * sizeof(uint32_t) > size)
+		return false;
+	return true;
+}
+
+/* the binary file is stale if the text file was changed after it's saved */
+static bool check_symbin_source(struct symbin_header *hdr, const char *symfile)
+{
+	uint64_t size, csum;
+
+	if (get_symfile_checksum(symfile, &size, &csum) < 0)
+		return false;
+
+	return hdr->sym_size == size && hdr->sym_csum == csum;
+}
+
+static int load_symbin_table(struct symtab *symtab, void *map,
+			     struct symbin_header *hdr, int n,
+			     unsigned long offset)
+{
+	struct symbin_table *tab = &hdr->table[n];
+	struct symbin_entry *ent = map + tab->sym_offset;
+	uint32_t *idx = map + tab->idx_offset;
+	char *strtab = map + hdr->str_offset;
+	bool use_dname = (hdr->demangler == (uint32_t)demangler);
+	size_t i;
+
+	/* names in the map should not be freed */
+	symtab->map = map;
+	symtab->map_size = hdr->str_offset + hdr->str_size;
+
+	symtab->nr_sym = symtab->nr_alloc = tab->nr_sym;
+	symtab->sym = xcalloc(tab->nr_sym ?: 1, sizeof(*symtab->sym));
+	symtab->sym_names = xcalloc(tab->nr_sym ?: 1,
+				    sizeof(*symtab->sym_names));
+
+	for (i = 0; i < tab->nr_sym; i++) {
+		struct sym *sym = &symtab->sym[i];
+
+		if (ent[i].name >= hdr->str_size ||
+		    ent[i].dname >= hdr->str_size || idx[i] >= tab->nr_sym)
+			return -1;
+
+		sym->addr = ent[i].addr + offset;
+		sym->size = ent[i].size;
+		sym->type = ent[i].type;
+		sym->name_id = 0;
+
+		/* otherwise, it'll be demangled when it's used */
+		if (use_dname)
+			sym->name = strtab + ent[i].dname;
+		else
+			sym->name = strtab + ent[i].name;
+
+		symtab->sym_names[i] = &symtab->sym[idx[i]];
+	}
+
+	symtab->lazy_demangle = !use_dname && (demangler != DEMANGLE_NONE);
+
+	if (n == 1) {
+		/* ->sym_names[] has the original index of dynamic symbols */
+		symtab->name_sorted = false;
+		return 0;
+	}
+
+	/* the index is sorted by the demangled names */
+	if (!use_dname && hdr->demangler != DEMANGLE_NONE) {
+		qsort(symtab->sym_names, symtab->nr_sym,
+		      sizeof(*symtab->sym_names), namesort);
+	}
+	symtab->name_sorted = true;
+	return 0;
+}
+
+/*
+ * load_symbol_binary - load symbols from the binary symbol file
+ * @stab: symbol table for normal symbols
+ * @dtab: symbol table for dynamic symbols (or NULL for modules)
+ * @symfile: name of the text symbol file
+ * @offset: load offset of the symbols
+ *
+ * It returns 0 if it loaded symbols from the binary file, or -1 if the
+ * file doesn't exist or is invalid so that the text file can be used.
+ */
+static int load_symbol_binary(struct symtab *stab, struct symtab *dtab,
+			      const char *symfile, unsigned long offset)
+{
+	struct symbin_header *hdr;
+	struct stat stbuf;
+	char *binfile;
+	void *map = MAP_FAILED;
+	int fd = -1;
+
+	binfile = get_symbin_name(symfile);
+	if (binfile == NULL)
+		return -1;
+
+	fd = open(binfile, O_RDONLY);
+	if (fd < 0)
+		goto err;
+
+	if (fstat(fd, &stbuf) < 0 || stbuf.st_size < (off_t)sizeof(*hdr))
+		goto err;
+
+	map = mmap(NULL, stbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		goto err;
+
+	hdr = map;
+	if (memcmp(hdr->magic, SYMBIN_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != SYMBIN_VERSION ||
+	    hdr->str_offset + hdr->str_size > (uint64_t)stbuf.st_size ||
+	    !check_symbin_table(&hdr->table[0], stbuf.st_size) ||
+	    !check_symbin_table(&hdr->table[1], stbuf.st_size))
+		goto invalid;
+
+	/* all names should be terminated within the string table */
+	if (hdr->str_size &&
+	    ((char *)map)[hdr->str_offset + hdr->str_size - 1] != '\0')
+		goto invalid;
+
+	if (!check_symbin_source(hdr, symfile)) {
+		pr_dbg("binary symbol file is stale: %s\n", binfile);
+		goto err;
+	}
+
+	/* modules have all symbols in a single table */
+	if (dtab == NULL && hdr->table[1].nr_sym)
+		goto invalid;
+
+	pr_dbg2("loading symbols from %s: offset = %lx\n", binfile, offset);
+
+	if (load_symbin_table(stab, map, hdr, 0, offset) < 0)
+		goto invalid;
+
+	if (dtab && hdr->table[1].nr_sym) {
+		if (load_symbin_table(dtab, map, hdr, 1, offset) < 0) {
+			__unload_symtab(dtab);
+			goto invalid;
+		}
+	}
+
+	/* normal symbol table unmaps the file */
+	stab->map_owner = true;
+
 	pr_dbg2("loaded %zd normal + %zd dynamic symbols\n",
-		symtabs->symtab.nr_sym, symtabs->dsymtab.nr_sym);
+		stab->nr_sym, dtab ? dtab->nr_sym : 0);
 
-	stab = &symtabs->symtab;
-	qsort(stab->sym, stab->nr_sym, sizeof(*stab->sym), addrsort);
+	close(fd);
+	free(binfile);
+	return 0;
 
-	stab->sym_names = xmalloc(sizeof(*stab->sym_names) * stab->nr_sym);
+invalid:
+	pr_dbg("invalid binary symbol file: %s\n", binfile);
+	if (stab->map)
+		__unload_symtab(stab);
+err:
+	if (map != MAP_FAILED && stab->map == NULL)
+		munmap(map, stbuf.st_size);
+	if (fd >= 0)
+		close(fd);
+	free(binfile);
+	return -1;
+}
 
-	for (i = 0; i < stab->nr_sym; i++)
-		stab->sym_names[i] = &stab->sym[i];
-	qsort(stab->sym_names, stab->nr_sym, sizeof(*stab->sym_names), namesort);
+int load_symbol_file(struct symtabs *symtabs, const char *symfile,
+		     unsigned long offset)
+{
+	struct symtab *stab = &symtabs->symtab;
+	struct symtab *dtab = &symtabs->dsymtab;
+
+	if (load_symbol_binary(stab, dtab, symfile, offset) == 0)
+		return 0;
+
+	if (read_symbol_file(symfile, offset, stab, dtab) < 0)
+		return -1;
+
+	/* names will be demangled when they're used */
+	stab->lazy_demangle = dtab->lazy_demangle = (demangler != DEMANGLE_NONE);
 
-	stab->name_sorted = true;
+	pr_dbg2("loaded %zd normal + %zd dynamic symbols\n",
+		stab->nr_sym, dtab->nr_sym);
+
+	sort_symtab(stab);
 
 	/*
 	 * sort dynamic symbol while reserving original index in ->sym_names[]
 	 */
-	stab = &symtabs->dsymtab;
-	if (stab->nr_sym == 0)
-		goto out;
+	if (dtab->nr_sym)
+		sort_dynsymtab(dtab);
 
-	sort_dynsymtab(stab);
-
-out:
-	fclose(fp);
 	return 0;
 }
 
@@ -1362,132 +1869,35 @@ do_it:
 
 	elf_end(elf);
 	close(fd);
-	free(symfile);
 	fclose(fp);
+
+	save_symbol_binary(symfile, false);
+	free(symfile);
 }
 
 static int load_module_symbol(struct symtab *symtab, const char *symfile,
 			      unsigned long offset)
 {
-	FILE *fp;
-	char *line = NULL;
-	size_t len = 0;
-	unsigned int i;
-	unsigned int grow = SYMTAB_GROW;
-	char allowed_types[] = "TtwPK";
-	uint64_t prev_addr = -1;
-	char prev_type = 'X';
+	if (load_symbol_binary(symtab, NULL, symfile, offset) == 0)
+		return 0;
 
-	fp = fopen(symfile, "r");
-	if (fp == NULL) {
-		pr_dbg("reading %s failed: %m\n", symfile);
+	if (read_symbol_file(symfile, offset, symtab, NULL) < 0)
 		return -1;
-	}
 
-	pr_dbg2("loading symbols from %s: offset = %lx\n", symfile, offset);
-	while (getline(&line, &len, fp) > 0) {
-		struct sym *sym;
-		uint64_t addr;
-		char type;
-		char *name;
-		char *pos;
+	symtab->lazy_demangle = (demangler != DEMANGLE_NONE);
 
-		pos = strchr(line, '\n');
-		if (pos)
-			*pos = '\0';
+	sort_symtab(symtab);
+	return 0;
+}
 
-		addr = strtoull(line, &pos, 16);
+static void save_module_symbol(struct symtab *stab, const char *symfile,
+			       unsigned long offset)
+{
+	FILE *fp;
+	unsigned i;
 
-		if (*pos++ != ' ') {
-			pr_dbg2("invalid symbol file format before type\n");
-			continue;
-		}
-		type = *pos++;
-
-		if (*pos++ != ' ') {
-			pr_dbg2("invalid symbol file format after type\n");
-			continue;
-		}
-		name = pos;
-
-		/*
-		 * remove kernel module if any.
-		 *   ex)  btrfs_end_transaction_throttle     [btrfs]
-		 */
-		pos = strchr(name, '\t');
-		if (pos)
-			*pos = '\0';
-
-		if (addr == prev_addr && type == prev_type) {
-			sym = &symtab->sym[symtab->nr_sym - 1];
-
-			/* for kernel symbols, replace SyS_xxx to sys_xxx */
-			if (!strncmp(sym->name, "SyS_", 4) &&
-			    !strncmp(name, "sys_", 4) &&
-			    !strcmp(sym->name + 4, name + 4))
-				strncpy(sym->name, name, 4);
-
-			pr_dbg2("skip duplicated symbols: %s\n", name);
-			continue;
-		}
-
-		if (strchr(allowed_types, type) == NULL)
-			continue;
-
-		/*
-		 * it should be updated after the type check
-		 * otherwise, it might access invalid sym
-		 * in the above.
-		 */
-		prev_addr = addr;
-		prev_type = type;
-
-		if (symtab->nr_sym >= symtab->nr_alloc) {
-			if (symtab->nr_alloc >= grow * 4)
-				grow *= 2;
-			symtab->nr_alloc += grow;
-			symtab->sym = xrealloc(symtab->sym,
-					       symtab->nr_alloc * sizeof(*sym));
-		}
-
-		sym = &symtab->sym[symtab->nr_sym++];
-
-		sym->addr = addr + offset;
-		sym->type = type;
-		sym->name = demangle(name);
-		sym->size = 0;
-
-		pr_dbg3("[%zd] %c %lx + %-5u %s\n", symtab->nr_sym,
-			sym->type, sym->addr, sym->size, sym->name);
-
-		if (symtab->nr_sym > 1)
-			sym[-1].size = sym->addr - sym[-1].addr;
-	}
-	free(line);
-
-	qsort(symtab->sym, symtab->nr_sym, sizeof(*symtab->sym), addrsort);
-
-	symtab->sym_names = xmalloc(sizeof(*symtab->sym_names) * symtab->nr_sym);
-
-	for (i = 0; i < symtab->nr_sym; i++)
-		symtab->sym_names[i] = &symtab->sym[i];
-	qsort(symtab->sym_names, symtab->nr_sym, sizeof(*symtab->sym_names),
-	      namesort);
-
-	symtab->name_sorted = true;
-
-	fclose(fp);
-	return 0;
-}
-
-static void save_module_symbol(struct symtab *stab, const char *symfile,
-			       unsigned long offset)
-{
-	FILE *fp;
-	unsigned i;
-
-	if (stab->nr_sym == 0)
-		return;
+	if (stab->nr_sym == 0)
+		return;
 
 	fp = fopen(symfile, "wx");
 	if (fp == NULL) {
@@ -1509,6 +1919,8 @@ static void save_module_symbol(struct symtab *stab, const char *symfile,
 	}
 
 	fclose(fp);
+
+	save_symbol_binary(symfile, true);
 }
 
 void save_module_symtabs(struct symtabs *symtabs)
@@ -1574,6 +1986,7 @@ int load_kernel_symbol(char *dirname)
 	for (i = 0; i < ksymtabs.symtab.nr_sym; i++)
 		ksymtabs.symtab.sym[i].type = ST_KERNEL;
 
+	finish_symtab(&ksymtabs.symtab);
 	free(symfile);
 	ksymtabs.loaded = true;
 	return 0;
@@ -1645,9 +2058,46 @@ size_t count_dynsym(struct symtabs *symtabs)
 	return dsymtab->nr_sym;
 }
 
+static int rangesort(const void *a, const void *b)
+{
+	const struct uftrace_map_range *ra = a;
+	const struct uftrace_map_range *rb = b;
+
+	if (ra->start > rb->start)
+		return 1;
+	if (ra->start < rb->start)
+		return -1;
+	return 0;
+}
+
+static void build_map_ranges(struct symtabs *symtabs)
+{
+	struct uftrace_mmap *map;
+	size_t nr = 0;
+
+	free(symtabs->ranges);
+
+	for (map = symtabs->maps; map; map = map->next)
+		nr++;
+
+	symtabs->ranges = xmalloc(nr * sizeof(*symtabs->ranges));
+	symtabs->nr_ranges = nr;
+
+	nr = 0;
+	for (map = symtabs->maps; map; map = map->next) {
+		symtabs->ranges[nr].start = map->start;
+		symtabs->ranges[nr].end   = map->end;
+		symtabs->ranges[nr].map   = map;
+		nr++;
+	}
+
+	qsort(symtabs->ranges, nr, sizeof(*symtabs->ranges), rangesort);
+}
+
 struct uftrace_mmap * find_map(struct symtabs *symtabs, uint64_t addr)
 {
-	struct uftrace_mmap *maps;
+	struct uftrace_map_range *range;
+	size_t nr, half;
 
 	if (is_kernel_address(symtabs, addr))
 		return MAP_KERNEL;
@@ -1674,13 +2124,31 @@ struct uftrace_mmap * find_map(struct symtabs *symtabs, uint64_t addr)
 			return MAP_MAIN;
 	}
 
-	maps = symtabs->maps;
-	while (maps) {
-		if (maps->start <= addr && addr < maps->end)
-			return maps;
+	if (symtabs->maps == NULL)
+		return NULL;
 
-		maps = maps->next;
+	/* the ranges are built after loading module symbols */
+	if (symtabs->ranges == NULL) {
+		struct uftrace_mmap *map;
+
+		for (map = symtabs->maps; map; map = map->next) {
+			if (map->start <= addr && addr < map->end)
+				return map;
+		}
+		return NULL;
 	}
+
+	/* find the last range starting at or before the addr */
+	range = symtabs->ranges;
+	nr = symtabs->nr_ranges;
+	while (nr > 1) {
+		half = nr / 2;
+		range = (range[half].start <= addr) ? range + half : range;
+		nr -= half;
+	}
+
+	if (range->start <= addr && addr < range->end)
+		return range->map;
 	return NULL;
 }
 
@@ -1703,6 +2171,122 @@ struct uftrace_mmap * find_symbol_map(struct symtabs *symtabs, char *name)
 	return NULL;
 }
 
+/*
+ * The address index keeps symbol addresses in a separate array in the
+ * Eytzinger (BFS) layout of the implicit binary search tree.  The first
+ * few levels of the tree are packed in a few cache lines and children
+ * of a node are next to each other so it can prefetch them ahead.
+ */
+static size_t build_addr_index(struct symtab *symtab, size_t i, size_t k)
+{
+	/* in-order traversal of the tree visits the symbols in order */
+	if (k <= symtab->nr_idx) {
+		i = build_addr_index(symtab, i, 2 * k);
+		symtab->addr_idx[k] = symtab->sym[i].addr;
+		symtab->sym_idx[k] = i++;
+		i = build_addr_index(symtab, i, 2 * k + 1);
+	}
+	return i;
+}
+
+static void update_addr_index(struct symtab *symtab)
+{
+	free(symtab->addr_idx);
+	free(symtab->sym_idx);
+
+	/* the index starts from 1 */
+	symtab->nr_idx = symtab->nr_sym;
+
+	/* align to cache line so that it can prefetch children at once */
+	if (posix_memalign((void **)&symtab->addr_idx, 64,
+			   (symtab->nr_idx + 1) * sizeof(*symtab->addr_idx)))
+		pr_err("cannot allocate symbol address index");
+	symtab->sym_idx = xmalloc((symtab->nr_idx + 1) * sizeof(*symtab->sym_idx));
+
+	build_addr_index(symtab, 0, 1);
+}
+
+static struct sym * lookup_symtab(struct symtab *symtab, uint64_t addr)
+{
+	uint64_t *idx;
+	size_t k = 1;
+	struct sym *sym;
+
+	if (symtab->nr_sym == 0)
+		return NULL;
+
+	/* the index is built by finish_symtab(), it's not changed here */
+	if (symtab->nr_idx != symtab->nr_sym) {
+		return bsearch(&addr, symtab->sym, symtab->nr_sym,
+			       sizeof(*symtab->sym), addrfind);
+	}
+
+	idx = symtab->addr_idx;
+	while (k <= symtab->nr_idx) {
+		/* descendants in 3 levels below fit in a cache line */
+		__builtin_prefetch(idx + 8 * k);
+		k = 2 * k + (idx[k] <= addr);
+	}
+
+	/* strip the left turns after the last right turn (idx[k] <= addr) */
+	k >>= __builtin_ffsl(k);
+	if (k == 0)
+		return NULL;
+
+	sym = &symtab->sym[symtab->sym_idx[k]];
+	if (addr >= sym->addr + sym->size)
+		return NULL;
+
+	return sym;
+}
+
+/* load symbols of a map which was not loaded by load_module_symtabs() */
+static void load_map_symtab(struct symtabs *symtabs, struct uftrace_mmap *map)
+{
+	static pthread_mutex_t load_lock = PTHREAD_MUTEX_INITIALIZER;
+	struct symtab stab = {};
+	bool found = false;
+	size_t nr_sym;
+
+	pthread_mutex_lock(&load_lock);
+
+	/* other thread might load it already */
+	if (map->symtab.nr_sym)
+		goto out;
+
+	if (symtabs->flags & SYMTAB_FL_USE_SYMFILE) {
+		char *symfile = NULL;
+		unsigned long offset = 0;
+
+		if (symtabs->flags & SYMTAB_FL_ADJ_OFFSET)
+			offset = map->start;
+
+		xasprintf(&symfile, "%s/%s.sym", symtabs->dirname,
+			  basename(map->libname));
+		if (!load_module_symbol(&stab, symfile, offset))
+			found = true;
+		free(symfile);
+	}
+
+	if (!found)
+		load_symtab(&stab, map->libname, map->start, symtabs->flags);
+
+	if (stab.nr_sym == 0)
+		goto out;
+
+	finish_symtab(&stab);
+	nr_sym = stab.nr_sym;
+	stab.nr_sym = 0;
+
+	/* publish the symbols after the table is complete */
+	__unload_symtab(&map->symtab);
+	map->symtab = stab;
+	__atomic_store_n(&map->symtab.nr_sym, nr_sym, __ATOMIC_RELEASE);
+
+out:
+	pthread_mutex_unlock(&load_lock);
+}
+
 struct sym * find_symtabs(struct symtabs *symtabs, uint64_t addr)
 {
 	struct symtab *stab = &symtabs->symtab;
@@ -1718,55 +2302,279 @@ struct sym * find_symtabs(struct symtabs *symtabs, uint64_t addr)
 		if (!ktab)
 			return NULL;
 
-		sym = bsearch(&kaddr, ktab->sym, ktab->nr_sym,
-			      sizeof(*ktab->sym), addrfind);
-		return sym;
+		return lookup_symtab(ktab, kaddr);
 	}
 
 	if (maps == MAP_MAIN) {
-		sym = bsearch(&addr, stab->sym, stab->nr_sym,
-			      sizeof(*sym), addrfind);
+		sym = lookup_symtab(stab, addr);
 		if (sym)
 			return sym;
 
 		/* try dynamic symbols if failed */
-		sym = bsearch(&addr, dtab->sym, dtab->nr_sym,
-			      sizeof(*sym), addrfind);
-		return sym;
+		return lookup_symtab(dtab, addr);
 	}
 
 	if (maps) {
-		if (maps->symtab.nr_sym == 0) {
-			bool found = false;
-
-			if (symtabs->flags & SYMTAB_FL_USE_SYMFILE) {
-				char *symfile = NULL;
-				unsigned long offset = 0;
-
-				if (symtabs->flags & SYMTAB_FL_ADJ_OFFSET)
-					offset = maps->start;
-
-				xasprintf(&symfile, "%s/%s.sym", symtabs->dirname,
-					  basename(maps->libname));
-				if (!load_module_symbol(&maps->symtab, symfile,
-							offset)) {
-					found = true;
-				}
-				free(symfile);
-			}
+		if (__atomic_load_n(&maps->symtab.nr_sym, __ATOMIC_ACQUIRE) == 0)
+			load_map_symtab(symtabs, maps);
 
-			if (!found) {
-				load_symtab(&maps->symtab, maps->libname,
-					    maps->start, symtabs->flags);
-			}
+		sym = lookup_symtab(&maps->symtab, addr);
+	}
+
+	return sym;
+}
+
+/*
+ * Demangled names are saved in a (process-wide) hash table so that
+ * a symbol is demangled only once even if it's in multiple symbol
+ * tables (of different sessions).  The demangled names are never freed
+ * and can be used as long as the process is running.
+ */
+struct demangle_entry {
+	char *mangled;
+	char *demangled;
+};
+
+static struct {
+	struct demangle_entry *entries;
+	unsigned nr;
+	unsigned bits;
+	enum symbol_demangler demangler;
+	pthread_mutex_t lock;
+} demangle_cache = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static unsigned hash_symbol_name(const char *name)
+{
+	/* FNV-1a */
+	unsigned hash = 2166136261U;
+
+	while (*name) {
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static struct demangle_entry *find_demangle_entry(const char *name)
+{
+	unsigned mask = (1U << demangle_cache.bits) - 1;
+	unsigned pos = hash_symbol_name(name) & mask;
+	struct demangle_entry *e;
+
+	while (1) {
+		e = &demangle_cache.entries[pos];
+
+		if (e->mangled == NULL || !strcmp(e->mangled, name))
+			return e;
+
+		pos = (pos + 1) & mask;
+	}
+}
+
+static void grow_demangle_cache(void)
+{
+	struct demangle_entry *old = demangle_cache.entries;
+	unsigned i, old_size = old ? 1U << demangle_cache.bits : 0;
+
+	demangle_cache.bits = old ? demangle_cache.bits + 1 : 10;
+	demangle_cache.entries = xcalloc(1U << demangle_cache.bits,
+					 sizeof(*old));
+
+	for (i = 0; i < old_size; i++) {
+		if (old[i].mangled)
+			*find_demangle_entry(old[i].mangled) = old[i];
+	}
+	free(old);
+}
+
+static void reset_demangle_cache(void)
+{
+	unsigned i;
+
+	for (i = 0; demangle_cache.entries && i < 1U << demangle_cache.bits; i++) {
+		free(demangle_cache.entries[i].mangled);
+		free(demangle_cache.entries[i].demangled);
+	}
+	free(demangle_cache.entries);
+
+	demangle_cache.entries = NULL;
+	demangle_cache.nr = 0;
+	demangle_cache.bits = 0;
+	demangle_cache.demangler = demangler;
+}
+
+static bool is_mangled_name(const char *name)
+{
+	return name[0] == '_' && name[1] == 'Z';
+}
+
+/* returns demangled name of @name using the cache, don't free it */
+static char *demangle_cached(char *name)
+{
+	struct demangle_entry *e;
+	char *ret;
+
+	pthread_mutex_lock(&demangle_cache.lock);
+
+	/* the demangler might be changed (by unit tests) */
+	if (demangle_cache.demangler != demangler)
+		reset_demangle_cache();
+
+	if (demangle_cache.nr >= (1U << demangle_cache.bits) / 2)
+		grow_demangle_cache();
+
+	e = find_demangle_entry(name);
+	if (e->mangled == NULL) {
+		e->mangled = xstrdup(name);
+		e->demangled = demangle(name);
+		demangle_cache.nr++;
+	}
+	ret = e->demangled;
+
+	pthread_mutex_unlock(&demangle_cache.lock);
+	return ret;
+}
+
+static char *get_symbol_name(struct sym *sym)
+{
+	if (demangler == DEMANGLE_NONE || !is_mangled_name(sym->name))
+		return sym->name;
+
+	return demangle_cached(sym->name);
+}
+
+/*
+ * get a part of mangled name which should be in a symbol demangled to
+ * @name.  It's the last component of the name (like "foo" in
+ * "ns::foo(int)") with the length prefix ("3foo").  It returns false
+ * for constructors, destructors and operators (or anything unusual)
+ * so that all symbols should be checked.
+ */
+static bool get_mangled_key(const char *name, char *buf, size_t size,
+			    bool *nested)
+{
+	const char *p, *last = name, *end = NULL;
+	int depth = 0;
+	int len;
+
+	for (p = name; *p; p++) {
+		if (*p == '<' || *p == '(') {
+			if (depth++ == 0 && end == NULL)
+				end = p;
+		} else if (*p == '>' || *p == ')') {
+			depth--;
+		} else if (depth == 0 && p[0] == ':' && p[1] == ':') {
+			last = p + 2;
+			end = NULL;
+			p++;
 		}
+	}
+	if (end == NULL)
+		end = p;
 
-		stab = &maps->symtab;
-		sym = bsearch(&addr, stab->sym, stab->nr_sym,
-			      sizeof(*sym), addrfind);
+	len = end - last;
+	if (len == 0 || len + 4 >= (int)size || !strncmp(last, "operator", 8))
+		return false;
+
+	for (p = last; p < end; p++) {
+		if (!isalnum(*p) && *p != '_')
+			return false;
 	}
 
-	return sym;
+	snprintf(buf, size, "%d%.*s", len, len, last);
+	*nested = (last != name);
+	return true;
+}
+
+/* check whether the mangled @sym can be demangled to the key */
+static bool maybe_demangled_to(struct sym *sym, const char *key, bool nested)
+{
+	/* constructors might use the name of standard library class */
+	if (nested && (strstr(sym->name, "C1") || strstr(sym->name, "C2") ||
+		       strstr(sym->name, "C3")))
+		return true;
+
+	return strstr(sym->name, key) != NULL;
+}
+
+/**
+ * symbol_get_match_key - get a key to check symbols before demangling
+ * @patt: a name or glob pattern which will be matched to demangled names
+ * @key: the key is saved here
+ *
+ * This function returns true if @patt can be reduced to a key so that
+ * symbol_may_match() can skip mangled symbols cheaply.  It returns false
+ * if every symbol should be demangled and checked.
+ */
+bool symbol_get_match_key(const char *patt, struct sym_match_key *key)
+{
+	if (demangler == DEMANGLE_NONE || is_mangled_name(patt))
+		return false;
+
+	return get_mangled_key(patt, key->str, sizeof(key->str), &key->nested);
+}
+
+/**
+ * symbol_may_match - check whether the symbol can be demangled to match
+ * @sym: symbol
+ * @key: the key from symbol_get_match_key()
+ *
+ * This function returns false only if the (mangled) name of @sym cannot
+ * match to the pattern of @key after demangled.
+ */
+bool symbol_may_match(struct sym *sym, struct sym_match_key *key)
+{
+	if (demangler == DEMANGLE_NONE || !is_mangled_name(sym->name))
+		return true;
+
+	return maybe_demangled_to(sym, key->str, key->nested);
+}
+
+/* find @name in a symbol table of mangled names */
+static struct sym *find_mangled_symname(struct symtab *symtab,
+					const char *name)
+{
+	struct sym **psym;
+	size_t lo = 0, hi = symtab->nr_sym;
+	char key[64];
+	bool has_key;
+	bool nested;
+
+	/* non-C++ symbols (or mangled names failed to demangle) */
+	psym = bsearch(name, symtab->sym_names, symtab->nr_sym,
+		       sizeof(*psym), namefind);
+	if (psym && !strcmp(name, get_symbol_name(*psym)))
+		return *psym;
+
+	if (is_mangled_name(name))
+		return NULL;
+
+	/* C++ symbols ("_Z...") are next to each other in the index */
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+
+		if (strcmp(symtab->sym_names[mid]->name, "_Z") < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	has_key = get_mangled_key(name, key, sizeof(key), &nested);
+
+	for (; lo < symtab->nr_sym; lo++) {
+		struct sym *sym = symtab->sym_names[lo];
+
+		if (!is_mangled_name(sym->name))
+			break;
+		if (has_key && !maybe_demangled_to(sym, key, nested))
+			continue;
+		if (!strcmp(name, demangle_cached(sym->name)))
+			return sym;
+	}
+
+	return NULL;
 }
 
 struct sym * find_symname(struct symtab *symtab, const char *name)
@@ -1776,6 +2584,9 @@ struct sym * find_symname(struct symtab *symtab, const char *name)
 	if (symtab->name_sorted) {
 		struct sym **psym;
 
+		if (symtab->lazy_demangle)
+			return find_mangled_symname(symtab, name);
+
 		psym = bsearch(name, symtab->sym_names, symtab->nr_sym,
 			       sizeof(*psym), namefind);
 		if (psym)
@@ -1786,14 +2597,27 @@ struct sym * find_symname(struct symtab *symtab, const char *name)
 
 	for (i = 0; i < symtab->nr_sym; i++) {
 		struct sym *sym = &symtab->sym[i];
+		char *symname = sym->name;
+
+		if (symtab->lazy_demangle)
+			symname = get_symbol_name(sym);
 
-		if (!strcmp(name, sym->name))
+		if (!strcmp(name, symname))
 			return sym;
 	}
 
 	return NULL;
 }
 
+/**
+ * symbol_getname - get the (demangled) name of the symbol
+ * @sym: symbol
+ * @addr: address of the symbol (used when @sym is NULL)
+ *
+ * This function returns the name of @sym.  If the symbol name is not
+ * demangled yet, it'd be demangled (and cached) here.  If @sym is NULL,
+ * it returns a string of @addr that should be freed by symbol_putname().
+ */
 char *symbol_getname(struct sym *sym, uint64_t addr)
 {
 	char *name;
@@ -1803,7 +2627,42 @@ char *symbol_getname(struct sym *sym, uint64_t addr)
 		return name;
 	}
 
-	return sym->name;
+	return get_symbol_name(sym);
+}
+
+/**
+ * symbol_getname_id - get the interned id of the symbol name
+ * @sym: symbol
+ * @addr: address of the symbol (used when @sym is NULL)
+ *
+ * This function returns the id of the name returned by symbol_getname().
+ * The id is saved in @sym so it can be compared with other names cheaply.
+ */
+unsigned symbol_getname_id(struct sym *sym, uint64_t addr)
+{
+	struct sym tmp;
+	char buf[32];
+	unsigned id;
+
+	if (sym == NULL) {
+		snprintf(buf, sizeof(buf), "<%"PRIx64">", addr);
+		return intern_id(buf);
+	}
+
+	/* other threads can set it, access the whole word atomically */
+	tmp.info = __atomic_load_n(&sym->info, __ATOMIC_RELAXED);
+	if (tmp.name_id)
+		return tmp.name_id;
+
+	id = intern_id(get_symbol_name(sym));
+	/* too many names to save in the symbol, look it up every time */
+	if (id <= SYM_NAME_ID_MAX) {
+		/* the type doesn't change, other threads would save the same id */
+		tmp.name_id = id;
+		__atomic_store_n(&sym->info, tmp.info, __ATOMIC_RELAXED);
+	}
+
+	return id;
 }
 
 /* must be used in pair with symbol_getname() */
@@ -1885,3 +2744,225 @@ void set_kernel_base(struct symtabs *symtabs, const char *session_id)
 
 	symtabs->kernel_base = kernel_base_addr;
 }
+
+#ifdef UNIT_TEST
+TEST_CASE(symbol_load_binary)
+{
+	char dirname[] = "symbol-test.XXXXXX";
+	char *symfile, *binfile;
+	struct symtab stab = {}, dtab = {};
+	struct symtab bstab = {}, bdtab = {};
+	unsigned long offset = 0x400000;
+	struct sym *sym;
+	size_t i;
+	FILE *fp;
+
+	TEST_NE(mkdtemp(dirname), NULL);
+	xasprintf(&symfile, "%s/test.sym", dirname);
+	xasprintf(&binfile, "%sbin", symfile);
+
+	fp = fopen(symfile, "w");
+	TEST_NE(fp, NULL);
+	fprintf(fp, "0000000000000500 P printf\n");
+	fprintf(fp, "0000000000000510 P malloc\n");
+	fprintf(fp, "0000000000000520 P __dynsym_end\n");
+	fprintf(fp, "0000000000001000 T main\n");
+	fprintf(fp, "0000000000001100 T _Z3fooi\n");
+	fprintf(fp, "0000000000001050 t bar\n");
+	fprintf(fp, "0000000000001200 T __sym_end\n");
+	fclose(fp);
+
+	save_symbol_binary(symfile, false);
+	TEST_EQ(access(binfile, R_OK), 0);
+
+	TEST_EQ(read_symbol_file(symfile, offset, &stab, &dtab), 0);
+	sort_symtab(&stab);
+	sort_dynsymtab(&dtab);
+	stab.lazy_demangle = true;
+
+	TEST_EQ(load_symbol_binary(&bstab, &bdtab, symfile, offset), 0);
+	TEST_EQ(bstab.map_owner, true);
+	TEST_EQ(bstab.name_sorted, true);
+	/* names are demangled already */
+	TEST_EQ(bstab.lazy_demangle, false);
+
+	TEST_EQ(bstab.nr_sym, stab.nr_sym);
+	for (i = 0; i < stab.nr_sym; i++) {
+		TEST_EQ(bstab.sym[i].addr, stab.sym[i].addr);
+		TEST_EQ(bstab.sym[i].size, stab.sym[i].size);
+		TEST_EQ((int)bstab.sym[i].type, (int)stab.sym[i].type);
+		TEST_STREQ(symbol_getname(&bstab.sym[i], 0),
+			   symbol_getname(&stab.sym[i], 0));
+	}
+
+	TEST_EQ(bdtab.nr_sym, dtab.nr_sym);
+	for (i = 0; i < dtab.nr_sym; i++) {
+		TEST_EQ(bdtab.sym[i].addr, dtab.sym[i].addr);
+		TEST_EQ(bdtab.sym[i].size, dtab.sym[i].size);
+		TEST_STREQ(bdtab.sym_names[i]->name, dtab.sym_names[i]->name);
+	}
+
+	sym = find_symname(&bstab, "bar");
+	TEST_NE(sym, NULL);
+	TEST_EQ(sym->addr, offset + 0x1050);
+
+	/* demangled name should be found */
+	sym = find_symname(&bstab, "foo");
+	TEST_NE(sym, NULL);
+	TEST_EQ(sym->addr, offset + 0x1100);
+
+	/* the text file keeps mangled names until they're used */
+	sym = find_symname(&stab, "foo");
+	TEST_NE(sym, NULL);
+	TEST_STREQ(sym->name, "_Z3fooi");
+	TEST_STREQ(symbol_getname(sym, sym->addr), "foo");
+	TEST_EQ(find_symname(&stab, "fooi"), NULL);
+	TEST_EQ(find_symname(&stab, "_Z3fooi"), NULL);
+
+	__unload_symtab(&stab);
+	__unload_symtab(&dtab);
+	__unload_symtab(&bdtab);
+	__unload_symtab(&bstab);
+	TEST_EQ(bstab.map, NULL);
+
+	/* it should fall back to the text file if binary is broken */
+	fp = fopen(binfile, "r+");
+	TEST_NE(fp, NULL);
+	/* the string table is at the end */
+	TEST_EQ(fseek(fp, -1, SEEK_END), 0);
+	fputc('x', fp);
+	fclose(fp);
+	TEST_EQ(load_symbol_binary(&bstab, &bdtab, symfile, offset), -1);
+	TEST_EQ(bstab.map, NULL);
+
+	/* a copied text file (with a new mtime) can still use it */
+	unlink(binfile);
+	save_symbol_binary(symfile, false);
+	TEST_EQ(utimensat(AT_FDCWD, symfile, NULL, 0), 0);
+	TEST_EQ(load_symbol_binary(&bstab, &bdtab, symfile, offset), 0);
+	__unload_symtab(&bdtab);
+	__unload_symtab(&bstab);
+
+	/* but not if the contents of the text file are changed */
+	fp = fopen(symfile, "a");
+	TEST_NE(fp, NULL);
+	fprintf(fp, "0000000000001300 T baz\n");
+	fclose(fp);
+	TEST_EQ(load_symbol_binary(&bstab, &bdtab, symfile, offset), -1);
+	TEST_EQ(bstab.map, NULL);
+
+	TEST_EQ(truncate(binfile, 16), 0);
+	TEST_EQ(load_symbol_binary(&bstab, &bdtab, symfile, offset), -1);
+
+	unlink(symfile);
+	unlink(binfile);
+	rmdir(dirname);
+	free(symfile);
+	free(binfile);
+
+	return TEST_OK;
+}
+TEST_CASE(symbol_addr_index)
+{
+	struct symtab stab = {};
+	struct uftrace_mmap maps[3] = {};
+	struct symtabs symtabs = {
+		.kernel_base = -1ULL,
+	};
+	struct sym *sym;
+	uint64_t addr;
+	size_t i;
+
+	TEST_EQ(lookup_symtab(&stab, 0x1000), NULL);
+
+	/* some symbols have a hole after them */
+	stab.nr_sym = stab.nr_alloc = 1000;
+	stab.sym = xcalloc(stab.nr_sym, sizeof(*stab.sym));
+	for (i = 0; i < stab.nr_sym; i++) {
+		stab.sym[i].addr = 0x1000 + i * 0x100;
+		stab.sym[i].size = (i % 3) ? 0x100 : 0x80;
+		stab.sym[i].type = ST_GLOBAL;
+		xasprintf(&stab.sym[i].name, "func%zd", i);
+	}
+	finish_symtab(&stab);
+
+	for (addr = 0; addr < 0x1000 + 1001 * 0x100; addr += 0x40) {
+		sym = bsearch(&addr, stab.sym, stab.nr_sym,
+			      sizeof(*sym), addrfind);
+		TEST_EQ(lookup_symtab(&stab, addr), sym);
+		addr--;
+		sym = bsearch(&addr, stab.sym, stab.nr_sym,
+			      sizeof(*sym), addrfind);
+		TEST_EQ(lookup_symtab(&stab, addr), sym);
+		addr++;
+	}
+	TEST_EQ(stab.nr_idx, stab.nr_sym);
+	TEST_EQ(lookup_symtab(&stab, -1ULL), NULL);
+
+	/* lookup should not change the (stale) index */
+	stab.nr_sym--;
+	addr = stab.sym[stab.nr_sym].addr;
+	TEST_EQ(lookup_symtab(&stab, addr), NULL);
+	TEST_EQ(lookup_symtab(&stab, addr - 1), &stab.sym[stab.nr_sym - 1]);
+	TEST_EQ(stab.nr_idx, stab.nr_sym + 1);
+	stab.nr_sym++;
+	TEST_EQ(lookup_symtab(&stab, addr), &stab.sym[stab.nr_sym - 1]);
+
+	__unload_symtab(&stab);
+	TEST_EQ(stab.addr_idx, NULL);
+
+	/* maps are not sorted in the list */
+	maps[0].start = 0x7000;
+	maps[0].end   = 0x8000;
+	maps[0].next  = &maps[1];
+	maps[1].start = 0x3000;
+	maps[1].end   = 0x5000;
+	maps[1].next  = &maps[2];
+	maps[2].start = 0x5000;
+	maps[2].end   = 0x6000;
+	symtabs.maps  = &maps[0];
+
+	/* it should work before and after building the ranges */
+	for (i = 0; i < 2; i++) {
+		TEST_EQ(find_map(&symtabs, 0x1000), NULL);
+		TEST_EQ(find_map(&symtabs, 0x3000), &maps[1]);
+		TEST_EQ(find_map(&symtabs, 0x4fff), &maps[1]);
+		TEST_EQ(find_map(&symtabs, 0x5000), &maps[2]);
+		TEST_EQ(find_map(&symtabs, 0x6000), NULL);
+		TEST_EQ(find_map(&symtabs, 0x7fff), &maps[0]);
+		TEST_EQ(find_map(&symtabs, 0x8000), NULL);
+		TEST_EQ(symtabs.nr_ranges, i * ARRAY_SIZE(maps));
+
+		build_map_ranges(&symtabs);
+	}
+
+	unload_symtabs(&symtabs);
+	TEST_EQ(symtabs.ranges, NULL);
+
+	return TEST_OK;
+}
+
+TEST_CASE(symbol_name_id)
+{
+	struct sym sym = {
+		.addr = 0x1000,
+		.size = 0x100,
+		.type = ST_WEAK,
+		.name = "foo",
+	};
+
+	if (sizeof(long) == 8)
+		TEST_EQ(sizeof(struct sym), 24);
+
+	TEST_EQ(symbol_getname_id(&sym, sym.addr), intern_id("foo"));
+	TEST_EQ((unsigned)sym.name_id, intern_id("foo"));
+	TEST_EQ((int)sym.type, ST_WEAK);
+
+	/* it should not be changed by other fields */
+	sym.type = ST_PLT;
+	TEST_EQ(symbol_getname_id(&sym, sym.addr), intern_id("foo"));
+	TEST_EQ(symbol_getname_id(NULL, 0x1234), intern_id("<1234>"));
+
+	return TEST_OK;
+}
+#endif /* UNIT_TEST */
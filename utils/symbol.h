@@ -28,13 +28,23 @@ enum symtype {
 	ST_KERNEL	= 'K',
 };
 
+/* keep it small (24 bytes on 64-bit) as there can be millions of symbols */
 struct sym {
 	uint64_t addr;
 	unsigned size;
-	enum symtype type;
+	union {
+		struct {
+			unsigned type:8;      /* enum symtype */
+			unsigned name_id:24;  /* interned (demangled) name, 0 if not yet */
+		};
+		/* name_id is set lazily by threads, update the word atomically */
+		uint32_t info;
+	};
 	char *name;
 };
 
+#define SYM_NAME_ID_MAX  ((1U << 24) - 1)
+
 #define SYMTAB_GROW  16
 
 struct symtab {
@@ -43,6 +53,16 @@ struct symtab {
 	size_t nr_sym;
 	size_t nr_alloc;
 	bool name_sorted;
+	/* names are not demangled yet (and ->sym_names[] sorted by them) */
+	bool lazy_demangle;
+	/* binary symbol file mapped (names might point into it) */
+	void *map;
+	size_t map_size;
+	bool map_owner;
+	/* symbol addresses in Eytzinger (BFS) order for address lookup */
+	uint64_t *addr_idx;
+	uint32_t *sym_idx;
+	size_t nr_idx;
 };
 
 struct uftrace_mmap {
@@ -55,6 +75,13 @@ struct uftrace_mmap {
 	char libname[];
 };
 
+/* address range of a map sorted for find_map() */
+struct uftrace_map_range {
+	uint64_t start;
+	uint64_t end;
+	struct uftrace_mmap *map;
+};
+
 enum symtab_flag {
 	SYMTAB_FL_DEMANGLE	= (1U << 0),
 	SYMTAB_FL_USE_SYMFILE	= (1U << 1),
@@ -72,6 +99,8 @@ struct symtabs {
 	struct symtab dsymtab;
 	uint64_t kernel_base;
 	struct uftrace_mmap *maps;
+	struct uftrace_map_range *ranges;
+	size_t nr_ranges;
 };
 
 /* only meaningful for 64-bit systems */
@@ -138,6 +167,16 @@ void save_symbol_file(struct symtabs *symtabs, const char *dirname,
 
 char *symbol_getname(struct sym *sym, uint64_t addr);
 void symbol_putname(struct sym *sym, char *name);
+unsigned symbol_getname_id(struct sym *sym, uint64_t addr);
+
+/* a part of mangled name to skip symbols without demangling */
+struct sym_match_key {
+	char str[64];
+	bool nested;
+};
+
+bool symbol_get_match_key(const char *patt, struct sym_match_key *key);
+bool symbol_may_match(struct sym *sym, struct sym_match_key *key);
 
 struct dynsym_idxlist {
 	unsigned *idx;
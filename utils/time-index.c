@@ -0,0 +1,118 @@
+/*
+ * Time index of data files to seek to the start of a time range
+ *
+ * The recorder appends an index entry (file offset and the first timestamp)
+ * whenever it writes a chunk to a data file.  Readers can find the last
+ * chunk before the time range using binary search instead of reading all
+ * records from the beginning.
+ *
+ * Released under the GPL v2.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "utils/utils.h"
+#include "utils/time-index.h"
+
+int append_time_index(const char *filename, struct uftrace_time_index *idx)
+{
+	int fd;
+	int ret;
+
+	fd = open(filename, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (fd < 0)
+		return -1;
+
+	ret = write_all(fd, idx, sizeof(*idx));
+	close(fd);
+
+	return ret;
+}
+
+/* returns number of index entries in @filename, or -1 on error */
+int read_time_index(const char *filename, struct uftrace_time_index **pidx)
+{
+	struct uftrace_time_index *idx;
+	struct stat stbuf;
+	FILE *fp;
+	int nr;
+
+	fp = fopen(filename, "rb");
+	if (fp == NULL)
+		return -1;
+
+	if (fstat(fileno(fp), &stbuf) < 0) {
+		fclose(fp);
+		return -1;
+	}
+
+	nr = stbuf.st_size / sizeof(*idx);
+	if (nr == 0) {
+		fclose(fp);
+		return -1;
+	}
+
+	idx = xmalloc(nr * sizeof(*idx));
+	if (fread(idx, sizeof(*idx), nr, fp) != (size_t)nr) {
+		pr_dbg("cannot read time index: %s\n", filename);
+		free(idx);
+		fclose(fp);
+		return -1;
+	}
+
+	fclose(fp);
+
+	*pidx = idx;
+	return nr;
+}
+
+/*
+ * find_time_index - find the last chunk which starts before @time
+ *
+ * Records in the previous chunks have timestamps not greater than the
+ * first one in the found chunk, so it's safe to skip them.  It returns
+ * index of the chunk or -1 if it cannot skip anything.
+ */
+int find_time_index(struct uftrace_time_index *idx, int nr, uint64_t time)
+{
+	int left = 0;
+	int right = nr;
+
+	while (left < right) {
+		int mid = (left + right) / 2;
+
+		if (idx[mid].time < time)
+			left = mid + 1;
+		else
+			right = mid;
+	}
+
+	return left - 1;
+}
+
+#ifdef UNIT_TEST
+TEST_CASE(time_index_find)
+{
+	struct uftrace_time_index idx[] = {
+		{ .offset = 0,    .time = 100, },
+		{ .offset = 4096, .time = 200, },
+		{ .offset = 8192, .time = 200, },
+		{ .offset = 9000, .time = 300, },
+	};
+	int nr = ARRAY_SIZE(idx);
+
+	TEST_EQ(find_time_index(idx, nr, 50), -1);
+	TEST_EQ(find_time_index(idx, nr, 100), -1);
+	TEST_EQ(find_time_index(idx, nr, 150), 0);
+	/* records with the same timestamp should not be skipped */
+	TEST_EQ(find_time_index(idx, nr, 200), 0);
+	TEST_EQ(find_time_index(idx, nr, 250), 2);
+	TEST_EQ(find_time_index(idx, nr, 1000), 3);
+	TEST_EQ(find_time_index(idx, 0, 1000), -1);
+
+	return TEST_OK;
+}
+#endif /* UNIT_TEST */
@@ -0,0 +1,22 @@
+#ifndef UFTRACE_TIME_INDEX_H
+#define UFTRACE_TIME_INDEX_H
+
+#include <stdint.h>
+
+/*
+ * An index entry is saved for each chunk (i.e. shmem buffer) written to
+ * a task data file.  Chunks always start at a record boundary so readers
+ * can seek to the offset directly.
+ */
+struct uftrace_time_index {
+	uint64_t offset;   /* file offset of the chunk */
+	uint64_t time;     /* timestamp of the first record in the chunk */
+	uint32_t depth;    /* depth of the first record (for validation) */
+	uint32_t unused;
+};
+
+int append_time_index(const char *filename, struct uftrace_time_index *idx);
+int read_time_index(const char *filename, struct uftrace_time_index **pidx);
+int find_time_index(struct uftrace_time_index *idx, int nr, uint64_t time);
+
+#endif /* UFTRACE_TIME_INDEX_H */
@@ -716,6 +716,49 @@ char *absolute_dirname(const char *path, char *resolved_path)
 	return resolved_path;
 }
 
+/**
+ * parse_cpulist - parse a list of CPUs in the sysfs format
+ * @str:  cpu list string like "0-3,8,10-11"
+ * @cpus: output array to save CPU numbers
+ * @max:  size of @cpus array
+ *
+ * This function parses @str (as found in /sys/devices/system/node/
+ * nodeN/cpulist) and saves each CPU number to @cpus.  It returns
+ * number of CPUs saved or -1 if @str has an invalid format.
+ */
+int parse_cpulist(const char *str, int *cpus, int max)
+{
+	int nr = 0;
+
+	while (*str && *str != '\n') {
+		char *end;
+		long first, last;
+
+		first = strtol(str, &end, 10);
+		if (end == str || first < 0)
+			return -1;
+
+		last = first;
+		if (*end == '-') {
+			str = end + 1;
+			last = strtol(str, &end, 10);
+			if (end == str || last < first)
+				return -1;
+		}
+
+		while (first <= last && nr < max)
+			cpus[nr++] = first++;
+
+		str = end;
+		if (*str == ',')
+			str++;
+		else if (*str && *str != '\n')
+			return -1;
+	}
+
+	return nr;
+}
+
 #ifdef UNIT_TEST
 TEST_CASE(utils_parse_cmdline)
 {
@@ -776,4 +819,26 @@ TEST_CASE(utils_strv)
 
 	return TEST_OK;
 }
+
+TEST_CASE(utils_parse_cpulist)
+{
+	int cpus[8];
+	const int expect[] = { 0, 1, 2, 3, 8, 10, 11 };
+	int i, nr;
+
+	nr = parse_cpulist("0-3,8,10-11\n", cpus, ARRAY_SIZE(cpus));
+	TEST_EQ(nr, (int)ARRAY_SIZE(expect));
+	for (i = 0; i < nr; i++)
+		TEST_EQ(cpus[i], expect[i]);
+
+	/* it should not overflow the output array */
+	TEST_EQ(parse_cpulist("0-15", cpus, ARRAY_SIZE(cpus)), 8);
+	TEST_EQ(cpus[7], 7);
+
+	TEST_EQ(parse_cpulist("", cpus, ARRAY_SIZE(cpus)), 0);
+	TEST_EQ(parse_cpulist("3-1", cpus, ARRAY_SIZE(cpus)), -1);
+	TEST_EQ(parse_cpulist("a,b", cpus, ARRAY_SIZE(cpus)), -1);
+
+	return TEST_OK;
+}
 #endif /* UNIT_TEST */
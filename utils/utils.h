@@ -42,6 +42,7 @@
 
 #define NSEC_PER_SEC  1000000000
 #define NSEC_PER_MSEC 1000000
+#define NSEC_PER_USEC 1000
 
 extern int debug;
 extern FILE *logfp;
@@ -280,4 +281,6 @@ char *get_event_name(struct ftrace_file_handle *handle, unsigned evt_id);
 
 char *absolute_dirname(const char *path, char *resolved_path);
 
+int parse_cpulist(const char *str, int *cpus, int max);
+
 #endif /* UFTRACE_UTILS_H */